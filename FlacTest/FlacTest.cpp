@@ -0,0 +1,115 @@
+//
+// Name :         FlacTest.cpp
+// Description :  Console test of the FLAC encoder.  Encodes blocks of
+//                each channel count, sample size and kind of input,
+//                decodes them again and checks that they come back
+//                as the frames they were made from.
+//
+
+#include "pch.h"
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+#include "Flac.h"
+
+using namespace std;
+
+enum Input { Constant, Noise, AntiPhase, Clipped };
+static const char *InputNames[] = {"constant", "noise", "anti-phase", "clipped"};
+
+//
+// Name :        MakeBlock()
+// Description : n interleaved frames of an input at a sample size.
+//
+
+static void MakeBlock(Input input, int n, int channels, int bps, vector<int> &frames)
+{
+    const int top = (1 << (bps - 1)) - 1;
+    const int bottom = -top - 1;
+    unsigned int rng = 0x2468ACEu;
+
+    frames.resize((size_t)n * channels);
+    for(int i=0;  i<n;  i++)
+    {
+        const double sine = sin(i * 2 * PI * 440 / 44100);
+        for(int c=0;  c<channels;  c++)
+        {
+            int &x = frames[(size_t)i * channels + c];
+            switch(input)
+            {
+            case Constant:
+                x = top / 3;
+                break;
+
+            case Noise:
+                rng ^= rng << 13;  rng ^= rng >> 17;  rng ^= rng << 5;
+                x = bottom + (int)(rng % ((unsigned)top - bottom + 1));
+                break;
+
+            case AntiPhase:
+                // Every other channel turned over, which side coding has
+                // to carry at one more bit than the samples
+                x = (int)(top * sine);
+                if(c % 2)
+                    x = -x;
+                break;
+
+            case Clipped:
+                x = sine * 4 > 1 ? top : (sine * 4 < -1 ? bottom : (int)(top * sine * 4));
+                break;
+            }
+        }
+    }
+}
+
+int main()
+{
+    static const int Sizes[] = {8, 16, 24};
+    static const int Lengths[] = {1, 2, 17, 1000, 4096};
+
+    int cases = 0;
+    int failed = 0;
+    vector<int> frames;
+    vector<unsigned char> encoded;
+
+    for(int channels=1;  channels<=8;  channels++)
+    {
+        for(int bps : Sizes)
+        {
+            for(int input=Constant;  input<=Clipped;  input++)
+            {
+                for(int n : Lengths)
+                {
+                    MakeBlock(Input(input), n, channels, bps, frames);
+
+                    // Numbers past the one-byte coding of the frame number
+                    const unsigned long number = (unsigned long)cases * 37;
+                    CFlacOut::EncodeBlock(frames.data(), n, channels, bps, 44100, number, encoded);
+
+                    cases++;
+                    if(!CFlacOut::DecodeBlock(encoded, frames.data(), n, channels, bps, number))
+                    {
+                        failed++;
+                        printf("FAILED: %d channels, %d bit, %s, %d frames\n",
+                            channels, bps, InputNames[input], n);
+                    }
+                }
+            }
+        }
+    }
+
+    // A damaged frame has to be caught, or the checks above prove nothing
+    MakeBlock(Noise, 4096, 2, 16, frames);
+    CFlacOut::EncodeBlock(frames.data(), 4096, 2, 16, 44100, 0, encoded);
+    encoded[encoded.size() / 2] ^= 0x10;
+    cases++;
+    if(CFlacOut::DecodeBlock(encoded, frames.data(), 4096, 2, 16, 0))
+    {
+        failed++;
+        printf("FAILED: a damaged frame decoded\n");
+    }
+
+    printf("%d of %d cases passed\n", cases - failed, cases);
+    return failed == 0 ? 0 : 1;
+}
@@ -3,8 +3,9 @@
 
 CAudioNode::CAudioNode()
 {
-	m_frame[0] = 0.0;
-	m_frame[1] = 0.0;
+	m_channels = 2;
+	for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+		m_frame[c] = 0.0;
 	m_sampleRate = 44100.0;
 	m_samplePeriod = 1.0 / m_sampleRate;
 }
@@ -1,10 +1,13 @@
 #pragma once
+#include "CChannelLayout.h"
+
 class CAudioNode
 {
 protected:
     double m_sampleRate;
     double m_samplePeriod;
-    double m_frame[2];
+    int m_channels;
+    double m_frame[CChannelLayout::MaxChannels];
 
 public:
     //! Start the node generation
@@ -22,6 +25,12 @@ public:
     //! Set the sample rate
     void SetSampleRate(double s) { m_sampleRate = s;  m_samplePeriod = 1 / s; }
 
+    //! Get the number of channels in a frame
+    int GetNumChannels() { return m_channels; }
+
+    //! Set the number of channels in a frame
+    void SetNumChannels(int n) { m_channels = n; }
+
     //! Access a generated audio frame
     const double* Frame() { return m_frame; }
 
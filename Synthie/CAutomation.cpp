@@ -0,0 +1,70 @@
+#include "pch.h"
+#include <cstdlib>
+#include "CAutomation.h"
+#include "CXmlReader.h"
+#include "CTempoMap.h"
+
+CAutomation::CAutomation()
+{
+    m_cursor = 0;
+}
+
+void CAutomation::AddPoint(double beat, double value)
+{
+    Point point = { beat, value };
+
+    // Points usually arrive in order, so search from the back
+    auto it = m_points.end();
+    while (it != m_points.begin() && (it - 1)->beat > beat)
+        --it;
+
+    m_points.insert(it, point);
+    m_cursor = 0;
+}
+
+double CAutomation::ValueAt(double beat)
+{
+    const int n = (int)m_points.size();
+    if (n == 0)
+        return 0.0;
+
+    if (beat <= m_points[0].beat)
+        return m_points[0].value;
+
+    if (beat >= m_points[n - 1].beat)
+        return m_points[n - 1].value;
+
+    // Move the cursor to the segment holding the position.  It
+    // only steps a point or two while the position moves forward.
+    if (m_cursor >= n - 1 || m_points[m_cursor].beat > beat)
+        m_cursor = 0;
+
+    while (m_points[m_cursor + 1].beat < beat)
+        m_cursor++;
+
+    const Point& a = m_points[m_cursor];
+    const Point& b = m_points[m_cursor + 1];
+    if (b.beat <= a.beat)
+        return b.value;
+
+    return a.value + (b.value - a.value) * (beat - a.beat) / (b.beat - a.beat);
+}
+
+void CAutomation::XmlLoad(CXmlReader& xml, const CTempoMap& meter)
+{
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("point"))
+        {
+            // Measures and beats start at 1 in the file, like notes
+            const char* measure = xml.Attribute("measure");
+            const int m = measure != NULL ? atoi(measure) : 1;
+            const double beat = CXmlReader::ToDouble(xml.Attribute("beat"), 1.0);
+            const double value = CXmlReader::ToDouble(xml.Attribute("value"), 0.0);
+
+            AddPoint(meter.Beat(m - 1, beat - 1.0), value);
+        }
+
+        xml.Skip();
+    }
+}
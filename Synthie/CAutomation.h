@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+
+class CXmlReader;
+class CTempoMap;
+
+/*! Breakpoint automation curve
+ *
+ * A lane is a list of (beat, value) points with straight lines
+ * between them.  Before the first point and after the last one the
+ * curve holds the end value.  Positions are in beats from the start
+ * of the score, so a lane follows any tempo change.
+ *
+ *  <automation bus="ToneInstrument" param="pan">
+ *    <point measure="1" beat="1" value="-1"/>
+ *    <point measure="5" beat="1" value="1"/>
+ *  </automation>
+ *
+ * The synthesizer reads lanes at control rate, so ValueAt() keeps a
+ * cursor and is constant time while the position moves forward.
+ */
+class CAutomation
+{
+public:
+    CAutomation();
+
+    void Clear() { m_points.clear();  m_cursor = 0; }
+
+    //! True if the lane has no points
+    bool IsEmpty() const { return m_points.empty(); }
+
+    //! Add a point, keeping the points in order
+    void AddPoint(double beat, double value);
+
+    //! Value of the curve at a position in beats
+    double ValueAt(double beat);
+
+    int NumPoints() const { return (int)m_points.size(); }
+    double PointBeat(int i) const { return m_points[i].beat; }
+    double PointValue(int i) const { return m_points[i].value; }
+
+    //! Load the <point> children of an <automation> element, placing
+    //! them with the meter changes loaded so far
+    void XmlLoad(CXmlReader& xml, const CTempoMap& meter);
+
+private:
+    struct Point
+    {
+        double beat;
+        double value;
+    };
+
+    std::vector<Point> m_points;
+    int m_cursor;               //!< Index of the segment used last
+};
@@ -0,0 +1,338 @@
+#include "pch.h"
+#include <cmath>
+#include <cwchar>
+#include <chrono>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+#include "CBiquad.h"
+#include "CStateVariable.h"
+
+//
+// Coefficient design
+//
+
+BiquadCoeffs BiquadCoeffs::Design(Shape shape, double freq, double q, double gainDb, double sampleRate)
+{
+    // Keep the corner strictly inside (0, Nyquist)
+    const double nyquist = sampleRate * 0.5;
+    freq = std::fmax(1.0, std::fmin(freq, nyquist * 0.999));
+    q = std::fmax(q, 1e-3);
+
+    const double w0 = 2.0 * PI * freq / sampleRate;
+    const double cosw = std::cos(w0);
+    const double alpha = std::sin(w0) / (2.0 * q);
+    const double A = std::pow(10.0, gainDb / 40.0);
+    const double sqA2alpha = 2.0 * std::sqrt(A) * alpha;
+
+    double b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+
+    switch (shape)
+    {
+    case Lowpass:
+        b0 = (1.0 - cosw) / 2.0;  b1 = 1.0 - cosw;  b2 = b0;
+        a0 = 1.0 + alpha;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha;
+        break;
+
+    case Highpass:
+        b0 = (1.0 + cosw) / 2.0;  b1 = -(1.0 + cosw);  b2 = b0;
+        a0 = 1.0 + alpha;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha;
+        break;
+
+    case Bandpass:
+        // Constant 0 dB peak gain
+        b0 = alpha;  b1 = 0.0;  b2 = -alpha;
+        a0 = 1.0 + alpha;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha;
+        break;
+
+    case Notch:
+        b0 = 1.0;  b1 = -2.0 * cosw;  b2 = 1.0;
+        a0 = 1.0 + alpha;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha;
+        break;
+
+    case Peak:
+        b0 = 1.0 + alpha * A;  b1 = -2.0 * cosw;  b2 = 1.0 - alpha * A;
+        a0 = 1.0 + alpha / A;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha / A;
+        break;
+
+    case LowShelf:
+        b0 = A * ((A + 1) - (A - 1) * cosw + sqA2alpha);
+        b1 = 2 * A * ((A - 1) - (A + 1) * cosw);
+        b2 = A * ((A + 1) - (A - 1) * cosw - sqA2alpha);
+        a0 = (A + 1) + (A - 1) * cosw + sqA2alpha;
+        a1 = -2 * ((A - 1) + (A + 1) * cosw);
+        a2 = (A + 1) + (A - 1) * cosw - sqA2alpha;
+        break;
+
+    case HighShelf:
+        b0 = A * ((A + 1) + (A - 1) * cosw + sqA2alpha);
+        b1 = -2 * A * ((A - 1) + (A + 1) * cosw);
+        b2 = A * ((A + 1) + (A - 1) * cosw - sqA2alpha);
+        a0 = (A + 1) - (A - 1) * cosw + sqA2alpha;
+        a1 = 2 * ((A - 1) - (A + 1) * cosw);
+        a2 = (A + 1) - (A - 1) * cosw - sqA2alpha;
+        break;
+
+    case Allpass:
+        b0 = 1.0 - alpha;  b1 = -2.0 * cosw;  b2 = 1.0 + alpha;
+        a0 = 1.0 + alpha;  a1 = -2.0 * cosw;  a2 = 1.0 - alpha;
+        break;
+    }
+
+    BiquadCoeffs c;
+    c.b0 = b0 / a0;
+    c.b1 = b1 / a0;
+    c.b2 = b2 / a0;
+    c.a1 = a1 / a0;
+    c.a2 = a2 / a0;
+    return c;
+}
+
+bool BiquadCoeffs::ShapeFromName(const wchar_t* name, Shape& shape)
+{
+    static const struct { const wchar_t* name; Shape shape; } shapes[] = {
+        {L"lowpass", Lowpass}, {L"highpass", Highpass}, {L"bandpass", Bandpass},
+        {L"notch", Notch}, {L"peak", Peak}, {L"lowshelf", LowShelf},
+        {L"highshelf", HighShelf}, {L"allpass", Allpass}
+    };
+
+    for (const auto& s : shapes)
+    {
+        if (wcscmp(name, s.name) == 0)
+        {
+            shape = s.shape;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//
+// CBiquad
+//
+
+void CBiquad::Process(double* data, int frames)
+{
+    const double b0 = m_c.b0, b1 = m_c.b1, b2 = m_c.b2, a1 = m_c.a1, a2 = m_c.a2;
+    double z1 = m_z1, z2 = m_z2;
+
+    for (int i = 0; i < frames; i++)
+    {
+        const double x = data[i];
+        const double y = b0 * x + z1;
+        z1 = b1 * x - a1 * y + z2;
+        z2 = b2 * x - a2 * y;
+        data[i] = y;
+    }
+
+    m_z1 = z1;
+    m_z2 = z2;
+}
+
+//
+// CStereoBiquad
+//
+
+void CStereoBiquad::Process(double* left, double* right, int frames)
+{
+#ifdef SYNTHIE_SSE2
+    const __m128d b0 = _mm_set1_pd(m_c.b0);
+    const __m128d b1 = _mm_set1_pd(m_c.b1);
+    const __m128d b2 = _mm_set1_pd(m_c.b2);
+    const __m128d a1 = _mm_set1_pd(m_c.a1);
+    const __m128d a2 = _mm_set1_pd(m_c.a2);
+    __m128d z1 = _mm_loadu_pd(m_z1);
+    __m128d z2 = _mm_loadu_pd(m_z2);
+
+    for (int i = 0; i < frames; i++)
+    {
+        const __m128d x = _mm_set_pd(right[i], left[i]);
+        const __m128d y = _mm_add_pd(_mm_mul_pd(b0, x), z1);
+        z1 = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1, x), _mm_mul_pd(a1, y)), z2);
+        z2 = _mm_sub_pd(_mm_mul_pd(b2, x), _mm_mul_pd(a2, y));
+        _mm_storel_pd(left + i, y);
+        _mm_storeh_pd(right + i, y);
+    }
+
+    _mm_storeu_pd(m_z1, z1);
+    _mm_storeu_pd(m_z2, z2);
+#else
+    const double b0 = m_c.b0, b1 = m_c.b1, b2 = m_c.b2, a1 = m_c.a1, a2 = m_c.a2;
+    for (int i = 0; i < frames; i++)
+    {
+        const double yL = b0 * left[i] + m_z1[0];
+        const double yR = b0 * right[i] + m_z1[1];
+        m_z1[0] = b1 * left[i] - a1 * yL + m_z2[0];
+        m_z1[1] = b1 * right[i] - a1 * yR + m_z2[1];
+        m_z2[0] = b2 * left[i] - a2 * yL;
+        m_z2[1] = b2 * right[i] - a2 * yR;
+        left[i] = yL;
+        right[i] = yR;
+    }
+#endif
+}
+
+//
+// CBiquadCascade
+//
+
+void CBiquadCascade::Design(BiquadCoeffs::Shape shape, double freq, double q, double gainDb,
+    int order, double sampleRate)
+{
+    int sections = (order + 1) / 2;
+    if (sections < 1)
+        sections = 1;
+    if (sections > MaxSections)
+        sections = MaxSections;
+
+    m_numSections = sections;
+
+    const bool butterworth = sections > 1 &&
+        (shape == BiquadCoeffs::Lowpass || shape == BiquadCoeffs::Highpass);
+
+    for (int k = 0; k < sections; k++)
+    {
+        // Butterworth pole pairs: Q = 1 / (2 cos((2k+1) pi / 2n))
+        double qk = q;
+        if (butterworth)
+            qk = 1.0 / (2.0 * std::cos((2 * k + 1) * PI / (4.0 * sections)));
+
+        m_sections[k].SetCoeffs(BiquadCoeffs::Design(shape, freq, qk, gainDb, sampleRate));
+    }
+}
+
+void CBiquadCascade::Reset()
+{
+    for (int k = 0; k < MaxSections; k++)
+        m_sections[k].Reset();
+}
+
+void CBiquadCascade::Process(double* left, double* right, int frames)
+{
+    for (int k = 0; k < m_numSections; k++)
+        m_sections[k].Process(left, right, frames);
+}
+
+//
+// Benchmark
+//
+
+namespace
+{
+    //! Run fn over the buffer until about a quarter second has elapsed
+    template<class Fn>
+    double SamplesPerSecond(Fn fn, int samplesPerCall)
+    {
+        using clock = std::chrono::steady_clock;
+
+        // Warm up the caches and the branch predictors
+        fn();
+
+        long long calls = 0;
+        const clock::time_point start = clock::now();
+        double elapsed = 0.0;
+        do
+        {
+            for (int i = 0; i < 16; i++)
+                fn();
+
+            calls += 16;
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        } while (elapsed < 0.25);
+
+        return double(calls) * samplesPerCall / elapsed;
+    }
+}
+
+std::wstring BiquadBenchmark()
+{
+    const double sr = 44100.0;
+    const int frames = 4096;
+
+    // Noise test signal with room for 8 interleaved lanes
+    std::vector<double> noise(frames * 8);
+    unsigned int rng = 0x1234567u;
+    for (double& d : noise)
+    {
+        rng ^= rng << 13;  rng ^= rng >> 17;  rng ^= rng << 5;
+        d = rng * (2.0 / 4294967296.0) - 1.0;
+    }
+
+    std::vector<double> a(noise.begin(), noise.begin() + frames);
+    std::vector<double> b(noise.begin() + frames, noise.begin() + 2 * frames);
+    std::vector<double> wide(noise.size());
+
+    const BiquadCoeffs lp = BiquadCoeffs::Design(BiquadCoeffs::Lowpass, 2000.0, 0.707, 0.0, sr);
+
+    CBiquad mono;
+    mono.SetCoeffs(lp);
+
+    CStereoBiquad stereo;
+    stereo.SetCoeffs(lp);
+
+    CBiquadCascade cascade;
+    cascade.Design(BiquadCoeffs::Lowpass, 2000.0, 0.707, 0.0, 8, sr);
+
+    CBiquadBank<4> bank4;
+    CBiquadBank<8> bank8;
+    for (int i = 0; i < 8; i++)
+    {
+        const BiquadCoeffs c = BiquadCoeffs::Design(BiquadCoeffs::Bandpass, 250.0 * (i + 1), 4.0, 0.0, sr);
+        if (i < 4)
+            bank4.SetCoeffs(i, c);
+        bank8.SetCoeffs(i, c);
+    }
+
+    CStateVariable svf;
+    svf.Design(CStateVariable::Lowpass, 2000.0, 0.707, sr);
+
+    // Each pass reloads the noise first.  Filtering the same buffer
+    // over and over would decay it into denormals and time those
+    // instead.  The copy is small next to the filtering itself.
+    auto reload = [&](std::vector<double>& v, size_t offset) {
+        std::copy(noise.begin() + offset, noise.begin() + offset + v.size(), v.begin());
+    };
+
+    const double rMono = SamplesPerSecond([&] {
+        reload(a, 0);
+        mono.Process(a.data(), frames); }, frames);
+
+    const double rStereo = SamplesPerSecond([&] {
+        reload(a, 0);  reload(b, frames);
+        stereo.Process(a.data(), b.data(), frames); }, 2 * frames);
+
+    const double rCascade = SamplesPerSecond([&] {
+        reload(a, 0);  reload(b, frames);
+        cascade.Process(a.data(), b.data(), frames); }, 2 * frames);
+
+    const double rBank4 = SamplesPerSecond([&] {
+        reload(wide, 0);
+        bank4.Process(wide.data(), frames); }, 4 * frames);
+
+    const double rBank8 = SamplesPerSecond([&] {
+        reload(wide, 0);
+        bank8.Process(wide.data(), frames); }, 8 * frames);
+
+    const double rSvf = SamplesPerSecond([&] {
+        reload(a, 0);  reload(b, frames);
+        svf.Process(a.data(), b.data(), frames); }, 2 * frames);
+
+    std::wostringstream str;
+    str.precision(1);
+    str << std::fixed;
+    str << L"Filter throughput (million samples/second)\n\n";
+    str << L"Mono biquad:\t\t" << rMono / 1e6 << L"\n";
+    str << L"Stereo biquad:\t\t" << rStereo / 1e6 << L"\n";
+    str << L"Stereo 8th order cascade:\t" << rCascade / 1e6 << L"\n";
+    str << L"4-wide parallel biquads:\t" << rBank4 / 1e6 << L"\n";
+    str << L"8-wide parallel biquads:\t" << rBank8 / 1e6 << L"\n";
+    str << L"Stereo state variable:\t" << rSvf / 1e6 << L"\n";
+#ifdef SYNTHIE_SSE2
+    str << L"\nSSE2 enabled";
+#else
+    str << L"\nScalar build";
+#endif
+
+    return str.str();
+}
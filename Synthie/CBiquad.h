@@ -0,0 +1,202 @@
+#pragma once
+
+//
+// SSE2 is the baseline for our x86 and x64 builds.  Without it the
+// stereo and parallel filters fall back to plain scalar loops.
+//
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SYNTHIE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include <string>
+
+/*! Normalized biquad coefficients (a0 == 1)
+ *
+ * The design functions follow the RBJ Audio EQ Cookbook.
+ */
+struct BiquadCoeffs
+{
+    double b0 = 1.0, b1 = 0.0, b2 = 0.0;
+    double a1 = 0.0, a2 = 0.0;
+
+    //! Filter shapes the designer knows about
+    enum Shape { Lowpass, Highpass, Bandpass, Notch, Peak, LowShelf, HighShelf, Allpass };
+
+    //! Design a filter.  gainDb is only used by Peak and the shelves.
+    static BiquadCoeffs Design(Shape shape, double freq, double q, double gainDb, double sampleRate);
+
+    //! Look up a shape by its score name ("lowpass", "highshelf", ...)
+    static bool ShapeFromName(const wchar_t* name, Shape& shape);
+
+    //! True if the filter passes the signal unchanged
+    bool IsIdentity() const { return b0 == 1.0 && b1 == 0.0 && b2 == 0.0 && a1 == 0.0 && a2 == 0.0; }
+};
+
+/*! Mono biquad, transposed direct form II */
+class CBiquad
+{
+public:
+    void SetCoeffs(const BiquadCoeffs& c) { m_c = c; }
+    const BiquadCoeffs& Coeffs() const { return m_c; }
+
+    void Reset() { m_z1 = m_z2 = 0.0; }
+
+    //! Filter one sample
+    double Process(double x)
+    {
+        const double y = m_c.b0 * x + m_z1;
+        m_z1 = m_c.b1 * x - m_c.a1 * y + m_z2;
+        m_z2 = m_c.b2 * x - m_c.a2 * y;
+        return y;
+    }
+
+    //! Filter a block in place
+    void Process(double* data, int frames);
+
+private:
+    BiquadCoeffs m_c;
+    double m_z1 = 0.0, m_z2 = 0.0;
+};
+
+/*! Stereo biquad: the same filter on a left/right pair
+ *
+ * Both channels run in one SSE2 register.
+ */
+class CStereoBiquad
+{
+public:
+    CStereoBiquad() { Reset(); }
+
+    void SetCoeffs(const BiquadCoeffs& c) { m_c = c; }
+    const BiquadCoeffs& Coeffs() const { return m_c; }
+
+    void Reset() { m_z1[0] = m_z1[1] = m_z2[0] = m_z2[1] = 0.0; }
+
+    //! Filter a planar stereo block in place
+    void Process(double* left, double* right, int frames);
+
+private:
+    BiquadCoeffs m_c;
+    double m_z1[2], m_z2[2];
+};
+
+/*! Cascade of stereo biquad sections for steeper slopes
+ *
+ * Lowpass and highpass cascades are designed as Butterworth
+ * filters of the requested order (2, 4, 6 or 8).  Other shapes
+ * repeat the same section.
+ */
+class CBiquadCascade
+{
+public:
+    static const int MaxSections = 4;
+
+    CBiquadCascade() : m_numSections(1) {}
+
+    //! Design the cascade.  order is rounded up to an even number.
+    void Design(BiquadCoeffs::Shape shape, double freq, double q, double gainDb,
+        int order, double sampleRate);
+
+    int NumSections() const { return m_numSections; }
+
+    void Reset();
+
+    //! Filter a planar stereo block in place
+    void Process(double* left, double* right, int frames);
+
+private:
+    int m_numSections;
+    CStereoBiquad m_sections[MaxSections];
+};
+
+/*! N independent biquads processed side by side
+ *
+ * Data is interleaved, N samples per frame, one per filter.  Each
+ * lane may have its own coefficients, so this serves both N-channel
+ * audio and banks of filters fed from a single source.  N must be
+ * even; lanes are processed two at a time in SSE2 registers.
+ */
+template<int N>
+class CBiquadBank
+{
+public:
+    CBiquadBank() { SetCoeffs(BiquadCoeffs());  Reset(); }
+
+    void SetCoeffs(int lane, const BiquadCoeffs& c)
+    {
+        m_b0[lane] = c.b0;  m_b1[lane] = c.b1;  m_b2[lane] = c.b2;
+        m_a1[lane] = c.a1;  m_a2[lane] = c.a2;
+    }
+
+    void SetCoeffs(const BiquadCoeffs& c)
+    {
+        for (int i = 0; i < N; i++)
+            SetCoeffs(i, c);
+    }
+
+    void Reset()
+    {
+        for (int i = 0; i < N; i++)
+            m_z1[i] = m_z2[i] = 0.0;
+    }
+
+    //! Filter interleaved data (frames * N samples) in place
+    void Process(double* data, int frames)
+    {
+#ifdef SYNTHIE_SSE2
+        __m128d b0[N / 2], b1[N / 2], b2[N / 2], a1[N / 2], a2[N / 2], z1[N / 2], z2[N / 2];
+        for (int p = 0; p < N / 2; p++)
+        {
+            b0[p] = _mm_loadu_pd(m_b0 + 2 * p);  b1[p] = _mm_loadu_pd(m_b1 + 2 * p);
+            b2[p] = _mm_loadu_pd(m_b2 + 2 * p);  a1[p] = _mm_loadu_pd(m_a1 + 2 * p);
+            a2[p] = _mm_loadu_pd(m_a2 + 2 * p);
+            z1[p] = _mm_loadu_pd(m_z1 + 2 * p);  z2[p] = _mm_loadu_pd(m_z2 + 2 * p);
+        }
+
+        for (int f = 0; f < frames; f++, data += N)
+        {
+            for (int p = 0; p < N / 2; p++)
+            {
+                const __m128d x = _mm_loadu_pd(data + 2 * p);
+                const __m128d y = _mm_add_pd(_mm_mul_pd(b0[p], x), z1[p]);
+                z1[p] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[p], x), _mm_mul_pd(a1[p], y)), z2[p]);
+                z2[p] = _mm_sub_pd(_mm_mul_pd(b2[p], x), _mm_mul_pd(a2[p], y));
+                _mm_storeu_pd(data + 2 * p, y);
+            }
+        }
+
+        for (int p = 0; p < N / 2; p++)
+        {
+            _mm_storeu_pd(m_z1 + 2 * p, z1[p]);
+            _mm_storeu_pd(m_z2 + 2 * p, z2[p]);
+        }
+#else
+        for (int f = 0; f < frames; f++, data += N)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                const double x = data[i];
+                const double y = m_b0[i] * x + m_z1[i];
+                m_z1[i] = m_b1[i] * x - m_a1[i] * y + m_z2[i];
+                m_z2[i] = m_b2[i] * x - m_a2[i] * y;
+                data[i] = y;
+            }
+        }
+#endif
+    }
+
+private:
+    static_assert(N % 2 == 0, "CBiquadBank needs an even number of lanes");
+
+    double m_b0[N], m_b1[N], m_b2[N], m_a1[N], m_a2[N];
+    double m_z1[N], m_z2[N];
+};
+
+/*! Time the filters and report throughput
+ *
+ * Runs mono, stereo, cascaded and 4/8-wide parallel filters over a
+ * few seconds of noise and returns a text report in samples per
+ * second, one line per configuration.
+ */
+std::wstring BiquadBenchmark();
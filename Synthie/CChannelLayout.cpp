@@ -0,0 +1,160 @@
+#include "pch.h"
+#include <cmath>
+#include <cstring>
+#include "CChannelLayout.h"
+
+namespace
+{
+    //! Where the speakers of a layout stand
+    struct Speakers
+    {
+        const char* name;
+        int channels;
+        double azimuth[CChannelLayout::MaxChannels];
+        int lfe;                //!< LFE channel, -1 if none
+    };
+
+    // In the order of CChannelLayout::Layout
+    const Speakers layouts[] = {
+        { "mono", 1, { 0 }, -1 },
+        { "stereo", 2, { -30, 30 }, -1 },
+        { "quad", 4, { -45, 45, -135, 135 }, -1 },
+        { "5.1", 6, { -30, 30, 0, 0, -110, 110 }, 3 },
+    };
+
+    const int NumLayouts = sizeof(layouts) / sizeof(layouts[0]);
+
+    //! An angle in degrees brought into [0, 360)
+    double Wrap(double degrees)
+    {
+        degrees = std::fmod(degrees, 360.0);
+        return degrees < 0 ? degrees + 360.0 : degrees;
+    }
+}
+
+int CChannelLayout::NumChannels() const
+{
+    return layouts[m_layout].channels;
+}
+
+bool CChannelLayout::FromName(const char* name, Layout& layout)
+{
+    for (int l = 0; l < NumLayouts; l++)
+    {
+        if (strcmp(name, layouts[l].name) == 0)
+        {
+            layout = Layout(l);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool CChannelLayout::FromChannels(int channels, Layout& layout)
+{
+    for (int l = 0; l < NumLayouts; l++)
+    {
+        if (layouts[l].channels == channels)
+        {
+            layout = Layout(l);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+double CChannelLayout::Azimuth(int channel) const
+{
+    return layouts[m_layout].azimuth[channel];
+}
+
+bool CChannelLayout::IsLfe(int channel) const
+{
+    return channel == layouts[m_layout].lfe;
+}
+
+void CChannelLayout::PanGains(double gain, double pan, double* gains) const
+{
+    switch (m_layout)
+    {
+    case Mono:
+        gains[0] = gain;
+        break;
+
+    case Stereo:
+        gains[0] = pan > 0 ? gain * (1.0 - pan) : gain;
+        gains[1] = pan < 0 ? gain * (1.0 + pan) : gain;
+        break;
+
+    default:
+        // The right front speaker is channel 1 in every layout
+        AzimuthGains(gain, pan * Azimuth(1), gains);
+        break;
+    }
+}
+
+void CChannelLayout::AzimuthGains(double gain, double azimuth, double* gains) const
+{
+    const Speakers& speakers = layouts[m_layout];
+    for (int c = 0; c < speakers.channels; c++)
+        gains[c] = 0.0;
+
+    if (m_layout == Mono)
+    {
+        gains[0] = gain;
+        return;
+    }
+
+    double source = Wrap(azimuth);
+    if (m_layout == Stereo)
+    {
+        // Reflect the back half to the front, and hold the sides
+        // on the speakers
+        source = source > 180.0 ? source - 360.0 : source;
+        source = source > 90.0 ? 180.0 - source : (source < -90.0 ? -180.0 - source : source);
+        source = std::fmax(speakers.azimuth[0], std::fmin(speakers.azimuth[1], source));
+        source = Wrap(source);
+    }
+
+    // Find the speaker at or before the source going clockwise, and
+    // the next one on from it
+    int a = -1;
+    int b = -1;
+    double before = 360.0;
+    double after = 360.0;
+    for (int c = 0; c < speakers.channels; c++)
+    {
+        if (c == speakers.lfe)
+            continue;
+
+        const double back = Wrap(source - speakers.azimuth[c]);
+        const double ahead = Wrap(speakers.azimuth[c] - source);
+        if (back < before)
+        {
+            before = back;
+            a = c;
+        }
+        if (ahead > 0.0 && ahead < after)
+        {
+            after = ahead;
+            b = c;
+        }
+    }
+
+    if (before == 0.0 || b < 0)
+    {
+        gains[a] = gain;
+        return;
+    }
+
+    // Solve for the gains that point the pair's speaker vectors at
+    // the source, then scale them to constant power
+    const double span = (before + after) * PI / 180.0;
+    const double ga = std::sin(after * PI / 180.0) / std::sin(span);
+    const double gb = std::sin(before * PI / 180.0) / std::sin(span);
+    const double norm = std::sqrt(ga * ga + gb * gb);
+    gains[a] = gain * ga / norm;
+    gains[b] = gain * gb / norm;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+/*! Speaker layout of the synthesizer output
+ *
+ * Says how many channels the engine renders and where the speaker
+ * for each one stands.  The channels are in the order Wave and FLAC
+ * files keep them:
+ *
+ *   mono     C
+ *   stereo   L R
+ *   quad     L R Ls Rs           at -45, 45, -135 and 135 degrees
+ *   5.1      L R C LFE Ls Rs     at -30, 30, 0, -, -110 and 110 degrees
+ *
+ * Azimuths are in degrees clockwise from straight ahead, so a
+ * positive azimuth is to the right.
+ */
+class CChannelLayout
+{
+public:
+    //! Most channels a layout has
+    static const int MaxChannels = 6;
+
+    enum Layout { Mono, Stereo, Quad, Surround51 };
+
+    CChannelLayout(Layout layout = Stereo) : m_layout(layout) {}
+
+    Layout GetLayout() const { return m_layout; }
+    void SetLayout(Layout layout) { m_layout = layout; }
+
+    //! Number of channels in the layout
+    int NumChannels() const;
+
+    //! Look up a layout by its score name ("mono", "stereo", "quad", "5.1")
+    static bool FromName(const char* name, Layout& layout);
+
+    //! The layout usually meant by a number of channels
+    static bool FromChannels(int channels, Layout& layout);
+
+    //! Azimuth of a channel's speaker in degrees
+    double Azimuth(int channel) const;
+
+    //! True for the low frequency effects channel, which no source is panned to
+    bool IsLfe(int channel) const;
+
+    /*! Channel gains for a source at a level and a pan position
+     *
+     * In stereo the pan is the balance it has always been: the centre
+     * leaves both channels at the level, and turning toward one side
+     * fades the other.  In the other layouts the pan sweeps across the
+     * front speakers, from the left one at -1 to the right one at 1,
+     * placed as AzimuthGains() places it.
+     */
+    void PanGains(double gain, double pan, double* gains) const;
+
+    /*! Channel gains for a source at a level and an azimuth
+     *
+     * The source is panned between the two speakers either side of
+     * it with constant power, which is two dimensional vector base
+     * amplitude panning.  A source on a speaker plays from that
+     * speaker alone.  Stereo has no speakers behind the listener, so
+     * a source behind is reflected to the front.
+     */
+    void AzimuthGains(double gain, double azimuth, double* gains) const;
+
+private:
+    Layout m_layout;
+};
@@ -0,0 +1,119 @@
+#include "pch.h"
+#include <cmath>
+#include "CCompressor.h"
+
+CCompressor::CCompressor()
+{
+    m_sampleRate = 44100.0;
+    m_thresholdDb = -20.0;
+    m_ratio = 4.0;
+    m_kneeDb = 6.0;
+    m_makeupDb = 0.0;
+    m_attackMs = 5.0;
+    m_releaseMs = 120.0;
+    m_detector = Peak;
+
+    Prepare();
+    Reset();
+}
+
+void CCompressor::Prepare()
+{
+    // The follower runs once per sub-block, so the time
+    // constants are expressed in sub-blocks.
+    const double blocksPerMs = m_sampleRate * 0.001 / SubBlock;
+    m_attackCoeff = std::exp(-1.0 / (std::fmax(m_attackMs, 0.01) * blocksPerMs));
+    m_releaseCoeff = std::exp(-1.0 / (std::fmax(m_releaseMs, 0.01) * blocksPerMs));
+
+    // RMS averaging window of about 10 ms
+    m_rmsCoeff = std::exp(-1.0 / (10.0 * blocksPerMs));
+}
+
+void CCompressor::Reset()
+{
+    m_meanSquare = 0.0;
+    m_envelopeDb = -120.0;
+    m_gain = std::pow(10.0, m_makeupDb / 20.0);
+    m_reductionDb = 0.0;
+}
+
+//! Static curve: gain change in dB for a detector level in dB
+double CCompressor::GainComputer(double levelDb) const
+{
+    const double over = levelDb - m_thresholdDb;
+    const double slope = 1.0 / m_ratio - 1.0;
+
+    if (2.0 * over <= -m_kneeDb)
+        return 0.0;
+
+    if (2.0 * std::abs(over) < m_kneeDb)
+    {
+        // Quadratic soft knee
+        const double x = over + m_kneeDb / 2.0;
+        return slope * x * x / (2.0 * m_kneeDb);
+    }
+
+    return slope * over;
+}
+
+void CCompressor::Process(double* const* channels, const double* const* key, int numChannels, int frames)
+{
+    if (key == NULL)
+        key = channels;
+
+    for (int start = 0; start < frames; start += SubBlock)
+    {
+        const int n = frames - start < SubBlock ? frames - start : SubBlock;
+
+        // 1) Detector over the sub-block
+        double level;
+        if (m_detector == Peak)
+        {
+            double peak = 0.0;
+            for (int c = 0; c < numChannels; c++)
+            {
+                for (int i = start; i < start + n; i++)
+                    peak = std::fmax(peak, std::abs(key[c][i]));
+            }
+            level = peak;
+        }
+        else
+        {
+            double sum = 0.0;
+            for (int i = start; i < start + n; i++)
+            {
+                double frame = 0.0;
+                for (int c = 0; c < numChannels; c++)
+                    frame += key[c][i] * key[c][i];
+                sum += frame;
+            }
+
+            const double ms = sum / (numChannels * n);
+            m_meanSquare = ms + (m_meanSquare - ms) * m_rmsCoeff;
+            level = std::sqrt(m_meanSquare);
+        }
+
+        const double levelDb = 20.0 * std::log10(level + 1e-12);
+
+        // 2) Attack/release follower in dB
+        const double coeff = levelDb > m_envelopeDb ? m_attackCoeff : m_releaseCoeff;
+        m_envelopeDb = levelDb + (m_envelopeDb - levelDb) * coeff;
+
+        // 3) Gain computer, then ramp to the new gain over the sub-block
+        m_reductionDb = GainComputer(m_envelopeDb);
+        const double target = std::pow(10.0, (m_reductionDb + m_makeupDb) / 20.0);
+        const double step = (target - m_gain) / n;
+
+        for (int c = 0; c < numChannels; c++)
+        {
+            double g = m_gain;
+            for (int i = start; i < start + n; i++)
+            {
+                g += step;
+                channels[c][i] *= g;
+            }
+        }
+
+        m_gain = target;
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+/*! Feed-forward compressor with an optional external sidechain
+ *
+ * The detector works on sub-blocks of SubBlock frames: it measures
+ * the key signal's peak or mean square over each sub-block, runs the
+ * attack/release follower once per sub-block in the dB domain, and
+ * ramps the gain linearly across the sub-block.  That keeps the
+ * log/exp work to one per sub-block and adds no latency.
+ *
+ * With no key connected the compressor keys off its own input.
+ */
+class CCompressor
+{
+public:
+    //! Frames per detector step
+    static const int SubBlock = 16;
+
+    enum Detector { Peak, Rms };
+
+    CCompressor();
+
+    void SetSampleRate(double sr) { m_sampleRate = sr;  Prepare(); }
+    void SetThreshold(double db) { m_thresholdDb = db; }
+    void SetRatio(double ratio) { m_ratio = ratio < 1.0 ? 1.0 : ratio; }
+    void SetKnee(double db) { m_kneeDb = db < 0.0 ? 0.0 : db; }
+    void SetMakeup(double db) { m_makeupDb = db; }
+    void SetAttack(double ms) { m_attackMs = ms;  Prepare(); }
+    void SetRelease(double ms) { m_releaseMs = ms;  Prepare(); }
+    void SetDetector(Detector d) { m_detector = d; }
+
+    //! Clear the detector and gain state
+    void Reset();
+
+    //! Gain reduction applied to the last sub-block, in dB (<= 0)
+    double GainReduction() const { return m_reductionDb; }
+
+    /*! Process a block of planar channels in place
+     * \param key Sidechain key channels, as many as the input, or NULL
+     * to key off the input
+     */
+    void Process(double* const* channels, const double* const* key, int numChannels, int frames);
+
+private:
+    void Prepare();
+    double GainComputer(double levelDb) const;
+
+    double m_sampleRate;
+    double m_thresholdDb;
+    double m_ratio;
+    double m_kneeDb;
+    double m_makeupDb;
+    double m_attackMs;
+    double m_releaseMs;
+    Detector m_detector;
+
+    // Per sub-block smoothing coefficients
+    double m_attackCoeff;
+    double m_releaseCoeff;
+    double m_rmsCoeff;
+
+    double m_meanSquare;        //!< RMS detector state
+    double m_envelopeDb;        //!< Smoothed detector level
+    double m_gain;              //!< Linear gain at the end of the last sub-block
+    double m_reductionDb;
+};
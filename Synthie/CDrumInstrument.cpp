@@ -2,6 +2,7 @@
 #include <cmath>
 #include <algorithm>
 #include "CDrumInstrument.h"
+#include "CStringTable.h"
 
 static inline double Sine01(double p) { return std::sin(p * 2.0 * 3.141592653589793); }
 static inline double clamp(double v, double lo, double hi) { return v < lo ? lo : (v > hi ? hi : v); }
@@ -14,6 +15,28 @@ static inline double Noise11(uint32_t& s) {
     return 2.0 * Noise01(s) - 1.0; // [-1,1]
 }
 
+// The drums' noise filters are first order, designed once a note.
+// The high-pass is the leaky differentiator y = x - x[-1] + a*y[-1],
+// which is not normalized: its gain climbs to 2/(1+a) at Nyquist, and
+// the drum levels are set with that in.
+static BiquadCoeffs DrumHighpass(double freq, double sampleRate)
+{
+    BiquadCoeffs c;
+    c.b1 = -1.0;
+    c.a1 = -std::exp(-2.0 * PI * freq / sampleRate);
+    return c;
+}
+
+// One-pole low-pass, y = (1-a)*x + a*y[-1]
+static BiquadCoeffs DrumLowpass(double freq, double sampleRate)
+{
+    const double a = std::exp(-2.0 * PI * freq / sampleRate);
+    BiquadCoeffs c;
+    c.b0 = 1.0 - a;
+    c.a1 = -a;
+    return c;
+}
+
 
 CDrumInstrument::CDrumInstrument()
 {
@@ -25,6 +48,8 @@ CDrumInstrument::CDrumInstrument()
     m_drumType = L"kick";
     m_velocity = 0.9;
     m_pitchOffset = 0.0;
+    m_oversampling = 1;
+    m_seed = 0xA3C59AC3u;
 }
 
 CDrumInstrument::~CDrumInstrument() {}
@@ -36,62 +61,69 @@ void CDrumInstrument::Start()
     Voice v;
     v.type = m_drumType;
     v.t = 0.0;
-    v.dur = m_duration;
     v.vel = m_velocity;
     v.isSynth = true;
+    Envelope(v);
 
     double ph1, ph2, ph3, ph4, ph5, ph6; // cymbal partial phases
 
-    // Per-type envelopes (very short for hats)
     if (m_drumType == L"hihat") {
-        v.atk = 0.0005; v.dec = 0.030; v.rel = 0.006; v.dur = 0.04; v.sus = 0.005;
+        // Band-pass around 9 kHz: (HPF @ 4k then LPF @ 12k)
+        v.hp.SetCoeffs(DrumHighpass(4000.0, GetSampleRate()));
+        v.lp.SetCoeffs(DrumLowpass(12000.0, GetSampleRate()));
     }
     else if (m_drumType == L"snare") {
-        v.atk = 0.0008;  // very fast
-        v.dec = 0.080;   // snap dies quick
-        v.rel = 0.050;   // short tail
-        v.sus = 0.0;
-        v.dur = 0.07;
-
         // tonal body ~200 Hz, decays fast internally
         v.bodyPh = 0.0;
         v.bodyAmp = 0.45;                  // start level of body
         v.toneDec = std::exp(-GetSamplePeriod() * 70.0); // faster than before
         v.toneMix = 0.0; // we'll use bodyAmp instead of toneMix for the sine body
 
-        // reset band-pass states
-        v.bp_prev = 0.0;
-        v.bp_hp_z = 0.0;
-        v.bp_lp_z = 0.0;
+        // Noise crack in the mid band (1 kHz - 4.5 kHz), and a
+        // bright fizz band (5 kHz - 10 kHz) for the first few ms
+        v.hp.SetCoeffs(DrumHighpass(1000.0, GetSampleRate()));
+        v.lp.SetCoeffs(DrumLowpass(4500.0, GetSampleRate()));
+        v.fizzLp.SetCoeffs(DrumLowpass(10000.0, GetSampleRate()));
+
+        // The fizz high-pass is a gentler first difference,
+        // x - (1-a)*x[-1], which only tilts the lows down
+        BiquadCoeffs fizz;
+        fizz.b1 = std::exp(-2.0 * PI * 5000.0 / GetSampleRate()) - 1.0;
+        v.fizzHp.SetCoeffs(fizz);
     }
 
     else if (m_drumType == L"tom" || m_drumType == L"tom-hi" || m_drumType == L"tom-low") {
-        v.atk = 0.001;  v.dec = 0.160; v.rel = 0.080; v.sus = 0.03;
         v.phaseInc = std::pow(2.0, m_pitchOffset / 12.0);
     }
     else if (m_drumType == L"cymbal")
     {
-        v.atk = 0.0008;  // instant
-        v.dec = 0.25;    // splash body
-        v.rel = 0.90;    // long tail
-        v.sus = 0.0;     // no sustain plateau
-        v.dur = 0.5;  // time before release begins
         // init metallic phases (add these fields to Voice if not present)
         v.ph1 = v.ph2 = v.ph3 = v.ph4 = v.ph5 = v.ph6 = 0.0;
-    }
-    else { // kick
-        v.atk = m_attack; v.dec = m_decay; v.rel = m_release; v.sus = 0.02;
+
+        // Noise band from 5.5 kHz to 12 kHz
+        v.hp.SetCoeffs(DrumHighpass(5500.0, GetSampleRate()));
+        v.lp.SetCoeffs(DrumLowpass(12000.0, GetSampleRate()));
     }
 
-    // Seed RNG uniquely per voice: hash current time + address
-    uint64_t mix = (uint64_t)(m_time * 44100.0) ^ (uint64_t)(uintptr_t)this;
+    // Seed the RNG from the note, so a note sounds the same in
+    // every render and a partial re-render matches the full one
+    uint64_t mix = m_seed;
     mix ^= (mix >> 33); mix *= 0xff51afd7ed558ccdULL;
     mix ^= (mix >> 33); mix *= 0xc4ceb9fe1a85ec53ULL;
     mix ^= (mix >> 33);
     v.rng = (uint32_t)mix | 1u; // keep it odd
 
     v.oscPh = v.auxPh = 0.0;
-    v.lpf_z = v.hpf_z = v.prev = 0.0;
+    v.hp.Reset();
+    v.lp.Reset();
+    v.fizzHp.Reset();
+    v.fizzLp.Reset();
+
+    // The oversampled clipper delays the voice.  Running the voice
+    // that far ahead up front keeps the hit on its beat.
+    v.os.SetFactor(m_oversampling);
+    for (int i = 0; i < v.os.Latency(); i++)
+        VoiceSample(v);
 
     if (m_voices.size() >= m_maxVoices) {
         m_voices.erase(m_voices.begin());
@@ -99,213 +131,227 @@ void CDrumInstrument::Start()
     m_voices.push_back(v);
 }
 
+//! Per-type envelope of a voice (very short for hats)
+void CDrumInstrument::Envelope(Voice& v) const
+{
+    v.dur = m_duration;
+    if (m_drumType == L"hihat") {
+        v.atk = 0.0005; v.dec = 0.030; v.rel = 0.006; v.dur = 0.04; v.sus = 0.005;
+    }
+    else if (m_drumType == L"snare") {
+        v.atk = 0.0008;  // very fast
+        v.dec = 0.080;   // snap dies quick
+        v.rel = 0.050;   // short tail
+        v.sus = 0.0;
+        v.dur = 0.07;
+    }
+    else if (m_drumType == L"tom" || m_drumType == L"tom-hi" || m_drumType == L"tom-low") {
+        v.atk = 0.001;  v.dec = 0.160; v.rel = 0.080; v.sus = 0.03;
+    }
+    else if (m_drumType == L"cymbal") {
+        v.atk = 0.0008;  // instant
+        v.dec = 0.25;    // splash body
+        v.rel = 0.90;    // long tail
+        v.sus = 0.0;     // no sustain plateau
+        v.dur = 0.5;  // time before release begins
+    }
+    else { // kick
+        v.atk = m_attack; v.dec = m_decay; v.rel = m_release; v.sus = 0.02;
+    }
+}
+
+double CDrumInstrument::Length() const
+{
+    Voice v;
+    Envelope(v);
+    return VoiceLength(v);
+}
+
+//! Seconds a voice plays for, through its release
+double CDrumInstrument::VoiceLength(const Voice& v)
+{
+    double tail = v.dur + 1e-3;
+    if (v.rel > 0.0) tail += v.rel;
+    return tail;
+}
+
 bool CDrumInstrument::Generate()
 {
     const double dt = GetSamplePeriod();
 
-    // Clear output
-    m_frame[0] = 0.0;
-    m_frame[1] = 0.0;
-
-    // Process all active voices
+    // Process all active voices into one sample.  It goes to every
+    // channel; the bus places it.
+    double sum = 0.0;
     for (auto it = m_voices.begin(); it != m_voices.end(); )
     {
         Voice& v = *it;
 
         // Check if voice is done
-        double tail = v.dur + 1e-3;
-        if (v.rel > 0.0) tail += v.rel;
-
-        if (v.t > tail) {
+        if (v.t > VoiceLength(v)) {
             it = m_voices.erase(it);
             continue;
         }
 
-        // Calculate envelope for this voice
-        double env = GetVoiceEnvelope(v);
-        double s = 0.0;
-
-        // Generate sound based on drum type
-        if (v.type == L"snare")
-        {
-            // ------------- Noise crack in the MID band (? 14.5 kHz) -------------
-            // Source: white noise
-            double n = Noise11(v.rng);
-
-            // High-pass around 1 kHz (remove low "bong", keep crack)
-            const double hp_cut = 1000.0;
-            const double a_hp = std::exp(-2.0 * PI * hp_cut * dt);
-            double hp = (n - v.bp_prev) + a_hp * v.bp_hp_z;
-            v.bp_prev = n;
-            v.bp_hp_z = hp;
-
-            // Low-pass around 4.5 kHz (avoid cymbal-ish sizzle)
-            const double lp_cut = 4500.0;
-            const double a_lp = std::exp(-2.0 * PI * lp_cut * dt);
-            v.bp_lp_z = (1.0 - a_lp) * hp + a_lp * v.bp_lp_z;
-            double midCrack = v.bp_lp_z;
-
-            // Tiny sprinkle of high fizz only in the first ~15 ms
-            double fizz = 0.0;
-            if (v.t < 0.015) {
-                // quick, bright burst (HP at 5 kHz then LP at 10 kHz)
-                const double hp2 = 5000.0, lp2 = 10000.0;
-                const double a_hp2 = std::exp(-2.0 * PI * hp2 * dt);
-                const double a_lp2 = std::exp(-2.0 * PI * lp2 * dt);
-                static thread_local double h2 = 0.0, l2 = 0.0;
-                double nn = Noise11(v.rng);
-                double hps = (nn - h2) + a_hp2 * h2; h2 = nn;
-                l2 = (1.0 - a_lp2) * hps + a_lp2 * l2;
-                fizz = 0.15 * l2 * std::exp(-v.t / 0.010); // very short
-            }
-
-            // ------------- Short tonal body around 180220 Hz -------------
-            const double bodyHz = 190.0; // tweak 180220 to taste
-            v.bodyPh += bodyHz * dt; if (v.bodyPh >= 1.0) v.bodyPh -= 1.0;
-            v.bodyAmp *= v.toneDec;  // fast internal decay (~70 s^-1)
-            double body = v.bodyAmp * Sine01(v.bodyPh);
-
-            // Mix: mostly mid-band noise + small body + micro fizz
-            s = 0.82 * midCrack   // the "crack"
-                + 0.12 * body       // thump without boom
-                + fizz;             // initial bright snap only
-        }
+        sum += VoiceSample(v);
+
+        ++it;
+    }
 
+    for (int c = 0; c < m_channels; c++)
+        m_frame[c] = sum;
 
-        else if (v.type == L"tom" || v.type == L"tom-hi" || v.type == L"tom-lo")
-        {
-            // Determine base pitch based on tom type
-            double basePitch = 110.0; // default mid tom (A2)
-
-            if (v.type == L"tom-hi") {
-                basePitch = 155.56; // D#3 - high tom
-            }
-            else if (v.type == L"tom-low") {
-                basePitch = 82.41; // E2 - low tom
-            }
-
-            // Then apply pitch offset on top
-            const double freq = basePitch * v.phaseInc;
-            const double sweep = 80.0;
-            const double tau = 0.04;
-            const double f = freq + sweep * std::exp(-v.t / tau);
-            v.oscPh += f * dt;
-            v.oscPh -= std::floor(v.oscPh);
-            s = Sine01(v.oscPh);
-        }
-        else if (v.type == L"hihat")
-        {
-            // bright noise
-            double n = Noise11(v.rng);
-
-            // Band-pass around 9 kHz: (HPF @ 4k then LPF @ 12k)
-            const double hp_cut = 4000.0;
-            const double lp_cut = 12000.0;
-            const double ahp = std::exp(-2.0 * PI * hp_cut * dt);
-            const double alp = std::exp(-2.0 * PI * lp_cut * dt);
-
-            // simple HPF (differentiator form)
-            double hp = n - v.prev + ahp * v.hpf_z;
-            v.prev = n;
-            v.hpf_z = hp;
-
-            // one-pole LPF on hp to make BPF
-            v.lpf_z = (1.0 - alp) * hp + alp * v.lpf_z;
-
-            // optional faint metallic cluster (inharmonic, very quiet)
-            v.oscPh += 0.123 * dt; if (v.oscPh >= 1.0) v.oscPh -= 1.0;
-            v.auxPh += 0.187 * dt; if (v.auxPh >= 1.0) v.auxPh -= 1.0;
-            double metal = 0.05 * (Sine01(v.oscPh * 11000.0) + Sine01(v.auxPh * 14700.0));
-
-            s = 0.95 * v.lpf_z + metal;
+    // Advance global time (for backwards compatibility)
+    m_time += dt;
+
+    // Continue if we have active voices
+    return !m_voices.empty();
+}
+
+//! Synthesize the next sample of a voice and advance its time
+double CDrumInstrument::VoiceSample(Voice& v)
+{
+    const double dt = GetSamplePeriod();
+
+    // Calculate envelope for this voice
+    double env = GetVoiceEnvelope(v);
+    double s = 0.0;
+
+    // Generate sound based on drum type
+    if (v.type == L"snare")
+    {
+        // ------------- Noise crack in the MID band (? 14.5 kHz) -------------
+        // Source: white noise
+        double n = Noise11(v.rng);
+
+        // High-pass around 1 kHz (remove low "bong", keep crack),
+        // then low-pass around 4.5 kHz (avoid cymbal-ish sizzle)
+        double midCrack = v.lp.Process(v.hp.Process(n));
+
+        // Tiny sprinkle of high fizz only in the first ~15 ms
+        double fizz = 0.0;
+        if (v.t < 0.015) {
+            // quick, bright burst (HP at 5 kHz then LP at 10 kHz)
+            double nn = Noise11(v.rng);
+            double l2 = v.fizzLp.Process(v.fizzHp.Process(nn));
+            fizz = 0.15 * l2 * std::exp(-v.t / 0.010); // very short
         }
 
-        else if (v.type == L"cymbal")
-        {
-            // White noise source (persistent RNG)
-            double n = Noise11(v.rng);
-
-            // --- High-pass (~5.5 kHz) using "differentiator + leak" ---
-            const double hp_cut = 5500.0;
-            const double a_hp = std::exp(-2.0 * PI * hp_cut * dt);
-            double hp = (n - v.prev) + a_hp * v.hpf_z;  // high-passy
-            v.prev = n;
-            v.hpf_z = hp;
-
-            // --- Low-pass (~12 kHz) to shape the band ---
-            const double lp_cut = 12000.0;
-            const double a_lp = std::exp(-2.0 * PI * lp_cut * dt);
-            v.lpf_z = (1.0 - a_lp) * hp + a_lp * v.lpf_z;
-            double band = v.lpf_z;
-
-            // --- Metallic partial cluster (very quiet, inharmonic) ---
-            // Two fast ring-mod pairs to add cymbal-like zing:
-            v.oscPh += 0.000; if (v.oscPh >= 1.0) v.oscPh -= 1.0; // (phases unused for time; well integrate below)
-            v.auxPh += 0.000; if (v.auxPh >= 1.0) v.auxPh -= 1.0;
-
-            // integrate explicit phases for metal partials
-            // choose inharmonic ratios around 412 kHz
-            static const double ratios[6] = { 4.07, 5.41, 6.80, 8.21, 9.63, 11.2 };
-            // base clang freq:
-            const double f0 = 1100.0;
-
-            // keep a couple of running phases on the voice (add these to your Voice struct if you want more)
-            v.ph1 += (f0 * ratios[0]) * dt; if (v.ph1 >= 1.0) v.ph1 -= 1.0;
-            v.ph2 += (f0 * ratios[1]) * dt; if (v.ph2 >= 1.0) v.ph2 -= 1.0;
-            v.ph3 += (f0 * ratios[2]) * dt; if (v.ph3 >= 1.0) v.ph3 -= 1.0;
-            v.ph4 += (f0 * ratios[3]) * dt; if (v.ph4 >= 1.0) v.ph4 -= 1.0;
-            v.ph5 += (f0 * ratios[4]) * dt; if (v.ph5 >= 1.0) v.ph5 -= 1.0;
-            v.ph6 += (f0 * ratios[5]) * dt; if (v.ph6 >= 1.0) v.ph6 -= 1.0;
-
-            double metal =
-                0.22 * Sine01(v.ph1) +
-                0.18 * Sine01(v.ph2) +
-                0.16 * Sine01(v.ph3) +
-                0.14 * Sine01(v.ph4) +
-                0.12 * Sine01(v.ph5) +
-                0.10 * Sine01(v.ph6);
-
-            // subtle internal decay on metallics so attack is bright, tail is mostly noise
-            static const double metalTau = 0.9; // seconds-ish
-            const double metalEnv = std::exp(-v.t / metalTau);
-            metal *= metalEnv;
-
-            // Mix a bright, airy cymbal: mostly filtered noise + a taste of metal
-            s = 0.80 * band + 0.20 * metal;
+        // ------------- Short tonal body around 180220 Hz -------------
+        const double bodyHz = 190.0; // tweak 180220 to taste
+        v.bodyPh += bodyHz * dt; if (v.bodyPh >= 1.0) v.bodyPh -= 1.0;
+        v.bodyAmp *= v.toneDec;  // fast internal decay (~70 s^-1)
+        double body = v.bodyAmp * Sine01(v.bodyPh);
+
+        // Mix: mostly mid-band noise + small body + micro fizz
+        s = 0.82 * midCrack   // the "crack"
+            + 0.12 * body       // thump without boom
+            + fizz;             // initial bright snap only
+    }
+
+
+    else if (v.type == L"tom" || v.type == L"tom-hi" || v.type == L"tom-lo")
+    {
+        // Determine base pitch based on tom type
+        double basePitch = 110.0; // default mid tom (A2)
+
+        if (v.type == L"tom-hi") {
+            basePitch = 155.56; // D#3 - high tom
         }
-        else // default: bass/kick
-        {
-            const double base = 55.0, sweep = 140.0, tau = 0.035;
-            const double f = base + sweep * std::exp(-v.t / tau);
-            v.oscPh += f * dt;
-            v.oscPh -= std::floor(v.oscPh);
-
-            double click = 0.0;
-            if (v.t < 0.006) {
-                v.auxPh += 1000.0 * dt;
-                v.auxPh -= std::floor(v.auxPh);
-                click = 0.35 * Sine01(v.auxPh);
-            }
-            s = 0.95 * Sine01(v.oscPh) + click;
+        else if (v.type == L"tom-low") {
+            basePitch = 82.41; // E2 - low tom
         }
 
-        double out = v.vel * env * s;
-        out = out / (1.0 + 0.5 * std::abs(out)); // soft clip
+        // Then apply pitch offset on top
+        const double freq = basePitch * v.phaseInc;
+        const double sweep = 80.0;
+        const double tau = 0.04;
+        const double f = freq + sweep * std::exp(-v.t / tau);
+        v.oscPh += f * dt;
+        v.oscPh -= std::floor(v.oscPh);
+        s = Sine01(v.oscPh);
+    }
+    else if (v.type == L"hihat")
+    {
+        // bright noise
+        double n = Noise11(v.rng);
 
-        // Add to output frame
-        m_frame[0] += out;
-        m_frame[1] += out;
+        // Band-pass around 9 kHz: (HPF @ 4k then LPF @ 12k)
+        double band = v.lp.Process(v.hp.Process(n));
 
-        // Advance voice time
-        v.t += dt;
-        ++it;
+        // optional faint metallic cluster (inharmonic, very quiet)
+        v.oscPh += 0.123 * dt; if (v.oscPh >= 1.0) v.oscPh -= 1.0;
+        v.auxPh += 0.187 * dt; if (v.auxPh >= 1.0) v.auxPh -= 1.0;
+        double metal = 0.05 * (Sine01(v.oscPh * 11000.0) + Sine01(v.auxPh * 14700.0));
+
+        s = 0.95 * band + metal;
     }
 
-    // Advance global time (for backwards compatibility)
-    m_time += dt;
+    else if (v.type == L"cymbal")
+    {
+        // White noise source (persistent RNG)
+        double n = Noise11(v.rng);
+
+        // --- High-pass (~5.5 kHz), then low-pass (~12 kHz) to shape the band ---
+        double band = v.lp.Process(v.hp.Process(n));
+
+        // --- Metallic partial cluster (very quiet, inharmonic) ---
+        // Two fast ring-mod pairs to add cymbal-like zing:
+        v.oscPh += 0.000; if (v.oscPh >= 1.0) v.oscPh -= 1.0; // (phases unused for time; well integrate below)
+        v.auxPh += 0.000; if (v.auxPh >= 1.0) v.auxPh -= 1.0;
+
+        // integrate explicit phases for metal partials
+        // choose inharmonic ratios around 412 kHz
+        static const double ratios[6] = { 4.07, 5.41, 6.80, 8.21, 9.63, 11.2 };
+        // base clang freq:
+        const double f0 = 1100.0;
+
+        // keep a couple of running phases on the voice (add these to your Voice struct if you want more)
+        v.ph1 += (f0 * ratios[0]) * dt; if (v.ph1 >= 1.0) v.ph1 -= 1.0;
+        v.ph2 += (f0 * ratios[1]) * dt; if (v.ph2 >= 1.0) v.ph2 -= 1.0;
+        v.ph3 += (f0 * ratios[2]) * dt; if (v.ph3 >= 1.0) v.ph3 -= 1.0;
+        v.ph4 += (f0 * ratios[3]) * dt; if (v.ph4 >= 1.0) v.ph4 -= 1.0;
+        v.ph5 += (f0 * ratios[4]) * dt; if (v.ph5 >= 1.0) v.ph5 -= 1.0;
+        v.ph6 += (f0 * ratios[5]) * dt; if (v.ph6 >= 1.0) v.ph6 -= 1.0;
+
+        double metal =
+            0.22 * Sine01(v.ph1) +
+            0.18 * Sine01(v.ph2) +
+            0.16 * Sine01(v.ph3) +
+            0.14 * Sine01(v.ph4) +
+            0.12 * Sine01(v.ph5) +
+            0.10 * Sine01(v.ph6);
+
+        // subtle internal decay on metallics so attack is bright, tail is mostly noise
+        static const double metalTau = 0.9; // seconds-ish
+        const double metalEnv = std::exp(-v.t / metalTau);
+        metal *= metalEnv;
+
+        // Mix a bright, airy cymbal: mostly filtered noise + a taste of metal
+        s = 0.80 * band + 0.20 * metal;
+    }
+    else // default: bass/kick
+    {
+        const double base = 55.0, sweep = 140.0, tau = 0.035;
+        const double f = base + sweep * std::exp(-v.t / tau);
+        v.oscPh += f * dt;
+        v.oscPh -= std::floor(v.oscPh);
+
+        double click = 0.0;
+        if (v.t < 0.006) {
+            v.auxPh += 1000.0 * dt;
+            v.auxPh -= std::floor(v.auxPh);
+            click = 0.35 * Sine01(v.auxPh);
+        }
+        s = 0.95 * Sine01(v.oscPh) + click;
+    }
 
-    // Continue if we have active voices
-    return !m_voices.empty();
+    // Soft clip, oversampled when enabled so hot hats and
+    // cymbals do not alias
+    const double level = v.vel * env * s;
+    const double out = v.os.Process(level, [](double x) { return x / (1.0 + 0.5 * std::abs(x)); });
+
+    v.t += dt;
+    return out;
 }
 
 double CDrumInstrument::GetVoiceEnvelope(const Voice& v)
@@ -335,51 +381,29 @@ double CDrumInstrument::GetVoiceEnvelope(const Voice& v)
     return sustain * (1.0 - xr);
 }
 
-void CDrumInstrument::SetNote(CNote* note)
+void CDrumInstrument::SetNote(const CNote* note)
 {
     // Safety check
-    if (note == NULL || note->Node() == NULL) return;
+    if (note == NULL) return;
 
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    HRESULT hr = note->Node()->get_attributes(&attributes);
-    if (FAILED(hr) || attributes == NULL) return;
+    if (note->Duration() >= 0)
+        m_duration = NoteSeconds(note);
 
-    long len;
-    attributes->get_length(&len);
+    if (note->Velocity() >= 0)
+        m_velocity = note->Velocity();
 
-    for (int i = 0; i < len; i++)
-    {
-        CComPtr<IXMLDOMNode> attrib;
-        attributes->get_item(i, &attrib);
-        if (attrib == NULL) continue;
+    m_pitchOffset = note->Pitch();
 
-        CComBSTR name;
-        attrib->get_nodeName(&name);
+    if (note->Type() >= 0 && m_strings != NULL)
+        m_drumType = m_strings->Get(note->Type());
 
-        CComVariant value;
-        attrib->get_nodeValue(&value);
-
-        if (name == L"duration")
-        {
-            if (SUCCEEDED(value.ChangeType(VT_R8)))
-                m_duration = value.dblVal;
-        }
-        else if (name == L"type")
-        {
-            if (value.vt == VT_BSTR && value.bstrVal != NULL)
-                m_drumType = value.bstrVal;
-        }
-        else if (name == L"velocity")
-        {
-            if (SUCCEEDED(value.ChangeType(VT_R8)))
-                m_velocity = value.dblVal;
-        }
-        else if (name == L"pitch")
-        {
-            if (SUCCEEDED(value.ChangeType(VT_R8)))
-                m_pitchOffset = value.dblVal;
-        }
-    }
+    // Hits at different places or of different drums get different
+    // noise.  In a pattern the place is counted from its start.
+    uint64_t seed = (uint64_t)(note->Measure() - m_origin) * 0x9E3779B97F4A7C15ULL;
+    seed ^= (uint64_t)(note->Beat() * 65536.0) * 0xC2B2AE3D27D4EB4FULL;
+    for (wchar_t c : m_drumType)
+        seed = (seed ^ (uint64_t)c) * 0x100000001B3ULL;
+    m_seed = seed;
 }
 
 void CDrumInstrument::AddVoice(const std::wstring& type, double durationSec, double velocity,
@@ -4,6 +4,8 @@
 #include <memory>
 #include <vector>
 #include <audio/Wave.h>
+#include "CBiquad.h"
+#include "COversampler.h"
 
 class CWavePlayer;  // Forward declaration
 
@@ -30,30 +32,36 @@ public:
         std::shared_ptr<CWave> sample; // whole file in RAM
         double phase = 0.0;            // fractional index
         double phaseInc = 1.0;         // pitch ratio
-        // Simple filters for snare/cymbal/tom body
-        double lpf_z = 0.0, hpf_z = 0.0;
+        // Band-pass filters for the snare/hihat/cymbal noise,
+        // designed once at note-on
+        CBiquad hp, lp;
+        CBiquad fizzHp, fizzLp;     // snare attack fizz
+        COversampler os;            // oversampling for the output soft clip
         // Scratch for synth oscillators
         double oscPh = 0.0, auxPh = 0.0;
 
         uint32_t rng = 0xA3C59AC3u;  // per-voice RNG state
-        double prev = 0.0;           // for simple HPF/differentiator
         double sus = 0.02;           // sustain level per voice (drums want it tiny)
         double toneMix = 0.0;        // for snare tone mix
         double toneDec = 0.0;        // snare tone decay rate
 
         double ph1, ph2, ph3, ph4, ph5, ph6;
 
-        double bp_prev = 0.0;   // for band-pass HP stage (prev noise)
-        double bp_hp_z = 0.0;   // HP leak state
-        double bp_lp_z = 0.0;   // LP state
         double bodyPh = 0.0;    // body sine phase (~200 Hz)
         double bodyAmp = 0.0;   // internal decay for body
 
     };
 
     double GetVoiceEnvelope(const Voice& v);
+    double VoiceSample(Voice& v);
+    void Envelope(Voice& v) const;
+    static double VoiceLength(const Voice& v);
 
-    virtual void SetNote(CNote* note);
+    //! Oversampling factor for the voice soft clip (1, 2 or 4)
+    void SetOversampling(int factor) { m_oversampling = factor; }
+
+    virtual void SetNote(const CNote* note);
+    virtual double Length() const;
 
     void AddVoice(const std::wstring& type, double durationSec, double velocity,
         double pitchSemitones = 0.0, double pan = 0.0);
@@ -72,6 +80,8 @@ private:
     double m_release;
     double m_velocity;
     double m_pitchOffset;
+    int m_oversampling;
+    uint64_t m_seed;            //!< Noise seed, from the note
 
     // Which drum sound to play
     std::wstring m_drumType;
@@ -1,26 +1,785 @@
 #include "pch.h"
+#include <cstring>
+#include <algorithm>
+#include <cwchar>
 #include "CEffects.h"
+#include "CXmlReader.h"
 
-void CEffects::Process(double frame[2])
+CEffects::CEffects()
 {
-    // 1) Gain
-    double L = frame[0] * m_gain;
-    double R = frame[1] * m_gain;
+    m_dry.Resize(m_channels, MaxBlock);
+    m_spare.resize(MaxBlock);
 
-    // 2) Gentle LPF (tames harsh noise tails)
-    m_lL += m_lpfA * (L - m_lL);
-    m_lR += m_lpfA * (R - m_lR);
-    L = m_lL; R = m_lR;
+    SetDefaultChain();
+}
 
-    // 3)
-    double wetL = 0.85 + 0.15;
-    double wetR = 0.85 + 0.15;
+void CEffects::SetSampleRate(double sr)
+{
+    m_sr = sr;
+
+    for (Stage& stage : m_stages)
+        Prepare(stage);
+}
+
+void CEffects::SetNumChannels(int channels)
+{
+    m_channels = channels;
+    m_dry.Resize(channels, MaxBlock);
+}
+
+void CEffects::SetOversampling(int factor)
+{
+    m_oversampling = factor;
+
+    for (Stage& stage : m_stages)
+        Prepare(stage);
+}
+
+void CEffects::Clear()
+{
+    m_stages.clear();
+    m_clips.clear();
+    m_biquads.clear();
+    m_svfs.clear();
+    m_limiters.clear();
+    m_compressors.clear();
+    m_mods.clear();
+}
+
+void CEffects::SetDefaultChain()
+{
+    Clear();
+
+    // Gain, then a gentle LPF that tames harsh noise tails,
+    // then a brickwall limiter that keeps the master out of clipping.
+    SetParam(AddStage(Gain), L"gain", 0.90);
+    SetParam(AddStage(Lowpass), L"freq", 8000.0);
+    AddStage(Limiter);
+}
+
+void CEffects::Reset(int frame)
+{
+    for (Stage& stage : m_stages)
+    {
+        stage.wetNow = stage.wet;
+        stage.gainNow = stage.gain;
+        stage.aNow = stage.a;
+
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+            stage.z[c] = 0.0;
+
+        DryDelay* dry = StageDry(stage);
+        if (dry != NULL)
+        {
+            dry->pos = 0;
+            for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+                std::fill(dry->line[c].begin(), dry->line[c].end(), 0.0);
+        }
+    }
+
+    for (ClipState& clip : m_clips)
+    {
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+            clip.os[c].Reset();
+    }
+
+    for (BiquadState& biquad : m_biquads)
+    {
+        for (int p = 0; p < MaxPairs; p++)
+            biquad.pairs[p].Reset();
+    }
+
+    for (SvfState& svf : m_svfs)
+    {
+        for (int p = 0; p < MaxPairs; p++)
+            svf.pairs[p].Reset();
+    }
+
+    for (LimiterState& limiter : m_limiters)
+        limiter.limiter.Reset();
+    for (CCompressor& compressor : m_compressors)
+        compressor.Reset();
+    for (CModDelay& mod : m_mods)
+        mod.Reset(frame);
+}
+
+int CEffects::Latency() const
+{
+    int latency = 0;
+    for (const Stage& stage : m_stages)
+    {
+        if (!IsBypassed(stage))
+            latency += StageLatency(stage);
+    }
+
+    return latency;
+}
+
+int CEffects::Tail() const
+{
+    double tail = 0;
+    for (const Stage& stage : m_stages)
+    {
+        if (!IsBypassed(stage))
+            tail += StageTail(stage);
+    }
+
+    return (int)std::ceil(tail * m_sr);
+}
+
+//! How long a stage remembers its input, in seconds
+double CEffects::StageTail(const Stage& stage) const
+{
+    // Exponential decays take this many time constants to fall
+    // below one step of 16-bit audio (ln 32768)
+    const double decays = 10.4;
+
+    switch (stage.type)
+    {
+    case Lowpass:
+        return decays / (2.0 * PI * stage.freq);
+
+    case Biquad:
+    case StateVariable:
+    {
+        // Resonant filters ring for about q / (pi f) per time
+        // constant, and each section of a cascade rings in turn
+        const double q = stage.q > 0.5 ? stage.q : 0.5;
+        const int sections = stage.type == Biquad ? stage.order / 2 : 1;
+        return decays * q / (PI * stage.freq) * sections;
+    }
+
+    case Limiter:
+    case Compressor:
+        return decays * stage.release * 0.001;
+
+    case Chorus:
+    case Flanger:
+    {
+        // Each pass round the feedback loop takes up to the longest delay
+        const double longest = (stage.delay + stage.depth) * 0.001;
+        const double fb = std::fabs(stage.feedback);
+        return fb < 1e-3 ? longest : longest * (1.0 + decays / -std::log(fb));
+    }
+
+    default:
+        return 0.0;
+    }
+}
+
+int CEffects::StageLatency(const Stage& stage) const
+{
+    switch (stage.type)
+    {
+    case SoftClip:
+        return m_clips[stage.state].os[0].Latency();
+
+    case Limiter:
+        return m_limiters[stage.state].limiter.Latency();
+
+    default:
+        return 0;
+    }
+}
+
+//! The dry delay of a stage that can have latency, or NULL
+CEffects::DryDelay* CEffects::StageDry(Stage& stage)
+{
+    switch (stage.type)
+    {
+    case SoftClip:
+        return &m_clips[stage.state].dry;
+
+    case Limiter:
+        return &m_limiters[stage.state].dry;
+
+    default:
+        return NULL;
+    }
+}
+
+int CEffects::AddStage(StageType type)
+{
+    Stage stage;
+    stage.type = type;
+    stage.wet = 1.0;
+    stage.gain = 1.0;
+    stage.freq = 8000.0;
+    stage.amount = 0.5;
+    stage.a = 0.0;
+    for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+        stage.z[c] = 0.0;
+    stage.oversample = 0;
+    stage.shape = 0;            // lowpass, for both biquad and svf
+    stage.q = 0.707;
+    stage.gainDb = 0.0;
+    stage.order = 2;
+    stage.ceiling = -1.0;
+    stage.lookahead = 1.5;
+    stage.attack = 5.0;
+    stage.release = type == Compressor ? 120.0 : 60.0;
+    stage.threshold = -20.0;
+    stage.ratio = 4.0;
+    stage.knee = 6.0;
+    stage.makeup = 0.0;
+    stage.detector = CCompressor::Peak;
+    stage.keyed = false;
+
+    // A chorus thickens with a few slow voices; a flanger sweeps
+    // one short, fed back delay
+    if (type == Flanger)
+    {
+        stage.delay = 2.5;
+        stage.depth = 2.0;
+        stage.rate = 0.25;
+        stage.feedback = 0.6;
+        stage.voices = 1;
+    }
+    else
+    {
+        stage.delay = 15.0;
+        stage.depth = 5.0;
+        stage.rate = 0.8;
+        stage.feedback = 0.0;
+        stage.voices = 2;
+    }
+    stage.spread = 90.0;
+    if (type == Chorus || type == Flanger)
+        stage.wet = 0.5;
+
+    // Only the state for the stage's own type is allocated
+    switch (type)
+    {
+    case SoftClip:
+        stage.state = (int)m_clips.size();
+        m_clips.emplace_back();
+        break;
+
+    case Biquad:
+        stage.state = (int)m_biquads.size();
+        m_biquads.emplace_back();
+        break;
+
+    case StateVariable:
+        stage.state = (int)m_svfs.size();
+        m_svfs.emplace_back();
+        break;
+
+    case Limiter:
+        stage.state = (int)m_limiters.size();
+        m_limiters.emplace_back();
+        break;
+
+    case Compressor:
+        stage.state = (int)m_compressors.size();
+        m_compressors.emplace_back();
+        break;
+
+    case Chorus:
+    case Flanger:
+        stage.state = (int)m_mods.size();
+        m_mods.emplace_back();
+        break;
+
+    default:
+        stage.state = -1;
+        break;
+    }
+
+    Prepare(stage);
+    stage.wetNow = stage.wet;
+    stage.gainNow = stage.gain;
+    stage.aNow = stage.a;
+
+    m_stages.push_back(stage);
+    return (int)m_stages.size() - 1;
+}
+
+bool CEffects::SetParam(int s, const wchar_t* name, double value)
+{
+    if (s < 0 || s >= (int)m_stages.size())
+        return false;
+
+    Stage& stage = m_stages[s];
+    if (wcscmp(name, L"wet") == 0)
+    {
+        // The mix has no derived state, so the stage keeps running
+        stage.wet = std::fmax(0.0, std::fmin(1.0, value));
+        return true;
+    }
+
+    if (wcscmp(name, L"gain") == 0)
+        stage.gain = value;
+    else if (wcscmp(name, L"freq") == 0 || wcscmp(name, L"cutoff") == 0)
+        stage.freq = value;
+    else if (wcscmp(name, L"amount") == 0)
+        stage.amount = std::fmax(0.0, value);
+    else if (wcscmp(name, L"oversample") == 0)
+        stage.oversample = (int)value;
+    else if (wcscmp(name, L"q") == 0)
+        stage.q = value;
+    else if (wcscmp(name, L"gaindb") == 0)
+        stage.gainDb = value;
+    else if (wcscmp(name, L"order") == 0)
+        stage.order = (int)value;
+    else if (wcscmp(name, L"ceiling") == 0)
+        stage.ceiling = std::fmin(0.0, value);
+    else if (wcscmp(name, L"lookahead") == 0)
+        stage.lookahead = std::fmax(0.0, std::fmin(50.0, value));
+    else if (wcscmp(name, L"release") == 0)
+        stage.release = std::fmax(1.0, value);
+    else if (wcscmp(name, L"attack") == 0)
+        stage.attack = std::fmax(0.01, value);
+    else if (wcscmp(name, L"threshold") == 0)
+        stage.threshold = value;
+    else if (wcscmp(name, L"ratio") == 0)
+        stage.ratio = std::fmax(1.0, value);
+    else if (wcscmp(name, L"knee") == 0)
+        stage.knee = std::fmax(0.0, value);
+    else if (wcscmp(name, L"makeup") == 0)
+        stage.makeup = value;
+    else if (wcscmp(name, L"delay") == 0)
+        stage.delay = std::fmax(0.1, std::fmin(40.0, value));
+    else if (wcscmp(name, L"depth") == 0)
+        stage.depth = std::fmax(0.0, std::fmin(10.0, value));
+    else if (wcscmp(name, L"rate") == 0)
+        stage.rate = std::fmax(0.0, value);
+    else if (wcscmp(name, L"feedback") == 0)
+        stage.feedback = value;
+    else if (wcscmp(name, L"spread") == 0)
+        stage.spread = value;
+    else if (wcscmp(name, L"voices") == 0)
+        stage.voices = (int)value;
+    else
+        return false;
+
+    Prepare(stage);
+    return true;
+}
+
+bool CEffects::SetParam(int s, const wchar_t* name, const wchar_t* value)
+{
+    if (s < 0 || s >= (int)m_stages.size())
+        return false;
+
+    Stage& stage = m_stages[s];
+    if (stage.type == Compressor)
+    {
+        if (wcscmp(name, L"sidechain") == 0)
+        {
+            stage.sidechain = value;
+            stage.keyed = false;
+            return true;
+        }
+
+        if (wcscmp(name, L"detector") != 0)
+            return false;
+
+        if (wcscmp(value, L"peak") == 0)
+            stage.detector = CCompressor::Peak;
+        else if (wcscmp(value, L"rms") == 0)
+            stage.detector = CCompressor::Rms;
+        else
+            return false;
+
+        Prepare(stage);
+        return true;
+    }
+
+    if (wcscmp(name, L"shape") != 0)
+        return false;
+
+    if (stage.type == Biquad)
+    {
+        BiquadCoeffs::Shape shape;
+        if (!BiquadCoeffs::ShapeFromName(value, shape))
+            return false;
+
+        stage.shape = shape;
+    }
+    else if (stage.type == StateVariable)
+    {
+        static const struct { const wchar_t* name; CStateVariable::Mode mode; } modes[] = {
+            {L"lowpass", CStateVariable::Lowpass}, {L"highpass", CStateVariable::Highpass},
+            {L"bandpass", CStateVariable::Bandpass}, {L"notch", CStateVariable::Notch},
+            {L"peak", CStateVariable::Peak}, {L"allpass", CStateVariable::Allpass}
+        };
+
+        int found = -1;
+        for (const auto& m : modes)
+        {
+            if (wcscmp(value, m.name) == 0)
+                found = m.mode;
+        }
+
+        if (found < 0)
+            return false;
+
+        stage.shape = found;
+    }
+    else
+    {
+        return false;
+    }
+
+    Prepare(stage);
+    return true;
+}
+
+bool CEffects::UsesSidechain(const std::wstring& bus) const
+{
+    for (const Stage& stage : m_stages)
+    {
+        if (stage.type == Compressor && stage.sidechain == bus)
+            return true;
+    }
+
+    return false;
+}
+
+void CEffects::ConnectSidechain(const std::wstring& bus, const double* const* key)
+{
+    for (Stage& stage : m_stages)
+    {
+        if (stage.type == Compressor && stage.sidechain == bus)
+        {
+            stage.keyed = true;
+            for (int c = 0; c < m_channels; c++)
+                stage.key[c] = key[c];
+        }
+    }
+}
+
+//! Compute the derived coefficients of a stage
+void CEffects::Prepare(Stage& stage)
+{
+    switch (stage.type)
+    {
+    case Lowpass:
+        // one-pole LPF: y += a*(x - y)
+        stage.a = 1.0 - std::exp(-2.0 * PI * stage.freq / m_sr);
+        break;
+
+    case SoftClip:
+    {
+        // Compared as the oversamplers would round it, or a factor
+        // such as 3 would reset them on every automation update
+        ClipState& clip = m_clips[stage.state];
+        const int factor = COversampler::Supported(stage.oversample > 0 ? stage.oversample : m_oversampling);
+        if (clip.os[0].GetFactor() != factor || (int)clip.dry.line[0].size() != clip.os[0].Latency())
+        {
+            for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+            {
+                clip.os[c].SetFactor(factor);
+                clip.dry.line[c].assign(clip.os[0].Latency(), 0.0);
+            }
+            clip.dry.pos = 0;
+        }
+        break;
+    }
+
+    case Biquad:
+        for (int p = 0; p < MaxPairs; p++)
+        {
+            m_biquads[stage.state].pairs[p].Design(BiquadCoeffs::Shape(stage.shape), stage.freq, stage.q,
+                stage.gainDb, stage.order, m_sr);
+        }
+        break;
+
+    case StateVariable:
+        for (int p = 0; p < MaxPairs; p++)
+            m_svfs[stage.state].pairs[p].Design(CStateVariable::Mode(stage.shape), stage.freq, stage.q, m_sr);
+        break;
+
+    case Limiter:
+    {
+        LimiterState& limiter = m_limiters[stage.state];
+        limiter.limiter.SetSampleRate(m_sr);
+        limiter.limiter.SetCeiling(stage.ceiling);
+        limiter.limiter.SetLookahead(stage.lookahead);
+        limiter.limiter.SetRelease(stage.release);
+        if ((int)limiter.dry.line[0].size() != limiter.limiter.Latency())
+        {
+            for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+                limiter.dry.line[c].assign(limiter.limiter.Latency(), 0.0);
+            limiter.dry.pos = 0;
+        }
+        break;
+    }
+
+    case Compressor:
+    {
+        CCompressor& compressor = m_compressors[stage.state];
+        compressor.SetSampleRate(m_sr);
+        compressor.SetThreshold(stage.threshold);
+        compressor.SetRatio(stage.ratio);
+        compressor.SetKnee(stage.knee);
+        compressor.SetMakeup(stage.makeup);
+        compressor.SetAttack(stage.attack);
+        compressor.SetRelease(stage.release);
+        compressor.SetDetector(CCompressor::Detector(stage.detector));
+        break;
+    }
+
+    case Chorus:
+    case Flanger:
+    {
+        CModDelay& mod = m_mods[stage.state];
+        mod.SetSampleRate(m_sr);
+        mod.SetDelay(stage.delay);
+        mod.SetDepth(stage.depth);
+        mod.SetRate(stage.rate);
+        mod.SetFeedback(stage.feedback);
+        mod.SetSpread(stage.spread);
+        mod.SetVoices(stage.voices);
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+//! True if a stage can be skipped.  A stage with latency never
+//! is, or the output would move in time when automation turned
+//! it off or on.
+bool CEffects::IsBypassed(const Stage& stage) const
+{
+    return IsOff(stage) && StageLatency(stage) == 0;
+}
+
+//! True if a stage leaves its input as it is, but for its latency
+bool CEffects::IsOff(const Stage& stage) const
+{
+    // A stage still ramping toward its new value is never skipped
+    if (stage.wet <= 0.0 && stage.wetNow <= 0.0)
+        return true;
+
+    switch (stage.type)
+    {
+    case Gain:
+        return stage.gain == 1.0 && stage.gainNow == 1.0;
+
+    case Lowpass:
+        return stage.freq >= m_sr * 0.5 && stage.aNow == stage.a;
+
+    case SoftClip:
+        return stage.amount <= 0.0;
+
+    case Biquad:
+        // Peak and shelf filters with no gain do nothing
+        return stage.gainDb == 0.0 && (stage.shape == BiquadCoeffs::Peak ||
+            stage.shape == BiquadCoeffs::LowShelf || stage.shape == BiquadCoeffs::HighShelf);
+
+    case StateVariable:
+    case Limiter:
+    case Compressor:
+    case Chorus:
+    case Flanger:
+        return false;
+    }
+
+    return false;
+}
+
+void CEffects::XmlLoad(CXmlReader& xml)
+{
+    static const struct { const char* name; StageType type; } types[] = {
+        { "gain", Gain }, { "lowpass", Lowpass }, { "softclip", SoftClip },
+        { "biquad", Biquad }, { "svf", StateVariable }, { "limiter", Limiter },
+        { "compressor", Compressor }, { "chorus", Chorus }, { "flanger", Flanger },
+    };
+
+    std::wstring name, text;
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        // The type has to be known before any parameter can be set
+        const char* type = xml.Is("effect") ? xml.Attribute("type") : NULL;
+        int stage = -1;
+        for (int t = 0; type != NULL && t < (int)(sizeof(types) / sizeof(types[0])); t++)
+        {
+            if (strcmp(type, types[t].name) == 0)
+            {
+                stage = AddStage(types[t].type);
+                break;
+            }
+        }
+
+        for (int i = 0; stage >= 0 && i < xml.NumAttributes(); i++)
+        {
+            if (strcmp(xml.AttributeName(i), "type") == 0)
+                continue;
+
+            CXmlReader::Widen(xml.AttributeName(i), name);
+            CXmlReader::Widen(xml.AttributeValue(i), text);
+
+            double value;
+            if (SetParam(stage, name.c_str(), text.c_str()))
+            {
+                // Text parameter (shape, detector, sidechain)
+            }
+            else if (CXmlReader::ParseDouble(xml.AttributeValue(i), value))
+            {
+                SetParam(stage, name.c_str(), value);
+            }
+        }
+
+        xml.Skip();
+    }
+}
+
+void CEffects::Process(double* const* channels, int frames)
+{
+    for (Stage& stage : m_stages)
+    {
+        if (IsBypassed(stage))
+            continue;
+
+        // Turned off, a stage with latency still runs so its state
+        // is current when it comes back, but what comes out is the
+        // dry signal delayed as long as the stage would delay it
+        if (IsOff(stage))
+        {
+            for (int c = 0; c < m_channels; c++)
+                std::memcpy(m_dry.Channel(c), channels[c], frames * sizeof(double));
+            DelayDry(*StageDry(stage), frames);
+
+            ProcessStage(stage, channels, frames);
+
+            for (int c = 0; c < m_channels; c++)
+                std::memcpy(channels[c], m_dry.Channel(c), frames * sizeof(double));
+            continue;
+        }
+
+        // A delayed signal cannot be mixed with the dry one, so
+        // stages with latency always run fully wet.
+        if ((stage.wet >= 1.0 && stage.wetNow >= 1.0) || stage.type == Limiter)
+        {
+            ProcessStage(stage, channels, frames);
+            stage.wetNow = stage.wet;
+            continue;
+        }
+
+        // Partially wet: keep a copy of the dry signal and mix it back in
+        for (int c = 0; c < m_channels; c++)
+            std::memcpy(m_dry.Channel(c), channels[c], frames * sizeof(double));
+        DryDelay* dry = StageDry(stage);
+        if (dry != NULL && !dry->line[0].empty())
+            DelayDry(*dry, frames);
+
+        ProcessStage(stage, channels, frames);
+
+        const double step = (stage.wet - stage.wetNow) / frames;
+        for (int c = 0; c < m_channels; c++)
+        {
+            double* x = channels[c];
+            const double* dry = m_dry.Channel(c);
+            double wet = stage.wetNow;
+            for (int i = 0; i < frames; i++)
+            {
+                wet += step;
+                x[i] = dry[i] + wet * (x[i] - dry[i]);
+            }
+        }
+        stage.wetNow = stage.wet;
+    }
+}
+
+//! Delay the dry copy by the stage latency so the mix stays aligned
+void CEffects::DelayDry(DryDelay& delayLine, int frames)
+{
+    const int delay = (int)delayLine.line[0].size();
+    int pos = delayLine.pos;
+    for (int c = 0; c < m_channels; c++)
+    {
+        double* line = delayLine.line[c].data();
+        double* dry = m_dry.Channel(c);
+        pos = delayLine.pos;
+        for (int i = 0; i < frames; i++)
+        {
+            const double x = line[pos];
+            line[pos] = dry[i];
+            dry[i] = x;
+            if (++pos == delay)
+                pos = 0;
+        }
+    }
+    delayLine.pos = pos;
+}
+
+void CEffects::ProcessStage(Stage& stage, double* const* channels, int frames)
+{
+    switch (stage.type)
+    {
+    case Gain:
+    {
+        const double step = (stage.gain - stage.gainNow) / frames;
+        for (int c = 0; c < m_channels; c++)
+        {
+            double* x = channels[c];
+            double g = stage.gainNow;
+            for (int i = 0; i < frames; i++)
+            {
+                g += step;
+                x[i] *= g;
+            }
+        }
+        stage.gainNow = stage.gain;
+        break;
+    }
+
+    case Lowpass:
+    {
+        const double step = (stage.a - stage.aNow) / frames;
+        for (int c = 0; c < m_channels; c++)
+        {
+            double* x = channels[c];
+            double a = stage.aNow;
+            double z = stage.z[c];
+            for (int i = 0; i < frames; i++)
+            {
+                a += step;
+                z += a * (x[i] - z);
+                x[i] = z;
+            }
+            stage.z[c] = z;
+        }
+        stage.aNow = stage.a;
+        break;
+    }
+
+    case SoftClip:
+    {
+        const double k = stage.amount;
+        auto clip = [k](double x) { return x / (1.0 + k * std::abs(x)); };
+        for (int c = 0; c < m_channels; c++)
+            m_clips[stage.state].os[c].Process(channels[c], frames, clip);
+        break;
+    }
+
+    case Biquad:
+    case StateVariable:
+        for (int p = 0; 2 * p < m_channels; p++)
+        {
+            double* second = 2 * p + 1 < m_channels ? channels[2 * p + 1] : m_spare.data();
+            if (stage.type == Biquad)
+                m_biquads[stage.state].pairs[p].Process(channels[2 * p], second, frames);
+            else
+                m_svfs[stage.state].pairs[p].Process(channels[2 * p], second, frames);
+        }
+        break;
+
+    case Limiter:
+        m_limiters[stage.state].limiter.Process(channels, m_channels, frames);
+        break;
 
-    double outL = (1.0 - m_wet) * L + m_wet * wetL;
-    double outR = (1.0 - m_wet) * R + m_wet * wetR;
+    case Compressor:
+        m_compressors[stage.state].Process(channels, stage.keyed ? stage.key : NULL, m_channels, frames);
+        break;
 
-    // 4) Soft limiter
-    auto soft = [](double x) { return x / (1.0 + 0.5 * std::abs(x)); };
-    frame[0] = soft(outL);
-    frame[1] = soft(outR);
-}
\ No newline at end of file
+    case Chorus:
+    case Flanger:
+        m_mods[stage.state].Process(channels, m_channels, frames);
+        break;
+    }
+}
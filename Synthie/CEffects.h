@@ -1,38 +1,234 @@
 #pragma once
 #include <vector>
+#include <string>
 #include <cmath>
+#include "CBiquad.h"
+#include "CStateVariable.h"
+#include "CLimiter.h"
+#include "CCompressor.h"
+#include "COversampler.h"
+#include "CModDelay.h"
+#include "CChannelLayout.h"
+#include "CPlanarBuffer.h"
 
+class CXmlReader;
+
+/*! Master effects chain
+ *
+ * The chain is declared in the <effects> section of the score and
+ * is compiled once at load time into a flat list of stages.  Process()
+ * runs each stage over a whole block with a switch on the stage type,
+ * so there is no virtual call per sample.  Stages whose wet level is
+ * zero or whose gain is unity are skipped automatically.
+ *
+ * A stage holds only its parameters.  The filters, oversamplers and
+ * delay lines behind it are kept in a pool for its type, so a gain
+ * stage does not carry a limiter.
+ *
+ * Gain, wet and lowpass cutoff can be changed while the chain runs.
+ * The new value is reached by a linear ramp across the next Process()
+ * call, so a caller that automates them every few dozen frames gets
+ * per-sample smoothing without recomputing coefficients per sample.
+ *
+ *  <effects>
+ *    <effect type="gain" gain="0.9"/>
+ *    <effect type="lowpass" freq="8000" wet="1"/>
+ *    <effect type="biquad" shape="highpass" freq="40" order="4"/>
+ *    <effect type="chorus" rate="0.8" depth="5" voices="3" wet="0.5"/>
+ *    <effect type="limiter" ceiling="-1" lookahead="1.5" release="60"/>
+ *  </effects>
+ *
+ * A compressor stage may name another bus as its sidechain; the
+ * synthesizer connects the key buffers with ConnectSidechain().
+ *
+ * Stages that look ahead or oversample delay the audio; Latency()
+ * reports the total so the caller can line the output back up with
+ * the score.
+ *
+ * The chain runs on as many channels as SetNumChannels() says, each
+ * in its own buffer.  Filters run the channels two at a time, so
+ * the pair shares an SSE2 register; the limiter and compressor
+ * apply one gain to all of them.
+ */
 class CEffects
 {
 public:
-    void SetSampleRate(double sr)
+    //! Largest number of frames a single Process() call may handle
+    static const int MaxBlock = 256;
+
+    //! The kinds of stage the chain can contain
+    enum StageType { Gain, Lowpass, SoftClip, Biquad, StateVariable, Limiter, Compressor, Chorus, Flanger };
+
+    CEffects();
+
+    void SetSampleRate(double sr);
+
+    //! Number of channels Process() is given
+    void SetNumChannels(int channels);
+    int GetNumChannels() const { return m_channels; }
+
+    /*! Oversampling factor for nonlinear stages that do not set one
+     *
+     * 1 turns oversampling off; 2 and 4 run the stages at that
+     * multiple of the sample rate.  Stages opt in or out with their
+     * own oversample parameter.
+     */
+    void SetOversampling(int factor);
+
+    //! Remove every stage from the chain
+    void Clear();
+
+    //! Install the chain used when the score has no <effects> section
+    void SetDefaultChain();
+
+    //! Clear the filter state of every stage, ready to process
+    //! from the given frame of the score
+    void Reset(int frame = 0);
+
+    //! Number of stages in the chain
+    int NumStages() const { return (int)m_stages.size(); }
+
+    //! Total delay of the active stages in frames
+    int Latency() const;
+
+    /*! Frames the chain can keep sounding, or keep changing the
+     * sound, after its input changes
+     *
+     * An estimate of how long it takes envelopes to recover and
+     * feedback and filter ringing to die away below 16-bit level.
+     */
+    int Tail() const;
+
+    //! Add a stage to the end of the chain
+    int AddStage(StageType type);
+
+    //! Set a parameter of a stage by name ("cutoff" is an alias for freq)
+    bool SetParam(int stage, const wchar_t* name, double value);
+
+    //! Set a text parameter of a stage (shape, detector, sidechain)
+    bool SetParam(int stage, const wchar_t* name, const wchar_t* value);
+
+    //! True if any compressor in the chain keys off the named bus
+    bool UsesSidechain(const std::wstring& bus) const;
+
+    /*! Point every compressor keyed off the named bus at its key buffers
+     *
+     * There is a buffer for each channel.  They must hold at least
+     * MaxBlock frames and stay valid while the chain is in use.  They
+     * are read for the same frames as each Process() call.
+     */
+    void ConnectSidechain(const std::wstring& bus, const double* const* key);
+
+    //! Load the stages of an <effects> section, appending to the chain
+    void XmlLoad(CXmlReader& xml);
+
+    //! Process a block of planar channels in place
+    void Process(double* const* channels, int frames);
+
+private:
+    //! Channel pairs the filters run
+    static const int MaxPairs = (CChannelLayout::MaxChannels + 1) / 2;
+
+    struct Stage
+    {
+        StageType type;
+        double wet;         //!< Dry/wet mix, 0 bypasses the stage
+        double gain;        //!< Gain stage multiplier
+        double freq;        //!< Filter corner frequency in Hz
+        double amount;      //!< Soft clip knee (x / (1 + amount*|x|))
+        double a;           //!< Derived lowpass coefficient
+        double z[CChannelLayout::MaxChannels];     //!< Per-channel filter state
+
+        // Values the ramps start from on the next block
+        double wetNow;
+        double gainNow;
+        double aNow;
+
+        int state;          //!< Index of the DSP state in the pool for the type, -1 if none
+
+        int oversample;     //!< Soft clip oversampling, 0 follows the chain
+
+        // Biquad and state variable stages
+        int shape;          //!< BiquadCoeffs::Shape or CStateVariable::Mode
+        double q;
+        double gainDb;      //!< Peak and shelf gain
+        int order;          //!< Biquad cascade order, 2 per section
+
+        // Limiter and compressor stages
+        double ceiling;     //!< Ceiling in dBFS
+        double lookahead;   //!< Lookahead in ms
+        double attack;      //!< Attack in ms
+        double release;     //!< Release in ms
+
+        // Compressor stage
+        double threshold;   //!< Threshold in dBFS
+        double ratio;
+        double knee;        //!< Knee width in dB
+        double makeup;      //!< Makeup gain in dB
+        int detector;       //!< CCompressor::Detector
+        std::wstring sidechain;     //!< Key bus name, empty for self keyed
+        bool keyed;                 //!< key points at the sidechain's buffers
+        const double* key[CChannelLayout::MaxChannels];
+
+        // Chorus and flanger stages
+        double delay;       //!< Center delay in ms
+        double depth;       //!< Sweep depth in ms
+        double rate;        //!< LFO rate in Hz
+        double feedback;
+        double spread;      //!< Right channel LFO offset in degrees
+        int voices;
+    };
+
+    //! Delay that lines the dry signal up with a stage that has latency
+    struct DryDelay
     {
-        m_sr = sr;
-        const int maxMs = 1000;
-        SetLowpassHz(8000.0);
-    }
-
-    void SetGain(double g) { m_gain = g; }
-    void SetWet(double w) { m_wet = std::fmax(0.0, std::fmin(1.0, w)); }
-    void SetFeedback(double fb) { m_fb = std::fmax(0.0, std::fmin(0.95, fb)); }
-    void SetLowpassHz(double hz)
+        std::vector<double> line[CChannelLayout::MaxChannels];
+        int pos = 0;
+    };
+
+    struct ClipState
     {
-        // one-pole LPF: y += a*(x - y)
-        m_lpfA = 1.0 - std::exp(-2.0 * PI * hz / m_sr);
-    }
+        COversampler os[CChannelLayout::MaxChannels];      //!< Per-channel oversamplers
+        DryDelay dry;
+    };
 
-    // Process one stereo frame in place
-    void Process(double frame[2]);
+    struct LimiterState
+    {
+        CLimiter limiter;
+        DryDelay dry;
+    };
+
+    //! Filters run a pair of channels each
+    struct BiquadState { CBiquadCascade pairs[MaxPairs]; };
+    struct SvfState { CStateVariable pairs[MaxPairs]; };
+
+    bool IsBypassed(const Stage& stage) const;
+    bool IsOff(const Stage& stage) const;
+    int StageLatency(const Stage& stage) const;
+    double StageTail(const Stage& stage) const;
+    DryDelay* StageDry(Stage& stage);
+    void Prepare(Stage& stage);
+    void DelayDry(DryDelay& dry, int frames);
+    void ProcessStage(Stage& stage, double* const* channels, int frames);
 
-private:
     double m_sr = 44100.0;
+    int m_oversampling = 1;
+    int m_channels = 2;
+
+    std::vector<Stage> m_stages;
 
-    // gain
-    double m_gain = 0.90;
+    // DSP state of the stages, one pool per type, indexed by Stage::state
+    std::vector<ClipState> m_clips;
+    std::vector<BiquadState> m_biquads;
+    std::vector<SvfState> m_svfs;
+    std::vector<LimiterState> m_limiters;
+    std::vector<CCompressor> m_compressors;
+    std::vector<CModDelay> m_mods;
 
-    // LPF
-    double m_lpfA = 0.0, m_lL = 0.0, m_lR = 0.0;
+    // Preallocated copy of the dry signal for partially wet stages
+    CPlanarBuffer m_dry;
 
-    double m_fb = 0.25;
-    double m_wet = 0.20;
+    // Partner for the last channel of an odd number, so the filters
+    // can always run pairs.  What they leave in it is never used.
+    std::vector<double> m_spare;
 };
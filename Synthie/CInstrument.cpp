@@ -1,10 +1,23 @@
 #include "pch.h"
 #include "CInstrument.h"
+#include "CTempoMap.h"
 
 CInstrument::CInstrument()
 {
+    m_strings = NULL;
+    m_tuning = NULL;
+    m_tempo = NULL;
+    m_origin = 0;
 }
 
 CInstrument::~CInstrument()
 {
+}
+
+double CInstrument::NoteSeconds(const CNote* note) const
+{
+    if (m_tempo == NULL)
+        return note->Duration();
+
+    return m_tempo->Duration(note->Measure(), note->Beat(), note->Duration());
 }
\ No newline at end of file
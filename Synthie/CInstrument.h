@@ -2,12 +2,42 @@
 #include "CAudioNode.h"
 #include "CNote.h"
 
+class CStringTable;
+class CTempoMap;
+struct Tuning;
+
 class CInstrument : public CAudioNode
 {
 public:
 	CInstrument();
 	virtual ~CInstrument();
 
-	virtual void SetNote(CNote* note) = 0;
+	virtual void SetNote(const CNote* note) = 0;
+
+	//! Seconds the instrument sounds for, release included, once
+	//! SetNote() has been called.  Used to size a render without it.
+	virtual double Length() const = 0;
+
+	//! The string table the ids in the notes refer to
+	void SetStrings(const CStringTable* strings) { m_strings = strings; }
+
+	//! The tuning note names are played in, NULL for equal temperament at 440 Hz
+	void SetTuning(const Tuning* tuning) { m_tuning = tuning; }
+
+	//! The tempo note durations are played at, NULL to take beats as seconds
+	void SetTempo(const CTempoMap* tempo) { m_tempo = tempo; }
+
+	//! Measure the next note's place is counted from, so the notes of
+	//! a pattern sound the same each time it is played.  Set before SetNote().
+	void SetOrigin(int measure) { m_origin = measure; }
+
+protected:
+	//! Seconds a note lasts, from its duration in beats
+	double NoteSeconds(const CNote* note) const;
+
+	const CStringTable* m_strings;
+	const Tuning* m_tuning;
+	const CTempoMap* m_tempo;
+	int m_origin;
 };
 
@@ -0,0 +1,177 @@
+#include "pch.h"
+#include <cmath>
+#include <algorithm>
+#include "CLimiter.h"
+
+CLimiter::CLimiter()
+{
+    m_sampleRate = 44100.0;
+    m_ceilingDb = -1.0;
+    m_lookaheadMs = 1.5;
+    m_releaseMs = 60.0;
+
+    // Windowed-sinc prototype for the 4x interpolator, split
+    // into its polyphase components.  Each phase is normalized
+    // to unity gain at DC.
+    const int n = TpPhases * TpTaps;
+    for (int p = 0; p < TpPhases; p++)
+    {
+        double sum = 0.0;
+        for (int j = 0; j < TpTaps; j++)
+        {
+            const int k = p + TpPhases * j;
+            const double t = (k - (n - 1) / 2.0) / TpPhases;
+            const double sinc = t == 0.0 ? 1.0 : std::sin(PI * t) / (PI * t);
+            const double hann = 0.5 - 0.5 * std::cos(2.0 * PI * (k + 0.5) / n);
+            m_tpCoeffs[p][j] = sinc * hann;
+            sum += m_tpCoeffs[p][j];
+        }
+
+        for (int j = 0; j < TpTaps; j++)
+            m_tpCoeffs[p][j] /= sum;
+    }
+
+    Prepare();
+}
+
+//! Derive the sample-domain settings and size the buffers
+void CLimiter::Prepare()
+{
+    m_ceiling = std::pow(10.0, m_ceilingDb / 20.0);
+    m_releaseCoeff = std::exp(-1.0 / (std::fmax(m_releaseMs, 0.1) * 0.001 * m_sampleRate));
+    m_window = (int)(m_lookaheadMs * 0.001 * m_sampleRate + 0.5);
+    if (m_window < 1)
+        m_window = 1;
+
+    m_minGain.assign(m_window + 1, 1.0);
+    m_minTime.assign(m_window + 1, 0);
+    m_box.assign(m_window, 1.0);
+    for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+        m_delay[c].assign(Latency(), 0.0);
+
+    Reset();
+}
+
+void CLimiter::Reset()
+{
+    for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+    {
+        for (int j = 0; j < TpTaps * 2; j++)
+            m_tpHist[c][j] = 0.0;
+
+        std::fill(m_delay[c].begin(), m_delay[c].end(), 0.0);
+    }
+
+    m_tpPos = 0;
+    m_minHead = 0;
+    m_minCount = 0;
+    m_time = 0;
+    m_envelope = 1.0;
+    std::fill(m_box.begin(), m_box.end(), 1.0);
+    m_boxPos = 0;
+    m_boxSum = (double)m_window;
+    m_delayPos = 0;
+}
+
+//! Feed frame i to the interpolator and return the largest
+//! absolute value among the interpolated points of every channel.
+double CLimiter::TruePeak(double* const* channels, int numChannels, int i)
+{
+    // The history is stored twice so the newest TpTaps samples are
+    // always contiguous, newest first, at m_tpPos.
+    m_tpPos = (m_tpPos == 0 ? TpTaps : m_tpPos) - 1;
+
+    double peak = 0.0;
+    for (int c = 0; c < numChannels; c++)
+    {
+        m_tpHist[c][m_tpPos] = m_tpHist[c][m_tpPos + TpTaps] = channels[c][i];
+
+        const double* x = m_tpHist[c] + m_tpPos;
+        for (int p = 0; p < TpPhases; p++)
+        {
+            double y = 0.0;
+            for (int j = 0; j < TpTaps; j++)
+                y += m_tpCoeffs[p][j] * x[j];
+
+            peak = std::fmax(peak, std::abs(y));
+        }
+    }
+
+    return peak;
+}
+
+void CLimiter::Process(double* const* channels, int numChannels, int frames)
+{
+    const int capacity = m_window + 1;
+    const int latency = Latency();
+
+    for (int i = 0; i < frames; i++)
+    {
+        // 1) Gain this frame needs to stay under the ceiling
+        const double peak = TruePeak(channels, numChannels, i);
+        const double need = peak > m_ceiling ? m_ceiling / peak : 1.0;
+
+        // 2) Sliding-window minimum over the lookahead window.  The
+        //    deque holds increasing gains; anything larger than the
+        //    new value can never be the minimum again.
+        while (m_minCount > 0)
+        {
+            const int back = (m_minHead + m_minCount - 1) % capacity;
+            if (m_minGain[back] < need)
+                break;
+            m_minCount--;
+        }
+
+        const int slot = (m_minHead + m_minCount) % capacity;
+        m_minGain[slot] = need;
+        m_minTime[slot] = m_time;
+        m_minCount++;
+
+        if (m_minTime[m_minHead] <= m_time - m_window)
+        {
+            m_minHead = (m_minHead + 1) % capacity;
+            m_minCount--;
+        }
+
+        const double held = m_minGain[m_minHead];
+        m_time++;
+
+        // 3) Instant attack, exponential release
+        if (held < m_envelope)
+            m_envelope = held;
+        else
+            m_envelope = held + (m_envelope - held) * m_releaseCoeff;
+
+        // 4) Moving average over the window ramps the gain down
+        //    across the lookahead instead of stepping it.
+        m_boxSum += m_envelope - m_box[m_boxPos];
+        m_box[m_boxPos] = m_envelope;
+        if (++m_boxPos == m_window)
+        {
+            // Recompute once per window so rounding cannot drift
+            m_boxPos = 0;
+            m_boxSum = 0.0;
+            for (double g : m_box)
+                m_boxSum += g;
+        }
+
+        const double gain = m_boxSum / m_window;
+
+        // 5) Apply the gain to the delayed signal.  The clamp only
+        //    catches rounding; the gain has already done the work.
+        for (int c = 0; c < numChannels; c++)
+        {
+            double out = channels[c][i];
+            if (latency > 0)
+            {
+                out = m_delay[c][m_delayPos];
+                m_delay[c][m_delayPos] = channels[c][i];
+            }
+
+            channels[c][i] = std::fmax(-m_ceiling, std::fmin(m_ceiling, out * gain));
+        }
+
+        if (latency > 0 && ++m_delayPos == latency)
+            m_delayPos = 0;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include "CChannelLayout.h"
+
+/*! Lookahead brickwall limiter
+ *
+ * The detector estimates true (inter-sample) peaks with a 4x
+ * polyphase interpolator.  The gain each peak needs is held over the
+ * lookahead window with a sliding-window minimum, released
+ * exponentially, then smoothed with a moving average the length of
+ * the window, so the gain is already down when the delayed peak
+ * arrives.  All the channels share one gain so the image holds.
+ *
+ * The audio is delayed by Latency() frames.
+ */
+class CLimiter
+{
+public:
+    CLimiter();
+
+    void SetSampleRate(double sr) { m_sampleRate = sr;  Prepare(); }
+
+    //! Output ceiling in dBFS (true peak)
+    void SetCeiling(double db) { m_ceilingDb = db;  Prepare(); }
+
+    //! Lookahead window in milliseconds
+    void SetLookahead(double ms) { m_lookaheadMs = ms;  Prepare(); }
+
+    //! Release time constant in milliseconds
+    void SetRelease(double ms) { m_releaseMs = ms;  Prepare(); }
+
+    double GetCeiling() const { return m_ceilingDb; }
+
+    //! Clear all state (delay lines, detector and gain)
+    void Reset();
+
+    //! Delay added to the signal in frames
+    int Latency() const { return TpDelay + m_window - 1; }
+
+    //! Process a block of planar channels in place
+    void Process(double* const* channels, int numChannels, int frames);
+
+private:
+    void Prepare();
+    double TruePeak(double* const* channels, int numChannels, int i);
+
+    // 4x true peak interpolator: 4 phases of 8 taps
+    static const int TpPhases = 4;
+    static const int TpTaps = 8;
+    static const int TpDelay = TpTaps / 2;
+
+    double m_sampleRate;
+    double m_ceilingDb;
+    double m_lookaheadMs;
+    double m_releaseMs;
+
+    double m_ceiling;           //!< Linear ceiling
+    double m_releaseCoeff;      //!< Per-sample release factor
+    int m_window;               //!< Lookahead window in samples
+
+    double m_tpCoeffs[TpPhases][TpTaps];
+    double m_tpHist[CChannelLayout::MaxChannels][TpTaps * 2];   //!< Doubled so reads never wrap
+    int m_tpPos;
+
+    // Sliding-window minimum of the required gain, kept as a
+    // monotonic deque in a ring buffer
+    std::vector<double> m_minGain;
+    std::vector<long long> m_minTime;
+    int m_minHead;
+    int m_minCount;
+    long long m_time;
+
+    double m_envelope;          //!< Held gain after release smoothing
+
+    // Moving average over the window
+    std::vector<double> m_box;
+    int m_boxPos;
+    double m_boxSum;
+
+    // Signal delay line, one per channel
+    std::vector<double> m_delay[CChannelLayout::MaxChannels];
+    int m_delayPos;
+};
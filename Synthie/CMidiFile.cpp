@@ -0,0 +1,448 @@
+#include "pch.h"
+#include <cstring>
+#include "CMidiFile.h"
+
+//! Bytes read from a track at a time
+static const size_t TrackBuffer = 4096;
+
+CMidiFile::CMidiFile()
+{
+    m_file = NULL;
+    m_failed = false;
+    m_division = 480;
+    m_channels = 0;
+    m_handedOut = 0;
+    m_lastTick = 0;
+}
+
+CMidiFile::~CMidiFile()
+{
+    Close();
+}
+
+//! Big-endian integer of n bytes
+static uint32_t BigEndian(const unsigned char* p, int n)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < n; i++)
+        value = (value << 8) | p[i];
+    return value;
+}
+
+bool CMidiFile::Open(const wchar_t* filename)
+{
+    Close();
+
+#ifdef _WIN32
+    m_file = _wfopen(filename, L"rb");
+#else
+    std::string narrow;
+    for (const wchar_t* p = filename; *p; p++)
+        narrow += (char)*p;
+    m_file = fopen(narrow.c_str(), "rb");
+#endif
+    if (m_file == NULL)
+        return false;
+
+    // Header chunk: format, number of tracks, division.  Negative
+    // divisions are SMPTE time codes, which scores have no use for.
+    unsigned char head[14];
+    if (fread(head, 1, sizeof(head), m_file) != sizeof(head) || memcmp(head, "MThd", 4) != 0 ||
+        BigEndian(head + 4, 4) < 6)
+    {
+        Close();
+        return false;
+    }
+
+    const int format = (int)BigEndian(head + 8, 2);
+    const int numTracks = (int)BigEndian(head + 10, 2);
+    m_division = (int)BigEndian(head + 12, 2);
+    if (format > 1 || (m_division & 0x8000) != 0 || m_division == 0)
+    {
+        Close();
+        return false;
+    }
+
+    // Find the track chunks, stepping over any others
+    uint64_t pos = 8 + BigEndian(head + 4, 4);
+    while ((int)m_tracks.size() < numTracks)
+    {
+        unsigned char chunk[8];
+        if (fseek(m_file, (long)pos, SEEK_SET) != 0 || fread(chunk, 1, sizeof(chunk), m_file) != sizeof(chunk))
+            break;
+
+        const uint64_t length = BigEndian(chunk + 4, 4);
+        if (memcmp(chunk, "MTrk", 4) == 0)
+        {
+            Track track = Track();
+            track.start = pos + 8;
+            track.end = pos + 8 + length;
+            track.buffer.resize(TrackBuffer);
+            m_tracks.push_back(track);
+        }
+
+        pos += 8 + length;
+    }
+
+    if (m_tracks.empty())
+    {
+        Close();
+        return false;
+    }
+
+    // Read the file through once for the tempo map, the meter and
+    // the channels in use
+    Rewind();
+    m_tempos.clear();
+    m_meters.clear();
+
+    Event e;
+    while (NextEvent(e))
+    {
+        if (e.status == 0xFF && e.data1 == 0x51 && e.tempo > 0)
+        {
+            Tempo tempo = { e.tick, 60000000.0 / e.tempo };
+            if (!m_tempos.empty() && m_tempos.back().tick == e.tick)
+                m_tempos.back() = tempo;
+            else
+                m_tempos.push_back(tempo);
+        }
+        else if (e.status == 0xFF && e.data1 == 0x58 && e.numerator > 0)
+        {
+            Meter meter = { e.tick, e.numerator * 4.0 / e.denominator };
+            if (!m_meters.empty() && m_meters.back().tick == e.tick)
+                m_meters.back() = meter;
+            else
+                m_meters.push_back(meter);
+        }
+        else if ((e.status & 0xF0) == 0x90 && e.data2 > 0)
+        {
+            m_channels |= 1 << (e.status & 0x0F);
+        }
+    }
+
+    // 120 beats per minute until the first tempo event
+    if (m_tempos.empty() || m_tempos[0].tick > 0)
+    {
+        Tempo tempo = { 0, 120.0 };
+        m_tempos.insert(m_tempos.begin(), tempo);
+    }
+
+    if (m_failed)
+    {
+        Close();
+        return false;
+    }
+
+    Rewind();
+    return true;
+}
+
+void CMidiFile::Close()
+{
+    if (m_file != NULL)
+    {
+        fclose(m_file);
+        m_file = NULL;
+    }
+
+    m_tracks.clear();
+    m_held.clear();
+    m_tempos.clear();
+    m_meters.clear();
+    m_channels = 0;
+    m_failed = false;
+}
+
+void CMidiFile::Rewind()
+{
+    // Cleared first, so a damaged first event still fails the file
+    m_failed = false;
+    for (Track& track : m_tracks)
+    {
+        track.pos = track.start;
+        track.tick = 0;
+        track.running = 0;
+        track.bufferPos = 0;
+        track.bufferLen = 0;
+        Advance(track);
+    }
+
+    m_held.clear();
+    m_handedOut = 0;
+    m_lastTick = 0;
+    for (int c = 0; c < 16; c++)
+    {
+        for (int k = 0; k < 128; k++)
+            m_open[c][k] = -1;
+    }
+}
+
+//! Read the next event of a track into its lookahead
+void CMidiFile::Advance(Track& track)
+{
+    track.has = track.pos < track.end && ReadEvent(track, track.next);
+}
+
+//! The next event of the file, from whichever track has the earliest
+bool CMidiFile::NextEvent(Event& e)
+{
+    // Ties go to the lower track, so the order is the same every time
+    Track* first = NULL;
+    for (Track& track : m_tracks)
+    {
+        if (track.has && (first == NULL || track.next.tick < first->next.tick))
+            first = &track;
+    }
+
+    if (first == NULL)
+        return false;
+
+    e = first->next;
+    Advance(*first);
+    return true;
+}
+
+//! Next byte of a track, or -1 past its end
+int CMidiFile::Byte(Track& track)
+{
+    if (track.pos >= track.end)
+        return -1;
+
+    if (track.pos < track.bufferPos || track.pos >= track.bufferPos + track.bufferLen)
+    {
+        uint64_t want = track.end - track.pos;
+        if (want > track.buffer.size())
+            want = track.buffer.size();
+
+        if (fseek(m_file, (long)track.pos, SEEK_SET) != 0)
+            return -1;
+
+        track.bufferPos = track.pos;
+        track.bufferLen = fread(track.buffer.data(), 1, (size_t)want, m_file);
+        if (track.bufferLen == 0)
+            return -1;
+    }
+
+    return track.buffer[(size_t)(track.pos++ - track.bufferPos)];
+}
+
+//! Read a variable-length quantity
+bool CMidiFile::VarLen(Track& track, uint32_t& value)
+{
+    value = 0;
+    for (int i = 0; i < 4; i++)
+    {
+        const int c = Byte(track);
+        if (c < 0)
+            return false;
+
+        value = (value << 7) | (c & 0x7F);
+        if ((c & 0x80) == 0)
+            return true;
+    }
+
+    return false;
+}
+
+bool CMidiFile::Skip(Track& track, uint32_t count)
+{
+    if (count > track.end - track.pos)
+        return false;
+
+    track.pos += count;
+    return true;
+}
+
+//! Read one event, failing the file if the track is damaged
+bool CMidiFile::ReadEvent(Track& track, Event& e)
+{
+    uint32_t delta;
+    if (!VarLen(track, delta))
+    {
+        m_failed = true;
+        return false;
+    }
+
+    track.tick += delta;
+    e.tick = track.tick;
+    e.data1 = 0;
+    e.data2 = 0;
+    e.tempo = 0;
+
+    int status = Byte(track);
+    if (status < 0x80)
+    {
+        // Running status: the byte read is the first data byte
+        if (track.running == 0 || status < 0)
+        {
+            m_failed = true;
+            return false;
+        }
+
+        e.status = track.running;
+        e.data1 = status;
+    }
+    else
+    {
+        e.status = status;
+        if (status < 0xF0)
+        {
+            track.running = status;
+            e.data1 = Byte(track);
+        }
+    }
+
+    if (e.status < 0xF0)
+    {
+        // Program change and channel pressure have one data byte
+        const int kind = e.status & 0xF0;
+        if (kind != 0xC0 && kind != 0xD0)
+            e.data2 = Byte(track);
+
+        if (e.data1 < 0 || e.data2 < 0)
+        {
+            m_failed = true;
+            return false;
+        }
+
+        return true;
+    }
+
+    // System exclusive and meta events cancel running status
+    track.running = 0;
+    uint32_t length;
+    if (e.status == 0xFF)
+    {
+        e.data1 = Byte(track);
+        if (e.data1 < 0 || !VarLen(track, length))
+        {
+            m_failed = true;
+            return false;
+        }
+
+        if (e.data1 == 0x51 && length == 3)
+        {
+            const int b0 = Byte(track);
+            const int b1 = Byte(track);
+            const int b2 = Byte(track);
+            if (b0 < 0 || b1 < 0 || b2 < 0)
+            {
+                m_failed = true;
+                return false;
+            }
+
+            e.tempo = ((uint32_t)b0 << 16) | ((uint32_t)b1 << 8) | (uint32_t)b2;
+            return true;
+        }
+
+        if (e.data1 == 0x58 && length == 4)
+        {
+            // The denominator is a power of two
+            e.numerator = Byte(track);
+            const int power = Byte(track);
+            if (e.numerator < 0 || power < 0 || power > 30 || !Skip(track, 2))
+            {
+                m_failed = true;
+                return false;
+            }
+
+            e.denominator = 1 << power;
+            return true;
+        }
+
+        if (e.data1 == 0x2F)
+        {
+            // End of track
+            track.pos = track.end;
+        }
+    }
+    else if (e.status == 0xF0 || e.status == 0xF7)
+    {
+        if (!VarLen(track, length))
+        {
+            m_failed = true;
+            return false;
+        }
+    }
+    else
+    {
+        // Real-time and common messages do not belong in a file
+        m_failed = true;
+        return false;
+    }
+
+    if (!Skip(track, length))
+    {
+        m_failed = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool CMidiFile::NextNote(Note& note)
+{
+    for (;;)
+    {
+        if (!m_held.empty() && !m_held.front().open)
+        {
+            note = m_held.front().note;
+            m_held.pop_front();
+            m_handedOut++;
+            return true;
+        }
+
+        Event e;
+        if (!NextEvent(e))
+        {
+            if (m_held.empty())
+                return false;
+
+            // Notes still sounding at the end stop with the last event
+            for (Held& held : m_held)
+            {
+                if (held.open)
+                {
+                    held.note.end = m_lastTick;
+                    held.open = false;
+                    m_open[held.note.channel][held.note.key] = -1;
+                }
+            }
+            continue;
+        }
+
+        m_lastTick = e.tick;
+        const int kind = e.status & 0xF0;
+        if (kind != 0x80 && kind != 0x90)
+            continue;
+
+        const int channel = e.status & 0x0F;
+        const int key = e.data1 & 0x7F;
+
+        // A note off, or a note on for a key already sounding, ends
+        // the note on that key
+        int64_t& open = m_open[channel][key];
+        if (open >= 0)
+        {
+            Held& held = m_held[(size_t)(open - (int64_t)m_handedOut)];
+            held.note.end = e.tick;
+            held.open = false;
+            open = -1;
+        }
+
+        if (kind == 0x90 && e.data2 > 0)
+        {
+            Held held;
+            held.note.start = e.tick;
+            held.note.end = e.tick;
+            held.note.channel = channel;
+            held.note.key = key;
+            held.note.velocity = e.data2;
+            held.open = true;
+
+            open = (int64_t)(m_handedOut + m_held.size());
+            m_held.push_back(held);
+        }
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+#include <cstdio>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/*! Standard MIDI File reader
+ *
+ * Reads format 0 and 1 files with a ticks-per-quarter-note
+ * division.  Each track is read through its own small buffer and
+ * the tracks are merged in time order, so memory use depends on
+ * the number of tracks and not on the length of the file.
+ *
+ * Open() reads the file through once for the tempo and meter and
+ * the channels that play notes.  NextNote() then hands out the
+ * notes in order of their start, each paired with its note off.  A
+ * note is only held until its note off has been read, and until
+ * every note that starts before it is complete.
+ */
+class CMidiFile
+{
+public:
+    //! A note, with times in ticks from the start of the file
+    struct Note
+    {
+        uint64_t start;
+        uint64_t end;
+        int channel;            //!< 0 to 15; 9 is the General MIDI drum channel
+        int key;                //!< 0 to 127; 60 is middle C
+        int velocity;           //!< 1 to 127
+    };
+
+    //! A tempo change
+    struct Tempo
+    {
+        uint64_t tick;
+        double bpm;             //!< Quarter notes per minute
+    };
+
+    //! A time signature
+    struct Meter
+    {
+        uint64_t tick;
+        double quarters;        //!< Quarter notes per measure
+    };
+
+    CMidiFile();
+    virtual ~CMidiFile();
+
+    //! Open a file, returning false if it is not a MIDI file we can read
+    bool Open(const wchar_t* filename);
+    void Close();
+
+    bool IsOpen() const { return m_file != NULL; }
+
+    //! Go back to the first note
+    void Rewind();
+
+    //! The next note in order of start, false after the last one
+    bool NextNote(Note& note);
+
+    //! True once a track has turned out to be damaged
+    bool Failed() const { return m_failed; }
+
+    //! Ticks per quarter note
+    int Division() const { return m_division; }
+
+    //! Tempo changes in order, the first at tick 0
+    const std::vector<Tempo>& Tempos() const { return m_tempos; }
+
+    //! Time signatures in order
+    const std::vector<Meter>& Meters() const { return m_meters; }
+
+    //! True if any notes play on a channel
+    bool UsesChannel(int channel) const { return (m_channels & (1 << channel)) != 0; }
+
+private:
+    //! A channel or meta event
+    struct Event
+    {
+        uint64_t tick;
+        int status;             //!< Channel message status, or 0xFF for meta events
+        int data1;              //!< Key, or the meta event type
+        int data2;              //!< Velocity
+        uint32_t tempo;         //!< Microseconds per quarter note of a tempo event
+        int numerator;          //!< Time signature of a time signature event
+        int denominator;
+    };
+
+    struct Track
+    {
+        uint64_t start;         //!< File offset of the track data
+        uint64_t end;
+        uint64_t pos;           //!< File offset of the next byte to read
+        uint64_t tick;
+        int running;            //!< Running status
+        bool has;               //!< next holds an event
+        Event next;
+        std::vector<unsigned char> buffer;
+        uint64_t bufferPos;     //!< File offset of buffer[0]
+        size_t bufferLen;
+    };
+
+    bool ReadEvent(Track& track, Event& e);
+    int Byte(Track& track);
+    bool VarLen(Track& track, uint32_t& value);
+    bool Skip(Track& track, uint32_t count);
+    bool NextEvent(Event& e);
+    void Advance(Track& track);
+
+    FILE* m_file;
+    bool m_failed;
+    int m_division;
+    unsigned m_channels;
+    std::vector<Tempo> m_tempos;
+    std::vector<Meter> m_meters;
+    std::vector<Track> m_tracks;
+
+    // Notes waiting for their note off, or for an earlier note's,
+    // in order of start.  A held note is found by its serial number,
+    // counted from the first note handed out.
+    struct Held
+    {
+        Note note;
+        bool open;
+    };
+
+    std::deque<Held> m_held;
+    uint64_t m_handedOut;       //!< Serial number of m_held.front()
+    int64_t m_open[16][128];    //!< Serial number of the sounding note, -1 if none
+    uint64_t m_lastTick;        //!< Tick of the last event read
+};
@@ -0,0 +1,157 @@
+#include "pch.h"
+#include <cmath>
+#include <algorithm>
+#include "CModDelay.h"
+
+CModDelay::CModDelay()
+{
+    m_sampleRate = 44100.0;
+    m_delayMs = 15.0;
+    m_depthMs = 5.0;
+    m_rate = 0.8;
+    m_feedback = 0.0;
+    m_spread = 0.25;
+    m_voices = 2;
+
+    Prepare();
+}
+
+//! Size the ring buffer for the largest delay the sweep can reach
+void CModDelay::Prepare()
+{
+    const double longest = (m_delayMs + m_depthMs) * 0.001 * m_sampleRate + 4.0;
+
+    int size = 16;
+    while (size < longest)
+        size *= 2;
+
+    // A new delay or depth only changes where the LFO reads, so
+    // the line keeps its contents unless it has to grow or shrink
+    if ((int)m_buffer[0].size() != size)
+    {
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+            m_buffer[c].assign(size, 0.0);
+        m_mask = size - 1;
+        Reset();
+    }
+}
+
+void CModDelay::Reset(int frame)
+{
+    for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+        std::fill(m_buffer[c].begin(), m_buffer[c].end(), 0.0);
+    m_write = 0;
+    m_count = 0;
+
+    // Back up one update from the frame, so the Tick() below lands
+    // on the LFO position the frame's ramp starts from
+    const int ticks = frame / ControlBlock;
+    m_phase = (ticks > 0 ? ticks - 1 : 0) * m_rate * ControlBlock / m_sampleRate;
+    m_phase -= std::floor(m_phase);
+
+    for (int v = 0; v < MaxVoices; v++)
+    {
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+            m_delay[v][c] = 0.0;
+    }
+
+    // Start every voice on its LFO position so the first block
+    // does not sweep in from zero
+    Tick();
+    for (int v = 0; v < MaxVoices; v++)
+    {
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+        {
+            m_delay[v][c] += m_step[v][c] * ControlBlock;
+            m_step[v][c] = 0.0;
+        }
+    }
+
+    // Part way through, the next block ramps to the following update
+    if (ticks > 0)
+        m_count = 0;
+}
+
+//! Control-rate update: advance the LFO and set the delay ramps
+void CModDelay::Tick()
+{
+    const double center = m_delayMs * 0.001 * m_sampleRate;
+    const double depth = m_depthMs * 0.001 * m_sampleRate;
+    const double longest = (double)m_mask - 3.0;
+
+    m_phase += m_rate * ControlBlock / m_sampleRate;
+    m_phase -= std::floor(m_phase);
+
+    for (int v = 0; v < MaxVoices; v++)
+    {
+        for (int c = 0; c < CChannelLayout::MaxChannels; c++)
+        {
+            const double phase = m_phase + (double)v / m_voices + c * m_spread;
+            double target = center + depth * std::sin(2.0 * PI * phase);
+
+            // Hermite reads one sample past the read point
+            target = target < 3.0 ? 3.0 : (target > longest ? longest : target);
+
+            m_step[v][c] = (target - m_delay[v][c]) / ControlBlock;
+        }
+    }
+
+    m_count = ControlBlock;
+}
+
+//! Read the line at a fractional delay behind the write position
+double CModDelay::Read(const double* buffer, double delay) const
+{
+    const double pos = m_write - delay;
+    const double whole = std::floor(pos);
+    const double t = pos - whole;
+    const int i = (int)whole;
+
+    const double xm1 = buffer[(i - 1) & m_mask];
+    const double x0 = buffer[i & m_mask];
+    const double x1 = buffer[(i + 1) & m_mask];
+    const double x2 = buffer[(i + 2) & m_mask];
+
+    // 4-point, 3rd order Hermite
+    const double c1 = 0.5 * (x1 - xm1);
+    const double c2 = xm1 - 2.5 * x0 + 2.0 * x1 - 0.5 * x2;
+    const double c3 = 0.5 * (x2 - xm1) + 1.5 * (x0 - x1);
+    return ((c3 * t + c2) * t + c1) * t + x0;
+}
+
+void CModDelay::Process(double* const* channels, int numChannels, int frames)
+{
+    const double voiceGain = 1.0 / std::sqrt((double)m_voices);
+
+    int i = 0;
+    while (i < frames)
+    {
+        if (m_count == 0)
+            Tick();
+
+        const int n = frames - i < m_count ? frames - i : m_count;
+        for (int f = i; f < i + n; f++)
+        {
+            for (int c = 0; c < numChannels; c++)
+            {
+                double* buffer = m_buffer[c].data();
+
+                double wet = 0.0;
+                for (int v = 0; v < m_voices; v++)
+                {
+                    wet += Read(buffer, m_delay[v][c]);
+                    m_delay[v][c] += m_step[v][c];
+                }
+                wet *= voiceGain;
+
+                buffer[m_write] = channels[c][f] + m_feedback * wet;
+                channels[c][f] = wet;
+            }
+
+            m_write = (m_write + 1) & m_mask;
+        }
+
+        m_count -= n;
+        i += n;
+    }
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <vector>
+#include "CChannelLayout.h"
+
+/*! Modulated delay line for chorus and flanger effects
+ *
+ * Each voice reads a ring buffer at a delay swept by a sine LFO.
+ * The LFO runs at control rate: every ControlBlock frames it picks
+ * the next delay for every voice and channel, and the read position
+ * ramps linearly to it across the block.  Reads between samples use
+ * 4-point Hermite interpolation, so slow sweeps do not zipper.
+ *
+ * Each channel's LFO runs the spread ahead of the channel before it,
+ * so in stereo the right channel leads the left by the spread, and
+ * the voices are spread evenly around the LFO cycle.  The output is the
+ * wet signal only; the effects chain mixes in the dry signal.
+ */
+class CModDelay
+{
+public:
+    //! Frames between LFO updates
+    static const int ControlBlock = 32;
+
+    //! Most voices a chorus can have
+    static const int MaxVoices = 4;
+
+    CModDelay();
+
+    void SetSampleRate(double sr) { m_sampleRate = sr;  Prepare(); }
+
+    //! Center delay in ms
+    void SetDelay(double ms) { m_delayMs = ms;  Prepare(); }
+
+    //! Sweep either side of the center in ms
+    void SetDepth(double ms) { m_depthMs = ms;  Prepare(); }
+
+    //! LFO rate in Hz
+    void SetRate(double hz) { m_rate = hz; }
+
+    //! Amount of the output fed back into the line (-0.95 to 0.95)
+    void SetFeedback(double fb) { m_feedback = fb < -0.95 ? -0.95 : (fb > 0.95 ? 0.95 : fb); }
+
+    //! LFO phase offset from one channel to the next in degrees
+    void SetSpread(double degrees) { m_spread = degrees / 360.0; }
+
+    //! Number of voices, 1 to MaxVoices
+    void SetVoices(int voices) { m_voices = voices < 1 ? 1 : (voices > MaxVoices ? MaxVoices : voices); }
+
+    /*! Clear the delay line and restart the LFO
+     *
+     * The LFO starts where it would be after running from frame 0
+     * to the given frame at the current rate, so a render started
+     * part way through sweeps in step with a full one.
+     */
+    void Reset(int frame = 0);
+
+    //! Process a block of planar channels in place
+    void Process(double* const* channels, int numChannels, int frames);
+
+private:
+    void Prepare();
+    void Tick();
+    double Read(const double* buffer, double delay) const;
+
+    double m_sampleRate;
+    double m_delayMs;
+    double m_depthMs;
+    double m_rate;
+    double m_feedback;
+    double m_spread;            //!< Channel to channel offset in cycles
+    int m_voices;
+
+    std::vector<double> m_buffer[CChannelLayout::MaxChannels];
+    int m_mask;                 //!< Ring size - 1, the size is a power of two
+    int m_write;
+
+    double m_phase;             //!< LFO phase in cycles
+    int m_count;                //!< Frames left before the next LFO update
+
+    // Delay in samples per voice and channel, and its per-frame step
+    double m_delay[MaxVoices][CChannelLayout::MaxChannels];
+    double m_step[MaxVoices][CChannelLayout::MaxChannels];
+};
@@ -1,60 +1,69 @@
 #include "pch.h"
+#include <cstring>
+#include <cstdlib>
 #include "CNote.h"
-#include "xmlhelp.h"
+#include "CXmlReader.h"
+#include "CStringTable.h"
 
 CNote::CNote()
 {
+    m_beat = 0;
+    m_duration = -1;
+    m_velocity = -1;
+    m_pitch = 0;
+    m_measure = 0;
+    m_bus = 0;
+    m_instrument = -1;
+    m_type = -1;
+    m_name = -1;
+    m_instance = -1;
 }
 
-CNote::~CNote()
+void CNote::XmlLoad(CXmlReader& xml, int instrument, CStringTable& strings)
 {
-}
-
-void CNote::XmlLoad(IXMLDOMNode* xml, std::wstring& instrument)
-{
-    // Remember the xml node and the instrument.
-    m_node = xml;
     m_instrument = instrument;
 
-    // Get a list of all attribute nodes and the
-    // length of that list
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    xml->get_attributes(&attributes);
-    long len;
-    attributes->get_length(&len);
-
     // Loop over the list of attributes
-    for (int i = 0; i < len; i++)
+    for (int i = 0; i < xml.NumAttributes(); i++)
     {
-        // Get attribute i
-        CComPtr<IXMLDOMNode> attrib;
-        attributes->get_item(i, &attrib);
-
-        // Get the name of the attribute
-        CComBSTR name;
-        attrib->get_nodeName(&name);
+        const char* name = xml.AttributeName(i);
+        const char* value = xml.AttributeValue(i);
 
-        // Get the value of the attribute.  
-        CComVariant value;
-        attrib->get_nodeValue(&value);
-
-        if (name == "measure")
+        if (strcmp(name, "measure") == 0)
         {
             // The file has measures that start at 1.  
             // We'll make them start at zero instead.
-            value.ChangeType(VT_I4);
-            m_measure = value.intVal - 1;
+            m_measure = atoi(value) - 1;
         }
-        else if (name == "beat")
+        else if (strcmp(name, "beat") == 0)
         {
             // Same thing for the beats.
-            value.ChangeType(VT_R8);
-            m_beat = value.dblVal - 1;
+            m_beat = CXmlReader::ToDouble(value) - 1;
+        }
+        else if (strcmp(name, "duration") == 0)
+        {
+            m_duration = CXmlReader::ToDouble(value, m_duration);
+        }
+        else if (strcmp(name, "velocity") == 0)
+        {
+            m_velocity = (float)CXmlReader::ToDouble(value, m_velocity);
+        }
+        else if (strcmp(name, "pitch") == 0)
+        {
+            m_pitch = (float)CXmlReader::ToDouble(value, m_pitch);
+        }
+        else if (strcmp(name, "type") == 0)
+        {
+            m_type = strings.Intern(value);
+        }
+        else if (strcmp(name, "note") == 0)
+        {
+            m_name = strings.Intern(value);
         }
     }
 }
 
-bool CNote::operator<(const CNote& b)
+bool CNote::operator<(const CNote& b) const
 {
     if (m_measure < b.m_measure)
         return true;
@@ -64,4 +73,4 @@ bool CNote::operator<(const CNote& b)
         return true;
 
     return false;
-}
\ No newline at end of file
+}
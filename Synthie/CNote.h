@@ -1,24 +1,62 @@
 #pragma once
-#include <string>
 
+class CXmlReader;
+class CStringTable;
+
+/*! One note of the score
+ *
+ * A note is a small fixed-size record: text attributes are kept as
+ * ids in the score's string table, and attributes the score leaves
+ * out are negative so the instrument keeps its own default.  The
+ * record is trivially copyable so a compiled score can hold an array
+ * of them as they are in memory.
+ */
 class CNote
 {
 private:
-	std::wstring m_instrument;
-	int m_measure;
 	double m_beat;
-	CComPtr<IXMLDOMNode> m_node;
+	double m_duration;	//!< In beats, < 0 if not given
+	float m_velocity;	//!< < 0 if not given
+	float m_pitch;		//!< Pitch offset in semitones
+	int m_measure;
+	int m_bus;
+	int m_instrument;	//!< String id of the instrument name
+	int m_type;		//!< String id of the drum type, -1 if not given
+	int m_name;		//!< String id of the note name, -1 if not given
+	int m_instance;		//!< Pattern instance the note was copied for, -1 if none
 
 public:
 	CNote(void);
-	virtual ~CNote(void);
 
 	int Measure() const { return m_measure; }
 	double Beat() const { return m_beat; }
-	const std::wstring& Instrument() const { return m_instrument; }
-	IXMLDOMNode* Node() { return m_node; }
+	int Instrument() const { return m_instrument; }
+
+	double Duration() const { return m_duration; }
+	double Velocity() const { return m_velocity; }
+	double Pitch() const { return m_pitch; }
+	int Type() const { return m_type; }
+	int Name() const { return m_name; }
+
+	//! Index of the pattern instance the note plays in, -1 if it is not in one
+	int Instance() const { return m_instance; }
+	void SetInstance(int instance) { m_instance = instance; }
+
+	//! Index of the synthesizer bus this note renders into
+	int Bus() const { return m_bus; }
+	void SetBus(int bus) { m_bus = bus; }
+
+	// For notes that come from somewhere other than a <note> element
+	void SetPosition(int measure, double beat) { m_measure = measure;  m_beat = beat; }
+	void SetDuration(double duration) { m_duration = duration; }
+	void SetVelocity(double velocity) { m_velocity = (float)velocity; }
+	void SetPitch(double pitch) { m_pitch = (float)pitch; }
+	void SetInstrument(int instrument) { m_instrument = instrument; }
+	void SetType(int type) { m_type = type; }
+	void SetName(int name) { m_name = name; }
 
-	void XmlLoad(IXMLDOMNode* xml, std::wstring& instrument);
-	bool operator<(const CNote& b);
+	//! Read the attributes of the <note> element the reader is on
+	void XmlLoad(CXmlReader& xml, int instrument, CStringTable& strings);
+	bool operator<(const CNote& b) const;
 };
 
@@ -0,0 +1,92 @@
+#include "pch.h"
+#include <cmath>
+#include "COversampler.h"
+
+//! Zeroth order modified Bessel function, for the Kaiser window
+static double BesselI0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 30; k++)
+    {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+void CHalfBand::Design(int k, double beta)
+{
+    m_k = k < 1 ? 1 : (k > MaxK ? MaxK : k);
+
+    // Nonzero taps sit at odd offsets d from the center.  The branch
+    // holds the taps from d = -(2K-1) up to -1; the rest mirror them.
+    const double half = 2.0 * m_k;
+    double sum = 0.0;
+    for (int i = 0; i < m_k; i++)
+    {
+        const double d = 2.0 * i - (2.0 * m_k - 1.0);
+        const double r = d / half;
+        const double window = BesselI0(beta * std::sqrt(1.0 - r * r)) / BesselI0(beta);
+        m_c[i] = std::sin(PI * d / 2.0) / (PI * d) * window;
+        sum += 2.0 * m_c[i];
+    }
+
+    // The side taps must sum to 0.5 for unity gain at DC
+    for (int i = 0; i < m_k; i++)
+        m_c[i] *= 0.5 / sum;
+
+    Reset();
+}
+
+void CHalfBand::Reset()
+{
+    for (int i = 0; i < MaxK * 4; i++)
+    {
+        m_up[i] = 0.0;
+        m_down[i] = 0.0;
+    }
+
+    for (int i = 0; i < MaxK; i++)
+        m_odd[i] = 0.0;
+
+    m_upPos = 0;
+    m_downPos = 0;
+    m_oddPos = 0;
+}
+
+COversampler::COversampler()
+{
+    // The outer stage sets the passband edge; the inner stage only
+    // has to reject images above the 2x band and can be much shorter.
+    m_outer.Design(12, 7.0);
+    m_inner.Design(4, 5.0);
+    m_factor = 1;
+    m_pad = 0.0;
+}
+
+void COversampler::SetFactor(int factor)
+{
+    m_factor = Supported(factor);
+    Reset();
+}
+
+void COversampler::Reset()
+{
+    m_outer.Reset();
+    m_inner.Reset();
+    m_pad = 0.0;
+}
+
+int COversampler::Latency() const
+{
+    if (m_factor == 1)
+        return 0;
+
+    int latency = m_outer.Latency();
+    if (m_factor == 4)
+        latency += (m_inner.Latency() + 1) / 2;
+
+    return latency;
+}
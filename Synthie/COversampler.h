@@ -0,0 +1,158 @@
+#pragma once
+
+/*! Polyphase half-band filter for 2x resampling
+ *
+ * A half-band FIR has every other coefficient zero apart from the
+ * 0.5 center tap.  Split into its two polyphase branches, one branch
+ * is a pure delay and the other a symmetric FIR of 2*K taps, so a
+ * 2x up or down step costs K multiplies per input sample.
+ *
+ * Up() and Down() keep separate state, so one object handles both
+ * sides of an oversampled stage.  Together they delay the signal by
+ * Latency() input-rate frames.
+ */
+class CHalfBand
+{
+public:
+    //! Largest supported K (pairs of nonzero taps per branch)
+    static const int MaxK = 16;
+
+    CHalfBand() { Design(8); }
+
+    /*! Design a Kaiser windowed half-band filter
+     * \param k Number of coefficient pairs in the FIR branch
+     * \param beta Kaiser window shape; larger trades width for stopband
+     */
+    void Design(int k, double beta = 6.0);
+
+    void Reset();
+
+    //! Delay of an Up()/Down() pair in input-rate frames
+    int Latency() const { return 2 * m_k - 1; }
+
+    //! Turn one input sample into two output samples
+    void Up(double x, double& y0, double& y1)
+    {
+        const int n = 2 * m_k;
+        m_upPos = (m_upPos == 0 ? n : m_upPos) - 1;
+        m_up[m_upPos] = m_up[m_upPos + n] = x;
+
+        const double* h = m_up + m_upPos;
+        y0 = 2.0 * Branch(h);
+        y1 = h[m_k - 1];
+    }
+
+    //! Turn two input samples into one output sample
+    double Down(double x0, double x1)
+    {
+        const int n = 2 * m_k;
+        m_downPos = (m_downPos == 0 ? n : m_downPos) - 1;
+        m_down[m_downPos] = m_down[m_downPos + n] = x0;
+
+        // The delay branch reads the odd sample from K frames ago
+        const double y = Branch(m_down + m_downPos) + 0.5 * m_odd[m_oddPos];
+        m_odd[m_oddPos] = x1;
+        if (++m_oddPos == m_k)
+            m_oddPos = 0;
+
+        return y;
+    }
+
+private:
+    //! FIR branch over a newest-first history, folded on its symmetry
+    double Branch(const double* h) const
+    {
+        const int last = 2 * m_k - 1;
+        double sum = 0.0;
+        for (int i = 0; i < m_k; i++)
+            sum += m_c[i] * (h[i] + h[last - i]);
+
+        return sum;
+    }
+
+    int m_k;
+    double m_c[MaxK];               //!< First half of the FIR branch
+
+    // Histories are stored twice so reads never wrap
+    double m_up[MaxK * 4];
+    int m_upPos;
+    double m_down[MaxK * 4];
+    int m_downPos;
+    double m_odd[MaxK];
+    int m_oddPos;
+};
+
+/*! 2x/4x oversampling wrapper for memoryless nonlinearities
+ *
+ * Process() upsamples, runs the shaping function at the higher rate
+ * and filters back down, so the harmonics a clipper creates above
+ * Nyquist are removed instead of folding back as aliases.  4x is a
+ * cascade of two 2x stages; the inner stage runs on an already band
+ * limited signal and gets by with a shorter filter.
+ *
+ * One object handles one channel.  The factor is 1 (off), 2 or 4.
+ */
+class COversampler
+{
+public:
+    COversampler();
+
+    //! Set the factor, rounded down to one of those supported
+    void SetFactor(int factor);
+    int GetFactor() const { return m_factor; }
+
+    //! The factor SetFactor() makes of a requested one
+    static int Supported(int factor) { return factor >= 4 ? 4 : (factor >= 2 ? 2 : 1); }
+
+    void Reset();
+
+    //! Delay added to the signal in frames
+    int Latency() const;
+
+    //! Run one sample through a nonlinearity at the oversampled rate
+    template<class Shape> double Process(double x, Shape shape)
+    {
+        if (m_factor == 1)
+            return shape(x);
+
+        double a, b;
+        m_outer.Up(x, a, b);
+        if (m_factor == 2)
+        {
+            a = shape(a);
+            b = shape(b);
+        }
+        else
+        {
+            a = Inner(a, shape);
+            b = Inner(b, shape);
+        }
+
+        return m_outer.Down(a, b);
+    }
+
+    //! Run a block in place through a nonlinearity
+    template<class Shape> void Process(double* samples, int frames, Shape shape)
+    {
+        for (int i = 0; i < frames; i++)
+            samples[i] = Process(samples[i], shape);
+    }
+
+private:
+    //! One 2x-rate sample through the inner 2x stage.  The extra
+    //! sample of delay rounds its latency to whole input frames.
+    template<class Shape> double Inner(double x, Shape shape)
+    {
+        double c, d;
+        m_inner.Up(x, c, d);
+        const double y = m_inner.Down(shape(c), shape(d));
+        const double out = m_pad;
+        m_pad = y;
+        return out;
+    }
+
+    int m_factor;
+    CHalfBand m_outer;      //!< Input rate <-> 2x
+    CHalfBand m_inner;      //!< 2x <-> 4x
+    double m_pad;
+};
@@ -0,0 +1,49 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+/*! A block of audio with each channel in a run of its own
+ *
+ * The effects work through one channel, or one pair of channels,
+ * at a time, so keeping each channel's samples together lets those
+ * loops read memory in order and lets a pair share an SSE2 register.
+ * The channels share one allocation and each is padded to a multiple
+ * of four samples, so they all have the alignment of the first.
+ */
+class CPlanarBuffer
+{
+public:
+    CPlanarBuffer() : m_channels(0), m_frames(0), m_stride(0) {}
+
+    //! Size the buffer and fill it with silence
+    void Resize(int channels, int frames)
+    {
+        m_channels = channels;
+        m_frames = frames;
+        m_stride = (frames + 3) & ~3;
+        m_data.assign((size_t)m_stride * channels, 0.0);
+    }
+
+    //! Fill the buffer with silence
+    void Clear() { std::fill(m_data.begin(), m_data.end(), 0.0); }
+
+    int NumChannels() const { return m_channels; }
+    int NumFrames() const { return m_frames; }
+
+    double* Channel(int c) { return m_data.data() + (size_t)c * m_stride; }
+    const double* Channel(int c) const { return m_data.data() + (size_t)c * m_stride; }
+
+    //! Point at every channel from a frame on, for the calls that
+    //! take an array of channels
+    void Channels(int frame, double** channels)
+    {
+        for (int c = 0; c < m_channels; c++)
+            channels[c] = Channel(c) + frame;
+    }
+
+private:
+    std::vector<double> m_data;
+    int m_channels;
+    int m_frames;
+    int m_stride;               //!< Samples from one channel to the next
+};
@@ -0,0 +1,223 @@
+#include "pch.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <type_traits>
+#include "CScoreBin.h"
+#include "CStringTable.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+static_assert(std::is_trivially_copyable<CNote>::value, "Notes are stored as raw records");
+
+static const char Magic[8] = { 'S', 'Y', 'N', 'S', 'C', 'O', 'R', 'E' };
+static const uint32_t Version = 3;
+
+CScoreBin::CScoreBin()
+{
+    m_view = NULL;
+    m_size = 0;
+#ifdef _WIN32
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = NULL;
+#endif
+}
+
+CScoreBin::~CScoreBin()
+{
+    Close();
+}
+
+bool CScoreBin::Open(const wchar_t* filename)
+{
+    Close();
+
+#ifdef _WIN32
+    m_file = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(Header))
+    {
+        Close();
+        return false;
+    }
+
+    m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (m_mapping == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    m_view = (const char*)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    m_size = (uint64_t)size.QuadPart;
+#else
+    std::string narrow;
+    for (const wchar_t* p = filename; *p; p++)
+        narrow += (char)*p;
+
+    const int fd = open(narrow.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Header))
+    {
+        void* view = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            m_view = (const char*)view;
+            m_size = (uint64_t)st.st_size;
+        }
+    }
+    close(fd);
+#endif
+
+    if (m_view == NULL || !Validate())
+    {
+        Close();
+        return false;
+    }
+
+    return true;
+}
+
+void CScoreBin::Close()
+{
+#ifdef _WIN32
+    if (m_view != NULL)
+        UnmapViewOfFile(m_view);
+    if (m_mapping != NULL)
+        CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE)
+        CloseHandle(m_file);
+
+    m_mapping = NULL;
+    m_file = INVALID_HANDLE_VALUE;
+#else
+    if (m_view != NULL)
+        munmap((void*)m_view, m_size);
+#endif
+
+    m_view = NULL;
+    m_size = 0;
+}
+
+//! Check the header and that every section lies inside the file
+bool CScoreBin::Validate() const
+{
+    const Header* h = Head();
+    if (memcmp(h->magic, Magic, sizeof(Magic)) != 0 || h->version != Version ||
+        h->noteSize != sizeof(CNote) || h->fileSize != m_size)
+    {
+        return false;
+    }
+
+    if (h->numNotes < 0 || h->numStrings < 0 || h->setupSize < 0 || h->beatsPerMeasure <= 0 || !(h->bpm > 0))
+        return false;
+
+    // Sections are in order: notes, strings, setup
+    const uint64_t notesEnd = h->notesOffset + (uint64_t)h->numNotes * sizeof(CNote);
+    const uint64_t offsetsEnd = h->stringsOffset + (uint64_t)h->numStrings * sizeof(uint32_t);
+    if (h->notesOffset < sizeof(Header) || h->notesOffset % alignof(CNote) != 0 ||
+        notesEnd > h->stringsOffset || offsetsEnd > h->setupOffset ||
+        h->stringsOffset % sizeof(uint32_t) != 0 ||
+        h->setupOffset + (uint64_t)h->setupSize > m_size)
+    {
+        return false;
+    }
+
+    // Each string has to end inside the string section
+    const uint32_t* offsets = (const uint32_t*)(m_view + h->stringsOffset);
+    const uint64_t textSize = h->setupOffset - offsetsEnd;
+    if (h->numStrings > 0 && (textSize == 0 || m_view[h->setupOffset - 1] != '\0'))
+        return false;
+
+    for (int i = 0; i < h->numStrings; i++)
+    {
+        if (offsets[i] >= textSize)
+            return false;
+    }
+
+    return true;
+}
+
+const CNote* CScoreBin::Notes() const
+{
+    return (const CNote*)(m_view + Head()->notesOffset);
+}
+
+const char* CScoreBin::String(int id) const
+{
+    if (id < 0 || id >= NumStrings())
+        return "";
+
+    const uint32_t* offsets = (const uint32_t*)(m_view + Head()->stringsOffset);
+    return m_view + Head()->stringsOffset + NumStrings() * sizeof(uint32_t) + offsets[id];
+}
+
+const char* CScoreBin::Setup() const
+{
+    return m_view + Head()->setupOffset;
+}
+
+bool CScoreBin::Write(const wchar_t* filename, double bpm, int beatsPerMeasure,
+    const CNote* notes, int numNotes, const CStringTable& strings, const std::string& setup,
+    uint64_t sourceHash, uint64_t sourceSize)
+{
+    // Lay out the string section
+    std::vector<uint32_t> offsets;
+    std::string text;
+    for (int i = 0; i < strings.Size(); i++)
+    {
+        offsets.push_back((uint32_t)text.size());
+        text += strings.Utf8(i);
+        text += '\0';
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, Magic, sizeof(Magic));
+    h.version = Version;
+    h.noteSize = sizeof(CNote);
+    h.bpm = bpm;
+    h.beatsPerMeasure = beatsPerMeasure;
+    h.numNotes = numNotes;
+    h.numStrings = strings.Size();
+    h.setupSize = (int32_t)setup.size();
+    h.notesOffset = sizeof(Header);
+    h.stringsOffset = h.notesOffset + (uint64_t)numNotes * sizeof(CNote);
+    h.setupOffset = h.stringsOffset + offsets.size() * sizeof(uint32_t) + text.size();
+    h.fileSize = h.setupOffset + setup.size();
+    h.sourceHash = sourceHash;
+    h.sourceSize = sourceSize;
+
+#ifdef _WIN32
+    FILE* file = _wfopen(filename, L"wb");
+#else
+    std::string narrow;
+    for (const wchar_t* p = filename; *p; p++)
+        narrow += (char)*p;
+    FILE* file = fopen(narrow.c_str(), "wb");
+#endif
+    if (file == NULL)
+        return false;
+
+    bool ok = fwrite(&h, sizeof(h), 1, file) == 1;
+    if (numNotes > 0)
+        ok = ok && fwrite(notes, sizeof(CNote), numNotes, file) == (size_t)numNotes;
+    if (!offsets.empty())
+        ok = ok && fwrite(offsets.data(), sizeof(uint32_t), offsets.size(), file) == offsets.size();
+    ok = ok && fwrite(text.data(), 1, text.size(), file) == text.size();
+    ok = ok && fwrite(setup.data(), 1, setup.size(), file) == setup.size();
+
+    return fclose(file) == 0 && ok;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "CNote.h"
+
+class CStringTable;
+
+/*! Compiled score file (.scorebin)
+ *
+ * A score compiled from XML into a form that can be used straight
+ * from a memory-mapped view:
+ *
+ *  - a fixed header with the tempo and meter and the offsets of
+ *    the sections,
+ *  - the notes, already sorted, as an array of CNote records,
+ *  - the string table the notes refer to, as offsets followed by
+ *    nul-terminated UTF-8 text,
+ *  - the score without its notes (instruments, buses, effects and
+ *    automation) as a small XML document.
+ *
+ * Open() maps the file and checks the header and section bounds.
+ * The notes are not read or copied, so opening costs the same
+ * however many notes the score has.  The file is read in the
+ * byte order and CNote layout of the machine that wrote it; a
+ * file from a different layout is rejected rather than converted.
+ */
+class CScoreBin
+{
+public:
+    CScoreBin();
+    virtual ~CScoreBin();
+
+    //! Map a compiled score, returning false if it is not valid
+    bool Open(const wchar_t* filename);
+    void Close();
+
+    bool IsOpen() const { return m_view != NULL; }
+
+    double Bpm() const { return Head()->bpm; }
+    int BeatsPerMeasure() const { return Head()->beatsPerMeasure; }
+
+    //! The sorted notes, valid while the file is open
+    const CNote* Notes() const;
+    int NumNotes() const { return Head()->numNotes; }
+
+    int NumStrings() const { return Head()->numStrings; }
+    const char* String(int id) const;
+
+    //! The score without its notes, as UTF-8 XML
+    const char* Setup() const;
+    int SetupSize() const { return Head()->setupSize; }
+
+    //! Hash and size of the XML score this was compiled from
+    uint64_t SourceHash() const { return Head()->sourceHash; }
+    uint64_t SourceSize() const { return Head()->sourceSize; }
+
+    //! Write a compiled score
+    static bool Write(const wchar_t* filename, double bpm, int beatsPerMeasure,
+        const CNote* notes, int numNotes, const CStringTable& strings, const std::string& setup,
+        uint64_t sourceHash, uint64_t sourceSize);
+
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t noteSize;          //!< sizeof(CNote) when written
+        double bpm;
+        int32_t beatsPerMeasure;
+        int32_t numNotes;
+        int32_t numStrings;
+        int32_t setupSize;
+        uint64_t notesOffset;
+        uint64_t stringsOffset;     //!< Offsets of each string, then the text
+        uint64_t setupOffset;
+        uint64_t fileSize;
+        uint64_t sourceHash;        //!< See CScoreCache::HashFile()
+        uint64_t sourceSize;
+    };
+
+    const Header* Head() const { return (const Header*)m_view; }
+    bool Validate() const;
+
+    const char* m_view;             //!< The mapped file
+    uint64_t m_size;
+
+#ifdef _WIN32
+    HANDLE m_file;
+    HANDLE m_mapping;
+#endif
+};
+
@@ -0,0 +1,185 @@
+#include "pch.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include "CScoreCache.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+// Multiply-rotate lanes in the style of xxHash
+static const uint64_t Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t Prime3 = 0x165667B19E3779F9ULL;
+
+static inline uint64_t Rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t Round(uint64_t lane, uint64_t word)
+{
+    return Rotl(lane + word * Prime2, 31) * Prime1;
+}
+
+static inline uint64_t Word(const unsigned char* p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+CScoreCache::CScoreCache()
+{
+    m_checked = false;
+}
+
+bool CScoreCache::HashFile(const wchar_t* filename, uint64_t& hash, uint64_t& size)
+{
+#ifdef _WIN32
+    FILE* file = _wfopen(filename, L"rb");
+#else
+    std::string narrow;
+    for (const wchar_t* p = filename; *p; p++)
+        narrow += (char)*p;
+    FILE* file = fopen(narrow.c_str(), "rb");
+#endif
+    if (file == NULL)
+        return false;
+
+    // Four independent lanes of 8-byte words, so the multiplies
+    // overlap.  Only the last read of the file is short.
+    uint64_t lane[4] = { Prime1 + Prime2, Prime2, 0, 0 - Prime1 };
+    std::vector<unsigned char> buffer(64 * 1024);
+    size = 0;
+    uint64_t tail = 0;
+    for (;;)
+    {
+        const size_t got = fread(buffer.data(), 1, buffer.size(), file);
+        size += got;
+
+        size_t i = 0;
+        for (; i + 32 <= got; i += 32)
+        {
+            lane[0] = Round(lane[0], Word(&buffer[i]));
+            lane[1] = Round(lane[1], Word(&buffer[i + 8]));
+            lane[2] = Round(lane[2], Word(&buffer[i + 16]));
+            lane[3] = Round(lane[3], Word(&buffer[i + 24]));
+        }
+
+        for (; i < got; i++)
+            tail = (tail ^ buffer[i]) * Prime3;
+
+        if (got < buffer.size())
+            break;
+    }
+
+    const bool failed = ferror(file) != 0;
+    fclose(file);
+    if (failed)
+        return false;
+
+    uint64_t h = Rotl(lane[0], 1) + Rotl(lane[1], 7) + Rotl(lane[2], 12) + Rotl(lane[3], 18);
+    h = (h ^ Round(0, tail)) * Prime1 + size;
+
+    // Final mix so every input bit reaches every output bit
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+
+    hash = h;
+    return true;
+}
+
+const std::wstring& CScoreCache::Directory()
+{
+    if (m_checked)
+        return m_directory;
+
+    m_checked = true;
+
+#ifdef _WIN32
+    const wchar_t* base = _wgetenv(L"LOCALAPPDATA");
+    if (base == NULL || *base == 0)
+        return m_directory;
+
+    std::wstring dir = base;
+    dir += L"\\Synthie";
+    CreateDirectoryW(dir.c_str(), NULL);
+    dir += L"\\ScoreCache";
+    CreateDirectoryW(dir.c_str(), NULL);
+
+    const DWORD attributes = GetFileAttributesW(dir.c_str());
+    if (attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY))
+        m_directory = dir + L"\\";
+#else
+    const char* base = getenv("TMPDIR");
+    std::string dir = std::string(base != NULL && *base ? base : "/tmp") + "/synthie-score-cache";
+    mkdir(dir.c_str(), 0755);
+
+    struct stat st;
+    if (stat(dir.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+        m_directory = std::wstring(dir.begin(), dir.end()) + L"/";
+#endif
+
+    return m_directory;
+}
+
+std::wstring CScoreCache::EntryPath(uint64_t hash, uint64_t size)
+{
+    const std::wstring& dir = Directory();
+    if (dir.empty())
+        return dir;
+
+    wchar_t name[64];
+    swprintf(name, sizeof(name) / sizeof(name[0]), L"%016llx-%llx.scorebin",
+        (unsigned long long)hash, (unsigned long long)size);
+
+    return dir + name;
+}
+
+void CScoreCache::Prune()
+{
+#ifdef _WIN32
+    const std::wstring& dir = Directory();
+    if (dir.empty())
+        return;
+
+    struct Entry
+    {
+        std::wstring name;
+        ULONGLONG written;
+    };
+
+    std::vector<Entry> entries;
+    WIN32_FIND_DATAW found;
+    HANDLE find = FindFirstFileW((dir + L"*.scorebin").c_str(), &found);
+    if (find == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        Entry e;
+        e.name = found.cFileName;
+        e.written = ((ULONGLONG)found.ftLastWriteTime.dwHighDateTime << 32) | found.ftLastWriteTime.dwLowDateTime;
+        entries.push_back(e);
+    } while (FindNextFileW(find, &found));
+    FindClose(find);
+
+    if ((int)entries.size() <= MaxEntries)
+        return;
+
+    // Newest first, then delete everything past the limit.  An entry
+    // another instance has mapped cannot be deleted and stays.
+    std::sort(entries.begin(), entries.end(),
+        [](const Entry& a, const Entry& b) { return a.written > b.written; });
+
+    for (size_t i = MaxEntries; i < entries.size(); i++)
+        DeleteFileW((dir + entries[i].name).c_str());
+#endif
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstdint>
+#include <string>
+
+/*! On-disk cache of parsed scores
+ *
+ * Opening an XML score stores the parsed, sorted notes as a compiled
+ * score (see CScoreBin) named by a hash of the score file's contents.
+ * Opening a file with the same contents again maps that entry instead
+ * of parsing.  Any edit changes the hash, so a stale entry is never
+ * found; it is only removed once the cache holds more than MaxEntries
+ * and it is among the oldest.
+ *
+ * Entries live in %LOCALAPPDATA%\Synthie\ScoreCache.
+ */
+class CScoreCache
+{
+public:
+    //! Entries kept before the oldest are removed
+    static const int MaxEntries = 64;
+
+    CScoreCache();
+
+    //! Hash the contents of a file
+    static bool HashFile(const wchar_t* filename, uint64_t& hash, uint64_t& size);
+
+    //! Path of the entry for some file contents, or "" if there is no cache directory
+    std::wstring EntryPath(uint64_t hash, uint64_t size);
+
+    //! Remove the oldest entries beyond MaxEntries
+    void Prune();
+
+private:
+    const std::wstring& Directory();
+
+    std::wstring m_directory;
+    bool m_checked;             //!< True once the directory has been created
+};
+
@@ -21,7 +21,8 @@ void CSineWave::Start()
 bool CSineWave::Generate()
 {
     m_frame[0] = m_amp * sin(m_phase * 2 * PI);
-    m_frame[1] = m_frame[0];
+    for (int c = 1; c < m_channels; c++)
+        m_frame[c] = m_frame[0];
 
     m_phase += m_freq * GetSamplePeriod();
 
@@ -0,0 +1,79 @@
+#include "pch.h"
+#include <cmath>
+#include "CStateVariable.h"
+
+void CStateVariable::Design(Mode mode, double freq, double q, double sampleRate)
+{
+    m_mode = mode;
+
+    freq = std::fmax(1.0, std::fmin(freq, sampleRate * 0.49));
+    const double g = std::tan(PI * freq / sampleRate);
+    const double k = 1.0 / std::fmax(q, 1e-3);
+
+    m_k = k;
+    m_a1 = 1.0 / (1.0 + g * (g + k));
+    m_a2 = g * m_a1;
+    m_a3 = g * m_a2;
+
+    // v0 is the input, v1 the band output, v2 the low output
+    switch (mode)
+    {
+    case Lowpass:   m_m0 = 0.0;  m_m1 = 0.0;      m_m2 = 1.0;   break;
+    case Highpass:  m_m0 = 1.0;  m_m1 = -k;       m_m2 = -1.0;  break;
+    case Bandpass:  m_m0 = 0.0;  m_m1 = 1.0;      m_m2 = 0.0;   break;
+    case Notch:     m_m0 = 1.0;  m_m1 = -k;       m_m2 = 0.0;   break;
+    case Peak:      m_m0 = 1.0;  m_m1 = -k;       m_m2 = -2.0;  break;
+    case Allpass:   m_m0 = 1.0;  m_m1 = -2.0 * k; m_m2 = 0.0;   break;
+    }
+}
+
+void CStateVariable::Process(double* left, double* right, int frames)
+{
+#ifdef SYNTHIE_SSE2
+    const __m128d a1 = _mm_set1_pd(m_a1);
+    const __m128d a2 = _mm_set1_pd(m_a2);
+    const __m128d a3 = _mm_set1_pd(m_a3);
+    const __m128d m0 = _mm_set1_pd(m_m0);
+    const __m128d m1 = _mm_set1_pd(m_m1);
+    const __m128d m2 = _mm_set1_pd(m_m2);
+    __m128d ic1 = _mm_loadu_pd(m_ic1);
+    __m128d ic2 = _mm_loadu_pd(m_ic2);
+
+    for (int i = 0; i < frames; i++)
+    {
+        const __m128d v0 = _mm_set_pd(right[i], left[i]);
+        const __m128d v3 = _mm_sub_pd(v0, ic2);
+        const __m128d v1 = _mm_add_pd(_mm_mul_pd(a1, ic1), _mm_mul_pd(a2, v3));
+        const __m128d v2 = _mm_add_pd(ic2, _mm_add_pd(_mm_mul_pd(a2, ic1), _mm_mul_pd(a3, v3)));
+        ic1 = _mm_sub_pd(_mm_add_pd(v1, v1), ic1);
+        ic2 = _mm_sub_pd(_mm_add_pd(v2, v2), ic2);
+
+        const __m128d y = _mm_add_pd(_mm_mul_pd(m0, v0),
+            _mm_add_pd(_mm_mul_pd(m1, v1), _mm_mul_pd(m2, v2)));
+        _mm_storel_pd(left + i, y);
+        _mm_storeh_pd(right + i, y);
+    }
+
+    _mm_storeu_pd(m_ic1, ic1);
+    _mm_storeu_pd(m_ic2, ic2);
+#else
+    double* channels[2] = { left, right };
+    for (int c = 0; c < 2; c++)
+    {
+        double* data = channels[c];
+        double ic1 = m_ic1[c], ic2 = m_ic2[c];
+        for (int i = 0; i < frames; i++)
+        {
+            const double v0 = data[i];
+            const double v3 = v0 - ic2;
+            const double v1 = m_a1 * ic1 + m_a2 * v3;
+            const double v2 = ic2 + m_a2 * ic1 + m_a3 * v3;
+            ic1 = 2.0 * v1 - ic1;
+            ic2 = 2.0 * v2 - ic2;
+            data[i] = m_m0 * v0 + m_m1 * v1 + m_m2 * v2;
+        }
+        m_ic1[c] = ic1;
+        m_ic2[c] = ic2;
+    }
+#endif
+}
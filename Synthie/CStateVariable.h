@@ -0,0 +1,36 @@
+#pragma once
+#include "CBiquad.h"
+
+/*! Stereo state variable filter
+ *
+ * Trapezoidal (zero delay feedback) SVF.  Unlike a biquad it stays
+ * well behaved when the cutoff moves every block, which makes it the
+ * filter of choice for swept or automated cutoffs.  Both channels
+ * run in one SSE2 register.
+ */
+class CStateVariable
+{
+public:
+    enum Mode { Lowpass, Highpass, Bandpass, Notch, Peak, Allpass };
+
+    CStateVariable() { Reset(); }
+
+    //! Compute the coefficients for a cutoff and resonance
+    void Design(Mode mode, double freq, double q, double sampleRate);
+
+    void Reset() { m_ic1[0] = m_ic1[1] = m_ic2[0] = m_ic2[1] = 0.0; }
+
+    //! Filter a planar stereo block in place
+    void Process(double* left, double* right, int frames);
+
+private:
+    Mode m_mode = Lowpass;
+
+    double m_k = 1.414;         //!< 1/Q damping
+    double m_a1 = 1.0, m_a2 = 0.0, m_a3 = 0.0;
+
+    // Output mix: y = m0*v0 + m1*v1 + m2*v2
+    double m_m0 = 0.0, m_m1 = 0.0, m_m2 = 1.0;
+
+    double m_ic1[2], m_ic2[2];  //!< Integrator states, per channel
+};
@@ -0,0 +1,43 @@
+#include "pch.h"
+#include "CStringTable.h"
+#include "CXmlReader.h"
+
+int CStringTable::Intern(const char* utf8)
+{
+    auto found = m_ids.find(utf8);
+    if (found != m_ids.end())
+        return found->second;
+
+    const int id = (int)m_strings.size();
+    m_strings.push_back(std::wstring());
+    CXmlReader::Widen(utf8, m_strings.back());
+    m_utf8.push_back(utf8);
+    m_ids[utf8] = id;
+
+    return id;
+}
+
+const std::wstring& CStringTable::Get(int id) const
+{
+    static const std::wstring empty;
+    if (id < 0 || id >= (int)m_strings.size())
+        return empty;
+
+    return m_strings[id];
+}
+
+const std::string& CStringTable::Utf8(int id) const
+{
+    static const std::string empty;
+    if (id < 0 || id >= (int)m_utf8.size())
+        return empty;
+
+    return m_utf8[id];
+}
+
+void CStringTable::Clear()
+{
+    m_strings.clear();
+    m_utf8.clear();
+    m_ids.clear();
+}
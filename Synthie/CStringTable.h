@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+/*! Interned strings for note records
+ *
+ * Notes refer to their instrument, drum type and note name by a
+ * small integer id instead of holding a string each.  A score only
+ * has a handful of distinct names, so the table stays tiny however
+ * many notes refer to it.
+ */
+class CStringTable
+{
+public:
+    //! Id of a UTF-8 string, adding it if it is new
+    int Intern(const char* utf8);
+
+    //! String for an id; ids that are out of range give ""
+    const std::wstring& Get(int id) const;
+
+    //! The UTF-8 text of an id, as it was interned
+    const std::string& Utf8(int id) const;
+
+    int Size() const { return (int)m_strings.size(); }
+
+    void Clear();
+
+private:
+    std::vector<std::wstring> m_strings;
+    std::vector<std::string> m_utf8;
+    std::unordered_map<std::string, int> m_ids;     //!< Keyed by the UTF-8 text
+};
@@ -2,340 +2,2747 @@
 #include <string>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <chrono>
+#include <map>
+#include <queue>
 #include "CSynthesizer.h"
 #include "CToneInstrument.h"
 #include "CDrumInstrument.h"
-#include "xmlhelp.h"
+#include "CXmlReader.h"
+#include "CScoreBin.h"
+#include "CScoreCache.h"
 using namespace std;
 
 CSynthesizer::CSynthesizer()
 {
-	CoInitialize(NULL);
-
-	m_channels = 2;
 	m_sampleRate = 44100.0;
 	m_samplePeriod = 1.0 / m_sampleRate;
 	m_time = 0.0;
 
 	m_bpm = 120.0;
-    m_secperbeat = 0.5;
 	m_beatspermeasure = 4;
+    m_tuning = EqualTuning;
 
     m_fx.SetSampleRate(m_sampleRate);
+
+    m_block.Resize(GetNumChannels(), CEffects::MaxBlock);
+    m_blockPos = 0;
+    m_blockLen = 0;
+    m_done = false;
+    m_tail = 0;
+    m_skip = 0;
+    m_busLatency = 0;
+    m_oversampling = 1;
+    m_score = NULL;
+    m_numNotes = 0;
+    m_frame = 0;
+    m_dueNote = -1;
+    m_dueFrame = 0;
+    m_recording = false;
+    m_record.complete = false;
+    m_capture = NULL;
+    m_streaming = false;
+    m_streamWindow = 0;
+    m_streamSetup = false;
+    m_streamHaveEffects = false;
+    m_streamEnd = true;
+    m_streamBus = -1;
+    m_streamInstrument = -1;
+    m_streamRead = 0;
+    m_streamLast = -1;
+    m_streamMax = -1;
+    m_streamLate = 0;
+    m_streamIgnored = 0;
+    m_streamErrorLine = 0;
+    m_streamPlay = 0;
+    m_streamPlayNote = 0;
+    m_midiToneBus = -1;
+    m_midiDrumBus = -1;
 }
 
 CSynthesizer::~CSynthesizer()
 {
+    StopInstruments();
+}
+
+void CSynthesizer::SetSampleRate(double s)
+{
+    m_sampleRate = s;
+    m_samplePeriod = 1.0 / s;
+    m_fx.SetSampleRate(s);
+
+    for (Bus& bus : m_buses)
+    {
+        bus.fx.SetSampleRate(s);
+    }
+}
+
+void CSynthesizer::SetOversampling(int factor)
+{
+    m_oversampling = factor;
+    m_fx.SetOversampling(factor);
+
+    for (Bus& bus : m_buses)
+    {
+        bus.fx.SetOversampling(factor);
+    }
+}
+
+void CSynthesizer::SetNumChannels(int n)
+{
+    CChannelLayout::Layout layout;
+    if (CChannelLayout::FromChannels(n, layout))
+        SetLayout(layout);
+}
+
+void CSynthesizer::SetLayout(CChannelLayout::Layout layout)
+{
+    m_defaultLayout.SetLayout(layout);
+    m_layout.SetLayout(layout);
 }
 
 void CSynthesizer::Clear()
 {
-    m_instruments.clear();
+    StopInstruments();
+    m_buses.clear();
     m_notes.clear();
+    m_score = NULL;
+    m_numNotes = 0;
+    m_bin.Close();
+    m_lanes.clear();
+    m_strings.Clear();
+    m_setup.clear();
+    m_runs.clear();
+    m_patterns.clear();
+    m_instances.clear();
+    m_renderings.clear();
+    m_tempo.Clear(m_bpm, m_beatspermeasure);
+    m_tuning = EqualTuning;
+    m_layout = m_defaultLayout;
+    m_stream.Close();
+    m_midi.Close();
+    m_streaming = false;
+    m_streamFile.clear();
+    m_fx.SetDefaultChain();
+}
+
+//! Delete any instruments still playing
+void CSynthesizer::StopInstruments()
+{
+    for (Bus& bus : m_buses)
+    {
+        for (Active& active : bus.instruments)
+        {
+            delete active.instrument;
+        }
+
+        bus.instruments.clear();
+    }
+}
+
+//! Find a bus by name, creating it if it does not exist yet
+int CSynthesizer::BusIndex(const std::wstring& name)
+{
+    for (int b = 0; b < (int)m_buses.size(); b++)
+    {
+        if (m_buses[b].name == name)
+            return b;
+    }
+
+    m_buses.push_back(Bus());
+    Bus& bus = m_buses.back();
+    bus.name = name;
+    bus.fx.Clear();             // Buses start with an empty chain
+    bus.fx.SetSampleRate(m_sampleRate);
+    bus.fx.SetOversampling(m_oversampling);
+    bus.gain = 1.0;
+    bus.pan = 0.0;
+    bus.azimuth = 0.0;
+    bus.surround = false;
+    bus.isKey = false;
+    bus.delayPos = 0;
+    bus.recording = -1;
+    bus.recorded = 0;
+
+    return (int)m_buses.size() - 1;
 }
 
 //! Start the synthesizer
 void CSynthesizer::Start()
 {
-    m_instruments.clear();
-    m_currentNote = 0;
-    m_measure = 0;
-    m_beat = 0;
-    m_time = 0;
+    Reset(0);
+
+    // A streamed score is read again from the top
+    if (m_streaming)
+        RewindStream();
+
+    PlanPatterns();
+
+    // Streamed notes are let go of as they are played, so there is
+    // nothing to keep a render against
+    m_capture = NULL;
+    if (m_recording && !m_streaming)
+    {
+        BeginRecording(m_record);
+        m_capture = &m_record;
+    }
 }
 
-//! Generate one audio frame
-bool CSynthesizer::Generate(double* frame)
+//! Put the score position back at the start, and reset the
+//! effects to run from the given frame
+void CSynthesizer::Reset(int frame)
 {
-    //
-    // Phase 1: Determine if any notes need to be played.
-    //
+    StopInstruments();
+    m_currentNote = 0;
+    m_frame = 0;
+    m_dueNote = -1;
+    m_time = 0;
 
-    while (m_currentNote < (int)m_notes.size())
-    {
-        // Get a pointer to the current note
-        CNote* note = &m_notes[m_currentNote];
+    // Put every automated parameter at its starting value before
+    // the effects are reset, so nothing ramps in from the load value
+    if (!m_lanes.empty())
+        AutomateMix(0.0);
 
-        // If the measure is in the future we can't play
-        // this note just yet.
-        if (note->Measure() > m_measure)
-            break;
+    // The buses and the layout are complete once the score is
+    // loaded, so the buffer pointers handed to the sidechains stay
+    // valid.
+    const int channels = GetNumChannels();
+    m_block.Resize(channels, CEffects::MaxBlock);
+    m_fx.SetNumChannels(channels);
 
-        // If this is the current measure, but the
-        // beat has not been reached, we can't play
-        // this note.
-        if (note->Measure() == m_measure && note->Beat() > m_beat)
-            break;
+    m_busLatency = 0;
+    for (Bus& bus : m_buses)
+    {
+        bus.audio.Resize(channels, CEffects::MaxBlock);
+        bus.fx.SetNumChannels(channels);
+        bus.fx.Reset(frame);
+        BusGains(bus, bus.mix);
+        if (bus.fx.Latency() > m_busLatency)
+            m_busLatency = bus.fx.Latency();
 
-        //
-        // Play the note!
-        //
+        bus.isKey = false;
+        for (const Bus& other : m_buses)
+        {
+            if (other.fx.UsesSidechain(bus.name))
+                bus.isKey = true;
+        }
+
+        bus.key.Resize(bus.isKey ? channels : 0, CEffects::MaxBlock);
+    }
 
-        // Create the instrument object
-        CInstrument* instrument = NULL;
-        if (note->Instrument() == L"ToneInstrument")
+    for (Bus& bus : m_buses)
+    {
+        if (bus.isKey)
         {
-            instrument = new CToneInstrument();
+            double* key[CChannelLayout::MaxChannels];
+            bus.key.Channels(0, key);
+            for (Bus& other : m_buses)
+            {
+                other.fx.ConnectSidechain(bus.name, key);
+            }
         }
-        else if (note->Instrument() == L"DrumInstrument")
+
+        bus.delay.Resize(channels, m_busLatency - bus.fx.Latency());
+        bus.delayPos = 0;
+        bus.recording = -1;
+    }
+
+    // Renderings that were cut off part way are recorded again
+    for (Instance& instance : m_instances)
+        instance.state = InstanceIdle;
+
+    for (Rendering& rendering : m_renderings)
+    {
+        if (!rendering.ready)
         {
-            instrument = new CDrumInstrument();
+            for (std::vector<double>& audio : rendering.audio)
+                audio.clear();
         }
+    }
 
-        // Configure the instrument object
-        if (instrument != NULL)
+    m_fx.Reset(frame);
+    m_blockPos = 0;
+    m_blockLen = 0;
+    m_done = false;
+    m_tail = 0;
+
+    // Effects that look ahead delay the audio.  Dropping that many
+    // frames at the start keeps the output aligned with the score.
+    m_skip = Latency();
+}
+
+//! Generate one audio frame
+bool CSynthesizer::Generate(double* frame)
+{
+    while (m_blockPos >= m_blockLen)
+    {
+        if (m_done && m_tail == 0)
         {
-            instrument->SetSampleRate(GetSampleRate());
-            instrument->SetNote(note);
-            instrument->Start();
+            if (m_streaming)
+                ReportStream();
+
+            if (m_capture != NULL)
+            {
+                m_capture->complete = true;
+                m_capture = NULL;
+            }
 
-            m_instruments.push_back(instrument);
+            return false;
         }
 
-        m_currentNote++;
+        RenderBlock();
     }
 
-    //
-    // Phase 2: Clear all channels to silence 
-    //
+    const int channels = GetNumChannels();
+    for (int c = 0; c < channels; c++)
+        frame[c] = m_block.Channel(c)[m_blockPos];
 
-    for (int c = 0; c < GetNumChannels(); c++)
+    if (m_capture != NULL)
     {
-        frame[c] = 0;
+        for (int c = 0; c < channels; c++)
+            m_capture->audio.push_back((float)frame[c]);
     }
 
-    //
-    // Phase 3: Play an active instruments
-    //
+    m_blockPos++;
+    return true;
+}
 
-    //
-    // We have a list of active (playing) instruments.  We iterate over 
-    // that list.  For each instrument we call generate, then add the
-    // output to our output frame.  If an instrument is done (Generate()
-    // returns false), we remove it from the list.
-    //
+//! Render the next block of frames and run the effects over it
+void CSynthesizer::RenderBlock()
+{
+    m_blockPos = 0;
+    m_blockLen = 0;
 
-    for (list<CInstrument*>::iterator node = m_instruments.begin(); node != m_instruments.end(); )
+    if (m_streaming && !m_done)
+        FillStream();
+
+    for (Bus& bus : m_buses)
     {
-        // Since we may be removing an item from the list, we need to know in 
-        // advance, what is after it in the list.  We keep that node as "next"
-        list<CInstrument*>::iterator next = node;
-        next++;
+        bus.audio.Clear();
+    }
 
-        // Get a pointer to the allocated instrument
-        CInstrument* instrument = *node;
+    while (m_blockLen < CEffects::MaxBlock)
+    {
+        // Remember where each control block starts in the score,
+        // for the lanes read when the effects run below
+        if (m_blockLen % ControlBlock == 0)
+            m_tickBeat[m_blockLen / ControlBlock] = m_tempo.BeatAt(m_frame * m_samplePeriod);
 
-        // Call the generate function
-        if (instrument->Generate())
+        if (!m_done)
         {
-            // If we returned true, we have a valid sample.  Add it 
-            // to the frame.
-            for (int c = 0; c < GetNumChannels(); c++)
+            if (!GenerateFrame(m_blockLen))
             {
-                frame[c] += instrument->Frame(c);
+                // Flush the audio still held in the effects' delay lines
+                m_done = true;
+                m_tail = Latency();
+                continue;
             }
         }
+        else if (m_tail > 0)
+        {
+            m_tail--;
+        }
         else
         {
-            // If we returned false, the instrument is done.  Remove it
-            // from the list and delete it from memory.
-            m_instruments.erase(node);
-            delete instrument;
+            break;
         }
 
-        // Move to the next instrument in the list
-        node = next;
+        m_blockLen++;
     }
 
-    m_fx.Process(frame);   // basic effects + mixing component.
+    m_block.Clear();
 
-    //
-    // Phase 4: Advance the time and beats
-    //
+    // With automation the effects run one control block at a time,
+    // each with the parameters for its position in the score.
+    const int step = m_lanes.empty() ? CEffects::MaxBlock : ControlBlock;
+    for (int start = 0; start < m_blockLen; start += step)
+    {
+        const int frames = m_blockLen - start < step ? m_blockLen - start : step;
 
-    // Time advances by the sample period
-    m_time += GetSamplePeriod();
+        if (!m_lanes.empty())
+            AutomateMix(m_tickBeat[start / ControlBlock]);
+
+        // Sidechain keys are the dry bus signals, captured before
+        // any bus runs its effects so the bus order does not matter.
+        for (Bus& bus : m_buses)
+        {
+            for (int c = 0; c < bus.key.NumChannels(); c++)
+            {
+                std::memcpy(bus.key.Channel(c), bus.audio.Channel(c) + start, frames * sizeof(double));
+            }
+        }
 
-    // Beat advances by the sample period divided by the 
-    // number of seconds per beat.  The inverse of seconds
-    // per beat is beats per second.
-    m_beat += GetSamplePeriod() / m_secperbeat;
+        for (Bus& bus : m_buses)
+        {
+            MixBus(bus, start, frames);
+        }
 
-    // When the measure is complete, we move to
-    // a new measure.  We might be a fraction into
-    // the new measure, so we subtract out rather 
-    // than just setting to zero.
-    if (m_beat > m_beatspermeasure)
-    {
-        m_beat -= m_beatspermeasure;
-        m_measure++;
+        double* out[CChannelLayout::MaxChannels];
+        m_block.Channels(start, out);
+        m_fx.Process(out, frames);
     }
 
-    //
-    // Phase 5: Determine when we are done
-    //
-
-    // We are done when there is nothing to play.  We'll put something more 
-    // complex here later.
-    return !m_instruments.empty() || m_currentNote < (int)m_notes.size();
+    if (m_skip > 0)
+    {
+        m_blockPos = m_skip < m_blockLen ? m_skip : m_blockLen;
+        m_skip -= m_blockPos;
+    }
 }
 
-void CSynthesizer::OpenScore(CString& filename)
+//! Run a bus's effects over frames [start, start+frames) and add
+//! it to the master block at its gain and place in the layout
+void CSynthesizer::MixBus(Bus& bus, int start, int frames)
 {
-    Clear();
+    double* in[CChannelLayout::MaxChannels];
+    bus.audio.Channels(start, in);
+    bus.fx.Process(in, frames);
 
-    //
-    // Create an XML document
-    //
+    // Ramp the channel gains to their new values across the frames
+    double to[CChannelLayout::MaxChannels];
+    BusGains(bus, to);
 
-    CComPtr<IXMLDOMDocument>  pXMLDoc;
-    bool succeeded = SUCCEEDED(CoCreateInstance(CLSID_DOMDocument, NULL, CLSCTX_INPROC_SERVER,
-        IID_IXMLDOMDocument, (void**)&pXMLDoc));
-    if (!succeeded)
+    const int delay = bus.delay.NumFrames();
+    int pos = bus.delayPos;
+    for (int c = 0; c < GetNumChannels(); c++)
     {
-        AfxMessageBox(L"Failed to create an XML document to use");
-        return;
-    }
+        const double* x = in[c];
+        double* out = m_block.Channel(c) + start;
+        double gain = bus.mix[c];
+        const double step = (to[c] - gain) / frames;
+        bus.mix[c] = to[c];
 
-    // Open the XML document
-    VARIANT_BOOL ok;
-    succeeded = SUCCEEDED(pXMLDoc->load(CComVariant(filename), &ok));
-    if (!succeeded || ok == VARIANT_FALSE)
-    {
-        AfxMessageBox(L"Failed to open XML score file");
-        return;
+        if (delay == 0)
+        {
+            // A channel the bus is not placed in is left alone,
+            // which in the surround layouts is most of them
+            if (gain == 0.0 && step == 0.0)
+                continue;
+
+            for (int i = 0; i < frames; i++)
+            {
+                gain += step;
+                out[i] += gain * x[i];
+            }
+            continue;
+        }
+
+        // Delay the bus so it lines up with the bus of largest latency
+        double* line = bus.delay.Channel(c);
+        pos = bus.delayPos;
+        for (int i = 0; i < frames; i++)
+        {
+            gain += step;
+            out[i] += line[pos];
+            line[pos] = gain * x[i];
+            if (++pos == delay)
+                pos = 0;
+        }
     }
+    bus.delayPos = pos;
+}
 
-    //
-    // Traverse the XML document in memory!!!!
-    // Top level tag is <score>
-    //
+//! Channel gains that place a bus in the layout at its level, by
+//! its azimuth if it has one and otherwise by its pan
+void CSynthesizer::BusGains(const Bus& bus, double* gains) const
+{
+    if (bus.surround)
+        m_layout.AzimuthGains(bus.gain, bus.azimuth, gains);
+    else
+        m_layout.PanGains(bus.gain, bus.pan, gains);
+}
 
-    CComPtr<IXMLDOMNode> node;
-    pXMLDoc->get_firstChild(&node);
-    for (; node != NULL; NextNode(node))
+//! Set the bus and effect parameters from their lanes.  The
+//! effects ramp to the new values over the next control block.
+void CSynthesizer::AutomateMix(double beat)
+{
+    for (Lane& lane : m_lanes)
     {
-        // Get the name of the node
-        CComBSTR nodeName;
-        node->get_nodeName(&nodeName);
-
-        if (nodeName == L"score")
+        if (lane.target == BusLane)
+        {
+            Bus& bus = m_buses[lane.bus];
+            if (lane.param == L"pan")
+                bus.pan = std::fmax(-1.0, std::fmin(1.0, lane.curve.ValueAt(beat)));
+            else if (lane.param == L"azimuth")
+                bus.azimuth = lane.curve.ValueAt(beat);
+            else
+                bus.gain = lane.curve.ValueAt(beat);
+        }
+        else if (lane.target == EffectLane)
         {
-            XmlLoadScore(node);
+            CEffects& fx = lane.bus < 0 ? m_fx : m_buses[lane.bus].fx;
+            fx.SetParam(lane.stage, lane.param.c_str(), lane.curve.ValueAt(beat));
         }
     }
+}
+
+/*! True if a note is due to start on the current frame
+ *
+ * The frame a note starts on is looked up in the tempo map once,
+ * when it becomes the next note to play.
+ */
+bool CSynthesizer::NoteDue(int note)
+{
+    if (note != m_dueNote)
+    {
+        m_dueNote = note;
+        m_dueFrame = m_tempo.Seconds(m_score[note].Measure(), m_score[note].Beat()) * m_sampleRate;
+    }
+
+    return m_frame >= m_dueFrame;
+}
+
+//! Create and start the instrument for a note, NULL if there is none
+CInstrument* CSynthesizer::CreateInstrument(const CNote* note)
+{
+    CInstrument* instrument = NewInstrument(note);
+    if (instrument != NULL)
+        instrument->Start();
 
-    sort(m_notes.begin(), m_notes.end());
+    return instrument;
 }
 
-void CSynthesizer::XmlLoadScore(IXMLDOMNode* xml)
+//! Create the instrument for a note and give it the note, without
+//! starting it
+CInstrument* CSynthesizer::NewInstrument(const CNote* note)
 {
-    // Get a list of all attribute nodes and the
-    // length of that list
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    xml->get_attributes(&attributes);
-    long len;
-    attributes->get_length(&len);
+    // Create the instrument object
+    CInstrument* instrument = NULL;
+    const wstring& name = m_strings.Get(note->Instrument());
+    if (note->Bus() < 0 || note->Bus() >= (int)m_buses.size())
+    {
+        // Only a damaged compiled score can get here
+    }
+    else if (name == L"ToneInstrument")
+    {
+        instrument = new CToneInstrument();
+    }
+    else if (name == L"DrumInstrument")
+    {
+        CDrumInstrument* drum = new CDrumInstrument();
+        drum->SetOversampling(m_oversampling);
+        instrument = drum;
+    }
 
-    // Loop over the list of attributes
-    for (int i = 0; i < len; i++)
+    // Configure the instrument object
+    if (instrument != NULL)
     {
-        // Get attribute i
-        CComPtr<IXMLDOMNode> attrib;
-        attributes->get_item(i, &attrib);
+        instrument->SetSampleRate(GetSampleRate());
+        instrument->SetNumChannels(GetNumChannels());
+        instrument->SetStrings(&m_strings);
+        instrument->SetTuning(&m_tuning);
+        instrument->SetTempo(&m_tempo);
+
+        const int from = note->Instance();
+        instrument->SetOrigin(from >= 0 && from < (int)m_instances.size() ? m_instances[from].measure : 0);
+        instrument->SetNote(note);
+    }
 
-        // Get the name of the attribute
-        CComBSTR name;
-        attrib->get_nodeName(&name);
+    return instrument;
+}
+
+//! Generate frame i of the block into the bus buffers
+bool CSynthesizer::GenerateFrame(int i)
+{
+    //
+    // Phase 1: Determine if any notes need to be played.
+    //
 
-        // Get the value of the attribute.  A CComVariant is a variable
-        // that can have any type. It loads the attribute value as a
-        // string (UNICODE), but we can then change it to an integer 
-        // (VT_I4) or double (VT_R8) using the ChangeType function 
-        // and then read its integer or double value from a member variable.
-        CComVariant value;
-        attrib->get_nodeValue(&value);
+    while (m_currentNote < m_numNotes && NoteDue(m_currentNote))
+    {
+        //
+        // Play the note!
+        //
 
-        if (name == L"bpm")
+        const CNote* note = m_score + m_currentNote;
+        const bool replayed = Replay(m_currentNote);
+        CInstrument* instrument = replayed ? NULL : CreateInstrument(note);
+        if (instrument != NULL)
         {
-            value.ChangeType(VT_R8);
-            m_bpm = value.dblVal;
-            m_secperbeat = 1 / (m_bpm / 60);
+            Active active = { instrument, m_currentNote };
+            m_buses[note->Bus()].instruments.push_back(active);
         }
-        else if (name == L"beatspermeasure")
+
+        if (m_capture != NULL)
         {
-            value.ChangeType(VT_I4);
-            m_beatspermeasure = value.intVal;
+            // A note with no instrument is over as soon as it starts
+            m_capture->noteStart[m_currentNote] = m_frame;
+            if (instrument == NULL && !replayed)
+                m_capture->noteEnd[m_currentNote] = m_frame;
         }
 
+        m_currentNote++;
     }
 
+    //
+    // Phase 2: Play an active instruments
+    //
 
-    CComPtr<IXMLDOMNode> node;
-    xml->get_firstChild(&node);
-    for (; node != NULL; NextNode(node))
-    {
-        // Get the name of the node
-        CComBSTR name;
-        node->get_nodeName(&name);
+    //
+    // Each bus has a list of active (playing) instruments.  We iterate over 
+    // those lists.  For each instrument we call generate, then add the
+    // output to frame i of its bus.  If an instrument is done (Generate()
+    // returns false), we remove it from the list.  The bus buffers were
+    // cleared to silence when the block started.
+    //
 
-        if (name == L"instrument")
+    bool playing = false;
+    for (Bus& bus : m_buses)
+    {
+        for (list<Active>::iterator node = bus.instruments.begin(); node != bus.instruments.end(); )
         {
-            XmlLoadInstrument(node);
+            // Since we may be removing an item from the list, we need to know in 
+            // advance, what is after it in the list.  We keep that node as "next"
+            list<Active>::iterator next = node;
+            next++;
+
+            // Get a pointer to the allocated instrument
+            CInstrument* instrument = node->instrument;
+
+            if (node->rendering != NULL)
+            {
+                // A pattern instance played back, which ends on the
+                // frame its instruments did
+                if (node->pos < (int)node->rendering->audio[0].size())
+                {
+                    for (int c = 0; c < GetNumChannels(); c++)
+                        bus.audio.Channel(c)[i] += node->rendering->audio[c][node->pos];
+                    node->pos++;
+                }
+                else
+                {
+                    bus.instruments.erase(node);
+                }
+            }
+            // Call the generate function
+            else if (instrument->Generate())
+            {
+                // If we returned true, we have a valid sample.  Add it 
+                // to its bus.
+                for (int c = 0; c < GetNumChannels(); c++)
+                    bus.audio.Channel(c)[i] += instrument->Frame(c);
+            }
+            else
+            {
+                // If we returned false, the instrument is done.  Remove it
+                // from the list and delete it from memory.
+                if (m_capture != NULL)
+                    m_capture->noteEnd[node->note] = m_frame;
+
+                bus.instruments.erase(node);
+                delete instrument;
+            }
+
+            // Move to the next instrument in the list
+            node = next;
         }
+
+        if (bus.recording >= 0)
+            Record(bus, i);
+
+        playing = playing || !bus.instruments.empty();
     }
+
+    //
+    // Phase 3: Advance the time.  The tempo map says where in the
+    // score each frame is, so there is no beat to step.
+    //
+
+    m_frame++;
+    m_time = m_frame * GetSamplePeriod();
+
+    //
+    // Phase 4: Determine when we are done
+    //
+
+    // We are done when there is nothing to play.  We'll put something more 
+    // complex here later.
+    return playing || m_currentNote < m_numNotes;
 }
 
-void CSynthesizer::XmlLoadInstrument(IXMLDOMNode* xml)
+//
+// Pattern renderings
+//
+
+//! Longest a pattern instance can sound for and still be recorded
+//! for the others, in seconds
+static const double MaxRenderingSeconds = 30.0;
+
+/*! Find the pattern instances that can share a rendering
+ *
+ * An instance can be played back from a recording of another if
+ * the two sound the same and nothing else sounds on the bus while
+ * either plays, so the bus carries nothing but the instance.  They
+ * sound the same if they play the same pattern with their notes the
+ * same number of frames apart and lasting the same number of
+ * seconds, which the tempo map decides.  The drum noise follows the
+ * place in the pattern, not in the score.  Effects run on the bus
+ * after the rendering is added, so their state does not matter.
+ */
+void CSynthesizer::PlanPatterns()
 {
-    wstring instrument = L"";
+    m_renderings.clear();
+    for (Instance& instance : m_instances)
+        instance.rendering = -1;
+
+    // Streamed notes are not all there to plan with
+    if (m_instances.empty() || m_streaming)
+        return;
+
+    std::vector<int> starts;
+    std::vector<int> blocks;
+    Schedule(0, starts, blocks);
 
-    // Get a list of all attribute nodes and the
-    // length of that list
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    xml->get_attributes(&attributes);
-    long len;
-    attributes->get_length(&len);
+    // The frame each note stops sounding by.  Instruments can stop
+    // a frame or two past their length, so allow for it.
+    std::vector<int> ends(m_numNotes);
+    std::vector<char> usable(m_instances.size(), 1);
+    std::vector<std::vector<double>> keys(m_instances.size());
+    for (Instance& instance : m_instances)
+    {
+        instance.start = -1;
+        instance.frames = 0;
+        instance.notes = 0;
+    }
 
-    // Loop over the list of attributes
-    for (int i = 0; i < len; i++)
+    for (int j = 0; j < m_numNotes; j++)
     {
-        // Get attribute i
-        CComPtr<IXMLDOMNode> attrib;
-        attributes->get_item(i, &attrib);
+        const CNote* note = m_score + j;
+        CInstrument* instrument = NewInstrument(note);
+        const double length = instrument != NULL ? instrument->Length() : 0;
+        delete instrument;
 
-        // Get the name of the attribute
-        CComBSTR name;
-        attrib->get_nodeName(&name);
+        ends[j] = starts[j] + (int)ceil(length * m_sampleRate) + 2;
 
-        // Get the value of the attribute.  
-        CComVariant value;
-        attrib->get_nodeValue(&value);
+        const int from = note->Instance();
+        if (from < 0 || from >= (int)m_instances.size())
+            continue;
 
-        if (name == L"instrument")
+        Instance& instance = m_instances[from];
+        std::vector<double>& key = keys[from];
+        if (instance.notes == 0)
         {
-            instrument = value.bstrVal;
+            instance.start = starts[j];
+            key.push_back(instance.pattern);
+            key.push_back(note->Bus());
         }
+
+        if (instrument == NULL || note->Bus() != key[1])
+            usable[from] = 0;
+
+        if (ends[j] - instance.start > instance.frames)
+            instance.frames = ends[j] - instance.start;
+
+        key.push_back(starts[j] - instance.start);
+        key.push_back(note->Duration() >= 0 ? m_tempo.Duration(note->Measure(), note->Beat(), note->Duration()) : -1);
+        key.push_back(length);
+        instance.notes++;
+    }
+
+    // The starts of the notes on each bus, in order, and the latest
+    // end of the notes up to each one
+    std::vector<std::vector<int>> busStarts(m_buses.size());
+    std::vector<std::vector<int>> busEnds(m_buses.size());
+    for (int j = 0; j < m_numNotes; j++)
+    {
+        const int b = m_score[j].Bus();
+        if (b < 0 || b >= (int)m_buses.size())
+            continue;
+
+        const int end = busEnds[b].empty() || ends[j] > busEnds[b].back() ? ends[j] : busEnds[b].back();
+        busStarts[b].push_back(starts[j]);
+        busEnds[b].push_back(end);
+    }
+
+    std::map<std::vector<double>, std::vector<int>> alike;
+    for (int i = 0; i < (int)m_instances.size(); i++)
+    {
+        const Instance& instance = m_instances[i];
+        if (!usable[i] || instance.notes == 0 || instance.frames > MaxRenderingSeconds * m_sampleRate)
+            continue;
+
+        // Nothing may still be sounding when it starts, and only
+        // its own notes may start before it ends
+        const int b = (int)keys[i][1];
+        const std::vector<int>& s = busStarts[b];
+        const int first = (int)(std::lower_bound(s.begin(), s.end(), instance.start) - s.begin());
+        const int last = (int)(std::upper_bound(s.begin(), s.end(), instance.start + instance.frames) - s.begin());
+        if (first > 0 && busEnds[b][first - 1] > instance.start)
+            continue;
+        if (last - first != instance.notes)
+            continue;
+
+        alike[keys[i]].push_back(i);
+    }
+
+    // A rendering only pays off if it is played back
+    for (const auto& group : alike)
+    {
+        if (group.second.size() < 2)
+            continue;
+
+        for (int i : group.second)
+            m_instances[i].rendering = (int)m_renderings.size();
+
+        Rendering rendering;
+        rendering.ready = false;
+        m_renderings.push_back(rendering);
     }
+}
+
+/*! Start a note of a pattern instance that shares a rendering
+ *
+ * The first note of the instance plays the rendering back if it has
+ * been recorded, or else starts recording it from the bus.  Returns
+ * true if the note is played back, and so needs no instrument.
+ */
+bool CSynthesizer::Replay(int note)
+{
+    const int from = m_score[note].Instance();
+    if (from < 0 || from >= (int)m_instances.size() || m_instances[from].rendering < 0)
+        return false;
 
+    Instance& instance = m_instances[from];
+    Rendering& rendering = m_renderings[instance.rendering];
+    Bus& bus = m_buses[m_score[note].Bus()];
 
-    CComPtr<IXMLDOMNode> node;
-    xml->get_firstChild(&node);
-    for (; node != NULL; NextNode(node))
+    if (instance.state == InstanceIdle)
     {
-        // Get the name of the node
-        CComBSTR name;
-        node->get_nodeName(&name);
+        // An instance the render started part way through is played
+        // as it is written
+        if (m_frame != instance.start)
+            return false;
 
-        if (name == L"note")
+        if (rendering.ready)
         {
-            XmlLoadNote(node, instrument);
+            Active active = { NULL, note, &rendering, 0 };
+            bus.instruments.push_back(active);
+            instance.state = InstanceReplaying;
         }
+        else if (bus.recording < 0)
+        {
+            for (std::vector<double>& audio : rendering.audio)
+                audio.clear();
+            bus.recording = from;
+            bus.recorded = 0;
+            instance.state = InstanceRecording;
+        }
+    }
+
+    if (instance.state == InstanceReplaying)
+    {
+        // Every note of it is over when the rendering is
+        if (m_capture != NULL)
+            m_capture->noteEnd[note] = instance.start + (int)rendering.audio[0].size();
+
+        return true;
     }
+
+    if (instance.state == InstanceRecording && bus.recording == from)
+        bus.recorded++;
+
+    return false;
 }
 
-void CSynthesizer::XmlLoadNote(IXMLDOMNode* xml, std::wstring& instrument)
+//! Add frame i of a bus to the rendering it is recording, and finish
+//! it once all of the instance has started and stopped
+void CSynthesizer::Record(Bus& bus, int i)
 {
-    m_notes.push_back(CNote());
-    m_notes.back().XmlLoad(xml, instrument);
+    Instance& instance = m_instances[bus.recording];
+    Rendering& rendering = m_renderings[instance.rendering];
+
+    if (bus.recorded == instance.notes && bus.instruments.empty())
+    {
+        rendering.ready = true;
+    }
+    else if (m_frame - instance.start < instance.frames)
+    {
+        for (int c = 0; c < GetNumChannels(); c++)
+            rendering.audio[c].push_back(bus.audio.Channel(c)[i]);
+        return;
+    }
+    else
+    {
+        // Sounding longer than planned; leave it for the next instance
+        for (std::vector<double>& audio : rendering.audio)
+            audio.clear();
+    }
+
+    instance.state = InstanceIdle;
+    bus.recording = -1;
+}
+
+//
+// Incremental rendering
+//
+
+//! Frames the output has to match the old render for at a seam
+static const int SeamFrames = 2048;
+
+//! Largest difference between the old and new output that counts
+//! as a match, under one step of 16-bit audio
+static const double SeamTolerance = 1.0 / 32768.0;
+
+void CSynthesizer::SetRecording(bool record)
+{
+    m_recording = record;
+    if (!record)
+        m_record = Recording();
+}
+
+//! Start keeping a render of the current score in record
+void CSynthesizer::BeginRecording(Recording& record)
+{
+    record.complete = false;
+    record.sampleRate = m_sampleRate;
+    record.oversampling = m_oversampling;
+    record.channels = GetNumChannels();
+    record.setup = m_setup;
+    record.notes.assign(m_score, m_score + m_numNotes);
+    record.strings = m_strings;
+    record.noteStart.assign(m_numNotes, -1);
+    record.noteEnd.assign(m_numNotes, -1);
+    record.audio.clear();
+}
+
+bool CSynthesizer::CanRenderIncremental() const
+{
+    return m_recording && !m_streaming && m_record.complete && m_record.sampleRate == m_sampleRate &&
+        m_record.oversampling == m_oversampling && m_record.channels == GetNumChannels() &&
+        m_record.setup == m_setup && !m_setup.empty();
+}
+
+//! True if two notes, each with its own string table, play the same thing
+static bool SameNote(const CNote& a, const CStringTable& as, const CNote& b, const CStringTable& bs)
+{
+    return a.Measure() == b.Measure() && a.Beat() == b.Beat() && a.Bus() == b.Bus() &&
+        a.Duration() == b.Duration() && a.Velocity() == b.Velocity() && a.Pitch() == b.Pitch() &&
+        a.Instance() == b.Instance() &&
+        as.Get(a.Instrument()) == bs.Get(b.Instrument()) && as.Get(a.Type()) == bs.Get(b.Type()) &&
+        as.Get(a.Name()) == bs.Get(b.Name());
+}
+
+/*! Pair the notes of the current score with the recorded ones
+ *
+ * match[j] is the recorded note the current note j plays the same
+ * as, or -1 if it is new.  kept[i] is set for every recorded note
+ * that was paired.  Both lists are sorted by position, so notes are
+ * only compared with notes at the same measure and beat.
+ */
+void CSynthesizer::MatchNotes(std::vector<int>& match, std::vector<char>& kept) const
+{
+    const std::vector<CNote>& old = m_record.notes;
+    const int numOld = (int)old.size();
+    match.assign(m_numNotes, -1);
+    kept.assign(numOld, 0);
+
+    int i = 0;
+    int j = 0;
+    while (i < numOld && j < m_numNotes)
+    {
+        const CNote& a = old[i];
+        const CNote& b = m_score[j];
+        if (a.Measure() < b.Measure() || (a.Measure() == b.Measure() && a.Beat() < b.Beat()))
+        {
+            i++;
+            continue;
+        }
+
+        if (b.Measure() < a.Measure() || (b.Measure() == a.Measure() && b.Beat() < a.Beat()))
+        {
+            j++;
+            continue;
+        }
+
+        // Both scores have notes at this position
+        int iEnd = i;
+        while (iEnd < numOld && old[iEnd].Measure() == a.Measure() && old[iEnd].Beat() == a.Beat())
+            iEnd++;
+
+        int jEnd = j;
+        while (jEnd < m_numNotes && m_score[jEnd].Measure() == b.Measure() && m_score[jEnd].Beat() == b.Beat())
+            jEnd++;
+
+        for (int n = j; n < jEnd; n++)
+        {
+            for (int o = i; o < iEnd; o++)
+            {
+                if (!kept[o] && SameNote(old[o], m_record.strings, m_score[n], m_strings))
+                {
+                    kept[o] = 1;
+                    match[n] = o;
+                    break;
+                }
+            }
+        }
+
+        i = iEnd;
+        j = jEnd;
+    }
+}
+
+/*! Work out when each note starts without rendering
+ *
+ * starts[j] is the frame note j starts on, the first frame at or
+ * after its place in the tempo map, as NoteDue() decides it.
+ * blocks[b] is the number of notes started before render block b,
+ * for every block up to the given frame and the last note.
+ */
+void CSynthesizer::Schedule(int frames, std::vector<int>& starts, std::vector<int>& blocks)
+{
+    starts.assign(m_numNotes, 0);
+    int last = frames;
+    for (int j = 0; j < m_numNotes; j++)
+    {
+        const double frame = m_tempo.Seconds(m_score[j].Measure(), m_score[j].Beat()) * m_sampleRate;
+        if (frame > 0)
+            starts[j] = (int)ceil(frame);
+        if (starts[j] > last)
+            last = starts[j];
+    }
+
+    // The notes are in order, so their starts are too
+    blocks.assign(last / CEffects::MaxBlock + 1, 0);
+    for (int b = 0; b < (int)blocks.size(); b++)
+    {
+        blocks[b] = (int)(std::lower_bound(starts.begin(), starts.end(), b * CEffects::MaxBlock) - starts.begin());
+    }
+}
+
+/*! Start rendering part way through the score
+ *
+ * The frame has to be the start of a render block.  Notes that
+ * started earlier and are still sounding are run up to the frame.
+ * The effects start empty, so their output takes a while to settle,
+ * but LFOs start in step with a full render.
+ */
+void CSynthesizer::StartAt(int frame, int note, const Recording& record)
+{
+    Reset(frame);
+
+    // The caller drops output from before the start of the score
+    m_skip = 0;
+    m_frame = frame;
+    m_time = frame * GetSamplePeriod();
+    m_currentNote = note;
+
+    if (!m_lanes.empty())
+    {
+        AutomateMix(m_tempo.BeatAt(m_time));
+        for (Bus& bus : m_buses)
+        {
+            BusGains(bus, bus.mix);
+        }
+    }
+
+    for (int j = 0; j < note; j++)
+    {
+        if (record.noteStart[j] < 0 || record.noteEnd[j] < frame)
+            continue;
+
+        CInstrument* instrument = CreateInstrument(m_score + j);
+        if (instrument == NULL)
+            continue;
+
+        bool playing = true;
+        for (int f = record.noteStart[j]; f < frame && playing; f++)
+            playing = instrument->Generate();
+
+        if (playing)
+        {
+            Active active = { instrument, j };
+            m_buses[m_score[j].Bus()].instruments.push_back(active);
+        }
+        else
+        {
+            delete instrument;
+        }
+    }
+}
+
+int CSynthesizer::RenderIncremental()
+{
+    if (!CanRenderIncremental())
+        return 0;
+
+    // Latency of the effects, and so how far the output trails the
+    // score, and how long they take to forget a change
+    Reset(0);
+    PlanPatterns();
+    const int latency = Latency();
+    int busTail = 0;
+    for (const Bus& bus : m_buses)
+    {
+        if (bus.fx.Tail() > busTail)
+            busTail = bus.fx.Tail();
+    }
+
+    const int tail = busTail + m_fx.Tail();
+
+    Recording next;
+    BeginRecording(next);
+
+    std::vector<int> match;
+    std::vector<char> kept;
+    MatchNotes(match, kept);
+
+    const int channels = GetNumChannels();
+    const int oldFrames = (int)(m_record.audio.size() / channels);
+    std::vector<int> blocks;
+    Schedule(oldFrames + latency, next.noteStart, blocks);
+
+    // Notes that stay keep their end frames.  Changed notes are
+    // ranges of the score to render again: removed notes end where
+    // they did, and new ones have to be rendered to find out.
+    struct Change
+    {
+        int start;
+        int old;                //!< Recorded note, or -1
+        int note;               //!< Current note, or -1
+    };
+
+    std::vector<Change> changes;
+    for (int j = 0; j < m_numNotes; j++)
+    {
+        if (match[j] >= 0)
+        {
+            next.noteEnd[j] = m_record.noteEnd[match[j]];
+        }
+        else
+        {
+            Change c = { next.noteStart[j], -1, j };
+            changes.push_back(c);
+        }
+    }
+
+    for (int i = 0; i < (int)kept.size(); i++)
+    {
+        if (!kept[i])
+        {
+            Change c = { m_record.noteStart[i], i, -1 };
+            changes.push_back(c);
+        }
+    }
+
+    std::sort(changes.begin(), changes.end(),
+        [](const Change& a, const Change& b) { return a.start < b.start; });
+
+    std::vector<float>& audio = next.audio;
+    audio = m_record.audio;
+    const std::vector<float>& old = m_record.audio;
+
+    int rendered = 0;
+    size_t c = 0;
+    int preroll = (int)(0.5 * m_sampleRate);
+    while (c < changes.size())
+    {
+        // The first output frame the change can affect, allowing
+        // for the effects looking ahead
+        const int first = changes[c].start - latency;
+
+        // Start early enough for the effects to settle and for the
+        // output before the seam to be checked against the old one
+        int from = first - SeamFrames - preroll;
+        from = from <= 0 ? 0 : from - from % CEffects::MaxBlock;
+        m_capture = &next;
+        StartAt(from, blocks[from / CEffects::MaxBlock], next);
+
+        size_t reached = c;     // Changes the render has reached
+        int until = -1;         // Score frame the reached changes are over by
+        bool open = false;      // A reached change has not ended yet
+        int matching = 0;       // Frames in a row that match the old output
+        bool settled = true;
+        bool converged = false;
+        int out = from - latency;
+        while (!converged && !(m_done && m_tail == 0))
+        {
+            RenderBlock();
+            rendered += m_blockLen;
+
+            for (int i = 0; i < m_blockLen && !converged; i++, out++)
+            {
+                if (out < 0)
+                    continue;
+
+                // The old output is silent past its end
+                bool same = true;
+                for (int ch = 0; ch < channels; ch++)
+                {
+                    const double was = out < oldFrames ? old[(size_t)out * channels + ch] : 0.0;
+                    same = same && fabs(m_block.Channel(ch)[i] - was) <= SeamTolerance;
+                }
+
+                if (out < first)
+                {
+                    // Before the seam the old output is still right
+                    if (from > 0 && out >= first - SeamFrames && !same)
+                    {
+                        settled = false;
+                        break;
+                    }
+                    continue;
+                }
+
+                if ((size_t)(out + 1) * channels > audio.size())
+                    audio.resize((size_t)(out + 1) * channels);
+
+                for (int ch = 0; ch < channels; ch++)
+                    audio[(size_t)out * channels + ch] = (float)m_block.Channel(ch)[i];
+
+                // Take in every change the render has got to
+                while (reached < changes.size() && changes[reached].start - latency <= out)
+                    reached++;
+
+                open = false;
+                until = -1;
+                for (size_t r = c; r < reached; r++)
+                {
+                    const int end = changes[r].old >= 0 ? m_record.noteEnd[changes[r].old] : next.noteEnd[changes[r].note];
+                    if (end < 0)
+                        open = true;
+                    else if (end > until)
+                        until = end;
+                }
+
+                // Past the changes, their releases and the effects
+                // tails, the output has to match the old one again
+                if (!open && out + latency >= until + tail && same)
+                    matching++;
+                else
+                    matching = 0;
+
+                converged = matching >= SeamFrames &&
+                    (reached == changes.size() || changes[reached].start - latency > out);
+            }
+
+            if (!settled)
+                break;
+        }
+
+        if (!settled)
+        {
+            // The effects had not settled by the seam, so start earlier
+            StopInstruments();
+            preroll *= 2;
+            continue;
+        }
+
+        // Rendering to the end of the score takes in every change left
+        if (!converged)
+            reached = changes.size();
+
+        StopInstruments();
+        c = reached;
+        preroll = (int)(0.5 * m_sampleRate);
+    }
+
+    // The output ends on the frame the last note stops on, which
+    // moves if the score got shorter or longer
+    int end = 0;
+    for (int j = 0; j < m_numNotes; j++)
+    {
+        if (next.noteEnd[j] > end)
+            end = next.noteEnd[j];
+    }
+
+    audio.resize((size_t)end * channels);
+
+    m_capture = NULL;
+    next.complete = true;
+    m_record = std::move(next);
+    return rendered;
+}
+
+//
+// Score analysis
+//
+
+//! CPU time each calibration run takes, at least
+static const double CalibrationSeconds = 0.02;
+
+//! Longest a calibration voice is run for, in seconds.  A voice
+//! costs about the same per frame all the way through.
+static const double CalibrationVoice = 2.0;
+
+/*! Time the voice for a note
+ *
+ * Returns the CPU seconds per frame it sounds, averaged over whole
+ * voices so the cost of starting one is included.
+ */
+double CSynthesizer::VoiceCost(const CNote* note)
+{
+    using clock = std::chrono::steady_clock;
+
+    const int longest = (int)(CalibrationVoice * m_sampleRate);
+    long long frames = 0;
+    double elapsed = 0;
+    clock::time_point start = clock::now();
+
+    // The first voice warms up the caches and is not counted
+    for (int run = 0; run == 0 || elapsed < CalibrationSeconds; run++)
+    {
+        CInstrument* instrument = CreateInstrument(note);
+        if (instrument == NULL)
+            return 0;
+
+        for (int f = 0; f < longest && instrument->Generate(); f++)
+            frames++;
+
+        delete instrument;
+        if (run == 0)
+        {
+            frames = 0;
+            start = clock::now();
+        }
+        else
+        {
+            elapsed = std::chrono::duration<double>(clock::now() - start).count();
+        }
+    }
+
+    return frames > 0 ? elapsed / frames : 0;
+}
+
+/*! Time the effects chains and the mix
+ *
+ * Noise goes through every bus and the master chain the way
+ * RenderBlock() runs them.  Returns the CPU seconds per frame.  The
+ * effects are left holding noise, so Reset() has to follow.
+ */
+double CSynthesizer::MixCost()
+{
+    using clock = std::chrono::steady_clock;
+
+    unsigned int rng = 0x1234567u;
+    for (Bus& bus : m_buses)
+    {
+        for (int i = 0; i < CEffects::MaxBlock; i++)
+        {
+            rng ^= rng << 13;  rng ^= rng >> 17;  rng ^= rng << 5;
+            const double noise = rng * (0.5 / 4294967296.0) - 0.25;
+            for (int c = 0; c < bus.audio.NumChannels(); c++)
+                bus.audio.Channel(c)[i] = noise;
+        }
+    }
+
+    const int step = m_lanes.empty() ? CEffects::MaxBlock : ControlBlock;
+    CPlanarBuffer noise;
+    noise.Resize(GetNumChannels(), step);
+    long long frames = 0;
+    double elapsed = 0;
+    const clock::time_point start = clock::now();
+    do
+    {
+        for (int block = 0; block < 16; block++)
+        {
+            // The bus buffers are run in place, so each block starts
+            // from the same noise
+            m_block.Clear();
+            for (int at = 0; at < CEffects::MaxBlock; at += step)
+            {
+                if (!m_lanes.empty())
+                    AutomateMix(0.0);
+
+                for (Bus& bus : m_buses)
+                {
+                    for (int c = 0; c < noise.NumChannels(); c++)
+                        std::memcpy(noise.Channel(c), bus.audio.Channel(c) + at, step * sizeof(double));
+                    MixBus(bus, at, step);
+                    for (int c = 0; c < noise.NumChannels(); c++)
+                        std::memcpy(bus.audio.Channel(c) + at, noise.Channel(c), step * sizeof(double));
+                }
+
+                double* out[CChannelLayout::MaxChannels];
+                m_block.Channels(at, out);
+                m_fx.Process(out, step);
+            }
+
+            frames += CEffects::MaxBlock;
+        }
+
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+    } while (elapsed < CalibrationSeconds);
+
+    return elapsed / frames;
+}
+
+//! Append a string to JSON as a quoted, escaped UTF-8 value
+static void AppendJson(std::string& json, const std::wstring& text)
+{
+    json += '"';
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned long c = (unsigned long)text[i];
+        if (c >= 0xD800 && c < 0xDC00 && i + 1 < text.size())
+        {
+            // A UTF-16 surrogate pair
+            c = 0x10000 + ((c - 0xD800) << 10) + ((unsigned long)text[++i] - 0xDC00);
+        }
+
+        if (c == '"' || c == '\\')
+        {
+            json += '\\';
+            json += (char)c;
+        }
+        else if (c < 0x20)
+        {
+            char escape[8];
+            snprintf(escape, sizeof(escape), "\\u%04lx", c);
+            json += escape;
+        }
+        else if (c < 0x80)
+        {
+            json += (char)c;
+        }
+        else if (c < 0x800)
+        {
+            json += (char)(0xC0 | (c >> 6));
+            json += (char)(0x80 | (c & 0x3F));
+        }
+        else if (c < 0x10000)
+        {
+            json += (char)(0xE0 | (c >> 12));
+            json += (char)(0x80 | ((c >> 6) & 0x3F));
+            json += (char)(0x80 | (c & 0x3F));
+        }
+        else
+        {
+            json += (char)(0xF0 | (c >> 18));
+            json += (char)(0x80 | ((c >> 12) & 0x3F));
+            json += (char)(0x80 | ((c >> 6) & 0x3F));
+            json += (char)(0x80 | (c & 0x3F));
+        }
+    }
+    json += '"';
+}
+
+//! Append a number to JSON
+static void AppendJson(std::string& json, double value)
+{
+    char text[32];
+    snprintf(text, sizeof(text), "%.6g", value);
+    json += text;
+}
+
+std::string CSynthesizer::AnalyzeScore()
+{
+    if (m_streaming)
+    {
+        RewindStream();
+        while (StreamNote())
+        {
+        }
+
+        stable_sort(m_notes.begin(), m_notes.end());
+        m_score = m_notes.data();
+        m_numNotes = (int)m_notes.size();
+    }
+
+    Reset(0);
+
+    // The notes on one instrument and bus, and the ends of the
+    // voices still sounding as the notes are swept in order
+    struct Group
+    {
+        int instrument;
+        int bus;
+        int notes;
+        int peak;
+        double seconds;         //!< Voice seconds
+        std::priority_queue<double, std::vector<double>, std::greater<double>> ends;
+    };
+
+    // Voices that cost the same: an instrument and drum type
+    struct Kind
+    {
+        const CNote* example;
+        double seconds;
+        double cost;            //!< CPU seconds per frame
+    };
+
+    std::map<std::pair<int, int>, Group> groups;
+    std::map<std::pair<int, int>, Kind> kinds;
+    std::priority_queue<double, std::vector<double>, std::greater<double>> ends;
+    std::vector<int> perMeasure;
+    int peak = 0;
+    double voiceSeconds = 0;
+    double notesEnd = 0;
+    double end = 0;
+
+    for (int j = 0; j < m_numNotes; j++)
+    {
+        const CNote* note = m_score + j;
+        if (note->Measure() >= 0)
+        {
+            if (note->Measure() >= (int)perMeasure.size())
+                perMeasure.resize(note->Measure() + 1, 0);
+            perMeasure[note->Measure()]++;
+        }
+
+        CInstrument* instrument = NewInstrument(note);
+        if (instrument == NULL)
+            continue;
+
+        const double start = m_tempo.Seconds(note->Measure(), note->Beat());
+        const double length = instrument->Length();
+        delete instrument;
+
+        const double stop = start + length;
+        if (stop > end)
+            end = stop;
+
+        const double duration = note->Duration() >= 0 ? m_tempo.Duration(note->Measure(), note->Beat(), note->Duration()) : 0;
+        if (start + duration > notesEnd)
+            notesEnd = start + duration;
+
+        while (!ends.empty() && ends.top() <= start)
+            ends.pop();
+        ends.push(stop);
+        if ((int)ends.size() > peak)
+            peak = (int)ends.size();
+
+        Group& group = groups[std::make_pair(note->Instrument(), note->Bus())];
+        if (group.notes == 0)
+        {
+            group.instrument = note->Instrument();
+            group.bus = note->Bus();
+        }
+
+        while (!group.ends.empty() && group.ends.top() <= start)
+            group.ends.pop();
+        group.ends.push(stop);
+        if ((int)group.ends.size() > group.peak)
+            group.peak = (int)group.ends.size();
+
+        group.notes++;
+        group.seconds += length;
+        voiceSeconds += length;
+
+        Kind& kind = kinds[std::make_pair(note->Instrument(), note->Type())];
+        if (kind.example == NULL)
+            kind.example = note;
+        kind.seconds += length;
+    }
+
+    // Calibrate on this machine, then put the effects back
+    double cpu = 0;
+    for (auto& kind : kinds)
+    {
+        kind.second.cost = VoiceCost(kind.second.example);
+        cpu += kind.second.seconds * m_sampleRate * kind.second.cost;
+    }
+
+    const double mixCost = MixCost();
+    Reset(0);
+
+    const double frames = ceil(end * m_sampleRate);
+    cpu += frames * mixCost;
+
+    int densityPeak = 0;
+    for (int count : perMeasure)
+    {
+        if (count > densityPeak)
+            densityPeak = count;
+    }
+
+    std::string json = "{\n  \"notes\": ";
+    AppendJson(json, m_numNotes);
+    json += ",\n  \"sampleRate\": ";
+    AppendJson(json, m_sampleRate);
+    json += ",\n  \"duration\": { \"notes\": ";
+    AppendJson(json, notesEnd);
+    json += ", \"rendered\": ";
+    AppendJson(json, end);
+    json += ", \"frames\": ";
+    AppendJson(json, frames);
+    json += " },\n  \"voices\": { \"peak\": ";
+    AppendJson(json, peak);
+    json += ", \"average\": ";
+    AppendJson(json, end > 0 ? voiceSeconds / end : 0);
+    json += " },\n  \"instruments\": [";
+
+    bool first = true;
+    for (const auto& entry : groups)
+    {
+        const Group& group = entry.second;
+        json += first ? "\n    { \"instrument\": " : ",\n    { \"instrument\": ";
+        first = false;
+        AppendJson(json, m_strings.Get(group.instrument));
+        json += ", \"bus\": ";
+        AppendJson(json, m_buses[group.bus].name);
+        json += ", \"notes\": ";
+        AppendJson(json, group.notes);
+        json += ", \"peakVoices\": ";
+        AppendJson(json, group.peak);
+        json += ", \"averageVoices\": ";
+        AppendJson(json, end > 0 ? group.seconds / end : 0);
+        json += " }";
+    }
+
+    json += "\n  ],\n  \"density\": { \"measures\": ";
+    AppendJson(json, (double)perMeasure.size());
+    json += ", \"peak\": ";
+    AppendJson(json, densityPeak);
+    json += ", \"average\": ";
+    AppendJson(json, perMeasure.empty() ? 0 : (double)m_numNotes / perMeasure.size());
+    json += ", \"perMeasure\": [";
+    for (size_t m = 0; m < perMeasure.size(); m++)
+    {
+        if (m > 0)
+            json += m % 16 == 0 ? ",\n      " : ", ";
+        AppendJson(json, perMeasure[m]);
+    }
+
+    json += "] },\n  \"cost\": { \"seconds\": ";
+    AppendJson(json, cpu);
+    json += ", \"realtime\": ";
+    AppendJson(json, end > 0 ? cpu / end : 0);
+    json += ", \"mixPerSecond\": ";
+    AppendJson(json, mixCost * m_sampleRate);
+    json += ", \"voicePerSecond\": [";
+
+    first = true;
+    for (const auto& entry : kinds)
+    {
+        const Kind& kind = entry.second;
+        json += first ? "\n    { \"instrument\": " : ",\n    { \"instrument\": ";
+        first = false;
+        AppendJson(json, m_strings.Get(kind.example->Instrument()));
+        if (kind.example->Type() >= 0)
+        {
+            json += ", \"type\": ";
+            AppendJson(json, m_strings.Get(kind.example->Type()));
+        }
+        json += ", \"seconds\": ";
+        AppendJson(json, kind.cost * m_sampleRate);
+        json += " }";
+    }
+
+    json += "\n  ] }\n}\n";
+
+    if (m_streaming)
+        RewindStream();
+
+    return json;
+}
+
+//! True if an XML score declares it can be played while it is read
+static bool IsStreamed(const wchar_t* filename)
+{
+    CXmlReader xml;
+    if (!xml.Open(filename))
+        return false;
+
+    CXmlReader::Event e;
+    while ((e = xml.Next()) == CXmlReader::StartElement && !xml.Is("score"))
+        xml.Skip();
+
+    return e == CXmlReader::StartElement && xml.Attribute("stream") != NULL;
+}
+
+void CSynthesizer::OpenScore(CString& filename)
+{
+    Clear();
+
+    // Compiled scores are mapped rather than parsed
+    if (filename.Right(9).CompareNoCase(L".scorebin") == 0)
+        LoadScoreBin(filename, true);
+    else if (filename.Right(4).CompareNoCase(L".mid") == 0 || filename.Right(5).CompareNoCase(L".midi") == 0)
+        OpenMidi(filename);
+    else if (IsStreamed(filename))
+        OpenStream(filename);
+    else
+        OpenXmlScore(filename);
+}
+
+bool CSynthesizer::CompileScore(const wchar_t* source, const wchar_t* target)
+{
+    Clear();
+
+    uint64_t hash = 0, size = 0;
+    CScoreCache::HashFile(source, hash, size);
+
+    if (!LoadXmlScore(source))
+        return false;
+
+    if (!CScoreBin::Write(target, m_bpm, m_beatspermeasure, m_score, m_numNotes, m_strings, m_setup, hash, size))
+    {
+        AfxMessageBox(L"Failed to write the compiled score file");
+        return false;
+    }
+
+    return true;
+}
+
+/*! Open an XML score through the parsed-score cache
+ *
+ * The cache entry for the file's contents is mapped if there is
+ * one.  Otherwise the score is parsed and then stored in the cache.
+ */
+bool CSynthesizer::OpenXmlScore(const wchar_t* filename)
+{
+    uint64_t hash, size;
+    if (!CScoreCache::HashFile(filename, hash, size))
+    {
+        AfxMessageBox(L"Failed to open XML score file");
+        return false;
+    }
+
+    const std::wstring entry = m_cache.EntryPath(hash, size);
+    if (!entry.empty())
+    {
+        if (LoadScoreBin(entry.c_str(), false))
+        {
+            if (m_bin.SourceHash() == hash && m_bin.SourceSize() == size)
+                return true;
+
+            Clear();
+        }
+    }
+
+    if (!LoadXmlScore(filename))
+        return false;
+
+    // A failed write only costs the next open a parse
+    if (!entry.empty() &&
+        CScoreBin::Write(entry.c_str(), m_bpm, m_beatspermeasure, m_score, m_numNotes, m_strings, m_setup, hash, size))
+    {
+        m_cache.Prune();
+    }
+
+    return true;
+}
+
+//! Parse an XML score
+bool CSynthesizer::LoadXmlScore(const wchar_t* filename)
+{
+    //
+    // The score is read as a stream, one element at a time.
+    // Top level tag is <score>
+    //
+
+    CXmlReader xml;
+    if (!xml.Open(filename))
+    {
+        AfxMessageBox(L"Failed to open XML score file");
+        return false;
+    }
+
+    // Everything but the notes is kept, for compiled scores and
+    // to tell whether a re-render can reuse the last one
+    xml.SetEcho(&m_setup, "note");
+
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("score"))
+            XmlLoadScore(xml);
+        else
+            xml.Skip();
+    }
+
+    if (xml.Failed())
+    {
+        CString msg;
+        msg.Format(L"XML score file is not well formed (line %d)", xml.Line());
+        AfxMessageBox(msg);
+        Clear();
+        return false;
+    }
+
+    MergeRuns();
+    m_score = m_notes.data();
+    m_numNotes = (int)m_notes.size();
+    return true;
+}
+
+//! Begin a new run of notes at the end of m_notes
+void CSynthesizer::StartRun()
+{
+    if (m_runs.empty() || m_runs.back() != m_notes.size())
+        m_runs.push_back(m_notes.size());
+}
+
+/*! Put the loaded notes in order
+ *
+ * The notes of an <instrument>, or of one play of a pattern, are a
+ * run that is usually already in order, which takes one pass to
+ * check.  A run that is not is sorted on its own.  The runs are then
+ * merged through a heap, so a score of n notes in k runs takes
+ * O(n log k) rather than the O(n log n) of sorting it whole.
+ *
+ * Notes at the same place come out in the order they were read:
+ * within a run the sort is stable, and between runs the earlier run
+ * wins.  Repeated loads and each play of a pattern start their
+ * notes in the same order.
+ */
+void CSynthesizer::MergeRuns()
+{
+    std::vector<size_t> runs = m_runs;
+    m_runs.clear();
+    if (is_sorted(m_notes.begin(), m_notes.end()))
+        return;
+
+    if (runs.empty() || runs[0] != 0)
+        runs.insert(runs.begin(), 0);
+    runs.push_back(m_notes.size());
+
+    struct Run
+    {
+        size_t next;
+        size_t end;
+    };
+
+    std::vector<Run> live;
+    for (size_t r = 0; r + 1 < runs.size(); r++)
+    {
+        const auto begin = m_notes.begin() + runs[r];
+        const auto end = m_notes.begin() + runs[r + 1];
+        if (begin == end)
+            continue;
+
+        if (!is_sorted(begin, end))
+            stable_sort(begin, end);
+
+        Run run = { runs[r], runs[r + 1] };
+        live.push_back(run);
+    }
+
+    // The heap holds the runs by their next note, with the run
+    // that comes last on top for std::priority_queue to pop first
+    auto later = [&](int a, int b)
+    {
+        const CNote& x = m_notes[live[a].next];
+        const CNote& y = m_notes[live[b].next];
+        if (y < x)
+            return true;
+        if (x < y)
+            return false;
+        return a > b;
+    };
+
+    std::priority_queue<int, std::vector<int>, decltype(later)> heap(later);
+    for (int r = 0; r < (int)live.size(); r++)
+        heap.push(r);
+
+    std::vector<CNote> merged;
+    merged.reserve(m_notes.size());
+    while (!heap.empty())
+    {
+        const int r = heap.top();
+        heap.pop();
+
+        // Take the run's notes for as long as they stay ahead of
+        // the next run
+        Run& run = live[r];
+        do
+        {
+            merged.push_back(m_notes[run.next++]);
+        } while (run.next < run.end && (heap.empty() || !later(r, heap.top())));
+
+        if (run.next < run.end)
+            heap.push(r);
+    }
+
+    m_notes.swap(merged);
+}
+
+//! Map a compiled score.  Problems are only reported if report is true.
+bool CSynthesizer::LoadScoreBin(const wchar_t* filename, bool report)
+{
+    if (!m_bin.Open(filename))
+    {
+        if (report)
+            AfxMessageBox(L"Failed to open compiled score file");
+        return false;
+    }
+
+    // The notes refer to strings by position, so the table is
+    // rebuilt in the order it was written
+    for (int i = 0; i < m_bin.NumStrings(); i++)
+        m_strings.Intern(m_bin.String(i));
+
+    // The instruments, buses, effects and automation are a small
+    // XML document.  It creates the buses in the order the notes
+    // were compiled against.
+    m_setup.assign(m_bin.Setup(), m_bin.SetupSize());
+
+    CXmlReader xml;
+    xml.OpenMemory(m_bin.Setup(), m_bin.SetupSize());
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("score"))
+            XmlLoadScore(xml);
+        else
+            xml.Skip();
+    }
+
+    if (xml.Failed() || m_strings.Size() != m_bin.NumStrings())
+    {
+        if (report)
+            AfxMessageBox(L"Compiled score file is damaged");
+        Clear();
+        return false;
+    }
+
+    m_bpm = m_bin.Bpm();
+    m_beatspermeasure = m_bin.BeatsPerMeasure();
+
+    // The notes are used in place
+    m_score = m_bin.Notes();
+    m_numNotes = m_bin.NumNotes();
+    return true;
+}
+
+/*! Open an XML score that is read while it plays
+ *
+ * The score declares with stream="N" that its notes are in time
+ * order to within N measures: no note comes later in the file than
+ * a note more than N measures after it.  Everything but the notes
+ * has to come before the first note.  Only the part of the file up
+ * to the first note is read here, so opening takes the same time
+ * however long the score is.
+ */
+bool CSynthesizer::OpenStream(const wchar_t* filename)
+{
+    m_streaming = true;
+    m_streamFile = filename;
+    m_streamSetup = true;
+    m_streamHaveEffects = false;
+
+    if (!RewindStream())
+    {
+        AfxMessageBox(L"Failed to open XML score file");
+        Clear();
+        return false;
+    }
+
+    // Reading the first note loads the setup before it
+    StreamNote();
+    if (m_stream.Failed())
+    {
+        CString msg;
+        msg.Format(L"XML score file is not well formed (line %d)", m_stream.Line());
+        AfxMessageBox(msg);
+        Clear();
+        return false;
+    }
+
+    return true;
+}
+
+/*! Open a Standard MIDI File as a streamed score
+ *
+ * A beat is a quarter note.  The tempo changes and the time
+ * signatures of a whole number of quarter notes go into the tempo
+ * map.  Channel 10 plays the drum instrument, with the General
+ * MIDI drum keys mapped to drum types, and the other channels play
+ * the tone instrument.  Program changes are ignored.
+ */
+bool CSynthesizer::OpenMidi(const wchar_t* filename)
+{
+    if (!m_midi.Open(filename))
+    {
+        AfxMessageBox(L"Failed to open MIDI file");
+        Clear();
+        return false;
+    }
+
+    const double division = m_midi.Division();
+    const std::vector<CMidiFile::Tempo>& tempos = m_midi.Tempos();
+    m_bpm = tempos[0].bpm;
+    m_tempo.Clear(m_bpm, m_beatspermeasure);
+
+    // Two points on the same beat make a step
+    for (size_t i = 1; i < tempos.size(); i++)
+    {
+        const double beat = tempos[i].tick / division;
+        m_tempo.AddTempo(beat, tempos[i - 1].bpm);
+        m_tempo.AddTempo(beat, tempos[i].bpm);
+    }
+
+    // A time signature part way through a measure starts at the
+    // next one.  Meters of a fraction of a quarter note are left out.
+    int measure = 0;
+    double measureBeat = 0;
+    double quarters = m_beatspermeasure;
+    for (const CMidiFile::Meter& meter : m_midi.Meters())
+    {
+        if (meter.quarters < 1 || meter.quarters != floor(meter.quarters))
+            continue;
+
+        const int measures = (int)ceil((meter.tick / division - measureBeat) / quarters - 1e-9);
+        measure += measures;
+        measureBeat += measures * quarters;
+        quarters = meter.quarters;
+
+        m_tempo.AddMeter(measure, (int)quarters);
+        if (measure == 0)
+            m_beatspermeasure = (int)quarters;
+    }
+
+    m_midiToneBus = -1;
+    m_midiDrumBus = -1;
+    for (int channel = 0; channel < 16; channel++)
+    {
+        if (!m_midi.UsesChannel(channel))
+            continue;
+
+        if (channel == 9)
+            m_midiDrumBus = BusIndex(L"DrumInstrument");
+        else if (m_midiToneBus < 0)
+            m_midiToneBus = BusIndex(L"ToneInstrument");
+    }
+
+    m_streaming = true;
+    m_streamFile = filename;
+    m_streamSetup = false;
+    m_streamWindow = 0;
+    ResolveLanes();
+    return RewindStream();
+}
+
+//! Go back to the start of a streamed score, past its <score> tag
+bool CSynthesizer::RewindStream()
+{
+    m_notes.clear();
+    m_score = NULL;
+    m_numNotes = 0;
+    m_currentNote = 0;
+
+    m_streamEnd = true;
+    if (m_midi.IsOpen())
+    {
+        m_midi.Rewind();
+    }
+    else
+    {
+        if (!m_stream.Open(m_streamFile.c_str()))
+            return false;
+
+        CXmlReader::Event e;
+        while ((e = m_stream.Next()) == CXmlReader::StartElement && !m_stream.Is("score"))
+            m_stream.Skip();
+
+        if (e != CXmlReader::StartElement)
+            return false;
+    }
+
+    if (m_streamSetup)
+    {
+        XmlLoadScoreAttributes(m_stream);
+
+        const char* stream = m_stream.Attribute("stream");
+        const int window = stream != NULL ? atoi(stream) : 0;
+        m_streamWindow = window > 0 ? window : 0;
+    }
+
+    m_streamEnd = false;
+    m_streamBus = -1;
+    m_streamInstrument = -1;
+    m_streamRead = 0;
+    m_streamLast = -1;
+    m_streamMax = -1;
+    m_streamLate = 0;
+    m_streamIgnored = 0;
+    m_streamErrorLine = 0;
+
+    // Patterns are read again with the notes
+    m_patterns.clear();
+    m_instances.clear();
+    m_streamPlay = 0;
+    m_streamPlayNote = 0;
+    return true;
+}
+
+/*! Read on to the next note of a streamed score
+ *
+ * The note is added to the end of m_notes.  Returns false at the
+ * end of the score.  Until the first note, the instruments, effects
+ * and automation are loaded as they are met.  Once a note has been
+ * read they are ignored, except that a later <instrument> for an
+ * existing bus goes on with that bus's notes.  The notes of a
+ * <play> are read out of its pattern one at a time, as if they
+ * were written out where the <play> is.
+ */
+bool CSynthesizer::StreamNote()
+{
+    if (m_midi.IsOpen())
+        return StreamMidiNote();
+
+    while (!m_streamEnd)
+    {
+        if (m_streamPlay < (int)m_instances.size())
+        {
+            const Instance& instance = m_instances[m_streamPlay];
+            const Pattern& pattern = m_patterns[instance.pattern];
+            if (m_streamPlayNote == (int)pattern.notes.size())
+            {
+                m_streamPlay++;
+                m_streamPlayNote = 0;
+                continue;
+            }
+
+            const CNote& from = pattern.notes[m_streamPlayNote++];
+            m_notes.push_back(from);
+            m_notes.back().SetPosition(from.Measure() + instance.measure, from.Beat());
+            m_notes.back().SetInstance(m_streamPlay);
+            m_streamRead++;
+
+            if (m_streamSetup)
+            {
+                m_streamSetup = false;
+                ResolveLanes();
+            }
+
+            return true;
+        }
+
+        const CXmlReader::Event e = m_stream.Next();
+        if (e == CXmlReader::EndElement && m_streamBus >= 0)
+        {
+            // The end of an <instrument>
+            m_streamBus = -1;
+            continue;
+        }
+
+        if (e != CXmlReader::StartElement)
+        {
+            // The end of the score, or malformed XML
+            m_streamEnd = true;
+            break;
+        }
+
+        if (m_streamBus >= 0 && m_stream.Is("note"))
+        {
+            XmlLoadNote(m_stream, m_streamInstrument);
+            m_notes.back().SetBus(m_streamBus);
+            m_streamRead++;
+
+            if (m_streamSetup)
+            {
+                m_streamSetup = false;
+                ResolveLanes();
+            }
+
+            return true;
+        }
+
+        if (m_streamBus >= 0 && m_stream.Is("pattern"))
+        {
+            XmlLoadPattern(m_stream, m_streamInstrument, m_streamBus);
+            continue;
+        }
+
+        if (m_stream.Is("play"))
+        {
+            XmlLoadPlay(m_stream, false);
+            continue;
+        }
+
+        if (m_streamBus < 0 && m_stream.Is("instrument"))
+        {
+            m_streamBus = XmlInstrumentBus(m_stream, m_streamInstrument, m_streamSetup);
+            if (m_streamBus < 0)
+            {
+                // Buses cannot be added once the score is playing
+                StreamProblem();
+                m_stream.Skip();
+            }
+            continue;
+        }
+
+        if (m_streamSetup && m_stream.Is("effects"))
+        {
+            if (m_streamBus >= 0)
+            {
+                m_buses[m_streamBus].fx.XmlLoad(m_stream);
+            }
+            else
+            {
+                // A score that declares effects replaces the default chain
+                if (!m_streamHaveEffects)
+                    m_fx.Clear();
+
+                m_streamHaveEffects = true;
+                m_fx.XmlLoad(m_stream);
+            }
+            continue;
+        }
+
+        if (m_streamSetup && m_streamBus < 0 && m_stream.Is("automation"))
+        {
+            XmlLoadAutomation(m_stream);
+            continue;
+        }
+
+        if (m_streamSetup && m_streamBus < 0 && m_stream.Is("meter"))
+        {
+            XmlLoadMeter(m_stream);
+            continue;
+        }
+
+        // Setup after the first note comes too late to use.  Before
+        // it, on a second pass, the setup is already loaded.
+        if (m_streamRead > 0 && (m_stream.Is("effects") || m_stream.Is("automation") || m_stream.Is("meter")))
+            StreamProblem();
+
+        m_stream.Skip();
+    }
+
+    // A score with no notes is all setup
+    if (m_streamSetup)
+    {
+        m_streamSetup = false;
+        ResolveLanes();
+    }
+
+    return false;
+}
+
+//! Drum type and pitch offset for a General MIDI drum key, NULL
+//! for the percussion the drum instrument does not have
+static const char* GmDrumType(int key, double& pitch)
+{
+    pitch = 0;
+    switch (key)
+    {
+    case 35: case 36:
+        return "kick";
+
+    case 37: case 38: case 39: case 40:
+        return "snare";
+
+    case 42: case 44: case 46:
+        return "hihat";
+
+    case 41: case 43:
+        // The mid tom five semitones down is the low tom's E2
+        pitch = -5;
+        return "tom";
+
+    case 45: case 47:
+        return "tom";
+
+    case 48: case 50:
+        return "tom-hi";
+
+    case 49: case 51: case 52: case 53: case 55: case 57: case 59:
+        return "cymbal";
+    }
+
+    return NULL;
+}
+
+/*! Read the next note of a MIDI file into m_notes
+ *
+ * Notes come out of the file in order of their start, so a MIDI
+ * file never plays late however small the window.
+ */
+bool CSynthesizer::StreamMidiNote()
+{
+    static const char* names[] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+
+    CMidiFile::Note in;
+    while (!m_streamEnd && m_midi.NextNote(in))
+    {
+        CNote note;
+        if (in.channel == 9)
+        {
+            double pitch;
+            const char* type = GmDrumType(in.key, pitch);
+            if (type == NULL || m_midiDrumBus < 0)
+                continue;
+
+            note.SetInstrument(m_strings.Intern("DrumInstrument"));
+            note.SetType(m_strings.Intern(type));
+            note.SetPitch(pitch);
+            note.SetBus(m_midiDrumBus);
+        }
+        else
+        {
+            // Key 60 is middle C, C4
+            const std::string name = names[in.key % 12] + std::to_string(in.key / 12 - 1);
+
+            note.SetInstrument(m_strings.Intern("ToneInstrument"));
+            note.SetName(m_strings.Intern(name.c_str()));
+            note.SetBus(m_midiToneBus);
+        }
+
+        const double division = m_midi.Division();
+        int measure;
+        double beat;
+        m_tempo.Position(in.start / division, measure, beat);
+        note.SetPosition(measure, beat);
+        note.SetDuration((in.end - in.start) / division);
+        note.SetVelocity(in.velocity / 127.0);
+
+        m_notes.push_back(note);
+        m_streamRead++;
+        return true;
+    }
+
+    m_streamEnd = true;
+    return false;
+}
+
+//! Note a problem with a streamed score, to report when it ends
+void CSynthesizer::StreamProblem()
+{
+    if (m_streamLate + m_streamIgnored == 0)
+        m_streamErrorLine = m_stream.Line();
+
+    m_streamIgnored++;
+}
+
+/*! Read the notes of a streamed score that the next block may play
+ *
+ * Reading stops at the first note more than the window and one
+ * measure past the playhead.  A score in order to within the window
+ * has nothing after that note due before the next block starts,
+ * even if the playhead moves into the next measure during this one.
+ * Notes already played are let go of, so memory does not grow with
+ * the length of the score.
+ */
+void CSynthesizer::FillStream()
+{
+    int measure;
+    double beat;
+    m_tempo.Position(m_tempo.BeatAt(m_frame * m_samplePeriod), measure, beat);
+    if (m_streamEnd || m_streamLast > measure + m_streamWindow + 1)
+        return;
+
+    m_notes.erase(m_notes.begin(), m_notes.begin() + m_currentNote);
+    m_currentNote = 0;
+    m_dueNote = -1;
+
+    const size_t pending = m_notes.size();
+    while (m_streamLast <= measure + m_streamWindow + 1 && StreamNote())
+    {
+        const int last = m_notes.back().Measure();
+        if (last < m_streamMax - m_streamWindow)
+        {
+            // Out of order by more than declared, so it may play late
+            if (m_streamLate + m_streamIgnored == 0)
+                m_streamErrorLine = m_stream.Line();
+
+            m_streamLate++;
+        }
+
+        m_streamLast = last;
+        if (last > m_streamMax)
+            m_streamMax = last;
+    }
+
+    // Only the new notes can be out of order, and they are
+    // usually in order already
+    if (!is_sorted(m_notes.begin() + pending, m_notes.end()))
+        stable_sort(m_notes.begin() + pending, m_notes.end());
+    inplace_merge(m_notes.begin(), m_notes.begin() + pending, m_notes.end());
+
+    m_score = m_notes.data();
+    m_numNotes = (int)m_notes.size();
+}
+
+//! Report what went wrong reading a streamed score, once it has played
+void CSynthesizer::ReportStream()
+{
+    CString msg;
+    if (m_midi.Failed())
+    {
+        msg = L"MIDI file is damaged after the notes that played";
+    }
+    else if (m_stream.Failed())
+    {
+        msg.Format(L"XML score file is not well formed (line %d)", m_stream.Line());
+    }
+    else if (m_streamLate > 0 || m_streamIgnored > 0)
+    {
+        msg.Format(L"Streamed score is out of order from line %d: %d notes more than %d measures late, "
+            L"%d instruments, effects or automation after the first note", m_streamErrorLine,
+            m_streamLate, m_streamWindow, m_streamIgnored);
+    }
+    else
+    {
+        return;
+    }
+
+    // Once per render
+    m_streamLate = 0;
+    m_streamIgnored = 0;
+    m_stream.Close();
+    AfxMessageBox(msg);
+}
+
+void CSynthesizer::XmlLoadScore(CXmlReader& xml)
+{
+    XmlLoadScoreAttributes(xml);
+
+    bool haveEffects = false;
+
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("instrument"))
+        {
+            XmlLoadInstrument(xml);
+        }
+        else if (xml.Is("effects"))
+        {
+            // A score that declares effects replaces the default chain
+            if (!haveEffects)
+                m_fx.Clear();
+
+            haveEffects = true;
+            m_fx.XmlLoad(xml);
+        }
+        else if (xml.Is("automation"))
+        {
+            XmlLoadAutomation(xml);
+        }
+        else if (xml.Is("meter"))
+        {
+            XmlLoadMeter(xml);
+        }
+        else if (xml.Is("play"))
+        {
+            XmlLoadPlay(xml, true);
+        }
+        else
+        {
+            xml.Skip();
+        }
+    }
+
+    ResolveLanes();
+}
+
+//! Read the tempo, meter and tuning from the <score> tag
+void CSynthesizer::XmlLoadScoreAttributes(CXmlReader& xml)
+{
+    m_bpm = CXmlReader::ToDouble(xml.Attribute("bpm"), m_bpm);
+
+    const char* beats = xml.Attribute("beatspermeasure");
+    if (beats != NULL)
+        m_beatspermeasure = atoi(beats);
+
+    m_tempo.Clear(m_bpm, m_beatspermeasure);
+
+    m_tuning.a4 = CXmlReader::ToDouble(xml.Attribute("a4"), m_tuning.a4);
+
+    // Unknown temperaments leave the notes in equal temperament
+    const char* temperament = xml.Attribute("temperament");
+    if (temperament != NULL)
+    {
+        wstring name;
+        CXmlReader::Widen(temperament, name);
+        SetTemperament(m_tuning, name.c_str());
+    }
+
+    // Unknown layouts leave the output as it was
+    CChannelLayout::Layout layout;
+    const char* channels = xml.Attribute("layout");
+    if (channels != NULL && CChannelLayout::FromName(channels, layout))
+        m_layout.SetLayout(layout);
+}
+
+//! Match the automation lanes up with the buses and stages they
+//! drive, and drop the ones that name nothing.  Lanes can name
+//! buses declared later in the score, so this waits until
+//! everything is loaded.  The tempo lane goes into the tempo map,
+//! which is then compiled.
+void CSynthesizer::ResolveLanes()
+{
+    // The last tempo lane in the score is the one that counts
+    const Lane* tempo = NULL;
+    for (const Lane& lane : m_lanes)
+    {
+        if (lane.target == TempoLane)
+            tempo = &lane;
+    }
+
+    if (tempo != NULL)
+    {
+        for (int i = 0; i < tempo->curve.NumPoints(); i++)
+            m_tempo.AddTempo(tempo->curve.PointBeat(i), tempo->curve.PointValue(i));
+    }
+
+    m_tempo.Compile();
+
+    for (auto lane = m_lanes.begin(); lane != m_lanes.end(); )
+    {
+        lane->bus = -1;
+        for (int b = 0; b < (int)m_buses.size(); b++)
+        {
+            if (m_buses[b].name == lane->busName)
+                lane->bus = b;
+        }
+
+        CEffects& fx = lane->bus < 0 ? m_fx : m_buses[lane->bus].fx;
+        bool valid = (lane->target == BusLane && lane->bus >= 0) ||
+            (lane->target == EffectLane && (lane->bus >= 0 || lane->busName == L"master") &&
+                lane->stage >= 0 && lane->stage < fx.NumStages());
+
+        // A bus with an azimuth lane is placed by azimuth
+        if (valid && lane->target == BusLane && lane->param == L"azimuth")
+            m_buses[lane->bus].surround = true;
+
+        if (valid)
+            ++lane;
+        else
+            lane = m_lanes.erase(lane);
+    }
+}
+
+void CSynthesizer::XmlLoadAutomation(CXmlReader& xml)
+{
+    Lane lane;
+    lane.target = BusLane;
+    lane.busName = L"master";
+    lane.bus = -1;
+    lane.stage = -1;
+
+    const char* param = xml.Attribute("param");
+    if (param != NULL)
+        CXmlReader::Widen(param, lane.param);
+
+    const char* bus = xml.Attribute("bus");
+    if (bus != NULL)
+        CXmlReader::Widen(bus, lane.busName);
+
+    // Stages are numbered from 1 in the file
+    const char* stage = xml.Attribute("stage");
+    if (stage != NULL)
+        lane.stage = atoi(stage) - 1;
+
+    // Parameters that can change while a stage runs without
+    // resetting it.  Gain, wet and cutoff are smoothed per sample.
+    static const wchar_t* automatable[] = {
+        L"gain", L"wet", L"freq", L"cutoff", L"q", L"gaindb", L"amount",
+        L"threshold", L"makeup", L"rate", L"feedback"
+    };
+
+    bool valid = true;
+    if (lane.param == L"tempo")
+    {
+        lane.target = TempoLane;
+    }
+    else if (lane.stage >= 0)
+    {
+        lane.target = EffectLane;
+
+        bool known = false;
+        for (const wchar_t* param : automatable)
+        {
+            if (lane.param == param)
+                known = true;
+        }
+
+        valid = known;
+    }
+    else if (lane.param != L"gain" && lane.param != L"pan" && lane.param != L"azimuth")
+    {
+        valid = false;
+    }
+
+    if (!valid)
+    {
+        xml.Skip();
+        return;
+    }
+
+    lane.curve.XmlLoad(xml, m_tempo);
+    if (!lane.curve.IsEmpty())
+        m_lanes.push_back(lane);
+}
+
+//! A change of meter, from the start of a measure on.  It places
+//! the automation points that come after it.
+void CSynthesizer::XmlLoadMeter(CXmlReader& xml)
+{
+    const char* measure = xml.Attribute("measure");
+    const char* beats = xml.Attribute("beatspermeasure");
+    if (measure != NULL && beats != NULL)
+        m_tempo.AddMeter(atoi(measure) - 1, atoi(beats));
+
+    xml.Skip();
+}
+
+/*! Read the attributes of an <instrument> element
+ *
+ * Returns the bus the instrument plays on, or -1 if the bus does
+ * not exist and create is not set.  instrument is set to the id
+ * of the instrument name.
+ */
+int CSynthesizer::XmlInstrumentBus(CXmlReader& xml, int& instrument, bool create)
+{
+    // Notes keep the instrument name as an id in the string table
+    const char* name = xml.Attribute("instrument");
+    instrument = m_strings.Intern(name != NULL ? name : "");
+
+    wstring busName = L"";
+    const char* bus = xml.Attribute("bus");
+    if (bus != NULL)
+        CXmlReader::Widen(bus, busName);
+
+    if (busName.empty())
+        busName = m_strings.Get(instrument);
+
+    if (!create)
+    {
+        for (int b = 0; b < (int)m_buses.size(); b++)
+        {
+            if (m_buses[b].name == busName)
+                return b;
+        }
+
+        return -1;
+    }
+
+    // Negative leaves the bus level alone, and outside [-1, 1]
+    // leaves the bus balance alone
+    const double gain = CXmlReader::ToDouble(xml.Attribute("gain"), -1);
+    const double pan = CXmlReader::ToDouble(xml.Attribute("pan"), 2);
+    const char* azimuth = xml.Attribute("azimuth");
+
+    int b = BusIndex(busName);
+    if (gain >= 0)
+        m_buses[b].gain = gain;
+    if (pan >= -1 && pan <= 1)
+        m_buses[b].pan = pan;
+    if (azimuth != NULL)
+    {
+        m_buses[b].azimuth = CXmlReader::ToDouble(azimuth, 0);
+        m_buses[b].surround = true;
+    }
+
+    return b;
+}
+
+void CSynthesizer::XmlLoadInstrument(CXmlReader& xml)
+{
+    int instrumentId;
+    const int b = XmlInstrumentBus(xml, instrumentId, true);
+    StartRun();
+
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("note"))
+        {
+            XmlLoadNote(xml, instrumentId);
+            m_notes.back().SetBus(b);
+        }
+        else if (xml.Is("effects"))
+        {
+            m_buses[b].fx.XmlLoad(xml);
+        }
+        else if (xml.Is("pattern"))
+        {
+            XmlLoadPattern(xml, instrumentId, b);
+        }
+        else if (xml.Is("play"))
+        {
+            XmlLoadPlay(xml, true);
+            StartRun();
+        }
+        else
+        {
+            xml.Skip();
+        }
+    }
+}
+
+void CSynthesizer::XmlLoadNote(CXmlReader& xml, int instrument)
+{
+    m_notes.push_back(CNote());
+    m_notes.back().XmlLoad(xml, instrument, m_strings);
+    xml.Skip();
+}
+
+/*! Read a <pattern> of an instrument
+ *
+ * The notes play on the instrument and its bus, with measure 1 the
+ * first measure of the pattern.  A pattern of the same name as an
+ * earlier one hides it from the <play> elements after it.
+ */
+void CSynthesizer::XmlLoadPattern(CXmlReader& xml, int instrument, int bus)
+{
+    Pattern pattern;
+    const char* name = xml.Attribute("name");
+    pattern.name = name != NULL ? name : "";
+
+    const char* measures = xml.Attribute("measures");
+    pattern.measures = measures != NULL ? atoi(measures) : 1;
+    if (pattern.measures < 1)
+        pattern.measures = 1;
+
+    while (xml.Next() == CXmlReader::StartElement)
+    {
+        if (xml.Is("note"))
+        {
+            CNote note;
+            note.XmlLoad(xml, instrument, m_strings);
+            note.SetBus(bus);
+            pattern.notes.push_back(note);
+        }
+
+        xml.Skip();
+    }
+
+    std::stable_sort(pattern.notes.begin(), pattern.notes.end());
+    m_patterns.push_back(std::move(pattern));
+}
+
+/*! Read a <play> of a pattern
+ *
+ * Adds an instance for each repeat, one pattern length after the
+ * last.  With expand set the pattern's notes are copied into
+ * m_notes for each instance; a streamed score reads them out one at
+ * a time instead.  A pattern that has not been defined yet plays
+ * nothing.
+ */
+void CSynthesizer::XmlLoadPlay(CXmlReader& xml, bool expand)
+{
+    int p = -1;
+    const char* name = xml.Attribute("pattern");
+    for (int i = 0; i < (int)m_patterns.size() && name != NULL; i++)
+    {
+        if (m_patterns[i].name == name)
+            p = i;
+    }
+
+    const char* measure = xml.Attribute("measure");
+    const char* repeat = xml.Attribute("repeat");
+    const int first = measure != NULL ? atoi(measure) - 1 : 0;
+    const int count = repeat != NULL ? atoi(repeat) : 1;
+    xml.Skip();
+
+    if (p < 0)
+        return;
+
+    const Pattern& pattern = m_patterns[p];
+    for (int r = 0; r < count; r++)
+    {
+        Instance instance;
+        instance.pattern = p;
+        instance.measure = first + r * pattern.measures;
+        instance.rendering = -1;
+        instance.start = -1;
+        instance.frames = 0;
+        instance.notes = 0;
+        instance.state = InstanceIdle;
+        m_instances.push_back(instance);
+
+        if (!expand)
+            continue;
+
+        StartRun();
+        for (const CNote& from : pattern.notes)
+        {
+            CNote note = from;
+            note.SetPosition(from.Measure() + instance.measure, from.Beat());
+            note.SetInstance((int)m_instances.size() - 1);
+            m_notes.push_back(note);
+        }
+    }
 }
@@ -1,38 +1,229 @@
 #pragma once
 #include <list>
 #include <vector>
-#include "msxml2.h"
 #include "CInstrument.h"
 #include "CNote.h"
 #include <CEffects.h>
+#include "CAutomation.h"
+#include "CStringTable.h"
+#include "CScoreBin.h"
+#include "CScoreCache.h"
+#include "CXmlReader.h"
+#include "CMidiFile.h"
+#include "CTempoMap.h"
+#include "CChannelLayout.h"
+#include "CPlanarBuffer.h"
+#include "Notes.h"
 
 class CSynthesizer
 {
 private:
-    int		m_channels;
+    CChannelLayout m_layout;            //!< Layout being rendered
+    CChannelLayout m_defaultLayout;     //!< Layout of a score that does not name one
     double	m_sampleRate;
     double	m_samplePeriod;
     double  m_time;
 
-    double  m_bpm;              //!< Beats per minute
-    int     m_beatspermeasure;  //!< Beats per measure
-    double  m_secperbeat;       //!< Seconds per beat
+    double  m_bpm;              //!< Beats per minute at the start
+    int     m_beatspermeasure;  //!< Beats per measure at the start
+    CTempoMap m_tempo;          //!< Tempo and meter changes, compiled once the score is loaded
+    Tuning  m_tuning;           //!< Tuning of the note names
 
     int m_currentNote;          //!< The current note we are playing
-    int m_measure;              //!< The current measure
-    double m_beat;              //!< The current beat within the measure
+    int m_frame;                //!< Frames of the score generated since Start()
+    int m_dueNote;              //!< Note m_dueFrame is for, -1 if none
+    double m_dueFrame;          //!< Frame that note starts on, as the tempo map places it
 
-	std::list<CInstrument*> m_instruments;
-    std::vector<CNote> m_notes;
+    struct Rendering;
 
-    CEffects m_fx;
+    //! An instrument playing a note, or a pattern instance played
+    //! back from a rendering of an earlier one
+    struct Active
+    {
+        CInstrument* instrument;
+        int note;               //!< Index of the note in the score
+        const Rendering* rendering;     //!< Played back instead of an instrument, if not NULL
+        int pos;                //!< Next frame of the rendering
+    };
+
+    /*! An instrument bus
+     *
+     * Each <instrument> element renders into a bus, named by its
+     * bus attribute or else by the instrument.  A bus runs its own
+     * effects chain before it is mixed into the master chain, and
+     * its dry signal can key a compressor on another bus.
+     *
+     * A bus has every channel of the layout.  Its instruments play
+     * the same into all of them, and it is placed when it is mixed,
+     * after its effects, by its pan or azimuth.
+     */
+    struct Bus
+    {
+        std::wstring name;
+        CEffects fx;
+        std::list<Active> instruments;          //!< Active instruments on this bus
+        CPlanarBuffer audio;                    //!< Block buffer
+        double gain;                            //!< Mix level
+        double pan;                             //!< Balance, -1 (left) to 1 (right)
+        double azimuth;                         //!< Direction in degrees, if placed by it
+        bool surround;                          //!< Placed by azimuth instead of pan
+        double mix[CChannelLayout::MaxChannels];        //!< Channel gains the next ramp starts from
+        bool isKey;                             //!< True if a compressor keys off this bus
+        CPlanarBuffer key;                      //!< Dry copy of the block for the keyed compressors
+
+        // Delay that lines this bus up with the slowest bus
+        CPlanarBuffer delay;
+        int delayPos;
+
+        int recording;                          //!< Pattern instance being recorded, -1 if none
+        int recorded;                           //!< Notes of it started so far
+    };
+
+    std::vector<Bus> m_buses;
+    std::vector<CNote> m_notes; //!< Notes loaded from an XML score
+    CStringTable m_strings;     //!< Names the notes refer to by id
+    CScoreBin m_bin;            //!< Mapped compiled score, if one is open
+    CScoreCache m_cache;        //!< Parsed XML scores, by content
+    std::string m_setup;        //!< The score without its notes, as XML
+    std::vector<size_t> m_runs; //!< Where each run of notes read in one place starts in m_notes
+
+    /*! A run of notes that <play> elements place in the score
+     *
+     * The notes are read once, with their measures counted from the
+     * start of the pattern, and copied for each time it is played.
+     */
+    struct Pattern
+    {
+        std::string name;
+        int measures;           //!< Length, and the distance between repeats
+        std::vector<CNote> notes;       //!< In order
+    };
+
+    //! Where an instance is in recording or playing back its rendering
+    enum InstanceState { InstanceIdle, InstanceRecording, InstanceReplaying };
+
+    //! One play of a pattern.  Notes copied for it keep its index.
+    struct Instance
+    {
+        int pattern;
+        int measure;            //!< Measure the pattern starts on
+        int rendering;          //!< Rendering it shares with instances that sound the same, -1 if none
+        int start;              //!< Frame its first note starts on
+        int frames;             //!< Frames it can sound for, at most
+        int notes;
+        InstanceState state;
+    };
+
+    //! Dry bus signal of a pattern instance that sounded alone on
+    //! its bus, played back for the instances that sound the same
+    struct Rendering
+    {
+        std::vector<double> audio[CChannelLayout::MaxChannels];    //!< A run for each channel
+        bool ready;             //!< Recorded all the way through
+    };
+
+    std::vector<Pattern> m_patterns;
+    std::vector<Instance> m_instances;
+    std::vector<Rendering> m_renderings;
+
+    // The sorted notes being played, from m_notes or m_bin
+    const CNote* m_score;
+    int m_numNotes;
+
+    //! Frames between automation updates
+    static const int ControlBlock = 32;
+
+    //! What an automation lane drives
+    enum LaneTarget { TempoLane, BusLane, EffectLane };
+
+    struct Lane
+    {
+        LaneTarget target;
+        std::wstring busName;   //!< Bus name in the score, "master" for the master chain
+        int bus;                //!< Bus index, -1 for the master chain
+        int stage;              //!< Effect stage index
+        std::wstring param;
+        CAutomation curve;
+    };
+
+    std::vector<Lane> m_lanes;
+    double m_tickBeat[CEffects::MaxBlock / ControlBlock];  //!< Score position of each control block
+
+    CEffects m_fx;              //!< Master effects chain
+    int m_busLatency;           //!< Largest latency of the bus chains
+    int m_oversampling;         //!< Oversampling factor for nonlinear stages
+
+    // Audio is rendered a block at a time so the effects
+    // chain can process whole blocks.  Generate() hands the
+    // block out one frame at a time.
+    CPlanarBuffer m_block;
+    int m_blockPos;             //!< Next frame to hand out of the block
+    int m_blockLen;             //!< Number of valid frames in the block
+    bool m_done;                //!< True when nothing remains to render
+    int m_tail;                 //!< Silent frames still to push through the effects
+    int m_skip;                 //!< Leading frames to drop for the effects latency
+
+    /*! A render kept so that a later one can reuse it
+     *
+     * Frames count from the start of the score, before the effects
+     * latency is dropped, so output frame f is score frame f + Latency().
+     */
+    struct Recording
+    {
+        bool complete;                  //!< The render ran to the end
+        double sampleRate;
+        int channels;
+        int oversampling;
+        std::string setup;
+        std::vector<CNote> notes;
+        CStringTable strings;
+        std::vector<int> noteStart;     //!< Frame each note started on
+        std::vector<int> noteEnd;       //!< Frame each note stopped on, -1 if unknown
+        std::vector<float> audio;       //!< Output, interleaved
+    };
+
+    bool m_recording;           //!< Keep each render in m_record
+    Recording m_record;
+    Recording* m_capture;       //!< Where note start and end frames go while rendering
+
+    /*
+     * A streamed score is read while it plays.  m_notes only holds
+     * the notes from the playhead to the window ahead of it, and
+     * the reader picks up where it left off at every render block.
+     */
+    bool m_streaming;
+    std::wstring m_streamFile;
+    CXmlReader m_stream;
+    int m_streamWindow;         //!< Measures the notes may be out of order by
+    bool m_streamSetup;         //!< Instruments, effects and automation are still loading
+    bool m_streamHaveEffects;   //!< The score has declared master effects
+    bool m_streamEnd;           //!< The whole score has been read
+    int m_streamBus;            //!< Bus of the <instrument> being read, -1 outside one
+    int m_streamInstrument;     //!< Id of its instrument name
+    int m_streamRead;           //!< Notes read since the stream was rewound
+    int m_streamLast;           //!< Measure of the last note read
+    int m_streamMax;            //!< Latest measure read so far
+    int m_streamLate;           //!< Notes out of order by more than the window
+    int m_streamIgnored;        //!< Setup elements after the first note
+    int m_streamErrorLine;      //!< Line of the first of those problems
+    int m_streamPlay;           //!< Instance whose notes are being read, m_instances.size() if none
+    int m_streamPlayNote;       //!< Next note of its pattern
+
+    // A MIDI file is played as a streamed score, with its notes
+    // read from m_midi instead of m_stream
+    CMidiFile m_midi;
+    int m_midiToneBus;          //!< Bus of the tone notes, -1 if there are none
+    int m_midiDrumBus;          //!< Bus of the channel 10 notes, -1 if there are none
 
 public:
     CSynthesizer();
     virtual ~CSynthesizer();
     
     //! Number of audio channels
-    int GetNumChannels() { return m_channels; }
+    int GetNumChannels() const { return m_layout.NumChannels(); }
+
+    //! Speaker layout of the output
+    const CChannelLayout& GetLayout() const { return m_layout; }
 
     //! Sample rate in samples per second
     double GetSampleRate() { return m_sampleRate; }
@@ -40,25 +231,132 @@ public:
     //! Sample period in seconds (1/samplerate)
     double GetSamplePeriod() { return m_samplePeriod; }
 
-    //! Set the number of channels
-    void SetNumChannels(int n) { m_channels = n; }
+    //! Set the number of channels, as the layout usual for that many
+    void SetNumChannels(int n);
+
+    /*! Set the speaker layout
+     *
+     * A score can name its own with the layout attribute of its
+     * <score> element, which holds until another score is opened.
+     * Takes effect at Start().
+     */
+    void SetLayout(CChannelLayout::Layout layout);
 
     //! Set the sample rate
-    void SetSampleRate(double s) { m_sampleRate = s;  m_samplePeriod = 1.0 / s; m_fx.SetSampleRate(s);  }
+    void SetSampleRate(double s);
+
+    /*! Oversampling factor for the nonlinear stages (1, 2 or 4)
+     *
+     * Applies to the drum voice clippers and to effects stages that
+     * do not choose their own factor.  Takes effect at Start().
+     */
+    void SetOversampling(int factor);
 
     //! Get the time since we started generating audio
 	double GetTime() { return m_time; }
 
+    //! Keep each render so RenderIncremental() can update it later
+    void SetRecording(bool record);
+
+    //! True if the last render was kept and can be updated for the current score
+    bool CanRenderIncremental() const;
+
+    /*! Update the kept render for the current score
+     *
+     * The notes of the current score are matched against the ones
+     * rendered last time.  Only the time ranges around notes that
+     * were added, removed or changed are rendered again and spliced
+     * into the old output.  Each range starts far enough back for
+     * the effects to settle, which is checked against the old output
+     * before the seam.  It ends once every changed note and its
+     * release are done and the output matches the old output again.
+     * The instruments, effects and automation must be unchanged.
+     *
+     * Returns the number of frames rendered, or 0 if the kept render
+     * cannot be updated.  The result is in
+     * RecordedAudio().
+     */
+    int RenderIncremental();
+
+    //! Output of the last kept render, interleaved, GetNumChannels() to a frame
+    const std::vector<float>& RecordedAudio() const { return m_record.audio; }
+
+    /*! Predict what rendering the current score will take, as JSON
+     *
+     * Works from the notes and the tempo map without rendering:
+     * the voices each instrument has sounding at once, the notes in
+     * each measure, how long the output runs with the releases, and
+     * the CPU time the render should take.  The CPU time is built
+     * from the cost of each kind of voice and of the effects chains,
+     * timed here first on this machine.  A streamed score is read
+     * through whole.
+     */
+    std::string AnalyzeScore();
+
     void Start();
     bool Generate(double* frame);
     void Clear();
 
+    /*! Open a score file
+     *
+     * A .scorebin is mapped.  An XML score whose <score> element has
+     * a stream attribute is read while it plays, and any other one
+     * is loaded whole, through the cache of compiled scores.  A .mid
+     * or .midi file is read while it plays, like a streamed score.
+     */
 	void OpenScore(CString& filename);
 
+    /*! Compile an XML score into a .scorebin file
+     *
+     * The score is left loaded.  Opening the compiled file later
+     * maps it instead of parsing and sorting the notes again.
+     */
+    bool CompileScore(const wchar_t* source, const wchar_t* target);
+
 private:
-    void XmlLoadScore(IXMLDOMNode* xml);
-    void XmlLoadInstrument(IXMLDOMNode* xml);
-    void XmlLoadNote(IXMLDOMNode* xml, std::wstring& instrument);
-};
+    bool GenerateFrame(int i);
+    bool NoteDue(int note);
+    void Reset(int frame);
+    CInstrument* CreateInstrument(const CNote* note);
+    CInstrument* NewInstrument(const CNote* note);
+    void PlanPatterns();
+    bool Replay(int note);
+    void Record(Bus& bus, int i);
+    double VoiceCost(const CNote* note);
+    double MixCost();
+    void BeginRecording(Recording& record);
+    void Schedule(int frames, std::vector<int>& starts, std::vector<int>& blocks);
+    void StartAt(int frame, int note, const Recording& record);
+    void MatchNotes(std::vector<int>& match, std::vector<char>& kept) const;
+    void RenderBlock();
+    void MixBus(Bus& bus, int start, int frames);
+    void BusGains(const Bus& bus, double* gains) const;
+    void AutomateMix(double beat);
+    void StopInstruments();
+    int Latency() const { return m_busLatency + m_fx.Latency(); }
+    int BusIndex(const std::wstring& name);
 
-#pragma comment(lib, "msxml2.lib")
\ No newline at end of file
+    bool OpenXmlScore(const wchar_t* filename);
+    bool LoadXmlScore(const wchar_t* filename);
+    void StartRun();
+    void MergeRuns();
+    bool LoadScoreBin(const wchar_t* filename, bool report);
+    bool OpenStream(const wchar_t* filename);
+    bool OpenMidi(const wchar_t* filename);
+    bool RewindStream();
+    bool StreamNote();
+    bool StreamMidiNote();
+    void FillStream();
+    void StreamProblem();
+    void ReportStream();
+    void XmlLoadScore(CXmlReader& xml);
+    void XmlLoadScoreAttributes(CXmlReader& xml);
+    void ResolveLanes();
+    int XmlInstrumentBus(CXmlReader& xml, int& instrument, bool create);
+    void XmlLoadInstrument(CXmlReader& xml);
+    void XmlLoadAutomation(CXmlReader& xml);
+    void XmlLoadMeter(CXmlReader& xml);
+    void XmlLoadNote(CXmlReader& xml, int instrument);
+    void XmlLoadPattern(CXmlReader& xml, int instrument, int bus);
+    void XmlLoadPlay(CXmlReader& xml, bool expand);
+};
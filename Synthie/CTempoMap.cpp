@@ -0,0 +1,192 @@
+#include "pch.h"
+#include <cmath>
+#include <algorithm>
+#include "CTempoMap.h"
+
+//! Slopes smaller than this are taken as a constant tempo
+static const double FlatSlope = 1e-9;
+
+CTempoMap::CTempoMap()
+{
+    Clear(120.0, 4);
+}
+
+void CTempoMap::Clear(double bpm, int beatsPerMeasure)
+{
+    m_bpm = bpm > 0 ? bpm : 120.0;
+    m_meters.clear();
+    m_points.clear();
+
+    Meter meter = { 0, beatsPerMeasure > 0 ? beatsPerMeasure : 4, 0.0 };
+    m_meters.push_back(meter);
+    Compile();
+}
+
+void CTempoMap::AddMeter(int measure, int beatsPerMeasure)
+{
+    if (measure < 0 || beatsPerMeasure <= 0)
+        return;
+
+    auto it = m_meters.begin();
+    while (it != m_meters.end() && it->measure < measure)
+        ++it;
+
+    if (it != m_meters.end() && it->measure == measure)
+    {
+        it->beats = beatsPerMeasure;
+    }
+    else
+    {
+        Meter meter = { measure, beatsPerMeasure, 0.0 };
+        m_meters.insert(it, meter);
+    }
+
+    // Later points are placed by measure as they are read, so the
+    // measure starts are kept up to date
+    for (size_t i = 1; i < m_meters.size(); i++)
+    {
+        const Meter& prev = m_meters[i - 1];
+        m_meters[i].start = prev.start + (double)(m_meters[i].measure - prev.measure) * prev.beats;
+    }
+}
+
+void CTempoMap::AddTempo(double beat, double bpm)
+{
+    if (bpm <= 0)
+        return;
+
+    // Points at the same beat stay in the order they came, for steps
+    Point point = { beat, bpm };
+    auto it = m_points.end();
+    while (it != m_points.begin() && (it - 1)->beat > beat)
+        --it;
+
+    m_points.insert(it, point);
+}
+
+void CTempoMap::Compile()
+{
+    m_segments.clear();
+
+    // The tempo at beat 0, which is held before the first point
+    double bpm = m_bpm;
+    size_t next = 0;
+    if (!m_points.empty())
+    {
+        bpm = m_points[0].bpm;
+        while (next < m_points.size() && m_points[next].beat <= 0)
+            next++;
+
+        if (next > 0 && next < m_points.size())
+        {
+            const Point& a = m_points[next - 1];
+            const Point& b = m_points[next];
+            bpm = a.bpm + (b.bpm - a.bpm) * (0 - a.beat) / (b.beat - a.beat);
+        }
+        else if (next > 0)
+        {
+            bpm = m_points[next - 1].bpm;
+        }
+    }
+
+    Segment segment = { 0.0, 0.0, bpm, 0.0 };
+    for (; next < m_points.size(); next++)
+    {
+        // A line to the point, then on from its value.  The second
+        // point of a step starts a segment of no length.
+        const Point& p = m_points[next];
+        if (p.beat > segment.beat)
+        {
+            segment.slope = (p.bpm - segment.bpm) / (p.beat - segment.beat);
+            m_segments.push_back(segment);
+
+            segment.seconds += SegmentSeconds(segment, p.beat - segment.beat);
+            segment.beat = p.beat;
+        }
+
+        segment.bpm = p.bpm;
+        segment.slope = 0;
+    }
+
+    // The last tempo holds to the end of the score
+    m_segments.push_back(segment);
+}
+
+//! Seconds from the start of a segment to a number of beats into it
+double CTempoMap::SegmentSeconds(const Segment& s, double beats)
+{
+    if (fabs(s.slope) < FlatSlope)
+        return 60.0 * beats / s.bpm;
+
+    // The integral of 60 / (bpm + slope * x)
+    return 60.0 / s.slope * log((s.bpm + s.slope * beats) / s.bpm);
+}
+
+//! Beats from the start of a segment to a time into it
+double CTempoMap::SegmentBeats(const Segment& s, double seconds)
+{
+    if (fabs(s.slope) < FlatSlope)
+        return s.bpm * seconds / 60.0;
+
+    return s.bpm * (exp(s.slope * seconds / 60.0) - 1.0) / s.slope;
+}
+
+double CTempoMap::Beat(int measure, double beat) const
+{
+    auto it = std::upper_bound(m_meters.begin() + 1, m_meters.end(), measure,
+        [](int m, const Meter& meter) { return m < meter.measure; });
+
+    const Meter& meter = *(it - 1);
+    return meter.start + (double)(measure - meter.measure) * meter.beats + beat;
+}
+
+void CTempoMap::Position(double beat, int& measure, double& inMeasure) const
+{
+    auto it = std::upper_bound(m_meters.begin() + 1, m_meters.end(), beat,
+        [](double b, const Meter& meter) { return b < meter.start; });
+
+    const Meter& meter = *(it - 1);
+    const int measures = (int)floor((beat - meter.start) / meter.beats);
+    measure = meter.measure + measures;
+    inMeasure = beat - meter.start - (double)measures * meter.beats;
+}
+
+double CTempoMap::Seconds(double beat) const
+{
+    if (beat <= 0)
+        return 60.0 * beat / m_segments[0].bpm;
+
+    auto it = std::upper_bound(m_segments.begin() + 1, m_segments.end(), beat,
+        [](double b, const Segment& s) { return b < s.beat; });
+
+    const Segment& s = *(it - 1);
+    return s.seconds + SegmentSeconds(s, beat - s.beat);
+}
+
+double CTempoMap::BeatAt(double seconds) const
+{
+    if (seconds <= 0)
+        return m_segments[0].bpm * seconds / 60.0;
+
+    auto it = std::upper_bound(m_segments.begin() + 1, m_segments.end(), seconds,
+        [](double t, const Segment& s) { return t < s.seconds; });
+
+    const Segment& s = *(it - 1);
+    return s.beat + SegmentBeats(s, seconds - s.seconds);
+}
+
+double CTempoMap::Duration(int measure, double beat, double duration) const
+{
+    const double start = Beat(measure, beat);
+
+    // At a steady tempo a duration lasts the same wherever it is,
+    // to the last bit, so repeated notes sound alike
+    auto it = std::upper_bound(m_segments.begin() + 1, m_segments.end(), start,
+        [](double b, const Segment& s) { return b < s.beat; });
+
+    const Segment& s = *(it - 1);
+    if (fabs(s.slope) < FlatSlope && start >= s.beat && (it == m_segments.end() || start + duration <= it->beat))
+        return SegmentSeconds(s, duration);
+
+    return Seconds(start + duration) - Seconds(start);
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+
+/*! Tempo and meter of a score, as a function of time
+ *
+ * The meter is a list of changes of the beats per measure, each at
+ * the start of a measure.  The tempo is a list of (beat, bpm) points
+ * with straight lines between them, like an automation lane, so two
+ * points on the same beat make a step and two on different beats a
+ * ramp.  Compile() integrates the tempo into segments that each
+ * know the time they start at, and every lookup is a binary search
+ * over the segments followed by a closed form within one.
+ *
+ * Beats are counted from 0 at the start of the score.  Measures and
+ * beats within them also start at 0, as in CNote.
+ */
+class CTempoMap
+{
+public:
+    CTempoMap();
+
+    //! Start over with one tempo and meter for the whole score
+    void Clear(double bpm, int beatsPerMeasure);
+
+    //! Change the beats per measure from the start of a measure on
+    void AddMeter(int measure, int beatsPerMeasure);
+
+    //! Add a tempo point.  Any points replace the Clear() tempo.
+    void AddTempo(double beat, double bpm);
+
+    //! Build the segments from the points.  Needed after any change.
+    void Compile();
+
+    //! Beats from the start of the score to a position
+    double Beat(int measure, double beat) const;
+
+    //! Measure and beat within it of a position in beats
+    void Position(double beat, int& measure, double& inMeasure) const;
+
+    //! Seconds from the start of the score to a position in beats
+    double Seconds(double beat) const;
+
+    //! Position in beats at a time in seconds
+    double BeatAt(double seconds) const;
+
+    //! Seconds from the start of the score to a measure and beat
+    double Seconds(int measure, double beat) const { return Seconds(Beat(measure, beat)); }
+
+    //! Seconds a duration in beats lasts from a measure and beat
+    double Duration(int measure, double beat, double duration) const;
+
+private:
+    struct Meter
+    {
+        int measure;
+        int beats;              //!< Beats per measure
+        double start;           //!< Beat the measure starts on
+    };
+
+    struct Point
+    {
+        double beat;
+        double bpm;
+    };
+
+    //! A stretch where the tempo changes linearly with the beat
+    struct Segment
+    {
+        double beat;            //!< Where the segment starts
+        double seconds;         //!< Time at its start
+        double bpm;             //!< Tempo at its start
+        double slope;           //!< Change of tempo per beat
+    };
+
+    static double SegmentSeconds(const Segment& s, double beats);
+    static double SegmentBeats(const Segment& s, double seconds);
+
+    double m_bpm;               //!< Tempo when there are no points
+    std::vector<Meter> m_meters;
+    std::vector<Point> m_points;
+    std::vector<Segment> m_segments;
+};
@@ -3,6 +3,7 @@
 #include "CSineWave.h"
 #include "Notes.h"
 #include "CDrumInstrument.h"
+#include "CStringTable.h"
 
 CToneInstrument::CToneInstrument()
 {
@@ -16,6 +17,7 @@ CToneInstrument::~CToneInstrument()
 void CToneInstrument::Start()
 {
     m_sinewave.SetSampleRate(GetSampleRate());
+    m_sinewave.SetNumChannels(GetNumChannels());
     m_sinewave.Start();
     m_time = 0;
 }
@@ -27,8 +29,8 @@ bool CToneInstrument::Generate()
     m_sinewave.Generate();
 
     // Read the component's sample and make it our resulting frame.
-    m_frame[0] = m_sinewave.Frame(0);
-    m_frame[1] = m_sinewave.Frame(1);
+    for (int c = 0; c < m_channels; c++)
+        m_frame[c] = m_sinewave.Frame(c);
 
     // Update time
     m_time += GetSamplePeriod();
@@ -37,42 +39,12 @@ bool CToneInstrument::Generate()
     return m_time < m_duration;
 }
 
-void CToneInstrument::SetNote(CNote* note)
+void CToneInstrument::SetNote(const CNote* note)
 {
-    // Get a list of all attribute nodes and the
-    // length of that list
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    note->Node()->get_attributes(&attributes);
-    long len;
-    attributes->get_length(&len);
+    // Durations are in beats, so how long they last depends on the tempo
+    if (note->Duration() >= 0)
+        SetDuration(NoteSeconds(note));
 
-    // Loop over the list of attributes
-    for (int i = 0; i < len; i++)
-    {
-        // Get attribute i
-        CComPtr<IXMLDOMNode> attrib;
-        attributes->get_item(i, &attrib);
-
-        // Get the name of the attribute
-        CComBSTR name;
-        attrib->get_nodeName(&name);
-
-        // Get the value of the attribute.  A CComVariant is a variable
-        // that can have any type. It loads the attribute value as a
-        // string (UNICODE), but we can then change it to an integer 
-        // (VT_I4) or double (VT_R8) using the ChangeType function 
-        // and then read its integer or double value from a member variable.
-        CComVariant value;
-        attrib->get_nodeValue(&value);
-
-        if (name == L"duration")
-        {
-            value.ChangeType(VT_R8);
-            SetDuration(value.dblVal);
-        }
-        else if (name == L"note")
-        {
-            SetFreq(NoteToFrequency(value.bstrVal));
-        }
-    }
+    if (note->Name() >= 0 && m_strings != NULL)
+        SetFreq(NoteToFrequency(m_strings->Get(note->Name()).c_str(), m_tuning != NULL ? *m_tuning : EqualTuning));
 }
\ No newline at end of file
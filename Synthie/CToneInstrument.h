@@ -6,7 +6,7 @@ class CToneInstrument : public CInstrument
 {
 private:
     CSineWave   m_sinewave;
-    double m_duration;
+    double m_duration;          //!< In seconds
     double m_time;
 
 public:
@@ -19,6 +19,7 @@ public:
     void SetFreq(double f) { m_sinewave.SetFreq(f); }
     void SetAmplitude(double a) { m_sinewave.SetAmplitude(a); }
     void SetDuration(double d) { m_duration = d; }
-    void SetNote(CNote* note) override;
+    void SetNote(const CNote* note) override;
+    double Length() const override { return m_duration; }
 };
 
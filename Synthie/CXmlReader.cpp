@@ -0,0 +1,532 @@
+#include "pch.h"
+#include <cstring>
+#include <cstdlib>
+#include "CXmlReader.h"
+
+//! Input is read in chunks of this many bytes
+static const size_t BufferSize = 64 * 1024;
+
+CXmlReader::CXmlReader()
+{
+    m_file = NULL;
+    m_data = NULL;
+    m_pos = 0;
+    m_end = 0;
+    m_line = 1;
+    m_failed = false;
+    m_pendingEnd = false;
+    m_echo = NULL;
+    m_echoSkipDepth = 0;
+    m_scratch.push_back('\0');
+}
+
+CXmlReader::~CXmlReader()
+{
+    Close();
+}
+
+bool CXmlReader::Open(const wchar_t* filename)
+{
+    Close();
+
+#ifdef _WIN32
+    m_file = _wfopen(filename, L"rb");
+#else
+    std::string narrow;
+    for (const wchar_t* p = filename; *p; p++)
+        narrow += (char)*p;
+    m_file = fopen(narrow.c_str(), "rb");
+#endif
+    if (m_file == NULL)
+        return false;
+
+    m_buffer.resize(BufferSize);
+    m_pos = 0;
+    m_end = 0;
+    m_line = 1;
+    m_failed = false;
+    m_pendingEnd = false;
+
+    // Skip a UTF-8 byte order mark
+    if (Fill())
+        SkipBom();
+
+    return true;
+}
+
+void CXmlReader::OpenMemory(const char* data, size_t size)
+{
+    Close();
+
+    m_data = data;
+    m_pos = 0;
+    m_end = size;
+    m_line = 1;
+    m_failed = false;
+    m_pendingEnd = false;
+    SkipBom();
+}
+
+void CXmlReader::SkipBom()
+{
+    if (m_end >= 3 && (unsigned char)m_data[0] == 0xEF &&
+        (unsigned char)m_data[1] == 0xBB && (unsigned char)m_data[2] == 0xBF)
+    {
+        m_pos = 3;
+    }
+}
+
+void CXmlReader::Close()
+{
+    if (m_file != NULL)
+    {
+        fclose(m_file);
+        m_file = NULL;
+    }
+}
+
+//! Read the next chunk of the file into the buffer
+bool CXmlReader::Fill()
+{
+    if (m_file == NULL)
+        return false;
+
+    m_data = m_buffer.data();
+    m_pos = 0;
+    m_end = fread(m_buffer.data(), 1, m_buffer.size(), m_file);
+    return m_end > 0;
+}
+
+CXmlReader::Event CXmlReader::Fail()
+{
+    m_failed = true;
+    return Error;
+}
+
+bool CXmlReader::Is(const char* name) const
+{
+    return strcmp(Name(), name) == 0;
+}
+
+const char* CXmlReader::Attribute(const char* name) const
+{
+    for (const AttributeRef& a : m_attributes)
+    {
+        if (strcmp(m_scratch.data() + a.name, name) == 0)
+            return m_scratch.data() + a.value;
+    }
+
+    return NULL;
+}
+
+void CXmlReader::SetEcho(std::string* out, const char* skip)
+{
+    m_echo = out;
+    m_echoSkip = skip != NULL ? skip : "";
+    m_echoSkipDepth = 0;
+}
+
+CXmlReader::Event CXmlReader::Next()
+{
+    const Event e = Read();
+    if (m_echo != NULL)
+        Echo(e);
+
+    return e;
+}
+
+CXmlReader::Event CXmlReader::Read()
+{
+    if (m_failed)
+        return Error;
+
+    if (m_pendingEnd)
+    {
+        // The name of a self-closing element is still in the scratch
+        m_pendingEnd = false;
+        m_attributes.clear();
+        return EndElement;
+    }
+
+    for (;;)
+    {
+        // Skip character data up to the next markup
+        int c = Get();
+        while (c != '<')
+        {
+            if (c < 0)
+                return EndOfFile;
+            c = Get();
+        }
+
+        c = Get();
+        if (c == '?')
+        {
+            if (!SkipPast("?>"))
+                return Fail();
+            continue;
+        }
+
+        if (c == '!')
+        {
+            if (Peek() == '-')
+            {
+                Get();
+                if (Get() != '-' || !SkipPast("-->"))
+                    return Fail();
+            }
+            else if (Peek() == '[')
+            {
+                if (!SkipPast("]]>"))
+                    return Fail();
+            }
+            else
+            {
+                // DOCTYPE, possibly with an internal subset in brackets
+                int depth = 0;
+                while ((c = Get()) >= 0)
+                {
+                    if (c == '[')
+                        depth++;
+                    else if (c == ']')
+                        depth--;
+                    else if (c == '>' && depth <= 0)
+                        break;
+                }
+
+                if (c < 0)
+                    return Fail();
+            }
+            continue;
+        }
+
+        m_scratch.clear();
+        m_attributes.clear();
+
+        if (c == '/')
+        {
+            if (!ReadName(Get()) || SkipSpace() != '>')
+                return Fail();
+
+            return EndElement;
+        }
+
+        if (!ReadName(c))
+            return Fail();
+
+        for (;;)
+        {
+            c = SkipSpace();
+            if (c == '>')
+                return StartElement;
+
+            if (c == '/')
+            {
+                if (Get() != '>')
+                    return Fail();
+
+                m_pendingEnd = true;
+                return StartElement;
+            }
+
+            AttributeRef a;
+            a.name = (int)m_scratch.size();
+            if (!ReadName(c) || SkipSpace() != '=')
+                return Fail();
+
+            c = SkipSpace();
+            if (c != '"' && c != '\'')
+                return Fail();
+
+            a.value = (int)m_scratch.size();
+            if (!ReadValue(c))
+                return Fail();
+
+            m_attributes.push_back(a);
+        }
+    }
+}
+
+//! Append text to XML, escaping the characters that cannot appear in a value
+static void AppendEscaped(std::string& xml, const char* text)
+{
+    for (; *text; text++)
+    {
+        switch (*text)
+        {
+        case '&': xml += "&amp;"; break;
+        case '<': xml += "&lt;"; break;
+        case '>': xml += "&gt;"; break;
+        case '"': xml += "&quot;"; break;
+        default: xml += *text; break;
+        }
+    }
+}
+
+//! Copy the element boundary just read to the echo string
+void CXmlReader::Echo(Event e)
+{
+    if (e == StartElement)
+    {
+        if (m_echoSkipDepth > 0 || Is(m_echoSkip.c_str()))
+        {
+            m_echoSkipDepth++;
+            return;
+        }
+
+        *m_echo += '<';
+        *m_echo += Name();
+        for (int i = 0; i < NumAttributes(); i++)
+        {
+            *m_echo += ' ';
+            *m_echo += AttributeName(i);
+            *m_echo += "=\"";
+            AppendEscaped(*m_echo, AttributeValue(i));
+            *m_echo += '"';
+        }
+        *m_echo += ">\n";
+    }
+    else if (e == EndElement)
+    {
+        if (m_echoSkipDepth > 0)
+        {
+            m_echoSkipDepth--;
+            return;
+        }
+
+        *m_echo += "</";
+        *m_echo += Name();
+        *m_echo += ">\n";
+    }
+}
+
+void CXmlReader::Skip()
+{
+    int depth = 1;
+    while (depth > 0)
+    {
+        const Event e = Next();
+        if (e == StartElement)
+            depth++;
+        else if (e == EndElement)
+            depth--;
+        else
+            return;
+    }
+}
+
+//! Consume input up to and including the terminator
+bool CXmlReader::SkipPast(const char* terminator)
+{
+    // Keep the last len characters read and compare them whole, so a
+    // run like "]]]>" still ends on the terminator that overlaps it
+    const size_t len = strlen(terminator);
+    std::string last;
+    while (last.size() < len || last.compare(last.size() - len, len, terminator) != 0)
+    {
+        const int c = Get();
+        if (c < 0)
+            return false;
+
+        last.push_back((char)c);
+        if (last.size() > len)
+            last.erase(0, 1);
+    }
+
+    return true;
+}
+
+//! Consume white space and return the character after it
+int CXmlReader::SkipSpace()
+{
+    int c;
+    do
+    {
+        c = Get();
+    } while (c == ' ' || c == '\t' || c == '\r' || c == '\n');
+
+    return c;
+}
+
+//! Append a name starting with the character first to the scratch
+bool CXmlReader::ReadName(int first)
+{
+    if (first < 0 || first == ' ' || first == '\t' || first == '\r' || first == '\n' ||
+        first == '>' || first == '/' || first == '=' || first == '"' || first == '\'')
+    {
+        return false;
+    }
+
+    m_scratch.push_back((char)first);
+    for (;;)
+    {
+        const int c = Peek();
+        if (c < 0 || c == ' ' || c == '\t' || c == '\r' || c == '\n' ||
+            c == '>' || c == '/' || c == '=')
+        {
+            break;
+        }
+
+        m_scratch.push_back((char)Get());
+    }
+
+    m_scratch.push_back('\0');
+    return true;
+}
+
+//! Append a quoted attribute value to the scratch
+bool CXmlReader::ReadValue(int quote)
+{
+    for (;;)
+    {
+        const int c = Get();
+        if (c < 0 || c == '<')
+            return false;
+
+        if (c == quote)
+            break;
+
+        if (c == '&')
+            AppendReference();
+        else
+            m_scratch.push_back((char)c);
+    }
+
+    m_scratch.push_back('\0');
+    return true;
+}
+
+//! Decode a character reference; the '&' has been consumed
+void CXmlReader::AppendReference()
+{
+    char ref[12];
+    int len = 0;
+    int c;
+    while ((c = Peek()) >= 0 && c != ';' && len < (int)sizeof(ref) - 1)
+    {
+        // A stray '&' followed by ordinary text is kept as it is
+        if (c == '"' || c == '\'' || c == '<' || c == '&' || c == ' ')
+            break;
+
+        ref[len++] = (char)Get();
+    }
+    ref[len] = '\0';
+
+    if (c == ';')
+    {
+        Get();
+
+        unsigned long code = 0;
+        if (strcmp(ref, "lt") == 0)
+            code = '<';
+        else if (strcmp(ref, "gt") == 0)
+            code = '>';
+        else if (strcmp(ref, "amp") == 0)
+            code = '&';
+        else if (strcmp(ref, "quot") == 0)
+            code = '"';
+        else if (strcmp(ref, "apos") == 0)
+            code = '\'';
+        else if (ref[0] == '#')
+            code = ref[1] == 'x' ? strtoul(ref + 2, NULL, 16) : strtoul(ref + 1, NULL, 10);
+
+        if (code != 0)
+        {
+            AppendUtf8(code);
+            return;
+        }
+    }
+
+    // Not a reference we know: keep the text
+    m_scratch.push_back('&');
+    m_scratch.insert(m_scratch.end(), ref, ref + len);
+    if (c == ';')
+        m_scratch.push_back(';');
+}
+
+void CXmlReader::AppendUtf8(unsigned long code)
+{
+    if (code < 0x80)
+    {
+        m_scratch.push_back((char)code);
+    }
+    else if (code < 0x800)
+    {
+        m_scratch.push_back((char)(0xC0 | (code >> 6)));
+        m_scratch.push_back((char)(0x80 | (code & 0x3F)));
+    }
+    else if (code < 0x10000)
+    {
+        m_scratch.push_back((char)(0xE0 | (code >> 12)));
+        m_scratch.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        m_scratch.push_back((char)(0x80 | (code & 0x3F)));
+    }
+    else
+    {
+        m_scratch.push_back((char)(0xF0 | (code >> 18)));
+        m_scratch.push_back((char)(0x80 | ((code >> 12) & 0x3F)));
+        m_scratch.push_back((char)(0x80 | ((code >> 6) & 0x3F)));
+        m_scratch.push_back((char)(0x80 | (code & 0x3F)));
+    }
+}
+
+double CXmlReader::ToDouble(const char* text, double def)
+{
+    double value;
+    return ParseDouble(text, value) ? value : def;
+}
+
+bool CXmlReader::ParseDouble(const char* text, double& value)
+{
+    if (text == NULL)
+        return false;
+
+    char* end;
+    const double parsed = strtod(text, &end);
+    if (end == text)
+        return false;
+
+    value = parsed;
+    return true;
+}
+
+void CXmlReader::Widen(const char* text, std::wstring& out)
+{
+    out.clear();
+    const unsigned char* p = (const unsigned char*)text;
+    while (*p)
+    {
+        unsigned long code = *p++;
+        int extra = 0;
+        if (code >= 0xF0)
+        {
+            code &= 0x07;
+            extra = 3;
+        }
+        else if (code >= 0xE0)
+        {
+            code &= 0x0F;
+            extra = 2;
+        }
+        else if (code >= 0xC0)
+        {
+            code &= 0x1F;
+            extra = 1;
+        }
+
+        for (; extra > 0 && (*p & 0xC0) == 0x80; extra--)
+            code = (code << 6) | (*p++ & 0x3F);
+
+        if (code >= 0x10000 && sizeof(wchar_t) == 2)
+        {
+            // UTF-16 surrogate pair
+            code -= 0x10000;
+            out += (wchar_t)(0xD800 + (code >> 10));
+            out += (wchar_t)(0xDC00 + (code & 0x3FF));
+        }
+        else
+        {
+            out += (wchar_t)code;
+        }
+    }
+}
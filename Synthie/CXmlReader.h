@@ -0,0 +1,144 @@
+#pragma once
+#include <cstdio>
+#include <vector>
+#include <string>
+
+/*! Streaming XML reader
+ *
+ * A small pull parser for score files.  Next() steps from one element
+ * boundary to the next and the caller reads the name and attributes
+ * of the element it is on.  Text, comments, processing instructions
+ * and DOCTYPE declarations are skipped.  Nothing is kept once the
+ * reader moves on, so memory use does not grow with the file: the
+ * input is read through a fixed buffer (or straight from memory
+ * with OpenMemory()), and the current element is
+ * held in scratch buffers that are reused from one element to the
+ * next.
+ *
+ * Names and values are UTF-8, with the standard and numeric
+ * character references decoded.  A self-closing element is reported
+ * as a StartElement followed by its EndElement.
+ *
+ *  while (xml.Next() == CXmlReader::StartElement)
+ *  {
+ *      if (xml.Is("note"))
+ *          ...
+ *      xml.Skip();
+ *  }
+ */
+class CXmlReader
+{
+public:
+    enum Event { StartElement, EndElement, EndOfFile, Error };
+
+    CXmlReader();
+    virtual ~CXmlReader();
+
+    bool Open(const wchar_t* filename);
+
+    //! Read from a block of memory, which must outlive the reader
+    void OpenMemory(const char* data, size_t size);
+    void Close();
+
+    //! Move to the next start or end of an element
+    Event Next();
+
+    //! Consume the rest of the current element, through its end tag
+    void Skip();
+
+    /*! Copy the elements read to a string as XML
+     *
+     * Every element the reader passes from now on is appended to
+     * out, with its attributes, except elements named skip and
+     * everything inside them.  Used to keep the parts of a score
+     * around its notes.  Pass NULL to stop.
+     */
+    void SetEcho(std::string* out, const char* skip);
+
+    //! Name of the element the reader is on
+    const char* Name() const { return m_scratch.empty() ? "" : m_scratch.data(); }
+
+    //! True if the element the reader is on has this name
+    bool Is(const char* name) const;
+
+    int NumAttributes() const { return (int)m_attributes.size(); }
+    const char* AttributeName(int i) const { return m_scratch.data() + m_attributes[i].name; }
+    const char* AttributeValue(int i) const { return m_scratch.data() + m_attributes[i].value; }
+
+    //! Value of a named attribute, or NULL if it is not there
+    const char* Attribute(const char* name) const;
+
+    //! True once the reader has hit malformed input
+    bool Failed() const { return m_failed; }
+
+    //! Line the reader stopped on, for error messages
+    int Line() const { return m_line; }
+
+    //! Parse a number, returning def if the text is not one
+    static double ToDouble(const char* text, double def = 0.0);
+
+    //! Parse a number, returning false if the text is not one
+    static bool ParseDouble(const char* text, double& value);
+
+    //! Convert UTF-8 text to a wide string
+    static void Widen(const char* text, std::wstring& out);
+
+private:
+    //! Next input byte, or -1 at the end of the file
+    int Get()
+    {
+        if (m_pos == m_end && !Fill())
+            return -1;
+
+        const int c = (unsigned char)m_data[m_pos++];
+        if (c == '\n')
+            m_line++;
+
+        return c;
+    }
+
+    //! Next input byte without consuming it
+    int Peek()
+    {
+        if (m_pos == m_end && !Fill())
+            return -1;
+
+        return (unsigned char)m_data[m_pos];
+    }
+
+    Event Read();
+    bool Fill();
+    void SkipBom();
+    Event Fail();
+    bool SkipPast(const char* terminator);
+    int SkipSpace();
+    bool ReadName(int first);
+    bool ReadValue(int quote);
+    void AppendReference();
+    void AppendUtf8(unsigned long code);
+    void Echo(Event e);
+
+    struct AttributeRef
+    {
+        int name;               //!< Offset of the name in m_scratch
+        int value;              //!< Offset of the value in m_scratch
+    };
+
+    FILE* m_file;
+    std::vector<char> m_buffer;
+    const char* m_data;         //!< The buffer, or the memory being read
+    size_t m_pos;
+    size_t m_end;
+    int m_line;
+    bool m_failed;
+
+    // The current element: its name then the attribute names and
+    // values, each nul terminated
+    std::vector<char> m_scratch;
+    std::vector<AttributeRef> m_attributes;
+    bool m_pendingEnd;          //!< Current element was self-closing
+
+    std::string* m_echo;        //!< Where elements are copied, if anywhere
+    std::string m_echoSkip;     //!< Name of the elements not copied
+    int m_echoSkipDepth;        //!< Depth inside a skipped element
+};
@@ -1,28 +1,116 @@
 #include "pch.h"
+#include <cmath>
+#include <cwchar>
 #include "Notes.h"
-#include <map>
-#include <string>
 
-using namespace std;
+const Tuning EqualTuning = { 440.0, { 0, 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100 } };
 
-static int g_initialized = false;
-static map<wstring, double> g_name2freq;
+//! Named temperaments, in cents above C
+static const struct
+{
+    const WCHAR *name;
+    double cents[12];
+} Temperaments[] = {
+    { L"equal", { 0, 100, 200, 300, 400, 500, 600, 700, 800, 900, 1000, 1100 } },
+    { L"just", { 0, 111.731, 203.910, 315.641, 386.314, 498.045, 590.224, 701.955, 813.686, 884.359, 1017.596, 1088.269 } },
+    { L"pythagorean", { 0, 90.225, 203.910, 294.135, 407.820, 498.045, 611.730, 701.955, 792.180, 905.865, 996.090, 1109.775 } },
+    { L"meantone", { 0, 76.049, 193.157, 310.265, 386.314, 503.422, 579.471, 696.578, 772.627, 889.735, 1006.843, 1082.892 } },
+    { L"werckmeister", { 0, 90.225, 192.180, 294.135, 390.225, 498.045, 588.270, 696.090, 792.180, 888.270, 996.090, 1092.180 } },
+};
+
+//! Semitones above C of the natural notes A to G
+static const int Naturals[] = { 9, 11, 0, 2, 4, 5, 7 };
 
-double NoteToFrequency(const WCHAR *name)
+bool SetTemperament(Tuning& tuning, const WCHAR *name)
 {
-    if(!g_initialized)
+    for (const auto& t : Temperaments)
     {
-        for(int i=0;  i<sizeof(notes) / sizeof(Notes);  i++)
+        if (wcscmp(name, t.name) == 0)
         {
-            g_name2freq[notes[i].name] = notes[i].freq;
+            for (int i = 0; i < 12; i++)
+                tuning.cents[i] = t.cents[i];
+            return true;
         }
+    }
 
-        g_initialized = true;
+    // Otherwise twelve numbers
+    double cents[12];
+    const WCHAR *p = name;
+    for (int i = 0; i < 12; i++)
+    {
+        WCHAR *end;
+        cents[i] = wcstod(p, &end);
+        if (end == p)
+            return false;
+        p = end;
     }
 
-    map<wstring, double>::iterator f = g_name2freq.find(name);
-    if(f == g_name2freq.end())
+    for (int i = 0; i < 12; i++)
+        tuning.cents[i] = cents[i];
+    return true;
+}
+
+double NoteToFrequency(const WCHAR *name, const Tuning& tuning)
+{
+    const WCHAR *p = name;
+
+    // Letter
+    WCHAR letter = *p++;
+    if (letter >= L'a' && letter <= L'g')
+        letter = letter - L'a' + L'A';
+    if (letter < L'A' || letter > L'G')
         return 0;
 
-    return f->second;
-}
\ No newline at end of file
+    int semitone = Naturals[letter - L'A'];
+
+    // Accidentals
+    for (;; p++)
+    {
+        if (*p == L'#' || *p == L's')
+            semitone++;
+        else if (*p == L'b')
+            semitone--;
+        else if (*p == L'x')
+            semitone += 2;
+        else
+            break;
+    }
+
+    // Octave
+    bool negative = false;
+    if (*p == L'-')
+    {
+        negative = true;
+        p++;
+    }
+
+    if (*p < L'0' || *p > L'9')
+        return 0;
+
+    int octave = 0;
+    while (*p >= L'0' && *p <= L'9')
+        octave = octave * 10 + (*p++ - L'0');
+    if (negative)
+        octave = -octave;
+
+    // Offset in cents
+    double cents = 0;
+    if (*p == L'+' || *p == L'-')
+    {
+        WCHAR *end;
+        cents = wcstod(p, &end);
+        if (end == p)
+            return 0;
+        p = end;
+    }
+
+    if (*p != 0)
+        return 0;
+
+    // Accidentals can carry into the next octave, as in B#3 or Cb4
+    const int pitchClass = ((semitone % 12) + 12) % 12;
+    octave += (semitone - pitchClass) / 12;
+
+    const double above = tuning.cents[pitchClass] - tuning.cents[9] + cents;
+    return tuning.a4 * pow(2.0, (octave - 4) + above / 1200.0);
+}
@@ -5,12 +5,16 @@
 #include "pch.h"
 #include "Synthie.h"
 #include "SynthieView.h"
+#include "CBiquad.h"
 #include <cmath>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
 #endif
 
+// Frames handed to the file writer's thread at a time
+static const int FileBlock = 4096;
+
 short RangeBound(double d)
 {
     if(d < -32768)
@@ -27,8 +31,10 @@ CSynthieView::CSynthieView()
 {
     m_audiooutput = true;
     m_fileoutput = false;
+    m_fileWide = false;
+    m_fileSink = NULL;
+    m_incremental = false;
 
-	m_synthesizer.SetNumChannels(NumChannels());
 	m_synthesizer.SetSampleRate(SampleRate());
 }
 
@@ -46,6 +52,11 @@ BEGIN_MESSAGE_MAP(CSynthieView, CWnd)
 	ON_COMMAND(ID_GENERATE_1000HZTONE, &CSynthieView::OnGenerate1000hztone)
 	ON_COMMAND(ID_GENERATE_SYNTHESIZER, &CSynthieView::OnGenerateSynthesizer)
 	ON_COMMAND(ID_FILE_OPENSCORE, &CSynthieView::OnFileOpenscore)
+	ON_COMMAND(ID_FILE_COMPILESCORE, &CSynthieView::OnFileCompilescore)
+	ON_COMMAND(ID_FILE_ANALYZESCORE, &CSynthieView::OnFileAnalyzescore)
+	ON_COMMAND(ID_GENERATE_FILTERBENCHMARK, &CSynthieView::OnGenerateFilterbenchmark)
+	ON_COMMAND(ID_GENERATE_INCREMENTAL, &CSynthieView::OnGenerateIncremental)
+	ON_UPDATE_COMMAND_UI(ID_GENERATE_INCREMENTAL, &CSynthieView::OnUpdateGenerateIncremental)
 END_MESSAGE_MAP()
 
 
@@ -82,7 +93,7 @@ void CSynthieView::OnGenerate1000hztone()
 	if(!GenerateBegin())
 		return;
 
-	short audio[2];
+	short audio[CChannelLayout::MaxChannels];
 
 	double freq = 1000;
 	double duration = 5;
@@ -90,7 +101,8 @@ void CSynthieView::OnGenerate1000hztone()
 	for(double time=0.;  time < duration;  time += 1. / SampleRate())
 	{                 
 		audio[0] = short(3200 * sin(time * 2 * PI * freq));
-		audio[1] = audio[0];
+		for(int c=1;  c<NumChannels();  c++)
+			audio[c] = audio[0];
 
 		GenerateWriteFrame(audio);
 
@@ -110,7 +122,7 @@ void CSynthieView::OnGenerate1000hztone()
 //
 // Name :        CSynthieView::GenerateBegin()
 // Description : This function opens an audio file for output as
-//               m_wave.  Be sure to call EndGenerate() when done.
+//               m_fileSink.  Be sure to call EndGenerate() when done.
 // Returns :     true if successful...
 //
 
@@ -124,8 +136,10 @@ bool CSynthieView::GenerateBegin()
 
 	if(m_fileoutput)
 	{
-	  if(!OpenGenerateFile(m_wave))
+	  if(!OpenGenerateFile())
 		 return false;
+
+	  m_writer.Start(m_fileSink, NumChannels(), m_fileWide, FileBlock);
 	}
 
 	ProgressBegin(this);
@@ -144,14 +158,21 @@ bool CSynthieView::GenerateBegin()
 //
 // Name :        CSynthieView::GenerateWriteFrame()
 // Description : Write a frame of output to the current generation device.
+//               p_exact is the frame before it was rounded to shorts,
+//               if the caller has it, for files of more than 16 bits.
 //
 
-void CSynthieView::GenerateWriteFrame(short *p_frame)
+void CSynthieView::GenerateWriteFrame(short *p_frame, const double *p_exact)
 {
     m_waveformBuffer.Frame(p_frame);
 
     if(m_fileoutput)
-        m_wave.WriteFrame(p_frame);
+    {
+        if(m_fileWide && p_exact != NULL)
+            m_writer.WriteFrames(p_exact, 1);
+        else
+            m_writer.WriteFrames(p_frame, 1);
+    }
 
     if(m_audiooutput)
         m_soundstream.WriteFrame(p_frame);
@@ -168,7 +189,32 @@ void CSynthieView::GenerateEnd()
     m_waveformBuffer.End();
 
     if(m_fileoutput)
-        m_wave.close();
+    {
+        // The writer thread did the writing, so this is the first
+        // the view hears of a full disk or a write error
+        bool failed = !m_writer.Finish();
+        m_fileSink->close();
+        failed = failed || m_fileSink->fail();
+
+        CString msg;
+        if(failed)
+        {
+            msg = L"Failed to write the audio file.  The disk may be full.";
+        }
+        else
+        {
+            // Show whether the render had to wait for the disk
+            msg.Format(L"File written.  Waited for the disk %d times, %.3f seconds in all; at most %d of %d blocks queued.",
+                m_writer.Stalls(), m_writer.StallSeconds(), m_writer.MaxQueued(), m_writer.NumBlocks());
+        }
+
+        CFrameWnd *frame = GetParentFrame();
+        if(frame != NULL)
+            frame->SetMessageText(msg);
+
+        if(failed)
+            AfxMessageBox(msg);
+    }
 
     if(m_audiooutput)
         m_soundstream.Close();
@@ -182,21 +228,44 @@ void CSynthieView::GenerateEnd()
 // Returns :     true if successful...
 //
 
-bool CSynthieView::OpenGenerateFile(CWaveOut &p_wave)
+bool CSynthieView::OpenGenerateFile()
 {
-   p_wave.NumChannels(NumChannels());
-   p_wave.SampleRate(SampleRate());
-
-	static WCHAR BASED_CODE szFilter[] = L"Wave Files (*.wav)|*.wav|All Files (*.*)|*.*||";
+	static WCHAR BASED_CODE szFilter[] = L"16-bit Wave Files (*.wav)|*.wav|24-bit Wave Files (*.wav)|*.wav|"
+		L"32-bit Float Wave Files (*.wav)|*.wav|16-bit FLAC Files (*.flac)|*.flac|24-bit FLAC Files (*.flac)|*.flac|"
+		L"All Files (*.*)|*.*||";
 
 	CFileDialog dlg(FALSE, L".wav", NULL, 0, szFilter, NULL);
 	if(dlg.DoModal() != IDOK)
       return false;
 
-   p_wave.open(dlg.GetPathName());
-   if(p_wave.fail())
+   // The file type chosen picks the file and sample format
+   const DWORD format = dlg.m_ofn.nFilterIndex;
+   m_fileWide = format == 2 || format == 3 || format == 5;
+
+   if(format == 4 || format == 5)
+   {
+      m_flac.NumChannels(NumChannels());
+      m_flac.SampleRate(SampleRate());
+      m_flac.SampleSize(format == 5 ? 24 : 16);
+
+      m_flac.open(dlg.GetPathName());
+      if(m_flac.fail())
+         return false;
+
+      m_fileSink = &m_flac;
+      return true;
+   }
+
+   m_wave.NumChannels(NumChannels());
+   m_wave.SampleRate(SampleRate());
+   m_wave.SampleSize(format == 2 ? 24 : 16);
+   m_wave.FloatSamples(format == 3);
+
+   m_wave.open(dlg.GetPathName());
+   if(m_wave.fail())
       return false;
 
+   m_fileSink = &m_wave;
    return true;
 }
 
@@ -228,16 +297,49 @@ void CSynthieView::OnGenerateSynthesizer()
 	if (!GenerateBegin())
 		return;
 
+	// Offline renders can afford to oversample the clippers;
+	// live playback keeps the cheaper path.
+	m_synthesizer.SetOversampling(m_audiooutput ? 1 : 2);
+	short audio[CChannelLayout::MaxChannels];
+	double frame[CChannelLayout::MaxChannels];
+	const int channels = NumChannels();
+
+	// After an edit, render only the parts of the score that changed
+	// and play the last render with them spliced in
+	if (m_incremental && m_synthesizer.CanRenderIncremental())
+	{
+		{
+			CWaitCursor wait;
+			m_synthesizer.RenderIncremental();
+		}
+
+		const std::vector<float>& recorded = m_synthesizer.RecordedAudio();
+		for (size_t i = 0; i + channels <= recorded.size(); i += channels)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				frame[c] = recorded[i + c];
+				audio[c] = RangeBound(frame[c] * 32767);
+			}
+
+			GenerateWriteFrame(audio, frame);
+
+			if (ProgressAbortCheck())
+				break;
+		}
+
+		GenerateEnd();
+		return;
+	}
+
 	m_synthesizer.Start();
-	short audio[2];
-	double frame[2];
 
 	while (m_synthesizer.Generate(frame))
 	{
-		audio[0] = RangeBound(frame[0] * 32767);
-		audio[1] = RangeBound(frame[1] * 32767);
+		for (int c = 0; c < channels; c++)
+			audio[c] = RangeBound(frame[c] * 32767);
 
-		GenerateWriteFrame(audio);
+		GenerateWriteFrame(audio, frame);
 
 		// The progress control
 		if (ProgressAbortCheck())
@@ -250,7 +352,7 @@ void CSynthieView::OnGenerateSynthesizer()
 
 void CSynthieView::OnFileOpenscore()
 {
-	static WCHAR BASED_CODE szFilter[] = L"Score files (*.score)|*.score|All Files (*.*)|*.*||";
+	static WCHAR BASED_CODE szFilter[] = L"Score files (*.score;*.scorebin;*.mid;*.midi)|*.score;*.scorebin;*.mid;*.midi|All Files (*.*)|*.*||";
 
 	CFileDialog dlg(TRUE, L".score", NULL, 0, szFilter, NULL);
 	if (dlg.DoModal() != IDOK)
@@ -258,3 +360,64 @@ void CSynthieView::OnFileOpenscore()
 
 	m_synthesizer.OpenScore(dlg.GetPathName());
 }
+
+void CSynthieView::OnFileCompilescore()
+{
+	static WCHAR BASED_CODE szFilter[] = L"Score files (*.score)|*.score|All Files (*.*)|*.*||";
+	static WCHAR BASED_CODE szBinFilter[] = L"Compiled scores (*.scorebin)|*.scorebin|All Files (*.*)|*.*||";
+
+	CFileDialog dlg(TRUE, L".score", NULL, 0, szFilter, NULL);
+	if (dlg.DoModal() != IDOK)
+		return;
+
+	CString source = dlg.GetPathName();
+	CString target = source;
+	int dot = target.ReverseFind(L'.');
+	if (dot > target.ReverseFind(L'\\'))
+		target = target.Left(dot);
+	target += L".scorebin";
+
+	CFileDialog save(FALSE, L".scorebin", target, OFN_OVERWRITEPROMPT, szBinFilter, NULL);
+	if (save.DoModal() != IDOK)
+		return;
+
+	CWaitCursor wait;
+	m_synthesizer.CompileScore(source, save.GetPathName());
+}
+
+void CSynthieView::OnFileAnalyzescore()
+{
+	static WCHAR BASED_CODE szFilter[] = L"JSON files (*.json)|*.json|All Files (*.*)|*.*||";
+
+	CFileDialog save(FALSE, L".json", L"analysis.json", OFN_OVERWRITEPROMPT, szFilter, NULL);
+	if (save.DoModal() != IDOK)
+		return;
+
+	CWaitCursor wait;
+	const std::string json = m_synthesizer.AnalyzeScore();
+
+	FILE* file = _wfopen(save.GetPathName(), L"wb");
+	if (file == NULL || fwrite(json.data(), 1, json.size(), file) != json.size())
+		AfxMessageBox(L"Failed to write the score analysis");
+
+	if (file != NULL)
+		fclose(file);
+}
+
+void CSynthieView::OnGenerateIncremental()
+{
+	m_incremental = !m_incremental;
+	m_synthesizer.SetRecording(m_incremental);
+}
+
+void CSynthieView::OnUpdateGenerateIncremental(CCmdUI *pCmdUI)
+{
+	pCmdUI->SetCheck(m_incremental);
+}
+
+void CSynthieView::OnGenerateFilterbenchmark()
+{
+	CWaitCursor wait;
+	std::wstring report = BiquadBenchmark();
+	AfxMessageBox(report.c_str(), MB_OK | MB_ICONINFORMATION);
+}
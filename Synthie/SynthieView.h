@@ -7,8 +7,10 @@
 
 #include "Progress.h"
 #include "audio/wave.h"
+#include "audio/Flac.h"
 #include "audio/DirSoundStream.h"	// Added by ClassView
 #include "audio/WaveformBuffer.h"
+#include "audio/WaveWriter.h"
 #include "CSynthesizer.h"
 
 
@@ -42,17 +44,22 @@ protected:
 private:
 	bool m_fileoutput;
 	bool m_audiooutput;
-	void GenerateWriteFrame(short *p_frame);
-	bool OpenGenerateFile(CWaveOut &p_wave);
+	bool m_incremental;
+	void GenerateWriteFrame(short *p_frame, const double *p_exact = NULL);
+	bool OpenGenerateFile();
 	void GenerateEnd();
 	bool GenerateBegin();
 
     // Audio destinations..
     CWaveOut        m_wave;
+    CFlacOut        m_flac;
+    CAudioSink     *m_fileSink;		// m_wave or m_flac, whichever is being written
+    CWaveWriter     m_writer;		// Writes to m_fileSink on its own thread
+    bool m_fileWide;			// m_fileSink takes more than 16 bits a sample
     CDirSoundStream m_soundstream;
     CWaveformBuffer m_waveformBuffer;
 
-	int NumChannels() {return 2;}
+	int NumChannels() {return m_synthesizer.GetNumChannels();}
 	double SampleRate() {return 44100;}
 public:
 	afx_msg void OnGenerateFileoutput();
@@ -65,5 +72,10 @@ private:
 public:
 	afx_msg void OnGenerateSynthesizer();
 	afx_msg void OnFileOpenscore();
+	afx_msg void OnFileCompilescore();
+	afx_msg void OnFileAnalyzescore();
+	afx_msg void OnGenerateFilterbenchmark();
+	afx_msg void OnGenerateIncremental();
+	afx_msg void OnUpdateGenerateIncremental(CCmdUI *pCmdUI);
 };
 
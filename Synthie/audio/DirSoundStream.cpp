@@ -11,6 +11,8 @@
 
 #include "pch.h"
 #include <math.h>
+#include <mmreg.h>
+#include <ksmedia.h>
 
 #include "DirSoundStream.h"
 
@@ -118,8 +120,11 @@ bool CDirSoundStream::InitializeDirectSound()
             DSBCAPS_GETCURRENTPOSITION2   // Always a good idea
             | DSBCAPS_GLOBALFOCUS         // Allows background playing
             | DSBCAPS_CTRLPOSITIONNOTIFY  // Needed for notification
-            | DSBCAPS_CTRLPAN             // Allow for panning
             | DSBCAPS_CTRLVOLUME;         // Allow volume control
+
+   // Only mono and stereo buffers can be panned
+   if(m_numchannels <= 2)
+      dsbdesc.dwFlags |= DSBCAPS_CTRLPAN;
  
    // The size of the buffer is arbitrary, but should be at least
    // two seconds, to keep data writes well ahead of the play
@@ -129,9 +134,12 @@ bool CDirSoundStream::InitializeDirectSound()
    // Set secondary buffer format
    //
 
-   WAVEFORMATEX wfx;
+   // More than two channels need the extensible format, which
+   // says which speaker each channel is for
+   WAVEFORMATEXTENSIBLE wfxe;
+   WAVEFORMATEX &wfx = wfxe.Format;
 
-   memset(&wfx, 0, sizeof(WAVEFORMATEX)); 
+   memset(&wfxe, 0, sizeof(WAVEFORMATEXTENSIBLE)); 
    wfx.wFormatTag = WAVE_FORMAT_PCM; 
    wfx.nChannels = m_numchannels; 
    wfx.nSamplesPerSec = m_samplerate; 
@@ -139,6 +147,16 @@ bool CDirSoundStream::InitializeDirectSound()
    wfx.nBlockAlign = wfx.wBitsPerSample / 8 * wfx.nChannels;
    wfx.nAvgBytesPerSec = wfx.nSamplesPerSec * wfx.nBlockAlign;
 
+   if(m_numchannels > 2)
+   {
+      wfx.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+      wfx.cbSize = sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX);
+      wfxe.Samples.wValidBitsPerSample = 16;
+      wfxe.dwChannelMask = m_numchannels == 4 ? KSAUDIO_SPEAKER_QUAD :
+         (m_numchannels == 6 ? KSAUDIO_SPEAKER_5POINT1 : 0);
+      wfxe.SubFormat = KSDATAFORMAT_SUBTYPE_PCM;
+   }
+
    m_buffersize = int(wfx.nAvgBytesPerSec * m_bufferduration); 
    m_bufferwrloc = 0;
    m_bufferrdloc = 0;
@@ -165,7 +183,7 @@ bool CDirSoundStream::Close()
       return false;
 
    // Pad the end with 500ms of silence.
-   short silence[2] = {0, 0};
+   short silence[MaxChannels] = {0};
    for(int i=0;  i<m_samplerate / 2;  i++)
       WriteFrame(silence);
 
@@ -210,17 +228,13 @@ void CDirSoundStream::WriteFrame(short *p_audio)
    // audio buffer.
    //
 
-   if(m_numchannels == 2)
-   {
-      m_audio[m_audiocnt++] = p_audio[0];
-      m_audio[m_audiocnt++] = p_audio[1];
-   }
-   else
+   for(int c=0;  c<m_numchannels;  c++)
    {
-      m_audio[m_audiocnt++] = p_audio[0];
+      m_audio[m_audiocnt++] = p_audio[c];
    }
 
-   if(m_audiocnt >= 1996)
+   // Move it on while there is still room for two more frames
+   if(m_audiocnt >= AudioSize - 2 * m_numchannels)
    {
       CSingleLock lock(&m_mutex);
       lock.Lock();
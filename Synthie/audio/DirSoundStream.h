@@ -18,6 +18,9 @@ const int DSNUMNOTIFY = 2;
 class CDirSoundStream : public CObject
 {
 public:
+   //! Most channels a stream can have
+   static const int MaxChannels = 8;
+
    CDirSoundStream();
 	CDirSoundStream(CDirSound *p_DirSound);
 	virtual ~CDirSoundStream();
@@ -31,7 +34,7 @@ public:
 	void SetVolume(double p_gain);
 	void SetPan(double p_pan);
 
-   void SetChannels(int c) {m_numchannels = c;}
+   void SetChannels(int c) {m_numchannels = c < MaxChannels ? c : MaxChannels;}
    void SetSampleRate(int s) {m_samplerate = s;}
 
    void SetBufferDuration(double d) {m_bufferduration = d;}
@@ -65,7 +68,8 @@ private:
    CComPtr<IDirectSoundBuffer> m_pSoundBuffer;
 
    // Audio data accumulator
-   short          m_audio[2000];
+   static const int AudioSize = 2000;
+   short          m_audio[AudioSize];
    int            m_audiocnt;
 };
 
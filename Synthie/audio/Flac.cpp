@@ -0,0 +1,1337 @@
+/*
+ *  Name :         Flac.cpp
+ *  Description :  FLAC file output.  The stream format is the one
+ *                 in RFC 9639.
+ */
+
+#include "pch.h"
+
+#include <fstream>
+#include <cstring>
+#include <cmath>
+#include <atomic>
+#include <thread>
+
+#include "Flac.h"
+
+using namespace std;
+
+// Frames in each block.  Only the last block may be shorter.
+static const int FlacBlock = 4096;
+
+// Blocks encoded together, for each thread
+static const int BlocksPerThread = 4;
+
+// Largest predictors and residual partitionings tried
+static const int MaxFixedOrder = 4;
+static const int MaxLpcOrder = 12;
+static const int MaxPartitionOrder = 8;
+
+// Subframe types
+enum { SubConstant, SubVerbatim, SubFixed, SubLpc };
+
+// Channel assignments for stereo
+enum { Independent = 1, LeftSide = 8, SideRight = 9, MidSide = 10 };
+
+
+// **********************************************************************
+//
+// Bits and checksums
+//
+// **********************************************************************
+
+// Writes bits most significant first, as FLAC stores them
+class CBitWriter
+{
+public:
+   CBitWriter(vector<unsigned char> &out) : m_out(out), m_acc(0), m_bits(0) {}
+
+   // Write the low bits of a value, at most 32
+   void Put(unsigned long long value, int bits)
+   {
+      m_acc = (m_acc << bits) | (value & ((1ull << bits) - 1));
+      m_bits += bits;
+      while(m_bits >= 8)
+      {
+         m_bits -= 8;
+         m_out.push_back((unsigned char)(m_acc >> m_bits));
+      }
+   }
+
+   void PutSigned(long long value, int bits) {Put((unsigned long long)value, bits);}
+
+   void Zeros(unsigned long long count)
+   {
+      for(;  count >= 32;  count -= 32)
+         Put(0, 32);
+      Put(0, (int)count);
+   }
+
+   // A residual, folded to unsigned and Rice coded with parameter k
+   void Rice(int value, int k)
+   {
+      const unsigned u = ((unsigned)value << 1) ^ (unsigned)(value >> 31);
+      const unsigned q = u >> k;
+      if(q + 1 + k <= 32)
+      {
+         Put((1ull << k) | (u & ((1u << k) - 1)), q + 1 + k);
+      }
+      else
+      {
+         Zeros(q);
+         Put(1, 1);
+         Put(u, k);
+      }
+   }
+
+   void Align()
+   {
+      if(m_bits > 0)
+         Put(0, 8 - m_bits);
+   }
+
+private:
+   vector<unsigned char> &m_out;
+   unsigned long long m_acc;
+   int m_bits;
+};
+
+
+// Reads bits most significant first.  Reading past the end gives
+// zeros and sets a flag.
+class CBitReader
+{
+public:
+   CBitReader(const unsigned char *data, size_t size) : m_data(data), m_bits(size * 8), m_pos(0), m_over(false) {}
+
+   unsigned long long Get(int bits)
+   {
+      unsigned long long v = 0;
+      while(bits > 0)
+      {
+         if(m_pos >= m_bits)
+         {
+            m_over = true;
+            return 0;
+         }
+
+         const int avail = 8 - (int)(m_pos & 7);
+         const int take = bits < avail ? bits : avail;
+         v = (v << take) | ((m_data[m_pos >> 3] >> (avail - take)) & ((1u << take) - 1));
+         m_pos += take;
+         bits -= take;
+      }
+
+      return v;
+   }
+
+   long long GetSigned(int bits)
+   {
+      const unsigned long long v = Get(bits);
+      if(bits > 0 && (v >> (bits - 1)) & 1)
+         return (long long)v - (long long)(1ull << bits);
+
+      return (long long)v;
+   }
+
+   // Count zero bits up to the next one bit
+   unsigned long long Unary()
+   {
+      unsigned long long q = 0;
+      while(Get(1) == 0 && !m_over)
+         q++;
+
+      return q;
+   }
+
+   int Rice(int k)
+   {
+      const unsigned long long u = (Unary() << k) | Get(k);
+      return (int)((u >> 1) ^ (0 - (u & 1)));
+   }
+
+   void Align() {m_pos = (m_pos + 7) & ~(size_t)7;}
+   size_t Bytes() const {return m_pos / 8;}
+   bool Over() const {return m_over;}
+
+private:
+   const unsigned char *m_data;
+   size_t m_bits;
+   size_t m_pos;
+   bool m_over;
+};
+
+
+// CRC-8, polynomial x^8 + x^2 + x + 1, for frame headers
+static unsigned Crc8(const unsigned char *data, size_t size)
+{
+   unsigned crc = 0;
+   for(size_t i=0;  i<size;  i++)
+   {
+      crc ^= data[i];
+      for(int b=0;  b<8;  b++)
+         crc = (crc & 0x80) ? ((crc << 1) ^ 0x07) & 0xFF : (crc << 1) & 0xFF;
+   }
+
+   return crc;
+}
+
+// CRC-16, polynomial x^16 + x^15 + x^2 + 1, for whole frames
+struct Crc16Table
+{
+   unsigned t[256];
+
+   Crc16Table()
+   {
+      for(unsigned i=0;  i<256;  i++)
+      {
+         unsigned crc = i << 8;
+         for(int b=0;  b<8;  b++)
+            crc = (crc & 0x8000) ? ((crc << 1) ^ 0x8005) & 0xFFFF : (crc << 1) & 0xFFFF;
+         t[i] = crc;
+      }
+   }
+};
+
+static unsigned Crc16(const unsigned char *data, size_t size)
+{
+   static const Crc16Table table;
+
+   unsigned crc = 0;
+   for(size_t i=0;  i<size;  i++)
+      crc = ((crc << 8) ^ table.t[(crc >> 8) ^ data[i]]) & 0xFFFF;
+
+   return crc;
+}
+
+
+// **********************************************************************
+//
+// Encoding
+//
+// **********************************************************************
+
+// How one channel of a block is coded
+struct Subframe
+{
+   int type;
+   int bps;			// Bits per sample, after wasted bits
+   int wasted;			// Low bits that are zero in every sample
+   int order;			// Predictor order
+   int precision;		// Bits in each LPC coefficient
+   int shift;			// LPC coefficients are scaled by 2^shift
+   int coefs[MaxLpcOrder];
+   vector<int> residual;	// Prediction errors after the warm-up samples
+   int partitionOrder;
+   int params[1 << MaxPartitionOrder];
+   bool rice5;			// Parameters take 5 bits rather than 4
+   unsigned long long bits;	// Size of the subframe
+};
+
+
+/*
+ *  Name :         PlanResidual()
+ *  Description :  Choose how to split the residual into partitions and
+ *                 the Rice parameter for each.  Returns the bits it
+ *                 will take.
+ */
+
+static unsigned long long PlanResidual(Subframe &sub, int n)
+{
+   const int order = sub.order;
+   const vector<int> &res = sub.residual;
+
+   // Partitions have to divide the block evenly and the first one has
+   // to hold more than the warm-up samples
+   int maxOrder = 0;
+   while(maxOrder < MaxPartitionOrder && (n & ((2 << maxOrder) - 1)) == 0 && (n >> (maxOrder + 1)) > order)
+      maxOrder++;
+
+   // Sums of the folded residuals in the finest partitions.  Coarser
+   // partitionings add these up pairwise.
+   vector<unsigned long long> sums(1 << maxOrder, 0);
+   vector<int> counts(1 << maxOrder, 0);
+   const int len = n >> maxOrder;
+   for(int i=0;  i<(int)res.size();  i++)
+   {
+      const int p = (i + order) / len;
+      sums[p] += ((unsigned)res[i] << 1) ^ (unsigned)(res[i] >> 31);
+      counts[p]++;
+   }
+
+   unsigned long long best = ~0ull;
+   for(int po = maxOrder;  po >= 0;  po--)
+   {
+      const int parts = 1 << po;
+      if(po < maxOrder)
+      {
+         for(int p=0;  p<parts;  p++)
+         {
+            sums[p] = sums[2 * p] + sums[2 * p + 1];
+            counts[p] = counts[2 * p] + counts[2 * p + 1];
+         }
+      }
+
+      int params[1 << MaxPartitionOrder];
+      bool rice5 = false;
+      unsigned long long bits = 2 + 4;
+      for(int p=0;  p<parts;  p++)
+      {
+         // The best parameter is near log2 of the mean
+         int k = 0;
+         if(counts[p] > 0)
+         {
+            const unsigned long long mean = sums[p] / counts[p];
+            while(k < 30 && (mean >> (k + 1)) > 0)
+               k++;
+         }
+
+         params[p] = k;
+         if(k > 14)
+            rice5 = true;
+
+         bits += (unsigned long long)counts[p] * (k + 1) + (sums[p] >> k);
+      }
+
+      bits += (unsigned long long)parts * (rice5 ? 5 : 4);
+      if(bits < best)
+      {
+         best = bits;
+         sub.partitionOrder = po;
+         sub.rice5 = rice5;
+         memcpy(sub.params, params, parts * sizeof(int));
+      }
+   }
+
+   return best;
+}
+
+
+// Prediction errors of a fixed polynomial predictor.  Returns false
+// if any does not fit in 32 bits.
+static bool FixedResidual(const int *x, int n, int order, vector<int> &res)
+{
+   res.resize(n - order);
+   for(int i=order;  i<n;  i++)
+   {
+      long long p = 0;
+      switch(order)
+      {
+      case 1: p = x[i - 1]; break;
+      case 2: p = 2ll * x[i - 1] - x[i - 2]; break;
+      case 3: p = 3ll * x[i - 1] - 3ll * x[i - 2] + x[i - 3]; break;
+      case 4: p = 4ll * x[i - 1] - 6ll * x[i - 2] + 4ll * x[i - 3] - x[i - 4]; break;
+      }
+
+      const long long r = x[i] - p;
+      if(r > 0x7FFFFFFF || r < -0x7FFFFFFF)
+         return false;
+
+      res[i - order] = (int)r;
+   }
+
+   return true;
+}
+
+
+// Prediction errors of a quantized linear predictor
+static bool LpcResidual(const int *x, int n, const Subframe &sub, vector<int> &res)
+{
+   const int order = sub.order;
+   res.resize(n - order);
+   for(int i=order;  i<n;  i++)
+   {
+      long long sum = 0;
+      for(int j=0;  j<order;  j++)
+         sum += (long long)sub.coefs[j] * x[i - 1 - j];
+
+      const long long r = x[i] - (sum >> sub.shift);
+      if(r > 0x7FFFFFFF || r < -0x7FFFFFFF)
+         return false;
+
+      res[i - order] = (int)r;
+   }
+
+   return true;
+}
+
+
+/*
+ *  Name :         PlanSubframe()
+ *  Description :  Choose the smallest way to code one channel of a
+ *                 block.
+ */
+
+static void PlanSubframe(const int *samples, int n, int bps, Subframe &sub, Subframe &trial)
+{
+   // Low bits that are zero throughout need not be stored
+   int all = 0;
+   for(int i=0;  i<n;  i++)
+      all |= samples[i];
+
+   int wasted = 0;
+   if(all != 0)
+   {
+      while(((all >> wasted) & 1) == 0)
+         wasted++;
+   }
+
+   vector<int> shifted;
+   const int *x = samples;
+   if(wasted > 0)
+   {
+      shifted.resize(n);
+      for(int i=0;  i<n;  i++)
+         shifted[i] = samples[i] >> wasted;
+      x = shifted.data();
+      bps -= wasted;
+   }
+
+   const unsigned long long header = 8 + wasted;
+
+   sub.wasted = trial.wasted = wasted;
+   sub.bps = trial.bps = bps;
+   sub.order = 0;
+
+   bool constant = true;
+   for(int i=1;  i<n && constant;  i++)
+      constant = x[i] == x[0];
+
+   if(constant)
+   {
+      sub.type = SubConstant;
+      sub.bits = header + bps;
+      return;
+   }
+
+   sub.type = SubVerbatim;
+   sub.bits = header + (unsigned long long)n * bps;
+
+   // Fixed predictors: pick the order with the smallest errors, as
+   // a cheap estimate, then cost that one exactly
+   if(n > MaxFixedOrder)
+   {
+      unsigned long long total[MaxFixedOrder + 1] = {0};
+      for(int i=MaxFixedOrder;  i<n;  i++)
+      {
+         const long long e0 = x[i];
+         const long long e1 = e0 - x[i - 1];
+         const long long e2 = e1 - (x[i - 1] - x[i - 2]);
+         const long long e3 = e2 - (x[i - 1] - 2ll * x[i - 2] + x[i - 3]);
+         const long long e4 = e3 - (x[i - 1] - 3ll * x[i - 2] + 3ll * x[i - 3] - x[i - 4]);
+         total[0] += e0 < 0 ? -e0 : e0;
+         total[1] += e1 < 0 ? -e1 : e1;
+         total[2] += e2 < 0 ? -e2 : e2;
+         total[3] += e3 < 0 ? -e3 : e3;
+         total[4] += e4 < 0 ? -e4 : e4;
+      }
+
+      int order = 0;
+      for(int o=1;  o<=MaxFixedOrder;  o++)
+      {
+         if(total[o] < total[order])
+            order = o;
+      }
+
+      trial.type = SubFixed;
+      trial.order = order;
+      if(FixedResidual(x, n, order, trial.residual))
+      {
+         trial.bits = header + (unsigned long long)order * bps + PlanResidual(trial, n);
+         if(trial.bits < sub.bits)
+            swap(sub, trial);
+      }
+   }
+
+   // Linear prediction, from the autocorrelation of the windowed
+   // block.  Orders are tried at a few points and costed exactly.
+   if(n <= 4 * MaxLpcOrder)
+      return;
+
+   double r[MaxLpcOrder + 1];
+   {
+      vector<double> w(n);
+      const double half = (n - 1) / 2.;
+      for(int i=0;  i<n;  i++)
+      {
+         const double t = (i - half) / (half + 1);
+         w[i] = x[i] * (1 - t * t);		// Welch window
+      }
+
+      for(int lag=0;  lag<=MaxLpcOrder;  lag++)
+      {
+         double sum = 0;
+         for(int i=lag;  i<n;  i++)
+            sum += w[i] * w[i - lag];
+         r[lag] = sum;
+      }
+   }
+
+   if(r[0] <= 0)
+      return;
+
+   // Levinson-Durbin recursion.  lpc[o - 1] holds the order o
+   // predictor, with lpc[o - 1][j] the weight of the sample j + 1 back.
+   double lpc[MaxLpcOrder][MaxLpcOrder];
+   double a[MaxLpcOrder] = {0};
+   double err = r[0];
+   int orders = 0;
+   for(int i=0;  i<MaxLpcOrder && err > 0;  i++)
+   {
+      double k = r[i + 1];
+      for(int j=0;  j<i;  j++)
+         k -= a[j] * r[i - j];
+      k /= err;
+
+      double next[MaxLpcOrder];
+      for(int j=0;  j<i;  j++)
+         next[j] = a[j] - k * a[i - 1 - j];
+      next[i] = k;
+      memcpy(a, next, (i + 1) * sizeof(double));
+
+      memcpy(lpc[i], a, (i + 1) * sizeof(double));
+      orders = i + 1;
+      err *= 1 - k * k;
+   }
+
+   const int precision = bps <= 17 ? 14 : 12;
+   static const int tryOrders[] = {4, 8, 12};
+   for(int t=0;  t<3;  t++)
+   {
+      const int order = tryOrders[t];
+      if(order > orders)
+         break;
+
+      // Quantize, carrying the rounding error from one coefficient
+      // to the next
+      double cmax = 0;
+      for(int j=0;  j<order;  j++)
+         cmax = fabs(lpc[order - 1][j]) > cmax ? fabs(lpc[order - 1][j]) : cmax;
+
+      if(cmax <= 0)
+         continue;
+
+      int log2cmax;
+      frexp(cmax, &log2cmax);
+      int shift = precision - 1 - log2cmax;
+      shift = shift < 0 ? 0 : (shift > 15 ? 15 : shift);
+
+      const int qmax = (1 << (precision - 1)) - 1;
+      const int qmin = -(1 << (precision - 1));
+      double carry = 0;
+      for(int j=0;  j<order;  j++)
+      {
+         carry += lpc[order - 1][j] * (1 << shift);
+         long q = lrint(carry);
+         q = q > qmax ? qmax : (q < qmin ? qmin : q);
+         carry -= q;
+         trial.coefs[j] = (int)q;
+      }
+
+      trial.type = SubLpc;
+      trial.order = order;
+      trial.precision = precision;
+      trial.shift = shift;
+      if(!LpcResidual(x, n, trial, trial.residual))
+         continue;
+
+      trial.bits = header + (unsigned long long)order * bps + 4 + 5 +
+         (unsigned long long)order * precision + PlanResidual(trial, n);
+      if(trial.bits < sub.bits)
+         swap(sub, trial);
+   }
+}
+
+
+/*
+ *  Name :         WriteSubframe()
+ *  Description :  Write one channel of a block as planned.
+ */
+
+static void WriteSubframe(CBitWriter &w, const int *samples, int n, const Subframe &sub)
+{
+   static const int codes[] = {0, 1, 8, 32};
+   int code = codes[sub.type];
+   if(sub.type == SubFixed)
+      code |= sub.order;
+   else if(sub.type == SubLpc)
+      code |= sub.order - 1;
+
+   w.Put(0, 1);
+   w.Put(code, 6);
+   if(sub.wasted > 0)
+   {
+      w.Put(1, 1);
+      w.Zeros(sub.wasted - 1);
+      w.Put(1, 1);
+   }
+   else
+   {
+      w.Put(0, 1);
+   }
+
+   const int bps = sub.bps;
+   const int warm = sub.type == SubConstant ? 1 : (sub.type == SubVerbatim ? n : sub.order);
+   for(int i=0;  i<warm;  i++)
+      w.PutSigned(samples[i] >> sub.wasted, bps);
+
+   if(sub.type == SubConstant || sub.type == SubVerbatim)
+      return;
+
+   if(sub.type == SubLpc)
+   {
+      w.Put(sub.precision - 1, 4);
+      w.PutSigned(sub.shift, 5);
+      for(int j=0;  j<sub.order;  j++)
+         w.PutSigned(sub.coefs[j], sub.precision);
+   }
+
+   w.Put(sub.rice5 ? 1 : 0, 2);
+   w.Put(sub.partitionOrder, 4);
+
+   const int parts = 1 << sub.partitionOrder;
+   const int len = n >> sub.partitionOrder;
+   const int *res = sub.residual.data();
+   for(int p=0;  p<parts;  p++)
+   {
+      const int k = sub.params[p];
+      w.Put(k, sub.rice5 ? 5 : 4);
+
+      const int count = p == 0 ? len - sub.order : len;
+      for(int i=0;  i<count;  i++)
+         w.Rice(*res++, k);
+   }
+}
+
+
+// Sample rates that have their own code in frame headers
+static int SampleRateCode(int rate)
+{
+   static const int rates[] = {0, 88200, 176400, 192000, 8000, 16000, 22050, 24000, 32000, 44100, 48000, 96000};
+   for(int i=1;  i<12;  i++)
+   {
+      if(rates[i] == rate)
+         return i;
+   }
+
+   return 0;		// From the stream info
+}
+
+static int SampleSizeCode(int bps)
+{
+   switch(bps)
+   {
+   case 8: return 1;
+   case 12: return 2;
+   case 16: return 4;
+   case 20: return 5;
+   case 24: return 6;
+   }
+
+   return 0;		// From the stream info
+}
+
+static int BlockSizeCode(int n)
+{
+   if(n == 192)
+      return 1;
+
+   for(int k=0;  k<4;  k++)
+   {
+      if(n == 576 << k)
+         return 2 + k;
+   }
+
+   for(int k=0;  k<8;  k++)
+   {
+      if(n == 256 << k)
+         return 8 + k;
+   }
+
+   return n <= 256 ? 6 : 7;	// Size follows the header
+}
+
+
+/*
+ *  Name :         CFlacOut::EncodeBlock()
+ *  Description :  Encode a block of interleaved frames as a FLAC frame.
+ */
+
+void CFlacOut::EncodeBlock(const int *in, int n, int channels, int bps, int rate,
+   unsigned long number, vector<unsigned char> &out)
+{
+   out.clear();
+
+   // Split the channels apart.  Stereo also gets side and mid.
+   const int planes = channels == 2 ? 4 : channels;
+   vector<vector<int> > x(planes, vector<int>(n));
+   for(int i=0;  i<n;  i++)
+   {
+      for(int c=0;  c<channels;  c++)
+         x[c][i] = in[(size_t)i * channels + c];
+   }
+
+   if(channels == 2)
+   {
+      for(int i=0;  i<n;  i++)
+      {
+         x[2][i] = x[0][i] - x[1][i];			// Side
+         x[3][i] = (x[0][i] + x[1][i]) >> 1;	// Mid
+      }
+   }
+
+   vector<Subframe> subs(planes);
+   Subframe trial;
+   for(int c=0;  c<planes;  c++)
+      PlanSubframe(x[c].data(), n, channels == 2 && c == 2 ? bps + 1 : bps, subs[c], trial);
+
+   // Stereo pairs, as left/right, left/side, side/right or mid/side
+   int assignment = channels - 1;
+   int pick[2] = {0, 1};
+   if(channels == 2)
+   {
+      static const int pairs[4][3] = {{0, 1, Independent}, {0, 2, LeftSide}, {2, 1, SideRight}, {3, 2, MidSide}};
+      unsigned long long best = ~0ull;
+      for(int p=0;  p<4;  p++)
+      {
+         const unsigned long long bits = subs[pairs[p][0]].bits + subs[pairs[p][1]].bits;
+         if(bits < best)
+         {
+            best = bits;
+            pick[0] = pairs[p][0];
+            pick[1] = pairs[p][1];
+            assignment = pairs[p][2];
+         }
+      }
+   }
+
+   CBitWriter w(out);
+
+   // Frame header
+   const int sizeCode = BlockSizeCode(n);
+   w.Put(0x3FFE, 14);		// Sync
+   w.Put(0, 1);
+   w.Put(0, 1);			// Fixed block size, so blocks are numbered
+   w.Put(sizeCode, 4);
+   w.Put(SampleRateCode(rate), 4);
+   w.Put(assignment, 4);
+   w.Put(SampleSizeCode(bps), 3);
+   w.Put(0, 1);
+
+   // The block number, coded like UTF-8
+   if(number < 0x80)
+   {
+      w.Put(number, 8);
+   }
+   else
+   {
+      int bytes = 2;
+      while(bytes < 6 && number >= (1ul << (5 * bytes + 1)))
+         bytes++;
+
+      // As many one bits as there are bytes, a zero, then the top of
+      // the number, then six bits in each of the other bytes
+      w.Put(((1u << bytes) - 1) << 1, bytes + 1);
+      w.Put(number >> (6 * (bytes - 1)), 7 - bytes);
+      for(int b=bytes-2;  b>=0;  b--)
+      {
+         w.Put(2, 2);
+         w.Put(number >> (6 * b), 6);
+      }
+   }
+
+   if(sizeCode == 6)
+      w.Put(n - 1, 8);
+   else if(sizeCode == 7)
+      w.Put(n - 1, 16);
+
+   w.Put(Crc8(out.data(), out.size()), 8);
+
+   if(channels == 2)
+   {
+      WriteSubframe(w, x[pick[0]].data(), n, subs[pick[0]]);
+      WriteSubframe(w, x[pick[1]].data(), n, subs[pick[1]]);
+   }
+   else
+   {
+      for(int c=0;  c<channels;  c++)
+         WriteSubframe(w, x[c].data(), n, subs[c]);
+   }
+
+   w.Align();
+   w.Put(Crc16(out.data(), out.size()), 16);
+}
+
+
+// **********************************************************************
+//
+// Decoding, to verify what was encoded
+//
+// **********************************************************************
+
+/*
+ *  Name :         DecodeSubframe()
+ *  Description :  Decode one channel of a block.
+ */
+
+static bool DecodeSubframe(CBitReader &r, int n, int bps, int *x)
+{
+   if(r.Get(1) != 0)
+      return false;
+
+   const int code = (int)r.Get(6);
+
+   int wasted = 0;
+   if(r.Get(1))
+      wasted = (int)r.Unary() + 1;
+
+   bps -= wasted;
+   if(bps < 1)
+      return false;
+
+   if(code == 0)
+   {
+      const int v = (int)r.GetSigned(bps);
+      for(int i=0;  i<n;  i++)
+         x[i] = v;
+   }
+   else if(code == 1)
+   {
+      for(int i=0;  i<n;  i++)
+         x[i] = (int)r.GetSigned(bps);
+   }
+   else if((code & 0x38) == 8 || (code & 0x20) != 0)
+   {
+      const bool lpc = (code & 0x20) != 0;
+      const int order = lpc ? (code & 0x1F) + 1 : code & 7;
+      if(order > n || (!lpc && order > MaxFixedOrder))
+         return false;
+
+      for(int i=0;  i<order;  i++)
+         x[i] = (int)r.GetSigned(bps);
+
+      int precision = 0;
+      int shift = 0;
+      int coefs[32];
+      if(lpc)
+      {
+         precision = (int)r.Get(4) + 1;
+         shift = (int)r.GetSigned(5);
+         if(precision == 16 || shift < 0)
+            return false;
+
+         for(int j=0;  j<order;  j++)
+            coefs[j] = (int)r.GetSigned(precision);
+      }
+
+      // The residual, which goes in x for now
+      const int method = (int)r.Get(2);
+      if(method > 1)
+         return false;
+
+      const int po = (int)r.Get(4);
+      const int parts = 1 << po;
+      if((n & (parts - 1)) != 0 || (n >> po) < order)
+         return false;
+
+      int *out = x + order;
+      for(int p=0;  p<parts;  p++)
+      {
+         const int k = (int)r.Get(method == 0 ? 4 : 5);
+         const int count = (n >> po) - (p == 0 ? order : 0);
+         if(k == (method == 0 ? 15 : 31))
+         {
+            // Escaped: the samples are stored as they are
+            const int raw = (int)r.Get(5);
+            for(int i=0;  i<count;  i++)
+               *out++ = raw == 0 ? 0 : (int)r.GetSigned(raw);
+         }
+         else
+         {
+            for(int i=0;  i<count;  i++)
+               *out++ = r.Rice(k);
+         }
+
+         if(r.Over())
+            return false;
+      }
+
+      // Add the prediction back in
+      for(int i=order;  i<n;  i++)
+      {
+         long long p = 0;
+         if(lpc)
+         {
+            for(int j=0;  j<order;  j++)
+               p += (long long)coefs[j] * x[i - 1 - j];
+            p >>= shift;
+         }
+         else
+         {
+            switch(order)
+            {
+            case 1: p = x[i - 1]; break;
+            case 2: p = 2ll * x[i - 1] - x[i - 2]; break;
+            case 3: p = 3ll * x[i - 1] - 3ll * x[i - 2] + x[i - 3]; break;
+            case 4: p = 4ll * x[i - 1] - 6ll * x[i - 2] + 4ll * x[i - 3] - x[i - 4]; break;
+            }
+         }
+
+         x[i] = (int)(x[i] + p);
+      }
+   }
+   else
+   {
+      return false;
+   }
+
+   if(wasted > 0)
+   {
+      for(int i=0;  i<n;  i++)
+         x[i] = (int)((unsigned)x[i] << wasted);
+   }
+
+   return !r.Over();
+}
+
+
+/*
+ *  Name :         CFlacOut::DecodeBlock()
+ *  Description :  Decode a FLAC frame written by EncodeBlock() and
+ *                 check that it holds the frames it was made from.
+ */
+
+bool CFlacOut::DecodeBlock(const vector<unsigned char> &data, const int *in, int n, int channels, int bps,
+   unsigned long number)
+{
+   if(data.size() < 8 || Crc16(data.data(), data.size() - 2) != ((unsigned)data[data.size() - 2] << 8 | data[data.size() - 1]))
+      return false;
+
+   CBitReader r(data.data(), data.size() - 2);
+   if(r.Get(14) != 0x3FFE || r.Get(1) != 0 || r.Get(1) != 0)
+      return false;
+
+   const int sizeCode = (int)r.Get(4);
+   r.Get(4);			// Sample rate
+   const int assignment = (int)r.Get(4);
+   const int sizeBits = (int)r.Get(3);
+   if(r.Get(1) != 0 || (sizeBits != 0 && sizeBits != SampleSizeCode(bps)))
+      return false;
+
+   // The block number
+   unsigned long first = (unsigned long)r.Get(8);
+   int more = 0;
+   while(more < 6 && (first & (0x80 >> more)))
+      more++;
+
+   unsigned long got = more == 0 ? first : first & (0x7F >> more);
+   for(int b=1;  b<more;  b++)
+   {
+      if(r.Get(2) != 2)
+         return false;
+      got = (got << 6) | (unsigned long)r.Get(6);
+   }
+
+   int size = 0;
+   if(sizeCode == 6)
+      size = (int)r.Get(8) + 1;
+   else if(sizeCode == 7)
+      size = (int)r.Get(16) + 1;
+   else if(sizeCode == 1)
+      size = 192;
+   else if(sizeCode >= 2 && sizeCode <= 5)
+      size = 576 << (sizeCode - 2);
+   else if(sizeCode >= 8)
+      size = 256 << (sizeCode - 8);
+
+   const size_t headerBytes = r.Bytes();
+   if(got != number || size != n || Crc8(data.data(), headerBytes) != r.Get(8))
+      return false;
+
+   vector<int> x[8];
+   const int count = assignment < 8 ? assignment + 1 : 2;
+   if(count != channels)
+      return false;
+
+   for(int c=0;  c<count;  c++)
+   {
+      x[c].resize(n);
+      const bool side = (assignment == LeftSide && c == 1) || (assignment == SideRight && c == 0) ||
+         (assignment == MidSide && c == 1);
+      if(!DecodeSubframe(r, n, side ? bps + 1 : bps, x[c].data()))
+         return false;
+   }
+
+   r.Align();
+   if(r.Bytes() != data.size() - 2)
+      return false;
+
+   for(int i=0;  i<n;  i++)
+   {
+      int left = x[0][i];
+      int right = channels > 1 ? x[1][i] : 0;
+      if(assignment == LeftSide)
+      {
+         right = left - right;
+      }
+      else if(assignment == SideRight)
+      {
+         left = left + right;
+      }
+      else if(assignment == MidSide)
+      {
+         const int mid = (int)(((unsigned)left << 1) | (right & 1));
+         left = (mid + right) >> 1;
+         right = (mid - right) >> 1;
+      }
+
+      const int *frame = in + (size_t)i * channels;
+      if(frame[0] != left || (channels > 1 && frame[1] != right))
+         return false;
+
+      for(int c=2;  c<channels;  c++)
+      {
+         if(frame[c] != x[c][i])
+            return false;
+      }
+   }
+
+   return true;
+}
+
+
+// **********************************************************************
+//
+// CFlacOut output object
+//
+// **********************************************************************
+
+
+/*
+ *  Name :         CFlacOut::CFlacOut()
+ *  Description :  Constructors.  We can construct with a filename or
+ *                 without.
+ */
+
+CFlacOut::CFlacOut() : CWave(), ofstream()
+{
+   _default();
+}
+
+
+CFlacOut::CFlacOut(const LPCTSTR fname) : CWave(), ofstream()
+{
+   _default();
+   open(fname);
+}
+
+
+CFlacOut::~CFlacOut()
+{
+   close();
+}
+
+
+/*
+ *  Name :         CFlacOut::open()
+ *  Description :  Open a file for writing.  Set the format before the
+ *                 first frames are written.
+ */
+
+void
+CFlacOut::open(const LPCTSTR fname)
+{
+   ofstream::clear();
+   ofstream::open(fname, ios::binary | ios::out);
+
+   if(bad() || !good())
+   {
+      _Error(TEXT("Unable to open file "), fname, TEXT(" for writing."));
+      return;
+   }
+
+   isopen = 1;
+   isstarted = 0;
+   numSampleFrames = 0;
+   numBlocks = 0;
+   minBlockBytes = 0;
+   maxBlockBytes = 0;
+   verifyFailures = 0;
+   m_pending.clear();
+}
+
+
+/*
+ *  Name :         CFlacOut::_default()
+ *  Description :  Set all file parameters to default values.
+ */
+
+void
+CFlacOut::_default()
+{
+   isopen = 0;
+   isstarted = 0;
+   numSampleFrames = 0;
+   numBlocks = 0;
+   minBlockBytes = 0;
+   maxBlockBytes = 0;
+   numChannels = 1;
+   sampleSize = 16;
+   sampleRate = 44100.;
+   verify = false;
+   threads = 0;
+   verifyFailures = 0;
+}
+
+
+/*
+ *  Name :         CFlacOut::close()
+ *  Description :  Encode what is left and fill in the stream info.
+ */
+
+void
+CFlacOut::close()
+{
+   if(!isopen)
+      return;
+
+   if(!isstarted)
+      _headers();
+
+   Encode(true);
+   isopen = 0;
+
+   WriteStreamInfo();
+   ofstream::close();
+
+   if(verifyFailures > 0)
+      Error(TEXT("The FLAC file did not verify.  Some blocks do not decode to the audio written."));
+}
+
+
+/*
+ *  Name :         CFlacOut::_headers()
+ *  Description :  Write the file header, with room for the stream
+ *                 info, which is filled in on close.
+ */
+
+int
+CFlacOut::_headers()
+{
+   isstarted = 1;
+
+   if(numChannels < 1 || numChannels > 8 || sampleSize < 8 || sampleSize > 24)
+   {
+      Error(TEXT("FLAC files are 1 to 8 channels of 8 to 24 bit samples"));
+      setstate(ios::failbit);
+      return 0;
+   }
+
+   write("fLaC", 4);
+   WriteStreamInfo();
+   return !fail();
+}
+
+
+/*
+ *  Name :         CFlacOut::WriteStreamInfo()
+ *  Description :  Write the STREAMINFO block, the only metadata block.
+ */
+
+void
+CFlacOut::WriteStreamInfo()
+{
+   vector<unsigned char> info;
+   CBitWriter w(info);
+
+   w.Put(0x80, 8);		// Last metadata block, of type 0
+   w.Put(34, 24);
+   w.Put(FlacBlock, 16);	// Smallest and largest block, in frames
+   w.Put(FlacBlock, 16);
+   w.Put(minBlockBytes, 24);
+   w.Put(maxBlockBytes, 24);
+   w.Put((unsigned long)sampleRate, 20);
+   w.Put(numChannels - 1, 3);
+   w.Put(sampleSize - 1, 5);
+   w.Put(numSampleFrames >> 32, 4);
+   w.Put(numSampleFrames & 0xFFFFFFFF, 32);
+
+   // The MD5 signature of the audio is optional.  Zero means it
+   // was not worked out.
+   for(int i=0;  i<16;  i++)
+      w.Put(0, 8);
+
+   const streampos at = tellp();
+   seekp(4);
+   write((const char *)info.data(), info.size());
+   if(at > 4 + (streamoff)info.size())
+      seekp(at);
+}
+
+
+/*
+ *  Name :         CFlacOut::WriteFrames()
+ *  Description :  Write a block of frames, interleaved.  Frames are
+ *                 kept until there is a batch of blocks to encode.
+ */
+
+int
+CFlacOut::WriteFrames(const short *frames, int count)
+{
+   if(!isopen || fail())
+      return 0;
+
+   if(!isstarted && !_headers())
+      return 0;
+
+   const size_t samples = (size_t)count * numChannels;
+   const size_t at = m_pending.size();
+   m_pending.resize(at + samples);
+
+   int *out = m_pending.data() + at;
+   for(size_t i=0;  i<samples;  i++)
+   {
+      // Shorts fill the top 16 bits of larger samples
+      out[i] = sampleSize >= 16 ? frames[i] * (1 << (sampleSize - 16)) : frames[i] >> (16 - sampleSize);
+   }
+
+   numSampleFrames += count;
+   if(m_pending.size() >= (size_t)Threads() * BlocksPerThread * FlacBlock * numChannels)
+      return Encode(false);
+
+   return !fail();
+}
+
+
+/*
+ *  Name :         CFlacOut::WriteFrames()
+ *  Description :  Write a block of frames of samples where full scale
+ *                 is 1.0, interleaved.  Samples are rounded and
+ *                 clipped.
+ */
+
+int
+CFlacOut::WriteFrames(const double *frames, int count)
+{
+   if(!isopen || fail())
+      return 0;
+
+   if(!isstarted && !_headers())
+      return 0;
+
+   const size_t samples = (size_t)count * numChannels;
+   const size_t at = m_pending.size();
+   m_pending.resize(at + samples);
+
+   const double full = ldexp(1.0, sampleSize - 1);
+   int *out = m_pending.data() + at;
+   for(size_t i=0;  i<samples;  i++)
+   {
+      double x = frames[i] * (full - 1);
+      if(!(x >= -full))
+         x = -full;
+      else if(x > full - 1)
+         x = full - 1;
+
+      out[i] = (int)lrint(x);
+   }
+
+   numSampleFrames += count;
+   if(m_pending.size() >= (size_t)Threads() * BlocksPerThread * FlacBlock * numChannels)
+      return Encode(false);
+
+   return !fail();
+}
+
+
+/*
+ *  Name :         CFlacOut::Threads()
+ *  Description :  How many threads to encode on.
+ */
+
+int
+CFlacOut::Threads() const
+{
+   if(threads > 0)
+      return threads;
+
+   const int n = (int)thread::hardware_concurrency();
+   return n > 0 ? n : 1;
+}
+
+
+/*
+ *  Name :         CFlacOut::Encode()
+ *  Description :  Encode the whole blocks waiting, or everything
+ *                 waiting if this is the end, and write them.  The
+ *                 blocks are shared out among the threads and
+ *                 written in order once they are all done.
+ */
+
+int
+CFlacOut::Encode(bool last)
+{
+   const size_t blockSamples = (size_t)FlacBlock * numChannels;
+   const size_t pendingFrames = m_pending.size() / numChannels;
+   const int blocks = (int)(last ? (pendingFrames + FlacBlock - 1) / FlacBlock : pendingFrames / FlacBlock);
+   if(blocks == 0 || fail())
+      return !fail();
+
+   const int bps = sampleSize;
+   const int rate = (int)sampleRate;
+   const int channels = numChannels;
+   const bool check = verify;
+   const unsigned long first = numBlocks;
+
+   m_encoded.resize(blocks);
+   atomic<int> next(0);
+   atomic<int> failures(0);
+
+   auto work = [&]()
+   {
+      for(;;)
+      {
+         const int b = next++;
+         if(b >= blocks)
+            break;
+
+         const int *in = m_pending.data() + b * blockSamples;
+         const size_t left = pendingFrames - (size_t)b * FlacBlock;
+         const int n = left < (size_t)FlacBlock ? (int)left : FlacBlock;
+
+         EncodeBlock(in, n, channels, bps, rate, first + b, m_encoded[b]);
+         if(check && !DecodeBlock(m_encoded[b], in, n, channels, bps, first + b))
+            failures++;
+      }
+   };
+
+   const int count = Threads() < blocks ? Threads() : blocks;
+   vector<thread> workers;
+   for(int t=1;  t<count;  t++)
+      workers.push_back(thread(work));
+
+   work();
+   for(thread &t : workers)
+      t.join();
+
+   verifyFailures += failures;
+
+   for(int b=0;  b<blocks;  b++)
+   {
+      const unsigned long bytes = (unsigned long)m_encoded[b].size();
+      if(minBlockBytes == 0 || bytes < minBlockBytes)
+         minBlockBytes = bytes;
+      if(bytes > maxBlockBytes)
+         maxBlockBytes = bytes;
+
+      write((const char *)m_encoded[b].data(), bytes);
+   }
+
+   numBlocks += blocks;
+
+   // Keep any part block for next time
+   const size_t used = last ? m_pending.size() : blocks * blockSamples;
+   m_pending.erase(m_pending.begin(), m_pending.begin() + used);
+
+   return !fail();
+}
@@ -0,0 +1,86 @@
+/*
+ *  Name :         Flac.h
+ *  Description :  FLAC file output.
+ */
+
+#ifndef _FLAC_H
+#define _FLAC_H
+
+#include <fstream>
+#include <vector>
+#include "Wave.h"
+
+/*! FLAC audio output class
+ *
+ * Writes losslessly compressed .flac files of 8 to 24 bit samples.
+ * Each block of frames is predicted with a fixed polynomial or a
+ * linear predictor, whichever codes smaller, and what the prediction
+ * misses is Rice coded.  Stereo is also tried as left, right, mid
+ * and side pairs.
+ *
+ * Blocks are gathered into batches that are encoded on several
+ * threads at once and then written in order.  With Verify() on,
+ * every block is decoded again after it is encoded and compared
+ * with the audio it came from, and close() reports any that differ.
+ * It is off by default, as it about doubles the encoding time.
+ */
+class CFlacOut : public CWave, public CAudioSink, private std::ofstream
+{
+public:
+   CFlacOut(const LPCTSTR);
+   CFlacOut();
+   virtual ~CFlacOut();
+
+   void open(const LPCTSTR);
+   virtual void close();
+   bool fail() {return std::ofstream::fail();}
+
+   virtual int WriteFrames(const short *, int frames);
+   virtual int WriteFrames(const double *, int frames);
+
+   void NumChannels(int n) {numChannels = n;}
+   void SampleSize(int s) {sampleSize = s;}
+   void SampleRate(double d) {sampleRate = d;}
+
+   //! Decode each block after encoding it and check it against the input
+   void Verify(bool v) {verify = v;}
+
+   //! Encode n interleaved frames as FLAC frame number
+   static void EncodeBlock(const int *in, int n, int channels, int bps, int rate,
+      unsigned long number, std::vector<unsigned char> &out);
+
+   //! True if a frame from EncodeBlock() decodes to the n frames in
+   static bool DecodeBlock(const std::vector<unsigned char> &data, const int *in, int n,
+      int channels, int bps, unsigned long number);
+
+   //! Threads to encode on, or 0 for one for each processor
+   void Threads(int t) {threads = t;}
+
+   //! Blocks that did not decode to the audio they were made from
+   int VerifyFailures() const {return verifyFailures;}
+
+private:
+   void _default();
+   int _headers();
+   int Encode(bool last);
+   void WriteStreamInfo();
+   int Threads() const;
+
+   std::vector<int> m_pending;	// Samples waiting to be encoded, interleaved
+   std::vector<std::vector<unsigned char> > m_encoded;	// Blocks of a batch, encoded
+
+   int isopen;
+   int isstarted;		// For delayed writing of the headers
+   unsigned long long numSampleFrames;
+   unsigned long numBlocks;	// Blocks written, which numbers the next
+   unsigned long minBlockBytes;	// Smallest and largest encoded blocks
+   unsigned long maxBlockBytes;
+   int numChannels;		// Number of audio channels
+   int sampleSize;		// Sample size in bits
+   double sampleRate;		// Samples per second
+   bool verify;			// Decode and check each block
+   int threads;			// Threads to encode on, 0 for all
+   int verifyFailures;		// Blocks that failed the check
+};
+
+#endif
@@ -15,6 +15,19 @@
 
 #include "wave.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+// SSE2 converts four samples at a time where we have it
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define WAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
 // Simple inline function to put a four character code into 
@@ -25,6 +38,108 @@ inline void IDPlace(char *p_to, const char *p_fm)
 		p_to[i] = p_fm[i];
 }
 
+// True if this machine stores numbers low byte first, as Wave
+// files do.  Compilers fold this to a constant.
+inline bool LittleEndian()
+{
+   const unsigned short one = 1;
+   unsigned char low;
+   memcpy(&low, &one, 1);
+   return low == 1;
+}
+
+// Audio is collected in a buffer of this many bytes and written
+// to the file a buffer at a time.
+static const size_t WaveBufferSize = 64 * 1024;
+
+// A file is mapped a window of at least this many bytes at a time,
+// which a 32-bit process can always find room for.  Windows start
+// on a multiple of WaveMapAlign, the Windows allocation granularity,
+// which is a multiple of the page size where mmap() is used.
+static const size_t WaveWindowSize = 64 * 1024 * 1024;
+static const unsigned long long WaveMapAlign = 64 * 1024;
+
+// Bytes in a ds64 chunk with no table: the RIFF and data sizes and
+// the frame count, 64 bits each, then the table length
+static const int Ds64Size = 28;
+
+// Format codes for the fmt chunk
+static const int WavePCM = 1;
+static const int WaveFloat = 3;
+static const int WaveExtensible = 0xFFFE;
+
+// Speakers the channels of the usual layouts feed, for the
+// extensible format: mono, stereo, quad, 5.1 and 7.1.  Other
+// channel counts are left unassigned.
+static unsigned long ChannelMask(int channels)
+{
+   switch(channels)
+   {
+   case 1: return 0x4;
+   case 2: return 0x3;
+   case 4: return 0x33;
+   case 6: return 0x3F;
+   case 8: return 0x63F;
+   }
+
+   return 0;
+}
+
+// Scale samples to integers, rounding to nearest and clamping
+// to [lo, hi].  NaN goes to lo.
+static void ToIntegers(const double *in, int *out, size_t n, double scale, double lo, double hi)
+{
+   size_t i = 0;
+#ifdef WAVE_SSE2
+   const __m128d s = _mm_set1_pd(scale);
+   const __m128d l = _mm_set1_pd(lo);
+   const __m128d h = _mm_set1_pd(hi);
+   for(;  i + 4 <= n;  i += 4)
+   {
+      const __m128d a = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(in + i), s), l), h);
+      const __m128d b = _mm_min_pd(_mm_max_pd(_mm_mul_pd(_mm_loadu_pd(in + i + 2), s), l), h);
+      _mm_storeu_si128((__m128i *)(out + i), _mm_unpacklo_epi64(_mm_cvtpd_epi32(a), _mm_cvtpd_epi32(b)));
+   }
+#endif
+   for(;  i < n;  i++)
+   {
+      double x = in[i] * scale;
+      if(!(x >= lo))
+         x = lo;
+      else if(x > hi)
+         x = hi;
+
+      out[i] = (int)lrint(x);
+   }
+}
+
+// Convert samples to little-endian floats, which may be unaligned
+static void ToFloats(const double *in, char *out, size_t n)
+{
+   size_t i = 0;
+#ifdef WAVE_SSE2
+   for(;  i + 4 <= n;  i += 4)
+   {
+      const __m128 a = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+      const __m128 b = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+      _mm_storeu_ps((float *)(out + 4 * i), _mm_movelh_ps(a, b));
+   }
+#endif
+   for(;  i < n;  i++)
+   {
+      const float f = (float)in[i];
+      unsigned char b[4];
+      memcpy(b, &f, 4);
+      if(!LittleEndian())
+      {
+         swap(b[0], b[3]);
+         swap(b[1], b[2]);
+      }
+
+      memcpy(out + 4 * i, b, 4);
+   }
+}
+
 // **********************************************************************
 // 
 // CWaveIn Input object
@@ -32,6 +147,23 @@ inline void IDPlace(char *p_to, const char *p_fm)
 // **********************************************************************
 
 
+// Numbers in Wave files are stored low byte first
+inline unsigned long GetULONG(const unsigned char *p)
+{
+   return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+      ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+inline unsigned long long GetULONGLONG(const unsigned char *p)
+{
+   return GetULONG(p) | ((unsigned long long)GetULONG(p + 4) << 32);
+}
+
+inline int GetSHORT(const unsigned char *p)
+{
+   return p[0] | (p[1] << 8);
+}
+
 
 /*
  *  Name :         CWaveIn::CWaveIn()
@@ -39,326 +171,528 @@ inline void IDPlace(char *p_to, const char *p_fm)
  *                 without.
  */
 
-CWaveIn::CWaveIn() : CWave(), std::ifstream()
+CWaveIn::CWaveIn() : CWave()
 {
+   _default();
 }
 
 
-CWaveIn::CWaveIn(const LPCTSTR fname) : CWave(), ifstream(fname, ios::binary)
+CWaveIn::CWaveIn(const LPCTSTR fname) : CWave()
 {
-   if(bad() || !good())
-   {
-      _Error(TEXT("Unable to open file "), fname, TEXT(" for reading."));
-      return;
-   }
-
-   // The stream has been opened okay, open the Wave file
-   if(!_open())
-      setf(ios::badbit | ios::failbit);
+   _default();
+   open(fname);
 }
 
 
 CWaveIn::~CWaveIn()
 {
+   close();
+}
+
+
+/*
+ *  Name :         CWaveIn::_default()
+ *  Description :  Set the reader to having no file open.
+ */
+
+void
+CWaveIn::_default()
+{
+   m_size = 0;
+   m_view = NULL;
+   m_viewStart = 0;
+   m_viewSize = 0;
+#ifdef _WIN32
+   m_file = INVALID_HANDLE_VALUE;
+   m_mapping = NULL;
+#else
+   m_fd = -1;
+#endif
+   soundStart = 0;
+   curFrame = 0;
+   numChannels = 1;
+   numSampleFrames = 0;
+   sampleSize = 16;
+   frameBytes = 2;
+   floatSamples = false;
+   sampleRate = 44100.;
 }
 
 
 /*
  *  Name :         CWaveIn::open()
- *  Description :  Open a file for reading.
+ *  Description :  Open a file for reading.  The file is mapped into
+ *                 memory a window at a time, as it is read.
  */
 
 bool
 CWaveIn::open(const LPCTSTR fname)
 {
-   ifstream::open(fname, ios::binary);
+   close();
 
-   if(bad() || !good())
+#ifdef _WIN32
+   m_file = CreateFile(fname, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+
+   LARGE_INTEGER size;
+   if(m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size))
    {
+      close();
       _Error(TEXT("Unable to open file "), fname, TEXT(" for reading."));
       return false;
    }
 
-   // The stream has been opened okay, open the Wave file
+   // An empty file cannot be mapped, and is not a Wave file anyway
+   if(size.QuadPart > 0)
+   {
+      m_mapping = CreateFileMapping(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if(m_mapping != NULL)
+         m_size = (unsigned long long)size.QuadPart;
+   }
+#else
+   m_fd = ::open(fname, O_RDONLY);
+   if(m_fd < 0)
+   {
+      _Error(TEXT("Unable to open file "), fname, TEXT(" for reading."));
+      return false;
+   }
+
+   struct stat st;
+   if(fstat(m_fd, &st) == 0 && st.st_size > 0)
+      m_size = (unsigned long long)st.st_size;
+#endif
+
+   if(m_size == 0)
+   {
+      close();
+      Error(TEXT("File is not a valid Wave file"));
+      return false;
+   }
+
    if(!_open())
-      setf(ios::badbit | ios::failbit);
+   {
+      close();
+      return false;
+   }
 
    return true;
 }
 
 
+/*
+ *  Name :         CWaveIn::close()
+ *  Description :  Unmap and close the file.  Pointers from FrameData()
+ *                 are no longer valid.
+ */
+
+void
+CWaveIn::close()
+{
+   Unmap();
+#ifdef _WIN32
+   if(m_mapping != NULL)
+      CloseHandle(m_mapping);
+   if(m_file != INVALID_HANDLE_VALUE)
+      CloseHandle(m_file);
+#else
+   if(m_fd >= 0)
+      ::close(m_fd);
+#endif
+
+   _default();
+}
+
+
+/*
+ *  Name :         CWaveIn::Map()
+ *  Description :  Bytes [offset, offset + bytes) of the file, mapped
+ *                 into memory, or NULL if they are not all in the
+ *                 file or cannot be mapped.  The window is moved if
+ *                 they are not in it, which invalidates any pointer
+ *                 into it from before.
+ */
+
+const char *
+CWaveIn::Map(unsigned long long offset, size_t bytes) const
+{
+   if(offset > m_size || bytes > m_size - offset)
+      return NULL;
+
+   if(m_view != NULL && offset >= m_viewStart && offset + bytes <= m_viewStart + m_viewSize)
+      return m_view + (size_t)(offset - m_viewStart);
+
+   Unmap();
+
+   const unsigned long long start = offset - offset % WaveMapAlign;
+   unsigned long long size = offset + bytes - start;
+   if(size < WaveWindowSize)
+      size = WaveWindowSize;
+   if(size > m_size - start)
+      size = m_size - start;
+   if(size > (size_t)-1)
+      return NULL;
+
+#ifdef _WIN32
+   void *view = MapViewOfFile(m_mapping, FILE_MAP_READ, (DWORD)(start >> 32),
+      (DWORD)start, (SIZE_T)size);
+   if(view == NULL)
+      return NULL;
+#else
+   void *view = mmap(NULL, (size_t)size, PROT_READ, MAP_SHARED, m_fd, (off_t)start);
+   if(view == MAP_FAILED)
+      return NULL;
+#endif
+
+   m_view = (const char *)view;
+   m_viewStart = start;
+   m_viewSize = (size_t)size;
+   return m_view + (size_t)(offset - start);
+}
+
+
+/*
+ *  Name :         CWaveIn::Unmap()
+ *  Description :  Unmap the window of the file, if there is one.
+ */
+
+void
+CWaveIn::Unmap() const
+{
+   if(m_view == NULL)
+      return;
+
+#ifdef _WIN32
+   UnmapViewOfFile(m_view);
+#else
+   munmap((void *)m_view, m_viewSize);
+#endif
+   m_view = NULL;
+   m_viewStart = 0;
+   m_viewSize = 0;
+}
+
+
 /*
  *  Name :         CWaveIn::_open()
  *  Description :  This is the private part of the open process after
  *                 the file is opened.  This reads the Wave headers and
  *                 prepares for sample reading.
  */
+
 int CWaveIn::_open()
 {
-	soundStart = 0;
-
-	// Read the RIFF/WAVE chunk.
-	Chunk RiffChunk;
-	if(!ReadChunk(RiffChunk))
+	// Read the RIFF/WAVE chunk.  RF64 and BW64 are the same with
+	// 64-bit sizes.
+	const unsigned char *file = (const unsigned char *)Map(0, 12);
+	const bool rf64 = file != NULL && (memcmp(file, "RF64", 4) == 0 || memcmp(file, "BW64", 4) == 0);
+	if(file == NULL || (memcmp(file, "RIFF", 4) != 0 && !rf64) || memcmp(file + 8, "WAVE", 4) != 0)
 	{
 		Error(TEXT("File is not a valid Wave file"));
 		return 0;
 	}
 
-	// Ensure this is actually a RIFF chunk.
-	if (strncmp(RiffChunk.ckID, "RIFF", 4) != 0)
+	unsigned long long riffSize = GetULONG(file + 4);
+	unsigned long long ds64Data = 0;
+	if(rf64)
 	{
-		Error(TEXT("File is not a valid Wave file"));
-		return 0;
-	}
+		// The ds64 chunk comes first, with the sizes that do not
+		// fit in their chunks
+		const unsigned char *ds64 = (const unsigned char *)Map(12, 8 + 24);
+		if(ds64 == NULL || memcmp(ds64, "ds64", 4) != 0 || GetULONG(ds64 + 4) < 24)
+		{
+			Error(TEXT("File is not a valid Wave file"));
+			return 0;
+		}
 
-	if(strncmp(RiffChunk.formType, "WAVE", 4) != 0)
-	{
-		Error(TEXT("File is not a valid Wave file"));
-		return 0;
+		riffSize = GetULONGLONG(ds64 + 8);
+		ds64Data = GetULONGLONG(ds64 + 16);
 	}
 
-	// Read the chunks.  Chunks need not be in any particular order.
-
-	ChunkHeader Header;
-	while (ReadChunkHeader(Header))
+	// The chunks end with the RIFF chunk.  Programs that write as
+	// they record may not have filled in its size, so if it does
+	// not fit in the file, they end with the file.
+	unsigned long long end = m_size;
+	if(riffSize >= 4 && riffSize <= m_size - 8)
+		end = riffSize + 8;
+
+	// Read the chunks.  Chunks need not be in any particular order,
+	// and the ones we have no use for (LIST, fact, cue , ...) are
+	// skipped.  Each chunk header is mapped on its own, as the chunks
+	// may be further apart than one window, so the fmt chunk is
+	// copied out.
+	std::vector<unsigned char> fmt;
+	bool haveFmt = false;
+	unsigned long long dataPos = 0;
+	unsigned long long dataSize = 0;
+
+	unsigned long long pos = 12;
+	while(pos + 8 <= end)
 	{
-		// Offset to point after the current chunk
-		int seek_offset = (int)tellg() + Header.ckSize;
+		const unsigned char *header = (const unsigned char *)Map(pos, 8);
+		char id[4];
+		memcpy(id, header, 4);
+		unsigned long long size = GetULONG(header + 4);
+		pos += 8;
 
-		if (strncmp(Header.ckID, "fmt ", 4) == 0) 
+		// In RF64, the data size is in the ds64 chunk
+		if(rf64 && size == 0xFFFFFFFF && memcmp(id, "data", 4) == 0)
+			size = ds64Data;
+
+		if(size > end - pos)
 		{
-			/*
-			* read fmt chunk
-			*/
-
-			int type;
-			ReadSHORT(type);   
-			if(type != 1)
-			{
-				Error(TEXT("Only PCM WAVE files are supported"));
-				return 0;
-			}
-
-			ReadSHORT(numChannels);
-			unsigned long lSampleRate;
-			ReadULONG(lSampleRate);
-			sampleRate = lSampleRate;
-
-			unsigned long dummy;
-			ReadULONG(dummy);	// Actually number of bytes per second
-
-			int dummy2;
-			ReadSHORT(dummy2);	// Bytes per frame (as if we care)
-
-			ReadSHORT(sampleSize);	// This we might need
-		} 
-		else if (strncmp(Header.ckID, "data", 4) == 0) 
+			// The file was cut short, or the data size was never
+			// filled in.  Take what sound there is.
+			if(memcmp(id, "data", 4) != 0)
+				break;
+
+			size = end - pos;
+		}
+
+		if(memcmp(id, "fmt ", 4) == 0)
 		{
-			/*
-			* record position of sound data
-			*/
-
-			soundStart =  (unsigned int)tellg();
-			numSampleFrames = Header.ckSize / 
-				(numChannels * ((sampleSize + 7) / 8));
-		} 
-
-		// Seek to after the current chunk
-		seekg(seek_offset);
-		if (fail())
+			// Nothing past the extensible format's 40 bytes is used
+			const size_t fmtSize = (size_t)(size < 40 ? size : 40);
+			const char *p = Map(pos, fmtSize);
+			fmt.assign(p, p + fmtSize);
+			haveFmt = true;
+		}
+		else if(memcmp(id, "data", 4) == 0 && dataPos == 0)
 		{
-			Error(TEXT("Error reading Wave file."));
-			return 0;
+			dataPos = pos;
+			dataSize = size;
 		}
+
+		// Chunks take up an even number of bytes
+		pos += size + (size & 1);
 	}
 
-	if(soundStart == 0)
-	{
-		Error(TEXT("Unable to find sound data in Wave file."));
+	if(!haveFmt || !ReadFormat(fmt.data(), fmt.size()))
 		return 0;
-	}
 
-	// Prepare for reading the sound data.
-	clear();
-	seekg(soundStart);
-	curFrame = 0;
-	if (fail())
+	if(dataPos == 0)
 	{
-		Error(TEXT("Error after seek to sound data."));
+		Error(TEXT("Unable to find sound data in Wave file."));
 		return 0;
 	}
 
+	soundStart = dataPos;
+	numSampleFrames = dataSize / frameBytes;
+	curFrame = 0;
 	return 1;
 }
 
 
 /*
- *  Name :         CWaveIn::ReadFrame()
- *  Description :  Read a frame of audio.
+ *  Name :         CWaveIn::ReadFormat()
+ *  Description :  Read the fmt chunk.  PCM and float samples are
+ *                 supported, in the plain or the extensible format.
  */
 
 int
-CWaveIn::ReadFrame(short *frame)
+CWaveIn::ReadFormat(const unsigned char *fmt, size_t size)
 {
-   if(sampleSize == 16)
-   {
-      signed char b[2];
-
-      for(int c=0;  c<numChannels;  c++)
-      {
-			read((char *)b, 2);
-			frame[c] = (int(b[1]) << 8) | (unsigned char)(b[0]);
-      }
-   }
-   else
-   {
-      for(int c=0;  c<numChannels;  c++)
-      {
-			signed char ch;
-			read((char *)&ch, 1);
-			frame[c] = ch;
-      }
-
-   }
-
-   curFrame++;
-   return !fail();
-}
+	if(size < 16)
+	{
+		Error(TEXT("File is not a valid Wave file"));
+		return 0;
+	}
 
+	int type = GetSHORT(fmt);
+	numChannels = GetSHORT(fmt + 2);
+	sampleRate = GetULONG(fmt + 4);
+	sampleSize = GetSHORT(fmt + 14);	// Bits each sample takes up
 
-/*
- *  Name :         CWaveIn::SeekFrame()
- *  Description :  Set the file position at a particular location in the file.
- */
+	// The extensible format has the real format code at the
+	// start of the sub-format GUID
+	if(type == 0xFFFE && size >= 40)
+		type = GetSHORT(fmt + 24);
 
-int
-CWaveIn::SeekFrame(int frame)
-{
-   clear();
-   curFrame = frame;
-   seekg(soundStart + frame * numChannels * (sampleSize + 7) / 8);
-   return !fail();
-}
+	floatSamples = type == 3;
+	if(!(type == 1 && sampleSize >= 1 && sampleSize <= 32) && !(floatSamples && sampleSize == 32))
+	{
+		Error(TEXT("Only PCM and 32-bit float WAVE files are supported"));
+		return 0;
+	}
 
+	if(numChannels < 1)
+	{
+		Error(TEXT("File is not a valid Wave file"));
+		return 0;
+	}
 
-void CWaveIn::Rewind()
-{
-   SeekFrame(0);
+	frameBytes = numChannels * ((sampleSize + 7) / 8);
+	return 1;
 }
 
 
-
 /*
- *  Name :         CWaveIn::ReadChunk()
- *  Description :  This reads an object of type Chunk from disk,
- *                 for any type of machine.
+ *  Name :         CWaveIn::FrameData()
+ *  Description :  The samples of a range of frames, interleaved, as
+ *                 they are in the file.  Returns NULL if the frames
+ *                 are not all in the file.
  */
 
-int
-CWaveIn::ReadChunk(Chunk &chunk)
+const char *
+CWaveIn::FrameData(long long frame, int count) const
 {
-   ReadID(chunk.ckID);
-   ReadLONG(chunk.ckSize);
-   ReadID(chunk.formType);
+   if(soundStart == 0 || frame < 0 || count < 0 ||
+      (unsigned long long)frame + (unsigned long long)count > numSampleFrames ||
+      (unsigned long long)count * frameBytes > (size_t)-1)
+      return NULL;
 
-   return !fail();
+   return Map(soundStart + (unsigned long long)frame * frameBytes, (size_t)count * frameBytes);
 }
 
 
 /*
- *  Name :         CWaveIn::ReadChunkHeader()
- *  Description :  This reads an object of type ChunkHeader from disk,
- *                 for any type of machine.
+ *  Name :         CWaveIn::ReadFrame()
+ *  Description :  Read a frame of audio.
  */
 
 int
-CWaveIn::ReadChunkHeader(ChunkHeader &chunk)
+CWaveIn::ReadFrame(short *frame)
 {
-   ReadID(chunk.ckID);
-   ReadLONG(chunk.ckSize);
+   const unsigned char *p = (const unsigned char *)FrameData(curFrame, 1);
+   if(p == NULL)
+      return 0;
 
-   return !fail();
-}
+   const int bytesper = frameBytes / numChannels;
+   for(int c=0;  c<numChannels;  c++,  p += bytesper)
+   {
+      if(floatSamples)
+      {
+         const unsigned int bits = (unsigned int)GetULONG(p);
+         float f;
+         memcpy(&f, &bits, 4);
 
-/*
- *  Name :         CWaveIn::ReadID()
- *  Description :  Reads an Wave file object of type ID.
- */
+         const double x = f * 32767.;
+         frame[c] = short(x > 32767 ? 32767 : (x < -32768 ? -32768 : x));
+      }
+      else if(bytesper == 1)
+      {
+         frame[c] = (signed char)p[0];
+      }
+      else
+      {
+         // Larger samples are cut to their top 16 bits
+         frame[c] = short(p[bytesper - 2] | (p[bytesper - 1] << 8));
+      }
+   }
 
-int
-CWaveIn::ReadID(ID id)
-{
-   read(id, 4);
+   curFrame++;
    return 1;
 }
 
 
 /*
- *  Name :         CWaveIn::ReadLONG()
- *  Description :  Reads an Wave file object of type LONG.
+ *  Name :         CWaveIn::ReadFrames()
+ *  Description :  Read a block of frames, interleaved, as floats with
+ *                 full scale at 1.0.  Returns the number of frames
+ *                 read, which is fewer than asked for at the end of
+ *                 the file.
  */
 
 int
-CWaveIn::ReadLONG(long &item)
+CWaveIn::ReadFrames(float *frames, int count)
 {
-   int i;
-   unsigned char b[4];
+   if(soundStart == 0 || count <= 0 || (unsigned long long)curFrame >= numSampleFrames)
+      return 0;
 
-   read((char *)b, 4);
+   if((unsigned long long)count > numSampleFrames - curFrame)
+      count = (int)(numSampleFrames - curFrame);
 
-   item = 0;
+   const unsigned char *in = (const unsigned char *)FrameData(curFrame, count);
+   if(in == NULL)
+      return 0;
+   const size_t samples = (size_t)count * numChannels;
+   size_t i = 0;
 
-   for(i=0;  i<4;  i++)
+   if(floatSamples && LittleEndian())
+   {
+      memcpy(frames, in, samples * 4);
+   }
+   else if(floatSamples)
+   {
+      for(;  i<samples;  i++)
+      {
+         const unsigned int bits = (unsigned int)GetULONG(in + 4 * i);
+         memcpy(frames + i, &bits, 4);
+      }
+   }
+   else
    {
-      item <<= 8;
-      item |= b[3 - i];
+      switch(frameBytes / numChannels)
+      {
+      case 1:
+         // 8-bit samples are unsigned
+         for(;  i<samples;  i++)
+            frames[i] = (in[i] - 128) * (1.f / 128);
+         break;
+
+      case 2:
+#ifdef WAVE_SSE2
+         {
+            const __m128 scale = _mm_set1_ps(1.f / 32768);
+            for(;  i + 8 <= samples;  i += 8)
+            {
+               const __m128i s = _mm_loadu_si128((const __m128i *)(in + 2 * i));
+               const __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+               const __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+               _mm_storeu_ps(frames + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+               _mm_storeu_ps(frames + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+         }
+#endif
+         for(;  i<samples;  i++)
+            frames[i] = short(GetSHORT(in + 2 * i)) * (1.f / 32768);
+         break;
+
+      case 3:
+         for(;  i<samples;  i++)
+         {
+            const unsigned char *p = in + 3 * i;
+            const int v = (int)(((unsigned long)p[0] << 8) | ((unsigned long)p[1] << 16) |
+               ((unsigned long)p[2] << 24));
+            frames[i] = (v >> 8) * (1.f / 8388608);
+         }
+         break;
+
+      default:
+         for(;  i<samples;  i++)
+            frames[i] = (float)((int)GetULONG(in + 4 * i) * (1. / 2147483648.));
+         break;
+      }
    }
 
-   return 1;
+   curFrame += count;
+   return count;
 }
 
 
 /*
- *  Name :         CWaveIn::ReadULONG()
- *  Description :  Reads an Wave file object of type LONG.
+ *  Name :         CWaveIn::SeekFrame()
+ *  Description :  Set the read position to a frame.  The end of the
+ *                 file is a valid position.
  */
 
 int
-CWaveIn::ReadULONG(unsigned long &item)
+CWaveIn::SeekFrame(long long frame)
 {
-   int i;
-   unsigned char b[4];
-
-   read((char *)b, 4);
-   item = 0;
-
-   for(i=0;  i<4;  i++)
-   {
-      item <<= 8;
-      item |= b[3 - i];
-   }
+   if(soundStart == 0 || frame < 0 || (unsigned long long)frame > numSampleFrames)
+      return 0;
 
+   curFrame = frame;
    return 1;
 }
 
 
-/*
- *  Name :         CWaveIn::ReadSHORT()
- *  Description :  Reads an Wave/AIFC file object of type SHORT
- */
-
-int
-CWaveIn::ReadSHORT(int &item)
+void CWaveIn::Rewind()
 {
-   unsigned char b[2];
-
-   read((char *)b, 2);
-   item = (b[1] << 8) | b[0];
-   return 1;
+   SeekFrame(0);
 }
 
 
+
 // **********************************************************************
 // 
 // WaveOut output object
@@ -433,11 +767,14 @@ CWaveOut::open(const LPCTSTR fname)
 void
 CWaveOut::_default()
 {
+   m_fill = 0;
+   m_factLoc = 0;
    isopen = 0;
    isstarted = 0;
    numChannels = 1;
    sampleSize = 16;
    sampleRate = 44100.;
+   floatSamples = false;
 }
 
 
@@ -454,6 +791,8 @@ CWaveOut::_open()
 
    isopen = 1;
    isstarted = 0;
+   m_buffer.resize(WaveBufferSize);
+   m_fill = 0;
    return 1;
 }
 
@@ -473,6 +812,13 @@ CWaveOut::_headers()
 
    isstarted = 1;
 
+   // Float samples, samples of more than 16 bits and more than two
+   // channels use the extensible format, which also says which
+   // speaker each channel is for
+   const int bytesper = BytesPerSample();
+   const int bits = floatSamples ? 32 : sampleSize;
+   const bool extensible = floatSamples || sampleSize > 16 || numChannels > 2;
+
    // Write the file header
    Chunk form;
    IDPlace(form.ckID, "RIFF");
@@ -480,10 +826,20 @@ CWaveOut::_headers()
    form.ckSize = 0;      // Have to rewrite later
    WriteChunk(form);
 
+   // Room for a ds64 chunk, in case the file grows past what 32-bit
+   // sizes can hold and has to become RF64.  Until then it is a JUNK
+   // chunk, which readers skip.
+   ChunkHeader junk;
+   IDPlace(junk.ckID, "JUNK");
+   junk.ckSize = Ds64Size;
+   WriteChunkHeader(junk);
+   for(int i=0;  i<Ds64Size;  i++)
+      write("", 1);
+
    // Write the fmt  header
    ChunkHeader fmt;
    IDPlace(fmt.ckID, "fmt ");
-   fmt.ckSize = 16;
+   fmt.ckSize = extensible ? 40 : 16;
    WriteChunkHeader(fmt);
    if(fail() || bad())
    {
@@ -491,16 +847,42 @@ CWaveOut::_headers()
       return 0;
    }
 
-   int bytesper = (sampleSize + 7) / 8;
-
-   WriteSHORT(1);		// Only PCM is supported
+   WriteSHORT(extensible ? WaveExtensible : WavePCM);
    WriteSHORT(numChannels);
    WriteULONG((unsigned long)(sampleRate));
    WriteULONG((unsigned long)(sampleRate) * numChannels * bytesper);
    WriteSHORT(numChannels * bytesper);
-   WriteSHORT(sampleSize);
+   WriteSHORT(bits);
+
+   if(extensible)
+   {
+      // The sub-format is a GUID: the format code followed by
+      // the fixed part KSDATAFORMAT_SUBTYPE_PCM and _IEEE_FLOAT share
+      static const char guid[8] = { '\x80', 0, 0, '\xAA', 0, '\x38', '\x9B', '\x71' };
+
+      WriteSHORT(22);		// Size of the extension
+      WriteSHORT(bits);		// Valid bits in each sample
+      WriteULONG(ChannelMask(numChannels));
+      WriteULONG(floatSamples ? WaveFloat : WavePCM);
+      WriteSHORT(0);
+      WriteSHORT(0x10);
+      write(guid, 8);
+   }
+
+   // Formats other than PCM give the length in frames as well
+   m_factLoc = 0;
+   if(floatSamples)
+   {
+      ChunkHeader fact;
+      IDPlace(fact.ckID, "fact");
+      fact.ckSize = 4;
+      WriteChunkHeader(fact);
+
+      m_factLoc = (unsigned long long)tellp();
+      WriteULONG(0);		// Have to fill in later
+   }
    
-   m_lenLoc = (int)tellp();		// Save off location for data length
+   m_lenLoc = (unsigned long long)tellp();		// Save off location for data length
 
    ChunkHeader data;
    IDPlace(data.ckID, "data");
@@ -536,17 +918,56 @@ void CWaveOut::close()
       _headers();
 
    isopen = 0;
+   Flush();
 
    // How long is the file?
-   unsigned long flen = (int)tellp();
+   unsigned long long flen = (unsigned long long)tellp();
+   const unsigned long long dataLen = flen - m_lenLoc - 8;
+
+   // Chunks take up an even number of bytes
+   if(dataLen & 1)
+   {
+      const char pad = 0;
+      write(&pad, 1);
+      flen++;
+   }
+
+   // Sizes that do not fit in 32 bits go in the ds64 chunk, and the
+   // file becomes RF64 with the 32-bit sizes all ones
+   const unsigned long long maxSize = 0xFFFFFFFFull;
+   const bool rf64 = flen - 8 > maxSize || dataLen > maxSize || numSampleFrames > maxSize;
 
    // Write in the sound length
-   seekp(m_lenLoc + 4);
-   WriteULONG(flen - m_lenLoc - 8);
+   seekp((streamoff)(m_lenLoc + 4));
+   WriteULONG(rf64 ? 0xFFFFFFFFul : (unsigned long)dataLen);
+
+   if(m_factLoc != 0)
+   {
+      seekp((streamoff)m_factLoc);
+      WriteULONG(rf64 ? 0xFFFFFFFFul : (unsigned long)numSampleFrames);
+   }
 
-   // Write in the entire file length
-   seekp(4l);
-   WriteULONG(flen - 8);
+   if(rf64)
+   {
+      seekp(0l);
+      WriteID("RF64");
+      WriteULONG(0xFFFFFFFFul);
+
+      // The JUNK chunk becomes the ds64 chunk
+      seekp(12l);
+      WriteID("ds64");
+      WriteULONG(Ds64Size);
+      WriteULONGLONG(flen - 8);
+      WriteULONGLONG(dataLen);
+      WriteULONGLONG(numSampleFrames);
+      WriteULONG(0);		// No table of other chunk sizes
+   }
+   else
+   {
+      // Write in the entire file length
+      seekp(4l);
+      WriteULONG((unsigned long)(flen - 8));
+   }
 
    if(fail() || bad())
    {
@@ -566,6 +987,20 @@ void CWaveOut::close()
 
 int
 CWaveOut::WriteFrame(short *frame)
+{
+   return WriteFrames(frame, 1);
+}
+
+
+/*
+ *  Name :         CWaveOut::WriteFrames()
+ *  Description :  Write a block of frames, interleaved.  The samples
+ *                 go into the buffer, which is written out to the
+ *                 file whenever it fills.
+ */
+
+int
+CWaveOut::WriteFrames(const short *frames, int count)
 {
    // Since we may set file parameters after the file is opened,
    // we need to defer writing the file headers until we are actually
@@ -574,28 +1009,185 @@ CWaveOut::WriteFrame(short *frame)
    if(!isstarted)
       _headers();
 
-   signed char b[2];
+   const int bytesper = BytesPerSample();
+   const size_t frameBytes = (size_t)numChannels * bytesper;
+   if(frameBytes == 0 || frameBytes > m_buffer.size())
+      return 0;
 
-   if(sampleSize == 16)
+   int done = 0;
+   while(done < count)
    {
-      for(int c=0;  c<numChannels;  c++)
+      if(m_fill + frameBytes > m_buffer.size() && !Flush())
+         return 0;
+
+      // As many frames as fit in the buffer
+      int n = (int)((m_buffer.size() - m_fill) / frameBytes);
+      if(n > count - done)
+         n = count - done;
+
+      const short *in = frames + (size_t)done * numChannels;
+      const size_t samples = (size_t)n * numChannels;
+      char *out = m_buffer.data() + m_fill;
+
+      if(sampleSize == 16 && !floatSamples && LittleEndian())
+      {
+         memcpy(out, in, samples * 2);
+      }
+      else if(floatSamples)
       {
-			 b[1] = (signed char)(frame[c] >> 8);
-			 b[0] = (signed char)(frame[c]);
-			 write((char *)b, 2);
+         // Full scale is 1.0, or 32768 as a short
+         for(size_t i=0;  i<samples;  i++)
+         {
+            const double x = in[i] / 32768.0;
+            ToFloats(&x, out + 4 * i, 1);
+         }
       }
+      else
+      {
+         // Shorts fill the top 16 bits of larger samples
+         m_scratch.resize(samples);
+         const int shift = sampleSize > 16 ? sampleSize - 16 : 0;
+         for(size_t i=0;  i<samples;  i++)
+            m_scratch[i] = in[i] * (1 << shift);
+
+         Pack(m_scratch.data(), samples, out);
+      }
+
+      m_fill += (size_t)n * frameBytes;
+      done += n;
    }
-   else
+
+   numSampleFrames += count;
+   return !fail();
+}
+
+
+/*
+ *  Name :         CWaveOut::WriteFrames()
+ *  Description :  Write a block of frames of samples where full scale
+ *                 is 1.0, interleaved.  Integer samples are rounded
+ *                 and clipped.  Float samples are written as they
+ *                 are.
+ */
+
+int
+CWaveOut::WriteFrames(const double *frames, int count)
+{
+   if(!isstarted)
+      _headers();
+
+   const int bytesper = BytesPerSample();
+   const size_t frameBytes = (size_t)numChannels * bytesper;
+   if(frameBytes == 0 || frameBytes > m_buffer.size())
+      return 0;
+
+   // The largest sample is full scale, so 1.0 and -1.0 come out
+   // the same distance from zero, as RangeBound() does for shorts
+   const int bits = sampleSize < 8 ? 8 : (sampleSize > 32 ? 32 : sampleSize);
+   const double full = ldexp(1.0, bits - 1);
+
+   int done = 0;
+   while(done < count)
+   {
+      if(m_fill + frameBytes > m_buffer.size() && !Flush())
+         return 0;
+
+      int n = (int)((m_buffer.size() - m_fill) / frameBytes);
+      if(n > count - done)
+         n = count - done;
+
+      const double *in = frames + (size_t)done * numChannels;
+      const size_t samples = (size_t)n * numChannels;
+      char *out = m_buffer.data() + m_fill;
+
+      if(floatSamples)
+      {
+         ToFloats(in, out, samples);
+      }
+      else
+      {
+         m_scratch.resize(samples);
+         ToIntegers(in, m_scratch.data(), samples, full - 1, -full, full - 1);
+
+         // 8-bit samples are unsigned
+         if(bits == 8)
+         {
+            for(size_t i=0;  i<samples;  i++)
+               m_scratch[i] += 128;
+         }
+
+         Pack(m_scratch.data(), samples, out);
+      }
+
+      m_fill += (size_t)n * frameBytes;
+      done += n;
+   }
+
+   numSampleFrames += count;
+   return !fail();
+}
+
+
+/*
+ *  Name :         CWaveOut::Pack()
+ *  Description :  Store integer samples low byte first, in as many
+ *                 bytes as a sample takes.
+ */
+
+void
+CWaveOut::Pack(const int *in, size_t samples, char *out)
+{
+   switch(BytesPerSample())
    {
-      for(int c=0;  c<numChannels;  c++)
+   case 1:
+      for(size_t i=0;  i<samples;  i++)
+         out[i] = (char)in[i];
+      break;
+
+   case 2:
+      for(size_t i=0;  i<samples;  i++)
+      {
+         out[2 * i] = (char)in[i];
+         out[2 * i + 1] = (char)(in[i] >> 8);
+      }
+      break;
+
+   case 3:
+      for(size_t i=0;  i<samples;  i++)
       {
-			 b[0] = (signed char)(frame[c]);
-			 write((char *)b, 1);
+         out[3 * i] = (char)in[i];
+         out[3 * i + 1] = (char)(in[i] >> 8);
+         out[3 * i + 2] = (char)(in[i] >> 16);
       }
+      break;
 
+   default:
+      for(size_t i=0;  i<samples;  i++)
+      {
+         out[4 * i] = (char)in[i];
+         out[4 * i + 1] = (char)(in[i] >> 8);
+         out[4 * i + 2] = (char)(in[i] >> 16);
+         out[4 * i + 3] = (char)(in[i] >> 24);
+      }
+      break;
+   }
+}
+
+
+/*
+ *  Name :         CWaveOut::Flush()
+ *  Description :  Write the buffered audio to the file.
+ */
+
+int
+CWaveOut::Flush()
+{
+   if(m_fill > 0)
+   {
+      write(m_buffer.data(), m_fill);
+      m_fill = 0;
    }
 
-   numSampleFrames++;
    return !fail();
 }
 
@@ -691,6 +1283,20 @@ CWaveOut::WriteULONG(unsigned long item)
 }
 
 
+/*
+ *  Name :         CWaveOut::WriteULONGLONG()
+ *  Description :  Writes a 64-bit size, for the ds64 chunk.
+ */
+
+int
+CWaveOut::WriteULONGLONG(unsigned long long item)
+{
+   WriteULONG((unsigned long)(item & 0xFFFFFFFF));
+   WriteULONG((unsigned long)(item >> 32));
+   return 1;
+}
+
+
 /*
  *  Name :         CWaveOut::WriteSHORT()
  *  Description :  Writes an Wave file object of type SHORT
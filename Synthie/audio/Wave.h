@@ -8,6 +8,7 @@
 #define _WAVE_H
 
 #include <fstream>
+#include <vector>
 
 /*! Abstract base class for wave file handling
  *
@@ -47,11 +48,41 @@ private:
 	CWave &operator=(const CWave &);
 };
 
+/*! Destination for audio frames
+ *
+ * The audio file writers all take frames this way, so code that
+ * produces audio can feed any of them.
+ */
+class CAudioSink
+{
+public:
+	virtual ~CAudioSink() {}
+
+	//! Write a block of interleaved frames
+	virtual int WriteFrames(const short *, int frames) = 0;
+
+	//! Write a block of interleaved frames, full scale at 1.0
+	virtual int WriteFrames(const double *, int frames) = 0;
+
+	virtual void close() = 0;
+
+	//! True if a write, or the close, failed
+	virtual bool fail() = 0;
+};
+
 /*! WAVE audio file input class
  *
- * Supports input of audio from .wav format files.
+ * Supports input of audio from .wav format files: PCM of up to 32
+ * bits and 32-bit float, in the plain or the extensible format.
+ * RF64 and BW64 files, which hold their sizes in a ds64 chunk, are
+ * read too, so files may be larger than 4GB.
+ *
+ * The file is mapped into memory a window at a time, at 64-bit
+ * offsets, so opening it and seeking in it take no time however long
+ * it is, even in a 32-bit build.  FrameData() gives the samples where
+ * they are without copying them.
  */
-class CWaveIn : public CWave, private std::ifstream
+class CWaveIn : public CWave
 {
 public:
 	CWaveIn(const LPCTSTR);
@@ -59,40 +90,62 @@ public:
 	virtual ~CWaveIn();
 
 	bool open(const LPCTSTR);
+	void close();
+	bool IsOpen() const {return m_size != 0;}
 
 	void Rewind();
 	int ReadFrame(short *);
-	int SeekFrame(int frame);
+	int ReadFrames(float *, int frames);
+	int SeekFrame(long long frame);
+
+	//! Samples of frames [frame, frame + count) as they are in the
+	//! file, or NULL if they are not all there.  Valid until the
+	//! next FrameData(), ReadFrame() or ReadFrames(), which may
+	//! move the mapped window, or until the file is closed.
+	const char *FrameData(long long frame, int count) const;
 
-	int CurFrame() const {return curFrame;}
+	long long CurFrame() const {return curFrame;}
 	int NumChannels() const {return numChannels;}
-	int NumSampleFrames() const {return numSampleFrames;}
+	long long NumSampleFrames() const {return numSampleFrames;}
 	int SampleSize() const {return sampleSize;}
+	bool FloatSamples() const {return floatSamples;}
+	int FrameBytes() const {return frameBytes;}
 	double SampleRate() const {return sampleRate;}
 
 private:
+	void _default();
 	int _open();
+	int ReadFormat(const unsigned char *fmt, size_t size);
+	const char *Map(unsigned long long offset, size_t bytes) const;
+	void Unmap() const;
+
+	unsigned long long m_size;		// Bytes in the file, 0 if none is open
+	mutable const char *m_view;		// The mapped window of the file
+	mutable unsigned long long m_viewStart;	// Offset of the window in the file
+	mutable size_t m_viewSize;		// Bytes in the window
+#ifdef _WIN32
+	HANDLE m_file;
+	HANDLE m_mapping;
+#else
+	int m_fd;
+#endif
 
-	int ReadChunk(Chunk &chunk);
-	int ReadID(ID id);
-	int ReadLONG(long &item);
-	int ReadULONG(unsigned long &item);
-	int ReadSHORT(int &item);
-	int ReadChunkHeader(ChunkHeader &chunk);
-
-	unsigned int soundStart;		// Offset to beginning of sound data
-	int curFrame;		// Current frame we are reading
+	unsigned long long soundStart;	// Offset of the sound data in the file
+	int frameBytes;		// Bytes in each frame
+	bool floatSamples;		// IEEE float rather than integer samples
+	long long curFrame;		// Current frame we are reading
 	int numChannels;		// Number of audio channels
-	unsigned long numSampleFrames;	// Total sample frames
+	unsigned long long numSampleFrames;	// Total sample frames
 	int sampleSize;		// Sample size in bits
 	double sampleRate;		// Samples per second
 };
 
 /*! Wave audio output class
  *
- * Allows for writing .wav files
+ * Allows for writing .wav files.  A file that grows past 4GB is
+ * written as RF64.
  */
-class CWaveOut : public CWave, private std::ofstream
+class CWaveOut : public CWave, public CAudioSink, private std::ofstream
 {
 public:
    CWaveOut(const LPCTSTR);
@@ -100,15 +153,21 @@ public:
    virtual ~CWaveOut();
 
    void open(const LPCTSTR);
-   void close();
+   virtual void close();
    bool fail() {return std::ofstream::fail();}
 
    int WriteFrame(short *);
+   virtual int WriteFrames(const short *, int frames);
+   virtual int WriteFrames(const double *, int frames);
 
    void NumChannels(int n) {numChannels = n;}
    void SampleSize(int s) {sampleSize = s;}
    void SampleRate(double d) {sampleRate = d;}
 
+   //! Write 32-bit IEEE float samples instead of integers.  Full
+   //! scale is 1.0, and nothing is clipped.
+   void FloatSamples(bool f) {floatSamples = f;}
+
 private:
    void _default();
    int _open();
@@ -119,14 +178,24 @@ private:
    int WriteID(const ID id);
    int WriteLONG(long item);
    int WriteULONG(unsigned long item);
+   int WriteULONGLONG(unsigned long long item);
    int WriteSHORT(int item);
+   int Flush();
+   int BytesPerSample() const {return floatSamples ? 4 : (sampleSize + 7) / 8;}
+   void Pack(const int *in, size_t samples, char *out);
    
-   unsigned long m_lenLoc;	// Location in file to write length
+   std::vector<char> m_buffer;	// Audio waiting to be written
+   size_t m_fill;		// Bytes of m_buffer in use
+   std::vector<int> m_scratch;	// Samples converted to integers
+   unsigned long long m_factLoc;	// Location of the fact chunk, 0 if none
+
+   unsigned long long m_lenLoc;	// Location in file to write length
    int isopen;
-   unsigned long numSampleFrames;
+   unsigned long long numSampleFrames;
    int numChannels;		// Number of audio channels
    int sampleSize;		// Sample size in bits
    double sampleRate;		// Samples per second
+   bool floatSamples;		// IEEE float rather than integer samples
 
    int isstarted;	       	// For delayed writing of fmt chunk
 };
@@ -0,0 +1,282 @@
+//
+// Name :         WaveWriter.cpp
+// Description :  Implementation of a writer that sends audio to a
+//                file on a thread of its own.
+//
+
+#include "pch.h"
+#include <chrono>
+#include <cstring>
+#include "WaveWriter.h"
+#include "Wave.h"
+
+CWaveWriter::CWaveWriter(void)
+{
+    m_sink = NULL;
+    m_channels = 0;
+    m_blockFrames = 0;
+    m_exact = false;
+    m_running = false;
+    m_filled = 0;
+    m_head = 0;
+    m_tail = 0;
+    m_done = false;
+    m_failed = false;
+    m_writerIdle = false;
+    m_renderWaiting = false;
+    m_stalls = 0;
+    m_stallSeconds = 0;
+    m_maxQueued = 0;
+}
+
+CWaveWriter::~CWaveWriter(void)
+{
+    Finish();
+}
+
+
+//
+// Name :        CWaveWriter::Start()
+// Description : Set up the ring and start the writing thread.
+//
+
+bool CWaveWriter::Start(CAudioSink *p_sink, int p_channels, bool p_exact, int p_blockFrames, int p_blocks)
+{
+    Finish();
+
+    if(p_sink == NULL || p_channels < 1 || p_blockFrames < 1 || p_blocks < 2)
+        return false;
+
+    m_sink = p_sink;
+    m_channels = p_channels;
+    m_blockFrames = p_blockFrames;
+    m_exact = p_exact;
+
+    m_blocks.resize(p_blocks);
+    for(Block &block : m_blocks)
+    {
+        if(m_exact)
+        {
+            block.exact.resize((size_t)m_blockFrames * m_channels);
+            block.shorts.clear();
+        }
+        else
+        {
+            block.shorts.resize((size_t)m_blockFrames * m_channels);
+            block.exact.clear();
+        }
+
+        block.frames = 0;
+    }
+
+    m_filled = 0;
+    m_head = 0;
+    m_tail = 0;
+    m_done = false;
+    m_failed = false;
+    m_writerIdle = false;
+    m_renderWaiting = false;
+    m_stalls = 0;
+    m_stallSeconds = 0;
+    m_maxQueued = 0;
+
+    m_thread = std::thread(&CWaveWriter::Run, this);
+    m_running = true;
+    return true;
+}
+
+
+//
+// Name :        CWaveWriter::WriteFrames()
+// Description : Copy frames into the block being filled, handing each
+//               block to the thread as it fills.
+//
+
+void CWaveWriter::WriteFrames(const short *p_frames, int p_count)
+{
+    while(m_running && p_count > 0)
+    {
+        Block &block = Current();
+
+        int n = m_blockFrames - m_filled;
+        if(n > p_count)
+            n = p_count;
+
+        if(m_exact)
+        {
+            double *out = block.exact.data() + (size_t)m_filled * m_channels;
+            for(int i=0;  i<n * m_channels;  i++)
+                out[i] = p_frames[i] / 32767.;
+        }
+        else
+        {
+            memcpy(block.shorts.data() + (size_t)m_filled * m_channels, p_frames,
+                (size_t)n * m_channels * sizeof(short));
+        }
+
+        m_filled += n;
+        p_frames += (size_t)n * m_channels;
+        p_count -= n;
+
+        if(m_filled == m_blockFrames)
+            Publish();
+    }
+}
+
+void CWaveWriter::WriteFrames(const double *p_frames, int p_count)
+{
+    while(m_running && p_count > 0)
+    {
+        Block &block = Current();
+
+        int n = m_blockFrames - m_filled;
+        if(n > p_count)
+            n = p_count;
+
+        if(m_exact)
+        {
+            memcpy(block.exact.data() + (size_t)m_filled * m_channels, p_frames,
+                (size_t)n * m_channels * sizeof(double));
+        }
+        else
+        {
+            short *out = block.shorts.data() + (size_t)m_filled * m_channels;
+            for(int i=0;  i<n * m_channels;  i++)
+            {
+                const double s = p_frames[i] * 32767;
+                out[i] = short(s > 32767 ? 32767 : (s < -32767 ? -32767 : s));
+            }
+        }
+
+        m_filled += n;
+        p_frames += (size_t)n * m_channels;
+        p_count -= n;
+
+        if(m_filled == m_blockFrames)
+            Publish();
+    }
+}
+
+
+//
+// Name :        CWaveWriter::Finish()
+// Description : Hand over the last, partly filled block and wait for
+//               the thread to write everything.
+//
+
+bool CWaveWriter::Finish()
+{
+    if(!m_running)
+        return !m_failed;
+
+    // The count is the render's own, so this does not look at a
+    // block the thread may still be writing
+    if(m_filled > 0)
+        Publish();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_done = true;
+    }
+    m_ready.notify_one();
+
+    m_thread.join();
+    m_running = false;
+    return !m_failed;
+}
+
+
+//
+// Name :        CWaveWriter::Current()
+// Description : The block being filled.  If the thread has not written
+//               it out since the last time round the ring, wait.
+//
+
+CWaveWriter::Block &CWaveWriter::Current()
+{
+    const unsigned head = m_head.load(std::memory_order_relaxed);
+    const unsigned size = (unsigned)m_blocks.size();
+
+    if(head - m_tail.load(std::memory_order_acquire) >= size)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        m_stalls++;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_renderWaiting = true;
+        m_space.wait(lock, [&] {return head - m_tail.load() < size;});
+        m_renderWaiting = false;
+
+        m_stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    return m_blocks[head % size];
+}
+
+
+//
+// Name :        CWaveWriter::Publish()
+// Description : Hand the block being filled to the thread.  Only
+//               called once Current() has made the block the render's.
+//
+
+void CWaveWriter::Publish()
+{
+    const unsigned size = (unsigned)m_blocks.size();
+    const unsigned head = m_head.load(std::memory_order_relaxed);
+    m_blocks[head % size].frames = m_filled;
+    m_filled = 0;
+    m_head.store(head + 1);
+
+    const int queued = (int)(head + 1 - m_tail.load());
+    if(queued > m_maxQueued)
+        m_maxQueued = queued;
+
+    // Only wake the thread if it has gone to sleep
+    if(m_writerIdle.load())
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_ready.notify_one();
+    }
+}
+
+
+//
+// Name :        CWaveWriter::Run()
+// Description : The writing thread.  Writes blocks in order until
+//               Finish() says there are no more.
+//
+
+void CWaveWriter::Run()
+{
+    const unsigned size = (unsigned)m_blocks.size();
+
+    for(;;)
+    {
+        const unsigned tail = m_tail.load(std::memory_order_relaxed);
+        if(tail == m_head.load())
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_writerIdle = true;
+            m_ready.wait(lock, [&] {return tail != m_head.load() || m_done.load();});
+            m_writerIdle = false;
+
+            if(tail == m_head.load())
+                break;
+        }
+
+        Block &block = m_blocks[tail % size];
+        const int ok = m_exact ? m_sink->WriteFrames(block.exact.data(), block.frames)
+            : m_sink->WriteFrames(block.shorts.data(), block.frames);
+        if(!ok)
+            m_failed = true;
+
+        m_tail.store(tail + 1);
+
+        if(m_renderWaiting.load())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_space.notify_one();
+        }
+    }
+}
@@ -0,0 +1,95 @@
+//
+// Name :         WaveWriter.h
+// Description :  Header for a writer that sends audio to a file
+//                on a thread of its own.
+//
+
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+class CAudioSink;
+
+//
+// class CWaveWriter
+// Frames are gathered into blocks in a ring, and a thread writes each
+// block to the file once it is full, so rendering goes on while the
+// disk works.  The ring is a single producer, single consumer queue:
+// blocks pass between the threads through two counters, and a thread
+// only takes the lock to sleep when the ring is full or empty.
+//
+// When the disk falls behind and every block is waiting to be
+// written, WriteFrames() waits for one to come free.  Stalls() and
+// StallSeconds() say how often and for how long that happened.
+//
+
+class CWaveWriter
+{
+public:
+    CWaveWriter(void);
+    ~CWaveWriter(void);
+
+    // Start writing to an open CWaveOut or CFlacOut.  Blocks hold
+    // either shorts or, for files of more than 16 bits, doubles.
+    bool Start(CAudioSink *p_sink, int p_channels, bool p_exact,
+        int p_blockFrames = 4096, int p_blocks = 8);
+
+    // Queue interleaved frames
+    void WriteFrames(const short *p_frames, int p_count);
+    void WriteFrames(const double *p_frames, int p_count);
+
+    // Write everything queued and stop the thread.  The file is left
+    // open.  Returns false if any write failed.
+    bool Finish();
+
+    bool IsRunning() const {return m_running;}
+
+    // Backpressure
+    int Stalls() const {return m_stalls;}
+    double StallSeconds() const {return m_stallSeconds;}
+    int MaxQueued() const {return m_maxQueued;}
+    int NumBlocks() const {return (int)m_blocks.size();}
+    int BlocksWritten() const {return (int)m_tail.load();}
+
+private:
+    struct Block
+    {
+        std::vector<short> shorts;
+        std::vector<double> exact;
+        int frames;             // Set when the block is handed over
+    };
+
+    Block &Current();
+    void Publish();
+    void Run();
+
+    CAudioSink *m_sink;
+    int         m_channels;
+    int         m_blockFrames;
+    bool        m_exact;
+    bool        m_running;
+    int         m_filled;       // Frames in the block being filled
+
+    std::vector<Block> m_blocks;
+    std::atomic<unsigned> m_head;       // Blocks handed to the thread so far
+    std::atomic<unsigned> m_tail;       // Blocks written so far
+    std::atomic<bool> m_done;           // No more blocks are coming
+    std::atomic<bool> m_failed;
+
+    // For sleeping while the ring is full or empty
+    std::mutex  m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_space;
+    std::atomic<bool> m_writerIdle;
+    std::atomic<bool> m_renderWaiting;
+
+    std::thread m_thread;
+
+    int         m_stalls;
+    double      m_stallSeconds;
+    int         m_maxQueued;
+};
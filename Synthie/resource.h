@@ -24,13 +24,17 @@
 #define ID_GENERATE_1000HZTONE          32773
 #define ID_GENERATE_SYNTHESIZER         32774
 #define ID_FILE_OPENSCORE               32775
+#define ID_GENERATE_FILTERBENCHMARK     32776
+#define ID_FILE_COMPILESCORE            32777
+#define ID_GENERATE_INCREMENTAL         32778
+#define ID_FILE_ANALYZESCORE            32779
 
 // Next default values for new objects
 // 
 #ifdef APSTUDIO_INVOKED
 #ifndef APSTUDIO_READONLY_SYMBOLS
 #define _APS_NEXT_RESOURCE_VALUE        310
-#define _APS_NEXT_COMMAND_VALUE         32776
+#define _APS_NEXT_COMMAND_VALUE         32780
 #define _APS_NEXT_CONTROL_VALUE         1002
 #define _APS_NEXT_SYMED_VALUE           310
 #endif